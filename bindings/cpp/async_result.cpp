@@ -19,23 +19,93 @@
 
 #include "../../include/elliptics/cppdef.h"
 
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <climits>
 #include <condition_variable>
 #include <mutex>
+#include <new>
 #include <queue>
+#include <type_traits>
 
 namespace ioremap { namespace elliptics {
 
+enum async_result_state {
+	result_pending = 0,
+	result_finished
+};
+
+static inline void futex_wait(std::atomic<int> *addr, int value)
+{
+	syscall(SYS_futex, reinterpret_cast<int *>(addr), FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static inline void futex_wake(std::atomic<int> *addr)
+{
+	syscall(SYS_futex, reinterpret_cast<int *>(addr), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
 template <typename T>
 class async_result<T>::data
 {
 	public:
-		data() : total(0), finished(false)
+		data() : has_first(false), total(0), state(result_pending), waiters(0)
 		{
 			dnet_current_time(&start);
 		}
 
+		~data()
+		{
+			if (has_first)
+				first().~T();
+		}
+
+		/*
+		 * The first result is copied into inline storage, which is left unconstructed
+		 * until the first reply: result entries allocate their data in default constructor.
+		 * So commands with single reply like lookup do not allocate anything
+		 * for the result list unless the whole list is requested.
+		 */
+		void push(const T &result)
+		{
+			if (!has_first) {
+				new (&first_storage) T(result);
+				has_first = true;
+			} else {
+				results.push_back(result);
+			}
+		}
+
+		T &first()
+		{
+			return *reinterpret_cast<T *>(&first_storage);
+		}
+
+		const T &first() const
+		{
+			return *reinterpret_cast<const T *>(&first_storage);
+		}
+
+		std::vector<T> all_results() const
+		{
+			std::vector<T> all;
+			if (has_first) {
+				all.reserve(results.size() + 1);
+				all.push_back(first());
+				all.insert(all.end(), results.begin(), results.end());
+			}
+			return all;
+		}
+
+		bool finished() const
+		{
+			return state == result_finished;
+		}
+
 		std::mutex lock;
-		std::condition_variable condition;
 
 		async_result<T>::result_function result_handler;
 		async_result<T>::final_function final_handler;
@@ -45,13 +115,20 @@ class async_result<T>::data
 		uint32_t policy;
 		result_error_handler error_handler;
 
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type first_storage;
+		bool has_first;
 		std::vector<T> results;
 		error_info error;
 
 		std::vector<dnet_cmd> statuses;
 		size_t total;
 
-		bool finished;
+		/*
+		 * Waiters sleep on futex of @state instead of condition variable and mutex,
+		 * completion wakes them only if there are any
+		 */
+		std::atomic<int> state;
+		std::atomic<int> waiters;
 		dnet_time start;
 		dnet_time end;
 };
@@ -82,7 +159,8 @@ void async_result<T>::connect(const result_function &result_handler, const final
 	std::unique_lock<std::mutex> locker(m_data->lock);
 	if (result_handler) {
 		m_data->result_handler = result_handler;
-		if (!m_data->results.empty()) {
+		if (m_data->has_first) {
+			result_handler(m_data->first());
 			for (auto it = m_data->results.begin(), end = m_data->results.end(); it != end; ++it) {
 				result_handler(*it);
 			}
@@ -90,7 +168,7 @@ void async_result<T>::connect(const result_function &result_handler, const final
 	}
 	if (final_handler) {
 		m_data->final_handler = final_handler;
-		if (m_data->finished)
+		if (m_data->finished())
 			final_handler(m_data->error);
 	}
 }
@@ -125,7 +203,13 @@ error_info async_result<T>::error() const
 template <typename T>
 bool async_result<T>::ready() const
 {
-	return m_data->finished;
+	return m_data->finished();
+}
+
+template <typename T>
+uint32_t async_result<T>::exceptions_policy() const
+{
+	return m_data->policy;
 }
 
 template <typename T>
@@ -152,13 +236,19 @@ template <typename T>
 std::vector<T> async_result<T>::get()
 {
 	wait(session::throw_at_get);
-	return m_data->results;
+	return m_data->all_results();
 }
 
 template <typename T>
 bool async_result<T>::get(T &entry)
 {
 	wait(session::throw_at_get);
+	if (!m_data->has_first)
+		return false;
+	if (m_data->first().status() == 0 && !m_data->first().data().empty()) {
+		entry = m_data->first();
+		return true;
+	}
 	for (auto it = m_data->results.begin(); it != m_data->results.end(); ++it) {
 		if (it->status() == 0 && !it->data().empty()) {
 			entry = *it;
@@ -172,8 +262,8 @@ template <>
 bool async_result<index_entry>::get(index_entry &entry)
 {
 	wait(session::throw_at_get);
-	if (!m_data->results.empty()) {
-		entry = m_data->results[0];
+	if (m_data->has_first) {
+		entry = m_data->first();
 		return true;
 	}
 	return false;
@@ -183,8 +273,8 @@ template <>
 bool async_result<find_indexes_result_entry>::get(find_indexes_result_entry &entry)
 {
 	wait(session::throw_at_get);
-	if (!m_data->results.empty()) {
-		entry = m_data->results[0];
+	if (m_data->has_first) {
+		entry = m_data->first();
 		return true;
 	}
 	return false;
@@ -364,9 +454,12 @@ struct async_result<T>::data_keeper
 template <typename T>
 void async_result<T>::wait(uint32_t policy)
 {
-	std::unique_lock<std::mutex> locker(m_data->lock);
-	while (!m_data->finished)
-		m_data->condition.wait(locker);
+	if (!m_data->finished()) {
+		++m_data->waiters;
+		while (!m_data->finished())
+			futex_wait(&m_data->state, result_pending);
+		--m_data->waiters;
+	}
 	if (m_data->policy & policy)
 		m_data->error.throw_error();
 }
@@ -376,7 +469,7 @@ void async_result<T>::aggregator_final_handler(const std::shared_ptr<data_keeper
 {
 	std::shared_ptr<data> d;
 	std::swap(d, keeper->data_ptr);
-	handler(d->results, d->error);
+	handler(d->all_results(), d->error);
 }
 
 template <typename T>
@@ -427,6 +520,11 @@ size_t async_result_handler<T>::get_total()
 	return m_data->total;
 }
 
+/*
+ * Replies from different states are processed by different threads and
+ * connect() may run in parallel, so results are still appended under the lock.
+ * It is not contended for commands with single reply.
+ */
 template <typename T>
 void async_result_handler<T>::process(const T &result)
 {
@@ -439,7 +537,7 @@ void async_result_handler<T>::process(const T &result)
 	if (m_data->result_handler) {
 		m_data->result_handler(result);
 	} else {
-		m_data->results.push_back(result);
+		m_data->push(result);
 	}
 }
 
@@ -450,7 +548,7 @@ void async_result_handler<index_entry>::process(const index_entry &result)
 	if (m_data->result_handler) {
 		m_data->result_handler(result);
 	} else {
-		m_data->results.push_back(result);
+		m_data->push(result);
 	}
 }
 
@@ -461,7 +559,7 @@ void async_result_handler<find_indexes_result_entry>::process(const find_indexes
 	if (m_data->result_handler) {
 		m_data->result_handler(result);
 	} else {
-		m_data->results.push_back(result);
+		m_data->push(result);
 	}
 }
 
@@ -469,7 +567,6 @@ template <typename T>
 void async_result_handler<T>::complete(const error_info &error)
 {
 	std::unique_lock<std::mutex> locker(m_data->lock);
-	m_data->finished = true;
 	dnet_current_time(&m_data->end);
 	m_data->error = error;
 	if (!error) {
@@ -479,7 +576,11 @@ void async_result_handler<T>::complete(const error_info &error)
 	if (m_data->final_handler) {
 		m_data->final_handler(m_data->error);
 	}
-	m_data->condition.notify_all();
+
+	// Result is published after final handler as waiters used to wait for the lock
+	m_data->state = result_finished;
+	if (m_data->waiters)
+		futex_wake(&m_data->state);
 }
 
 template <typename T>
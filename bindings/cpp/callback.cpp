@@ -353,6 +353,12 @@ void iterator_result_container::append(const iterator_result_entry &result)
 	append(result.reply());
 }
 
+static void iterator_container_writer_destroy(dnet_iterator_container_writer *writer)
+{
+	dnet_iterator_container_writer_flush(writer);
+	dnet_iterator_container_writer_destroy(writer);
+}
+
 void iterator_result_container::append(const dnet_iterator_response *response)
 {
 	static const ssize_t resp_size = sizeof(dnet_iterator_response);
@@ -361,13 +367,33 @@ void iterator_result_container::append(const dnet_iterator_response *response)
 	if (m_sorted)
 		throw_error(-EROFS, "can't append to already sorted container");
 
-	err = dnet_iterator_response_container_append(response, m_fd, m_write_position);
+	if (!m_writer) {
+		dnet_iterator_container_writer *writer = dnet_iterator_container_writer_create(m_fd, m_write_position);
+		if (!writer)
+			throw_error(-ENOMEM, "dnet_iterator_container_writer_create() failed");
+		m_writer.reset(writer, iterator_container_writer_destroy);
+	}
+
+	err = dnet_iterator_container_writer_append(m_writer.get(), response);
 	if (err != 0)
-		throw_error(err, "dnet_iterator_response_container_append() failed");
+		throw_error(err, "dnet_iterator_container_writer_append() failed");
 	m_write_position += resp_size;
 	m_count++;
 }
 
+//* Write buffered results to container file
+void iterator_result_container::flush() const
+{
+	int err;
+
+	if (!m_writer)
+		return;
+
+	err = dnet_iterator_container_writer_flush(m_writer.get());
+	if (err != 0)
+		throw_error(err, "dnet_iterator_container_writer_flush() failed");
+}
+
 //* Sort container by (key, timestamp) tuple
 void iterator_result_container::sort()
 {
@@ -376,6 +402,9 @@ void iterator_result_container::sort()
 	if (m_sorted == true)
 		return;
 
+	flush();
+	m_writer.reset();
+
 	err = dnet_iterator_response_container_sort(m_fd, m_write_position);
 	if (err != 0)
 		throw_error(err, "sort failed");
@@ -391,6 +420,11 @@ void iterator_result_container::diff(const iterator_result_container &other,
 	if (m_sorted == false || other.m_sorted == false)
 		throw_error(-EINVAL, "both containers must be sorted");
 
+	flush();
+	other.flush();
+	result.flush();
+	result.m_writer.reset();
+
 	err = dnet_iterator_response_container_diff(result.m_fd, m_fd, m_write_position,
 			other.m_fd, other.m_write_position);
 	if (err < 0)
@@ -407,6 +441,8 @@ dnet_iterator_response iterator_result_container::operator [](size_t n) const
 	dnet_iterator_response response;
 	int err;
 
+	flush();
+
 	err = dnet_iterator_response_container_read(m_fd, n * sizeof(response), &response);
 	if (err != 0)
 		throw_error(err, "dnet_iterator_response_container_read failed");
@@ -18,6 +18,7 @@
 #define CALLBACK_P_H
 
 #include "elliptics/cppdef.h"
+#include "node_p.hpp"
 
 #include <algorithm>
 #include <cassert>
@@ -79,6 +80,15 @@ class callback_result_data
 		callback_result_data(dnet_addr *addr, dnet_cmd *cmd)
 		{
 			const size_t size = sizeof(struct dnet_addr) + sizeof(struct dnet_cmd) + cmd->size;
+
+			// Received reply is referenced in the network buffer, others are copied
+			if (void *block = dnet_reply_adopt(cmd)) {
+				dnet_addr *reply_addr = reinterpret_cast<dnet_addr *>(cmd) - 1;
+				memcpy(reply_addr, addr, sizeof(struct dnet_addr));
+				data = data_pointer::adopt(block, reply_addr, size);
+				return;
+			}
+
 			data = data_pointer::allocate(size);
 			memcpy(data.data(), addr, sizeof(struct dnet_addr));
 			memcpy(data.data<char>() + sizeof(struct dnet_addr), cmd, sizeof(struct dnet_cmd) + cmd->size);
@@ -702,6 +712,206 @@ class read_callback : public multigroup_callback<read_result_entry>
 		read_result_entry read_result;
 };
 
+/*
+ * Zero hedge delay means this many replica's latency estimates, but not less than minimal delay
+ */
+#define DNET_HEDGE_LATENCY_FACTOR	3
+#define DNET_HEDGE_MIN_DELAY		1000L
+
+/*
+ * Read which is additionally sent to the next group if the previous one
+ * did not reply within hedge delay, the first successful reply wins.
+ * Transactions can not be cancelled, so replies of the losers are ignored.
+ *
+ * Every request carries its own attempt as private data, which keeps
+ * the callback alive until transaction is destroyed. Failed group is replaced
+ * by the next one immediately and this does not spend hedge budget.
+ *
+ * Lock is never held while sending, since failed send destroys
+ * transaction and calls handler from the same thread.
+ */
+class hedged_read_callback : public std::enable_shared_from_this<hedged_read_callback>
+{
+	public:
+		typedef std::shared_ptr<hedged_read_callback> ptr;
+
+		hedged_read_callback(const session &sess, const async_read_result &result, const dnet_io_control &ctl,
+				const std::shared_ptr<hedge_scheduler> &scheduler, long delay)
+			: sess(sess), cb(sess, result), ctl(ctl), m_scheduler(scheduler), m_delay(delay),
+			  m_group_index(0), m_running(0), m_winner(NULL), m_completed(false)
+		{
+		}
+
+		void start()
+		{
+			size_t index;
+
+			m_scheduler->earn();
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				index = m_group_index++;
+				++m_running;
+			}
+
+			send(index);
+		}
+
+		static int handler(struct dnet_net_state *state, struct dnet_cmd *cmd, void *priv)
+		{
+			attempt *a = reinterpret_cast<attempt *>(priv);
+
+			if (is_trans_destroyed(state, cmd)) {
+				ptr parent = a->parent;
+				delete a;
+				parent->destroyed();
+			} else {
+				a->parent->process(a, state, cmd);
+			}
+			return 0;
+		}
+
+		session sess;
+		key kid;
+		std::vector<int> groups;
+
+	private:
+		struct attempt
+		{
+			ptr parent;
+			int group_id;
+		};
+
+		void send(size_t index)
+		{
+			dnet_io_control local = ctl;
+
+			attempt *a = new (std::nothrow) attempt;
+			if (!a) {
+				destroyed();
+				return;
+			}
+
+			a->parent = shared_from_this();
+			a->group_id = groups[index];
+
+			local.id = kid.id();
+			local.id.group_id = a->group_id;
+			local.complete = handler;
+			local.priv = a;
+
+			int err = dnet_read_object(sess.get_native(), &local);
+
+			dnet_log_raw(sess.get_native_node(), DNET_LOG_DEBUG, "hedged_read_callback::send: %s: group: %zd/%zd, err: %d\n",
+					dnet_dump_id(&local.id), index, groups.size(), err);
+
+			if (index + 1 < groups.size())
+				schedule_hedge(index + 1, local.id);
+		}
+
+		void schedule_hedge(size_t index, dnet_id &id)
+		{
+			long delay = m_delay;
+
+			if (!delay) {
+				long latency = dnet_state_latency(sess.get_native_node(), &id);
+				delay = std::max(latency * DNET_HEDGE_LATENCY_FACTOR, DNET_HEDGE_MIN_DELAY);
+			}
+
+			std::weak_ptr<hedged_read_callback> weak = shared_from_this();
+
+			try {
+				m_scheduler->schedule(delay, [weak, index] () {
+					if (ptr callback = weak.lock())
+						callback->hedge(index);
+				});
+			} catch (...) {
+				// hedging is an optimization, read still goes on without it
+			}
+		}
+
+		/*
+		 * Sends read to group @index if nothing was sent since the timer was armed
+		 */
+		void hedge(size_t index)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+
+				if (m_completed || m_group_index != index || index >= groups.size())
+					return;
+				if (!m_scheduler->spend())
+					return;
+
+				++m_group_index;
+				++m_running;
+			}
+
+			dnet_log_raw(sess.get_native_node(), DNET_LOG_NOTICE, "%s: hedged_read_callback::hedge: group: %d: %zd/%zd\n",
+					dnet_dump_id_str(kid.id().id), groups[index], index, groups.size());
+
+			send(index);
+		}
+
+		void process(attempt *a, struct dnet_net_state *state, struct dnet_cmd *cmd)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			if (m_completed || (m_winner && m_winner != a))
+				return;
+
+			if (!m_winner && cmd->status == 0 && cmd->size != 0)
+				m_winner = a;
+
+			cb.handle(state, cmd, handler, a);
+
+			if (m_winner == a) {
+				m_completed = true;
+				cb.complete(error_info());
+			}
+		}
+
+		void destroyed()
+		{
+			size_t index;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+
+				--m_running;
+				if (m_completed)
+					return;
+
+				if (m_group_index >= groups.size()) {
+					if (m_running)
+						return;
+
+					m_completed = true;
+					if (cb.statuses().empty()) {
+						cb.complete(create_error(-ENXIO, kid.id(), "READ: size: %llu",
+							static_cast<unsigned long long>(ctl.io.size)));
+					} else {
+						cb.complete(error_info());
+					}
+					return;
+				}
+
+				index = m_group_index++;
+				++m_running;
+			}
+
+			send(index);
+		}
+
+		default_callback<read_result_entry> cb;
+		struct dnet_io_control ctl;
+		std::shared_ptr<hedge_scheduler> m_scheduler;
+		long m_delay;
+		std::mutex m_mutex;
+		size_t m_group_index;
+		size_t m_running;
+		attempt *m_winner;
+		bool m_completed;
+};
+
 struct io_attr_comparator
 {
 	bool operator() (const dnet_io_attr &io1, const dnet_io_attr &io2)
@@ -1387,6 +1597,100 @@ class remove_index_callback
 		std::vector<int> groups;
 };
 
+struct batch_request
+{
+	dnet_io_control ctl;
+	data_pointer data;
+	// Read cache which has to forget written key on completion
+	std::shared_ptr<read_cache> cache;
+};
+
+class batch_data
+{
+	public:
+		batch_data(const session &sess) : sess(sess)
+		{
+		}
+
+		session sess;
+		std::vector<batch_request> requests;
+};
+
+class batch_callback
+{
+	public:
+		typedef std::shared_ptr<batch_callback> ptr;
+
+		batch_callback(const session &sess, const async_generic_result &result)
+			: sess(sess), cb(sess, result)
+		{
+		}
+
+		bool start(error_info *error, complete_func func, void *priv)
+		{
+			cb.set_count(unlimited);
+			cb.set_total(requests.size());
+
+			dnet_io_batch *batch = dnet_io_batch_alloc(sess.get_native());
+			if (!batch) {
+				*error = create_error(-ENOMEM, "Failed to allocate IO batch");
+				return true;
+			}
+
+			for (auto it = requests.begin(); it != requests.end(); ++it) {
+				it->ctl.complete = func;
+				it->ctl.priv = priv;
+
+				// Failed request is already completed
+				dnet_io_batch_add(batch, &it->ctl);
+			}
+
+			dnet_io_batch_send(batch);
+
+			return cb.set_count(requests.size());
+		}
+
+		bool handle(error_info *error, struct dnet_net_state *state, struct dnet_cmd *cmd, complete_func func, void *priv)
+		{
+			(void) error;
+
+			if (!is_trans_destroyed(state, cmd) && cmd->status == 0)
+				convert(cmd);
+
+			return cb.handle(state, cmd, func, priv);
+		}
+
+		void finish(const error_info &exc)
+		{
+			for (auto it = requests.begin(); it != requests.end(); ++it) {
+				if (it->cache)
+					it->cache->drop(it->ctl.id);
+			}
+
+			cb.complete(exc);
+		}
+
+		/*
+		 * Entries are generic, so replies are converted here as read or lookup results would do
+		 */
+		static void convert(struct dnet_cmd *cmd)
+		{
+			if (cmd->cmd == DNET_CMD_READ && cmd->size >= sizeof(struct dnet_io_attr)) {
+				dnet_convert_io_attr(reinterpret_cast<dnet_io_attr *>(cmd + 1));
+			} else if ((cmd->cmd == DNET_CMD_LOOKUP || cmd->cmd == DNET_CMD_WRITE) &&
+					cmd->size >= sizeof(struct dnet_addr) + sizeof(struct dnet_file_info)) {
+				dnet_addr *addr = reinterpret_cast<dnet_addr *>(cmd + 1);
+
+				dnet_convert_addr(addr);
+				dnet_convert_file_info(reinterpret_cast<dnet_file_info *>(addr + 1));
+			}
+		}
+
+		session sess;
+		default_callback<callback_result_entry> cb;
+		std::vector<batch_request> requests;
+};
+
 class write_callback
 {
 	public:
@@ -1432,12 +1736,16 @@ class write_callback
 
 		void finish(const error_info &exc)
 		{
+			if (cache)
+				cache->drop(ctl.id);
+
 			cb.complete(exc);
 		}
 
 		session sess;
 		default_callback<write_result_entry> cb;
 		dnet_io_control ctl;
+		std::shared_ptr<read_cache> cache;
 };
 
 class remove_callback
@@ -1475,12 +1783,16 @@ class remove_callback
 
 		void finish(const error_info &error)
 		{
+			if (cache)
+				cache->drop(id);
+
 			cb.complete(error);
 		}
 
 		session sess;
 		default_callback<callback_result_entry> cb;
 		dnet_id id;
+		std::shared_ptr<read_cache> cache;
 };
 
 class exec_callback
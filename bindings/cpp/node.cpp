@@ -15,6 +15,7 @@
  */
 
 #include <algorithm>
+#include <climits>
 #include <iostream>
 #include <stdexcept>
 #include <string>
@@ -25,6 +26,258 @@
 
 namespace ioremap { namespace elliptics {
 
+/*
+ * Default share of reads which may be hedged and number of hedges
+ * which may be sent at once after long period of quiet reads
+ */
+#define DNET_HEDGE_DEFAULT_BUDGET	10
+#define DNET_HEDGE_BURST		10
+
+hedge_scheduler::hedge_scheduler() : m_need_exit(false), m_tokens(0), m_budget(DNET_HEDGE_DEFAULT_BUDGET)
+{
+}
+
+hedge_scheduler::~hedge_scheduler()
+{
+	stop();
+}
+
+void hedge_scheduler::schedule(long usecs, const function &func)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_need_exit)
+		return;
+
+	if (!m_thread.joinable())
+		m_thread = std::thread(&hedge_scheduler::run, this);
+
+	m_queue.insert(std::make_pair(clock::now() + std::chrono::microseconds(usecs), func));
+	m_condition.notify_one();
+}
+
+void hedge_scheduler::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_need_exit = true;
+		m_queue.clear();
+	}
+
+	m_condition.notify_one();
+
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void hedge_scheduler::set_budget(int percent)
+{
+	m_budget = std::max(0, std::min(percent, 100));
+}
+
+void hedge_scheduler::earn()
+{
+	const long max_tokens = DNET_HEDGE_BURST * 100;
+	long tokens = m_tokens;
+
+	while (tokens < max_tokens && !m_tokens.compare_exchange_weak(tokens, std::min(tokens + m_budget, max_tokens)))
+		;
+}
+
+bool hedge_scheduler::spend()
+{
+	long tokens = m_tokens;
+
+	while (tokens >= 100) {
+		if (m_tokens.compare_exchange_weak(tokens, tokens - 100))
+			return true;
+	}
+
+	return false;
+}
+
+void hedge_scheduler::run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (!m_need_exit) {
+		if (m_queue.empty()) {
+			m_condition.wait(lock);
+			continue;
+		}
+
+		auto it = m_queue.begin();
+		if (it->first > clock::now()) {
+			m_condition.wait_until(lock, it->first);
+			continue;
+		}
+
+		function func = std::move(it->second);
+		m_queue.erase(it);
+
+		lock.unlock();
+		try {
+			func();
+		} catch (...) {
+		}
+		lock.lock();
+	}
+}
+
+read_cache::read_cache() : m_shard_size(0), m_lifetime(0), m_hits(0), m_misses(0)
+{
+}
+
+void read_cache::configure(size_t max_size, long lifetime)
+{
+	m_lifetime = lifetime;
+	m_shard_size = max_size / DNET_READ_CACHE_SHARDS;
+
+	if (!m_shard_size) {
+		for (int i = 0; i < DNET_READ_CACHE_SHARDS; ++i) {
+			shard &s = m_shards[i];
+			std::lock_guard<std::mutex> lock(s.lock);
+
+			s.entries.clear();
+			s.lru.clear();
+			s.size = 0;
+			++s.generation;
+		}
+	}
+}
+
+bool read_cache::enabled() const
+{
+	return m_shard_size != 0;
+}
+
+read_cache::shard &read_cache::get_shard(const dnet_id &id)
+{
+	unsigned int hash;
+
+	memcpy(&hash, id.id, sizeof(hash));
+	return m_shards[hash % DNET_READ_CACHE_SHARDS];
+}
+
+void read_cache::erase(shard &s, std::map<cache_key, cache_entry>::iterator it)
+{
+	s.size -= it->second.size;
+	s.lru.erase(it->second.lru);
+	s.entries.erase(it);
+}
+
+bool read_cache::lookup(const dnet_id &id, const std::vector<int> &groups, read_result_entry &entry)
+{
+	shard &s = get_shard(id);
+	const clock::time_point now = clock::now();
+	cache_key key;
+
+	memcpy(key.id.id, id.id, DNET_ID_SIZE);
+
+	std::lock_guard<std::mutex> lock(s.lock);
+
+	for (auto group = groups.begin(); group != groups.end(); ++group) {
+		key.group_id = *group;
+
+		auto it = s.entries.find(key);
+		if (it == s.entries.end())
+			continue;
+
+		if (it->second.expires <= now) {
+			erase(s, it);
+			continue;
+		}
+
+		s.lru.splice(s.lru.begin(), s.lru, it->second.lru);
+		entry = it->second.entry;
+		++m_hits;
+		return true;
+	}
+
+	++m_misses;
+	return false;
+}
+
+uint64_t read_cache::generation(const dnet_id &id)
+{
+	shard &s = get_shard(id);
+	std::lock_guard<std::mutex> lock(s.lock);
+
+	return s.generation;
+}
+
+void read_cache::insert(const dnet_id &id, uint64_t generation, const read_result_entry &entry)
+{
+	const size_t shard_size = m_shard_size;
+	const size_t size = entry.raw_data().size();
+	shard &s = get_shard(id);
+	cache_key key;
+
+	if (size > shard_size)
+		return;
+
+	memcpy(key.id.id, id.id, DNET_ID_SIZE);
+	key.group_id = entry.command()->id.group_id;
+
+	std::lock_guard<std::mutex> lock(s.lock);
+
+	if (s.generation != generation)
+		return;
+
+	auto it = s.entries.find(key);
+	if (it != s.entries.end())
+		erase(s, it);
+
+	while (s.size + size > shard_size && !s.lru.empty())
+		erase(s, s.entries.find(s.lru.back()));
+
+	s.lru.push_front(key);
+
+	cache_entry &e = s.entries[key];
+	e.entry = entry;
+	e.size = size;
+	e.expires = clock::now() + std::chrono::milliseconds(m_lifetime.load());
+	e.lru = s.lru.begin();
+
+	s.size += size;
+}
+
+void read_cache::drop(const dnet_id &id)
+{
+	shard &s = get_shard(id);
+	cache_key key;
+
+	memcpy(key.id.id, id.id, DNET_ID_SIZE);
+	key.group_id = INT_MIN;
+
+	std::lock_guard<std::mutex> lock(s.lock);
+
+	++s.generation;
+
+	auto it = s.entries.lower_bound(key);
+	while (it != s.entries.end() && !dnet_id_cmp_str(it->first.id.id, id.id))
+		erase(s, it++);
+}
+
+read_cache_stats read_cache::stats()
+{
+	read_cache_stats st;
+
+	memset(&st, 0, sizeof(st));
+	st.hits = m_hits;
+	st.misses = m_misses;
+
+	for (int i = 0; i < DNET_READ_CACHE_SHARDS; ++i) {
+		shard &s = m_shards[i];
+		std::lock_guard<std::mutex> lock(s.lock);
+
+		st.entries += s.entries.size();
+		st.size += s.size;
+	}
+
+	return st;
+}
+
 node::node()
 {
 }
@@ -121,6 +374,28 @@ void node::set_keepalive(int idle, int cnt, int interval)
 		dnet_set_keepalive(m_data->node_ptr, idle, cnt, interval);
 }
 
+void node::set_hedge_budget(int percent)
+{
+	if (m_data)
+		m_data->hedge->set_budget(percent);
+}
+
+void node::set_read_cache(size_t max_size, long lifetime)
+{
+	if (m_data)
+		m_data->cache->configure(max_size, lifetime);
+}
+
+read_cache_stats node::get_read_cache_stats() const
+{
+	if (m_data)
+		return m_data->cache->stats();
+
+	read_cache_stats st;
+	memset(&st, 0, sizeof(st));
+	return st;
+}
+
 logger node::get_log() const
 {
 	return m_data ? m_data->log : logger();
@@ -18,17 +18,138 @@
 
 #include <elliptics/cppdef.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+
 namespace ioremap { namespace elliptics {
 
+/*
+ * Fires delayed hedged reads and limits their number.
+ *
+ * Every read earns budget percent of a hedge, every hedge spends the whole one,
+ * so no more than budget percent of reads are duplicated in the long run.
+ * Thread is started by the first scheduled hedge, nodes which never
+ * hedge reads do not pay for it.
+ */
+class hedge_scheduler
+{
+	public:
+		typedef std::function<void ()> function;
+
+		hedge_scheduler();
+		~hedge_scheduler();
+
+		void schedule(long usecs, const function &func);
+		void stop();
+
+		void set_budget(int percent);
+		void earn();
+		bool spend();
+
+	private:
+		typedef std::chrono::steady_clock clock;
+
+		void run();
+
+		std::mutex				m_mutex;
+		std::condition_variable			m_condition;
+		std::multimap<clock::time_point, function>	m_queue;
+		std::thread				m_thread;
+		bool					m_need_exit;
+		std::atomic<long>			m_tokens;
+		std::atomic<int>			m_budget;
+};
+
+#define DNET_READ_CACHE_SHARDS		16
+
+/*
+ * Client-side cache of objects read by sessions with cached reads enabled.
+ *
+ * Entries are keyed by id and group and split into shards by id, every shard
+ * has its own lock and LRU list bounded by its share of the cache size.
+ * Entries expire after the lifetime, writes and removes sent through
+ * this node drop all groups of the key when they are sent and when they
+ * complete. Every drop bumps shard generation, so reads sent before it
+ * can not put stale data back.
+ */
+class read_cache
+{
+	public:
+		read_cache();
+
+		void configure(size_t max_size, long lifetime);
+		bool enabled() const;
+
+		bool lookup(const dnet_id &id, const std::vector<int> &groups, read_result_entry &entry);
+		uint64_t generation(const dnet_id &id);
+		void insert(const dnet_id &id, uint64_t generation, const read_result_entry &entry);
+		void drop(const dnet_id &id);
+
+		read_cache_stats stats();
+
+	private:
+		typedef std::chrono::steady_clock clock;
+
+		struct cache_key
+		{
+			dnet_raw_id	id;
+			int		group_id;
+
+			bool operator <(const cache_key &other) const
+			{
+				int cmp = dnet_id_cmp_str(id.id, other.id.id);
+				return cmp < 0 || (cmp == 0 && group_id < other.group_id);
+			}
+		};
+
+		struct cache_entry
+		{
+			read_result_entry			entry;
+			size_t					size;
+			clock::time_point			expires;
+			std::list<cache_key>::iterator		lru;
+		};
+
+		struct shard
+		{
+			shard() : size(0), generation(0) {}
+
+			std::mutex				lock;
+			std::map<cache_key, cache_entry>	entries;
+			std::list<cache_key>			lru;
+			size_t					size;
+			uint64_t				generation;
+		};
+
+		shard &get_shard(const dnet_id &id);
+		void erase(shard &s, std::map<cache_key, cache_entry>::iterator it);
+
+		shard				m_shards[DNET_READ_CACHE_SHARDS];
+		std::atomic<size_t>		m_shard_size;
+		std::atomic<long>		m_lifetime;
+		std::atomic<uint64_t>		m_hits;
+		std::atomic<uint64_t>		m_misses;
+};
+
 class node_data {
 	public:
-		node_data() : node_ptr(NULL) {}
+		node_data() : node_ptr(NULL), hedge(std::make_shared<hedge_scheduler>()),
+			cache(std::make_shared<read_cache>()) {}
 		~node_data() {
+			hedge->stop();
 			dnet_node_destroy(node_ptr);
 		}
 
 		struct dnet_node	*node_ptr;
 		logger				log;
+		std::shared_ptr<hedge_scheduler>	hedge;
+		std::shared_ptr<read_cache>		cache;
 };
 
 class session_data
@@ -46,6 +167,8 @@ class session_data
 		result_error_handler	error_handler;
 		uint32_t		policy;
 		uint32_t		trace_id;
+		long			hedge_delay;
+		bool			cached_reads;
 };
 
 }} // namespace ioremap::elliptics
@@ -369,6 +369,8 @@ session_data::session_data(const node &n) : node_guard(n.m_data), logger(n.get_l
 	error_handler = error_handlers::none;
 	policy = session::default_exceptions;
 	trace_id = 0;
+	hedge_delay = -1;
+	cached_reads = false;
 	::trace_id = 0;
 }
 
@@ -379,7 +381,9 @@ session_data::session_data(const session_data &other)
 	  checker(other.checker),
 	  error_handler(other.error_handler),
 	  policy(other.policy),
-	  trace_id(other.trace_id)
+	  trace_id(other.trace_id),
+	  hedge_delay(other.hedge_delay),
+	  cached_reads(other.cached_reads)
 {
 	session_ptr = dnet_session_copy(other.session_ptr);
 	if (!session_ptr)
@@ -587,6 +591,84 @@ uint32_t session::get_trace_id()
 	return m_data->trace_id;
 }
 
+void session::set_hedge_delay(long usecs)
+{
+	m_data->hedge_delay = usecs;
+}
+
+long session::get_hedge_delay() const
+{
+	return m_data->hedge_delay;
+}
+
+void session::set_cached_reads(bool cached)
+{
+	m_data->cached_reads = cached;
+}
+
+bool session::get_cached_reads() const
+{
+	return m_data->cached_reads;
+}
+
+/*
+ * Writes and removes drop the key from node's read cache whether the session
+ * reads through it or not. Read sent after the drop may be answered before
+ * the write lands, so callback drops the key once more on completion.
+ * Returns the cache to drop it from, or null if there is no cache.
+ */
+static std::shared_ptr<read_cache> drop_cached_reads(const std::shared_ptr<session_data> &data, const dnet_id &id)
+{
+	std::shared_ptr<node_data> node = data->node_guard.lock();
+	if (!node || !node->cache->enabled())
+		return std::shared_ptr<read_cache>();
+
+	node->cache->drop(id);
+	return node->cache;
+}
+
+/*
+ * Serves read from the cache or sends it to the storage and puts the reply
+ * into the cache, aggregated result is checked only by outer session's
+ * filter and checker like in read_latest()
+ */
+static async_read_result read_cached(session &outer, const key &id, const std::vector<int> &groups,
+		const dnet_io_attr &io, const std::shared_ptr<read_cache> &cache)
+{
+	async_read_result result(outer);
+	async_result_handler<read_result_entry> handler(result);
+	const dnet_id raw = id.id();
+	read_result_entry entry;
+
+	if (cache->lookup(raw, groups, entry)) {
+		handler.set_total(1);
+		handler.process(entry);
+		handler.complete(error_info());
+		return result;
+	}
+
+	const uint64_t generation = cache->generation(raw);
+
+	session sess = outer.clone();
+	sess.set_cached_reads(false);
+	sess.set_filter(filters::all_with_ack);
+	sess.set_checker(checkers::no_check);
+	sess.set_exceptions_policy(session::no_exceptions);
+
+	sess.read_data(id, groups, io).connect(
+		[cache, raw, generation, handler] (const read_result_entry &entry) mutable {
+			if (entry.status() == 0 && !entry.is_ack() && entry.size() >= sizeof(dnet_io_attr))
+				cache->insert(raw, generation, entry);
+
+			handler.process(entry);
+		},
+		[handler] (const error_info &error) mutable {
+			handler.complete(error);
+		});
+
+	return result;
+}
+
 void session::read_file(const key &id, const std::string &file, uint64_t offset, uint64_t size)
 {
 	int err;
@@ -647,6 +729,25 @@ async_read_result session::read_data(const key &id, const std::vector<int> &grou
 
 	memcpy(&control.io, &io, sizeof(dnet_io_attr));
 
+	if (m_data->cached_reads && cmd == DNET_CMD_READ && !io.offset && !io.size) {
+		std::shared_ptr<node_data> node = m_data->node_guard.lock();
+		if (node && node->cache->enabled())
+			return read_cached(*this, id, groups, io, node->cache);
+	}
+
+	if (m_data->hedge_delay >= 0 && cmd == DNET_CMD_READ && groups.size() > 1) {
+		std::shared_ptr<node_data> node = m_data->node_guard.lock();
+		if (node) {
+			auto cb = std::make_shared<hedged_read_callback>(*this, result, control,
+					node->hedge, m_data->hedge_delay);
+			cb->kid = id;
+			cb->groups = groups;
+
+			cb->start();
+			return result;
+		}
+	}
+
 	auto cb = createCallback<read_callback>(*this, result, control);
 	cb->kid = id;
 	cb->groups = groups;
@@ -833,6 +934,372 @@ async_read_result session::read_latest(const key &id, uint64_t offset, uint64_t
 	return result;
 }
 
+/*
+ * Returns reply with the latest timestamp first
+ */
+struct read_latest_timestamp_comparator
+{
+	bool operator() (const read_result_entry &a, const read_result_entry &b) const
+	{
+		return dnet_time_cmp(&a.io_attribute()->timestamp, &b.io_attribute()->timestamp) > 0;
+	}
+};
+
+/*
+ * Zero-length object has no file data, so reply is valid if it has io attribute,
+ * which gives timestamp and size, only acks have no data at all
+ */
+static bool read_latest_is_valid(const read_result_entry &entry)
+{
+	return entry.status() == 0 && entry.data().size() >= sizeof(dnet_io_attr);
+}
+
+/*
+ * Receives the part of the latest object which did not fit into size limit
+ * and joins it with already received prefix. If the rest belongs to another
+ * version of the object, the whole range is read again like two-phase read_latest() does.
+ */
+struct read_latest_rest_callback
+{
+	session sess;
+	key id;
+	uint64_t offset;
+	uint64_t size;
+	std::vector<int> groups;
+	async_result_handler<read_result_entry> handler;
+	read_result_entry prefix;
+
+	void operator() (const std::vector<read_result_entry> &results, const error_info &)
+	{
+		dnet_io_attr *prefix_io = prefix.io_attribute();
+
+		for (auto it = results.begin(); it != results.end(); ++it) {
+			if (!read_latest_is_valid(*it))
+				continue;
+
+			dnet_io_attr *io = it->io_attribute();
+			if (dnet_time_cmp(&io->timestamp, &prefix_io->timestamp) != 0
+					|| io->offset != prefix_io->offset + prefix_io->size)
+				continue;
+
+			handler.process(join(*it));
+			handler.complete(error_info());
+			return;
+		}
+
+		sess.set_filter(filters::all_with_ack);
+		sess.set_checker(checkers::no_check);
+		sess.read_data(id, groups, offset, size).connect(handler);
+	}
+
+	read_result_entry join(const read_result_entry &rest) const
+	{
+		const data_pointer prefix_file = prefix.file();
+		const data_pointer rest_file = rest.file();
+		const size_t file_size = prefix_file.size() + rest_file.size();
+
+		auto data = std::make_shared<callback_result_data>();
+		data->data = data_pointer::allocate(sizeof(dnet_addr) + sizeof(dnet_cmd) + sizeof(dnet_io_attr) + file_size);
+
+		dnet_addr *addr = data->data.data<dnet_addr>();
+		dnet_cmd *cmd = reinterpret_cast<dnet_cmd *>(addr + 1);
+		dnet_io_attr *io = reinterpret_cast<dnet_io_attr *>(cmd + 1);
+		char *file = reinterpret_cast<char *>(io + 1);
+
+		*addr = *prefix.address();
+		*cmd = *prefix.command();
+		cmd->size = sizeof(dnet_io_attr) + file_size;
+		*io = *prefix.io_attribute();
+		io->size = file_size;
+
+		memcpy(file, prefix_file.data(), prefix_file.size());
+		memcpy(file + prefix_file.size(), rest_file.data(), rest_file.size());
+
+		callback_result_entry entry = data;
+		return *static_cast<const read_result_entry *>(&entry);
+	}
+};
+
+/*
+ * Collects replies of parallel reads sent to every group. The latest reply is
+ * taken once replies of the majority of groups have been received, so that
+ * single stalled replica does not delay the read: object written to the majority
+ * of groups is seen by it. If no group has the object, all of them are waited for.
+ */
+struct read_latest_parallel_state
+{
+	session sess;
+	key id;
+	uint64_t offset;
+	uint64_t size;
+	async_result_handler<read_result_entry> handler;
+
+	std::mutex lock;
+	std::vector<read_result_entry> results;
+	size_t total;
+	size_t finished;
+	bool done;
+
+	read_latest_parallel_state(const session &sess, const key &id, uint64_t offset, uint64_t size,
+			const async_result_handler<read_result_entry> &handler, size_t total) :
+		sess(sess), id(id), offset(offset), size(size), handler(handler),
+		total(total), finished(0), done(false)
+	{
+	}
+
+	void process(const read_result_entry &entry)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!done)
+			results.push_back(entry);
+	}
+
+	void complete(const error_info &)
+	{
+		std::vector<read_result_entry> ready;
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (done)
+				return;
+
+			++finished;
+
+			bool has_valid = std::any_of(results.begin(), results.end(), read_latest_is_valid);
+			if (finished < total && (finished <= total / 2 || !has_valid))
+				return;
+
+			done = true;
+			ready.swap(results);
+		}
+
+		finish(ready);
+	}
+
+	void finish(const std::vector<read_result_entry> &results)
+	{
+		std::vector<read_result_entry> valid;
+		for (auto it = results.begin(); it != results.end(); ++it) {
+			if (read_latest_is_valid(*it))
+				valid.push_back(*it);
+		}
+
+		if (valid.empty()) {
+			for (auto it = results.begin(); it != results.end(); ++it) {
+				if (it->status() != 0)
+					handler.process(*it);
+			}
+			handler.complete(error_info());
+			return;
+		}
+
+		std::stable_sort(valid.begin(), valid.end(), read_latest_timestamp_comparator());
+
+		const read_result_entry &latest = valid.front();
+		dnet_io_attr *io = latest.io_attribute();
+		uint64_t end = io->total_size;
+
+		if (size && offset + size < end)
+			end = offset + size;
+
+		if (io->offset + io->size >= end) {
+			handler.process(latest);
+			handler.complete(error_info());
+			return;
+		}
+
+		// The latest object is larger than the limit, read the rest from groups ordered by timestamps
+		std::vector<int> groups;
+		groups.reserve(valid.size());
+		for (auto it = valid.begin(); it != valid.end(); ++it)
+			groups.push_back(it->command()->id.group_id);
+
+		const uint64_t rest_offset = io->offset + io->size;
+
+		sess.set_filter(filters::all_with_ack);
+		sess.set_checker(checkers::no_check);
+
+		read_latest_rest_callback callback = { sess, id, offset, size, groups, handler, latest };
+		sess.read_data(id, groups, rest_offset, end - rest_offset).connect(callback);
+	}
+};
+
+async_read_result session::read_latest(const key &id, uint64_t offset, uint64_t size, uint64_t size_limit)
+{
+	if (!size_limit)
+		return read_latest(id, offset, size);
+
+	DNET_SESSION_GET_GROUPS(async_read_result);
+
+	session sess = clone();
+	sess.set_exceptions_policy(no_exceptions);
+	sess.set_filter(filters::positive);
+	sess.set_checker(checkers::no_check);
+
+	async_read_result result(*this);
+	async_result_handler<read_result_entry> handler(result);
+
+	if (groups.empty()) {
+		handler.complete(create_error(-ENXIO, id, "read_latest: no groups"));
+		return result;
+	}
+
+	auto state = std::make_shared<read_latest_parallel_state>(sess, id, offset, size, handler, groups.size());
+
+	{
+		session_scope scope(*this);
+
+		// Every group is handled separately, so that stalled one does not hold the result
+		set_filter(filters::all_with_ack);
+		set_checker(checkers::no_check);
+		set_exceptions_policy(no_exceptions);
+
+		const uint64_t limited_size = (size && size < size_limit) ? size : size_limit;
+
+		for (size_t i = 0; i < groups.size(); ++i) {
+			session session_copy = clone();
+
+			const std::vector<int> group(1, groups[i]);
+			session_copy.read_data(id, group, offset, limited_size).connect(
+				std::bind(&read_latest_parallel_state::process, state, std::placeholders::_1),
+				std::bind(&read_latest_parallel_state::complete, state, std::placeholders::_1));
+		}
+	}
+	return result;
+}
+
+session_batch session::batch()
+{
+	return session_batch(*this);
+}
+
+session_batch::session_batch(const session &sess) : m_data(std::make_shared<batch_data>(sess))
+{
+}
+
+session_batch::session_batch(const session_batch &other) : m_data(other.m_data)
+{
+}
+
+session_batch::~session_batch()
+{
+}
+
+session_batch &session_batch::operator =(const session_batch &other)
+{
+	m_data = other.m_data;
+	return *this;
+}
+
+void session_batch::read_data(const key &id, uint64_t offset, uint64_t size)
+{
+	session &sess = m_data->sess;
+	std::vector<int> groups;
+
+	if (error_info error = sess.mix_states(id, groups))
+		error.throw_error();
+
+	batch_request request;
+	dnet_io_control &ctl = request.ctl;
+	memset(&ctl, 0, sizeof(ctl));
+
+	ctl.fd = -1;
+	ctl.cmd = DNET_CMD_READ;
+	ctl.cflags = DNET_FLAGS_NEED_ACK | sess.get_cflags();
+
+	ctl.io.size = size;
+	ctl.io.offset = offset;
+	ctl.io.flags = sess.get_ioflags();
+
+	memcpy(ctl.io.id, id.id().id, DNET_ID_SIZE);
+	memcpy(ctl.io.parent, id.id().id, DNET_ID_SIZE);
+
+	ctl.id = id.id();
+	ctl.id.group_id = groups.front();
+
+	m_data->requests.push_back(request);
+}
+
+void session_batch::write_data(const key &id, const data_pointer &file, uint64_t remote_offset)
+{
+	session &sess = m_data->sess;
+	sess.transform(id);
+
+	batch_request request;
+	dnet_io_control &ctl = request.ctl;
+	memset(&ctl, 0, sizeof(ctl));
+
+	request.data = file;
+
+	ctl.fd = -1;
+	ctl.cmd = DNET_CMD_WRITE;
+	ctl.cflags = DNET_FLAGS_NEED_ACK | sess.get_cflags();
+	ctl.data = file.data();
+
+	ctl.io.flags = sess.get_ioflags();
+	ctl.io.user_flags = sess.get_user_flags();
+	ctl.io.offset = remote_offset;
+	ctl.io.size = file.size();
+
+	sess.get_timestamp(&ctl.io.timestamp);
+	if (dnet_time_is_empty(&ctl.io.timestamp))
+		dnet_current_time(&ctl.io.timestamp);
+
+	memcpy(ctl.io.id, id.id().id, DNET_ID_SIZE);
+	memcpy(ctl.io.parent, id.id().id, DNET_ID_SIZE);
+
+	ctl.id = id.id();
+
+	request.cache = drop_cached_reads(sess.m_data, ctl.id);
+
+	std::vector<int> groups = sess.get_groups();
+	for (auto it = groups.begin(); it != groups.end(); ++it) {
+		ctl.id.group_id = *it;
+		m_data->requests.push_back(request);
+	}
+}
+
+void session_batch::lookup(const key &id)
+{
+	session &sess = m_data->sess;
+	std::vector<int> groups;
+
+	if (error_info error = sess.mix_states(id, groups))
+		error.throw_error();
+
+	batch_request request;
+	dnet_io_control &ctl = request.ctl;
+	memset(&ctl, 0, sizeof(ctl));
+
+	ctl.fd = -1;
+	ctl.cmd = DNET_CMD_LOOKUP;
+	ctl.cflags = DNET_FLAGS_NEED_ACK | sess.get_cflags();
+
+	memcpy(ctl.io.id, id.id().id, DNET_ID_SIZE);
+	memcpy(ctl.io.parent, id.id().id, DNET_ID_SIZE);
+
+	ctl.id = id.id();
+	ctl.id.group_id = groups.front();
+
+	m_data->requests.push_back(request);
+}
+
+size_t session_batch::size() const
+{
+	return m_data->requests.size();
+}
+
+async_generic_result session_batch::execute()
+{
+	async_generic_result result(m_data->sess);
+	auto cb = createCallback<batch_callback>(m_data->sess, result);
+
+	cb->requests.swap(m_data->requests);
+
+	startCallback(cb);
+	return result;
+}
+
 async_write_result session::write_data(const dnet_io_control &ctl)
 {
 	async_write_result result(*this);
@@ -843,6 +1310,8 @@ async_write_result session::write_data(const dnet_io_control &ctl)
 
 	memcpy(cb->ctl.io.id, cb->ctl.id.id, DNET_ID_SIZE);
 
+	cb->cache = drop_cached_reads(m_data, cb->ctl.id);
+
 	startCallback(cb);
 	return result;
 }
@@ -1349,6 +1818,8 @@ async_remove_result session::remove(const key &id)
 	async_remove_result result(*this);
 	auto cb = createCallback<remove_callback>(*this, result, id.id());
 
+	cb->cache = drop_cached_reads(m_data, id.id());
+
 	startCallback(cb);
 	return result;
 }
@@ -1783,27 +2254,55 @@ error_info session::mix_states(const key &id, std::vector<int> &groups)
 }
 
 async_iterator_result session::start_iterator(const key &id, const std::vector<dnet_iterator_range>& ranges,
-								uint32_t type, uint64_t flags,
-								const dnet_time& time_begin, const dnet_time& time_end)
+								const dnet_iterator_request &request)
 {
-	auto ranges_size = ranges.size() * sizeof(ranges.front());
+	auto ranges_size = ranges.size() * sizeof(dnet_iterator_range);
 
 	data_pointer data = data_pointer::allocate(sizeof(dnet_iterator_request) + ranges_size);
 
 	auto req = data.data<dnet_iterator_request>();
+	*req = request;
 
 	req->action = DNET_ITERATOR_ACTION_START;
-	req->itype = type;
-	req->flags = flags;
-	req->time_begin = time_begin;
-	req->time_end = time_end;
 	req->range_num = ranges.size();
 
-	memcpy(data.skip<dnet_iterator_request>().data(), &ranges.front(), ranges_size);
+	if (ranges_size)
+		memcpy(data.skip<dnet_iterator_request>().data(), &ranges.front(), ranges_size);
 
 	return iterator(id, data);
 }
 
+async_iterator_result session::start_iterator(const key &id, const std::vector<dnet_iterator_range>& ranges,
+								uint32_t type, uint64_t flags,
+								const dnet_time& time_begin, const dnet_time& time_end)
+{
+	dnet_iterator_request req;
+	memset(&req, 0, sizeof(dnet_iterator_request));
+
+	req.itype = type;
+	req.flags = flags;
+	req.time_begin = time_begin;
+	req.time_end = time_end;
+
+	return start_iterator(id, ranges, req);
+}
+
+async_iterator_result session::start_journal_iterator(const key &id, const std::vector<dnet_iterator_range>& ranges,
+								uint64_t flags, uint64_t journal_seq,
+								const dnet_time& time_begin, const dnet_time& time_end)
+{
+	dnet_iterator_request req;
+	memset(&req, 0, sizeof(dnet_iterator_request));
+
+	req.itype = DNET_ITYPE_NETWORK;
+	req.flags = flags | DNET_IFLAGS_JOURNAL;
+	req.journal_seq = journal_seq;
+	req.time_begin = time_begin;
+	req.time_end = time_end;
+
+	return start_iterator(id, ranges, req);
+}
+
 async_iterator_result session::pause_iterator(const key &id, uint64_t iterator_id)
 {
 	data_pointer data = data_pointer::allocate(sizeof(dnet_iterator_request));
@@ -1837,6 +2336,119 @@ async_iterator_result session::cancel_iterator(const key &id, uint64_t iterator_
 	return iterator(id, data);
 }
 
+async_generic_result session::range_hash(const key &id, const std::vector<dnet_iterator_range> &ranges, uint32_t depth)
+{
+	async_generic_result result(*this);
+
+	if (get_groups().empty()) {
+		async_result_handler<callback_result_entry> handler(result);
+		handler.complete(create_error(-ENXIO, "range_hash: groups list is empty"));
+		return result;
+	}
+
+	transform(id);
+
+	const size_t ranges_size = ranges.size() * sizeof(dnet_iterator_range);
+	data_pointer data = data_pointer::allocate(sizeof(dnet_range_hash_request) + ranges_size);
+
+	auto req = data.data<dnet_range_hash_request>();
+	memset(req, 0, sizeof(dnet_range_hash_request));
+	req->depth = depth;
+	req->range_num = ranges.size();
+	dnet_convert_range_hash_request(req);
+
+	if (!ranges.empty())
+		memcpy(data.skip<dnet_range_hash_request>().data(), &ranges.front(), ranges_size);
+
+	dnet_id raw = id.id();
+	raw.group_id = get_groups().front();
+
+	transport_control control;
+	control.set_key(raw);
+	control.set_command(DNET_CMD_RANGE_HASH);
+	control.set_cflags(get_cflags() | DNET_FLAGS_NEED_ACK | DNET_FLAGS_NOLOCK);
+	control.set_data(data.data(), data.size());
+
+	auto cb = createCallback<single_cmd_callback>(*this, result, control);
+	startCallback(cb);
+	return result;
+}
+
+async_generic_result session::copy(const key &id, const std::vector<dnet_raw_id> &keys,
+		const std::vector<int> &groups, uint64_t flags)
+{
+	async_generic_result result(*this);
+
+	if (get_groups().empty() || groups.empty() || keys.empty()) {
+		async_result_handler<callback_result_entry> handler(result);
+		handler.complete(create_error(-EINVAL, "copy: groups or keys list is empty"));
+		return result;
+	}
+
+	transform(id);
+
+	const size_t groups_size = groups.size() * sizeof(uint32_t);
+	const size_t keys_size = keys.size() * sizeof(dnet_raw_id);
+	data_pointer data = data_pointer::allocate(sizeof(dnet_copy_request) + groups_size + keys_size);
+
+	auto req = data.data<dnet_copy_request>();
+	memset(req, 0, sizeof(dnet_copy_request));
+	req->flags = flags;
+	req->group_num = groups.size();
+	req->key_num = keys.size();
+	dnet_convert_copy_request(req);
+
+	uint32_t *groups_data = data.skip<dnet_copy_request>().data<uint32_t>();
+	for (size_t i = 0; i < groups.size(); ++i)
+		groups_data[i] = dnet_bswap32(groups[i]);
+
+	memcpy(groups_data + groups.size(), &keys.front(), keys_size);
+
+	dnet_id raw = id.id();
+	raw.group_id = get_groups().front();
+
+	transport_control control;
+	control.set_key(raw);
+	control.set_command(DNET_CMD_COPY);
+	control.set_cflags(get_cflags() | DNET_FLAGS_NEED_ACK);
+	control.set_data(data.data(), data.size());
+
+	auto cb = createCallback<single_cmd_callback>(*this, result, control);
+	startCallback(cb);
+	return result;
+}
+
+async_generic_result session::io_sched(const key &id, const dnet_io_sched_ctl &ctl)
+{
+	async_generic_result result(*this);
+
+	if (get_groups().empty()) {
+		async_result_handler<callback_result_entry> handler(result);
+		handler.complete(create_error(-EINVAL, "io_sched: groups list is empty"));
+		return result;
+	}
+
+	transform(id);
+
+	data_pointer data = data_pointer::allocate(sizeof(dnet_io_sched_ctl));
+	auto req = data.data<dnet_io_sched_ctl>();
+	memcpy(req, &ctl, sizeof(dnet_io_sched_ctl));
+	dnet_convert_io_sched_ctl(req);
+
+	dnet_id raw = id.id();
+	raw.group_id = get_groups().front();
+
+	transport_control control;
+	control.set_key(raw);
+	control.set_command(DNET_CMD_IO_SCHED);
+	control.set_cflags(get_cflags() | DNET_FLAGS_NEED_ACK | DNET_FLAGS_NOLOCK);
+	control.set_data(data.data(), data.size());
+
+	auto cb = createCallback<single_cmd_callback>(*this, result, control);
+	startCallback(cb);
+	return result;
+}
+
 async_exec_result session::exec(dnet_id *id, const std::string &event, const argument_data &data)
 {
 	return exec(id, -1, event, data);
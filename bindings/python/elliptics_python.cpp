@@ -48,6 +48,11 @@ enum elliptics_iterator_flags {
 	iflag_data = DNET_IFLAGS_DATA,
 	iflag_key_range = DNET_IFLAGS_KEY_RANGE,
 	iflag_ts_range = DNET_IFLAGS_TS_RANGE,
+	iflag_journal = DNET_IFLAGS_JOURNAL,
+	iflag_user_flags = DNET_IFLAGS_USER_FLAGS,
+	iflag_size_range = DNET_IFLAGS_SIZE_RANGE,
+	iflag_sample = DNET_IFLAGS_SAMPLE,
+	iflag_data_range = DNET_IFLAGS_DATA_RANGE,
 };
 
 enum elliptics_cflags {
@@ -69,6 +74,11 @@ enum elliptics_ioflags {
 	ioflags_cache_remove_from_disk = DNET_IO_FLAGS_CACHE_REMOVE_FROM_DISK,
 };
 
+enum elliptics_copy_flags {
+	copy_flags_default = 0,
+	copy_flags_newer = DNET_COPY_FLAGS_NEWER,
+};
+
 enum elliptics_log_level {
 	log_level_data = DNET_LOG_DATA,
 	log_level_error = DNET_LOG_ERROR,
@@ -138,6 +148,17 @@ class elliptics_node_python : public node, public bp::wrapper<node> {
 			: node(l, cfg) {}
 
 		elliptics_node_python(const node &n): node(n) {}
+
+		bp::dict get_read_cache_dict() const {
+			read_cache_stats st = get_read_cache_stats();
+			bp::dict result;
+
+			result["hits"] = st.hits;
+			result["misses"] = st.misses;
+			result["entries"] = st.entries;
+			result["size"] = st.size;
+			return result;
+		}
 };
 
 
@@ -348,6 +369,24 @@ BOOST_PYTHON_MODULE(core)
 		     "set_timeouts(wait_timeout, check_timeout)\n"
 		     "    Changes timeouts values\n\n"
 		     "    node.set_timeouts(wait_timeout=5, check_timeout=50)")
+		.def("set_hedge_budget", &node::set_hedge_budget,
+		     (bp::arg("percent")),
+		     "set_hedge_budget(percent)\n"
+		     "    Sets percent of reads which may be additionally sent\n"
+		     "    to the next group by sessions with hedge_delay set\n\n"
+		     "    node.set_hedge_budget(10)")
+		.def("set_read_cache", &node::set_read_cache,
+		     (bp::arg("max_size"), bp::arg("lifetime")),
+		     "set_read_cache(max_size, lifetime)\n"
+		     "    Sets size in bytes of client-side cache of objects read\n"
+		     "    by sessions with cached_reads enabled. Entries expire after\n"
+		     "    lifetime milliseconds. Zero max_size disables the cache\n\n"
+		     "    node.set_read_cache(100 * 1024 * 1024, 1000)")
+		.def("read_cache_stats", &elliptics_node_python::get_read_cache_dict,
+		     "read_cache_stats()\n"
+		     "    Returns dict with hits, misses, entries and size of the read cache\n\n"
+		     "    stats = node.read_cache_stats()\n"
+		     "    print 'Hits:', stats['hits']")
 	;
 
 	bp::enum_<elliptics_iterator_flags>("iterator_flags",
@@ -355,11 +394,21 @@ BOOST_PYTHON_MODULE(core)
 	    "default\n    There no filtering should be while iteration. All keys will be presented\n"
 	    "data\n    Iteration results should also includes objects datas\n"
 	    "key_range\n    elliptics.Id ranges should be used for filtering keys on the node while iteration\n"
-	    "ts_range\n    Time range should be used for filtering keys on the node while iteration")
+	    "ts_range\n    Time range should be used for filtering keys on the node while iteration\n"
+	    "journal\n    Change journal should be iterated instead of all keys on the node\n"
+	    "user_flags\n    User flags mask and value of elliptics.IteratorFilter should be used for filtering keys\n"
+	    "size_range\n    Size range of elliptics.IteratorFilter should be used for filtering keys\n"
+	    "sample\n    Only sample_rate of elliptics.IteratorFilter per million keys should be sent\n"
+	    "data_range\n    Only part of the data specified by elliptics.IteratorFilter should be sent")
 		.value("default", iflag_default)
 		.value("data", iflag_data)
 		.value("key_range", iflag_key_range)
 		.value("ts_range", iflag_ts_range)
+		.value("journal", iflag_journal)
+		.value("user_flags", iflag_user_flags)
+		.value("size_range", iflag_size_range)
+		.value("sample", iflag_sample)
+		.value("data_range", iflag_data_range)
 	;
 
 	bp::enum_<elliptics_iterator_types>("iterator_types",
@@ -412,6 +461,14 @@ BOOST_PYTHON_MODULE(core)
 		.value("cache_remove_from_disk", ioflags_cache_remove_from_disk)
 	;
 
+	bp::enum_<elliptics_copy_flags>("copy_flags",
+		"Flags which specifies how server-side copy should be done:\n\n"
+		"default\n    Records are written to destination groups unconditionally\n"
+		"newer\n    Records are written only if destination does not have the same or newer one")
+		.value("default", copy_flags_default)
+		.value("newer", copy_flags_newer)
+	;
+
 	bp::enum_<elliptics_log_level>("log_level",
 	    "Different levels of verbosity elliptics logs:\n\n"
 	     "data\n    The level has very important data, practically nothing is written\n"
@@ -445,7 +502,7 @@ BOOST_PYTHON_MODULE(core)
 	bp::enum_<elliptics_config_flags>("config_flags",
 	    "Bit flags which could be used at elliptics.Config.flags:\n\n"
 	    "no_route_list\n    Do not request route table from remote nodes\n"
-	    "mix_stats\n    Mix states according to their weights before reading data\n"
+	    "mix_stats\n    Order replicas by latency, load and timeouts before reading data\n"
 	    "no_csum\n    Globally disable checksum verification and update\n"
 	    "randomize_states\n    Randomize states for read requests\n\n"
 	    "config.flags = elliptics.config_flags.mix_stats | elliptics.config_flags.randomize_states\n"
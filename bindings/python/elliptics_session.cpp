@@ -131,6 +131,29 @@ struct elliptics_range {
 	int				group_id;
 };
 
+struct elliptics_iterator_filter {
+	elliptics_iterator_filter()
+	: user_flags_mask(0), user_flags_value(0)
+	, size_begin(0), size_end(0)
+	, data_offset(0), data_size(0)
+	, sample_rate(0) {}
+
+	void fill(dnet_iterator_request &req) const {
+		req.user_flags_mask = user_flags_mask;
+		req.user_flags_value = user_flags_value;
+		req.size_begin = size_begin;
+		req.size_end = size_end;
+		req.data_offset = data_offset;
+		req.data_size = data_size;
+		req.sample_rate = sample_rate;
+	}
+
+	uint64_t		user_flags_mask, user_flags_value;
+	uint64_t		size_begin, size_end;
+	uint64_t		data_offset, data_size;
+	uint32_t		sample_rate;
+};
+
 elliptics_id dnet_iterator_range_get_key_begin(const dnet_iterator_range *range)
 {
 	return elliptics_id(range->key_begin);
@@ -151,6 +174,26 @@ void dnet_iterator_range_set_key_end(dnet_iterator_range *range, const elliptics
 	range->key_end = id.raw_id();
 }
 
+uint64_t dnet_iterator_position_get_blob(const dnet_iterator_position *position)
+{
+	return position->blob;
+}
+
+void dnet_iterator_position_set_blob(dnet_iterator_position *position, uint64_t blob)
+{
+	position->blob = blob;
+}
+
+uint64_t dnet_iterator_position_get_offset(const dnet_iterator_position *position)
+{
+	return position->offset;
+}
+
+void dnet_iterator_position_set_offset(dnet_iterator_position *position, uint64_t offset)
+{
+	position->offset = offset;
+}
+
 class elliptics_session: public session, public bp::wrapper<session> {
 public:
 	elliptics_session(const node &n) : session(n) {}
@@ -198,6 +241,22 @@ public:
 		return session::get_trace_id();
 	}
 
+	void set_hedge_delay(long usecs) {
+		session::set_hedge_delay(usecs);
+	}
+
+	long get_hedge_delay() {
+		return session::get_hedge_delay();
+	}
+
+	void set_cached_reads(bool cached) {
+		session::set_cached_reads(cached);
+	}
+
+	bool get_cached_reads() {
+		return session::get_cached_reads();
+	}
+
 	void set_namespace(const std::string& ns) {
 		session::set_namespace(ns.c_str(), ns.size());
 	}
@@ -320,15 +379,15 @@ public:
 		return create_result(std::move(session::prepare_latest(io_attr.id, groups)));
 	}
 
-	python_read_result read_latest(const bp::api::object &id, uint64_t offset, uint64_t size) {
+	python_read_result read_latest(const bp::api::object &id, uint64_t offset, uint64_t size, uint64_t size_limit) {
 		bp::extract<elliptics_io_attr&> get_io_attr(id);
 		if (!get_io_attr.check())
-			return create_result(std::move(session::read_latest(elliptics_id::convert(id), offset, size)));
+			return create_result(std::move(session::read_latest(elliptics_id::convert(id), offset, size, size_limit)));
 
 		elliptics_io_attr &io_attr = get_io_attr;
 		transform_io_attr(io_attr);
 
-		return create_result(std::move(session::read_latest(io_attr.id, io_attr.offset, io_attr.size)));
+		return create_result(std::move(session::read_latest(io_attr.id, io_attr.offset, io_attr.size, size_limit)));
 	}
 
 	python_write_result write_data(const bp::api::object &id, const std::string &data, uint64_t offset) {
@@ -437,6 +496,53 @@ public:
 		return create_result(std::move(session::start_iterator(elliptics_id::convert(id), std_ranges, type, flags, time_begin.m_time, time_end.m_time)));
 	}
 
+	python_iterator_result start_filtered_iterator(const bp::api::object &id, const bp::api::object &ranges,
+	                                               uint32_t type, uint64_t flags,
+	                                               const elliptics_time& time_begin,
+	                                               const elliptics_time& time_end,
+	                                               const elliptics_iterator_filter &filter) {
+		std::vector<dnet_iterator_range> std_ranges = convert_to_vector<dnet_iterator_range>(ranges);
+
+		dnet_iterator_request req;
+		memset(&req, 0, sizeof(dnet_iterator_request));
+		req.itype = type;
+		req.flags = flags;
+		req.time_begin = time_begin.m_time;
+		req.time_end = time_end.m_time;
+		filter.fill(req);
+
+		return create_result(std::move(session::start_iterator(elliptics_id::convert(id), std_ranges, req)));
+	}
+
+	python_iterator_result resume_iterator(const bp::api::object &id, const bp::api::object &ranges,
+	                                       uint32_t type, uint64_t flags,
+	                                       const elliptics_time& time_begin,
+	                                       const elliptics_time& time_end,
+	                                       const elliptics_iterator_filter &filter,
+	                                       const dnet_iterator_position &position) {
+		std::vector<dnet_iterator_range> std_ranges = convert_to_vector<dnet_iterator_range>(ranges);
+
+		dnet_iterator_request req;
+		memset(&req, 0, sizeof(dnet_iterator_request));
+		req.itype = type;
+		req.flags = flags;
+		req.time_begin = time_begin.m_time;
+		req.time_end = time_end.m_time;
+		req.position = position;
+		filter.fill(req);
+
+		return create_result(std::move(session::start_iterator(elliptics_id::convert(id), std_ranges, req)));
+	}
+
+	python_iterator_result start_journal_iterator(const bp::api::object &id, const bp::api::object &ranges,
+	                                              uint64_t flags, uint64_t journal_seq,
+	                                              const elliptics_time& time_begin,
+	                                              const elliptics_time& time_end) {
+		std::vector<dnet_iterator_range> std_ranges = convert_to_vector<dnet_iterator_range>(ranges);
+
+		return create_result(std::move(session::start_journal_iterator(elliptics_id::convert(id), std_ranges, flags, journal_seq, time_begin.m_time, time_end.m_time)));
+	}
+
 	python_iterator_result pause_iterator(const bp::api::object &id, const uint64_t &iterator_id) {
 		return create_result(std::move(session::pause_iterator(elliptics_id::convert(id), iterator_id)));
 	}
@@ -449,6 +555,73 @@ public:
 		return create_result(std::move(session::cancel_iterator(elliptics_id::convert(id), iterator_id)));
 	}
 
+	bp::list range_hash(const bp::api::object &id, const bp::api::object &ranges, uint32_t depth) {
+		std::vector<dnet_iterator_range> std_ranges = convert_to_vector<dnet_iterator_range>(ranges);
+		const key raw_id = elliptics_id::convert(id);
+		sync_generic_result results;
+
+		{
+			py_allow_threads_scoped pythr;
+			results = session::range_hash(raw_id, std_ranges, depth).get();
+		}
+
+		bp::list res;
+
+		for (auto it = results.begin(), end = results.end(); it != end; ++it) {
+			data_pointer data = it->data();
+
+			for (size_t i = 0; i + sizeof(dnet_range_hash) <= data.size(); i += sizeof(dnet_range_hash)) {
+				dnet_range_hash hash = *data.skip(i).data<dnet_range_hash>();
+				dnet_convert_range_hash(&hash);
+
+				res.append(bp::make_tuple(hash.prefix, hash.count, hash.hash));
+			}
+		}
+
+		return res;
+	}
+
+	bp::list copy(const bp::api::object &id, const bp::api::object &keys, const bp::api::object &groups, uint64_t flags) {
+		const key raw_id = elliptics_id::convert(id);
+		std::vector<dnet_raw_id> std_keys;
+		std_keys.reserve(bp::len(keys));
+
+		for (bp::stl_input_iterator<bp::api::object> it(keys), end; it != end; ++it) {
+			key k = elliptics_id::convert(*it);
+			session::transform(k);
+
+			dnet_raw_id raw;
+			memcpy(raw.id, k.id().id, DNET_ID_SIZE);
+			std_keys.push_back(raw);
+		}
+
+		std::vector<int> std_groups = convert_to_vector<int>(groups);
+		sync_generic_result results;
+
+		{
+			py_allow_threads_scoped pythr;
+			results = session::copy(raw_id, std_keys, std_groups, flags).get();
+		}
+
+		bp::list res;
+
+		for (auto it = results.begin(), end = results.end(); it != end; ++it) {
+			data_pointer data = it->data();
+
+			for (size_t i = 0; i + sizeof(dnet_copy_status) <= data.size(); i += sizeof(dnet_copy_status)) {
+				dnet_copy_status status = *data.skip(i).data<dnet_copy_status>();
+				dnet_convert_copy_status(&status);
+
+				dnet_id eid;
+				dnet_setup_id(&eid, status.group_id, status.key.id);
+
+				res.append(bp::make_tuple(elliptics_id(eid), status.group_id, status.status, status.size));
+			}
+		}
+
+		return res;
+	}
+
 	python_exec_result exec_src(const bp::api::object &id, const int src_key, const std::string &event, const bp::api::object &data) {
 		dnet_id* raw_id = NULL;
 		dnet_id conv_id;
@@ -706,6 +879,29 @@ void init_elliptics_session() {
 		.def_readwrite("limit_num", &elliptics_range::limit_num)
 	;
 
+	bp::class_<elliptics_iterator_filter>("IteratorFilter",
+	    "Server-side iterator filters, each of them is used only if corresponding elliptics.iterator_flags is set")
+		.def_readwrite("user_flags_mask", &elliptics_iterator_filter::user_flags_mask,
+		               "iterator_flags.user_flags: only keys with (user_flags & user_flags_mask) == user_flags_value are sent")
+		.def_readwrite("user_flags_value", &elliptics_iterator_filter::user_flags_value)
+		.def_readwrite("size_begin", &elliptics_iterator_filter::size_begin,
+		               "iterator_flags.size_range: only keys with size in [size_begin, size_end] are sent")
+		.def_readwrite("size_end", &elliptics_iterator_filter::size_end)
+		.def_readwrite("sample_rate", &elliptics_iterator_filter::sample_rate,
+		               "iterator_flags.sample: only sample_rate of every 1000000 keys are sent")
+		.def_readwrite("data_offset", &elliptics_iterator_filter::data_offset,
+		               "iterator_flags.data_range: only data_size bytes of data starting from data_offset are sent")
+		.def_readwrite("data_size", &elliptics_iterator_filter::data_size)
+	;
+
+	bp::class_<dnet_iterator_position>("IteratorPosition",
+	    "Iterator checkpoint, interrupted iteration may be resumed from it")
+		.add_property("blob", dnet_iterator_position_get_blob,
+		                      dnet_iterator_position_set_blob)
+		.add_property("offset", dnet_iterator_position_get_offset,
+		                        dnet_iterator_position_set_offset)
+	;
+
 	bp::class_<dnet_iterator_range>("IteratorRange",
 	    "Used in iteration for specifying elliptics.Id ranges for filtering results")
 		.add_property("key_begin", dnet_iterator_range_get_key_begin,
@@ -760,6 +956,23 @@ void init_elliptics_session() {
 		    "session.trace_id = 123456\n"
 		    "session.trace_id = 123456 | elliptics.trace_bit")
 
+		.add_property("hedge_delay",
+		              &elliptics_session::get_hedge_delay,
+		              &elliptics_session::set_hedge_delay,
+		    "Delay in microseconds after which read is additionally sent\n"
+		    "to the next group if the current one has not replied yet.\n"
+		    "The first successful reply wins. 0 derives delay from the latency\n"
+		    "of the replica being read, negative value disables hedged reads\n\n"
+		    "session.hedge_delay = 20000\n"
+		    "session.hedge_delay = -1")
+
+		.add_property("cached_reads",
+		              &elliptics_session::get_cached_reads,
+		              &elliptics_session::set_cached_reads,
+		    "Whether whole object reads are served by node's read cache\n"
+		    "configured by elliptics.Node.set_read_cache()\n\n"
+		    "session.cached_reads = True")
+
 		.add_property("cflags",
 		              &elliptics_session::get_cflags,
 		              &elliptics_session::set_cflags,
@@ -936,12 +1149,14 @@ void init_elliptics_session() {
 		    "        print 'flags:', read_result.flags\n")
 
 		.def("read_latest", &elliptics_session::read_latest,
-		     (bp::arg("key"), bp::arg("offset") = 0, bp::arg("size") = 0),
-		    "read_latest(key, offset=0, size=0)\n"
+		     (bp::arg("key"), bp::arg("offset") = 0, bp::arg("size") = 0, bp::arg("size_limit") = 0),
+		    "read_latest(key, offset=0, size=0, size_limit=0)\n"
 		    "    Looks up to each group for the key and reads one which is newer then other. Returns elliptics.AsyncResult\n"
 		    "    -- key - string or elliptics.Id, or elliptics.IoAttr\n"
 		    "    -- offset - offset from which object data should be read\n"
-		    "    -- size - number of bytes to be read. If size equal ot 0 then the full object will be read\n\n"
+		    "    -- size - number of bytes to be read. If size equal ot 0 then the full object will be read\n"
+		    "    -- size_limit - if not 0, reads up to size_limit bytes from all groups at once instead of lookups\n"
+		    "       and the latest reply wins. Larger objects are read again from groups with the latest data\n\n"
 		    "    read_result = None\n"
 		    "    try:\n"
 		    "        result = session.read_latest('key', 0, 0)\n"
@@ -1338,6 +1553,54 @@ void init_elliptics_session() {
 		    "                       result.response.timestamp.tnsec,\n"
 		    "                       result.response_data))\n")
 
+		.def("start_filtered_iterator", &elliptics_session::start_filtered_iterator,
+		     bp::args("id", "ranges", "type", "flags", "time_begin", "time_end", "filter"),
+		    "start_filtered_iterator(id, ranges, type, flags, time_begin, time_end, filter)\n"
+		    "    The same as start_iterator but also applies @filter on the node,\n"
+		    "    so that only matching keys and requested parts of their data are sent.\n"
+		    "    -- filter - elliptics.IteratorFilter, its fields are used according to @flags\n\n"
+		    "    flt = elliptics.IteratorFilter()\n"
+		    "    flt.size_begin = 1024\n"
+		    "    flt.size_end = 1024 * 1024\n"
+		    "    flt.sample_rate = 10000\n"
+		    "    iterator = session.start_filtered_iterator(id, [], elliptics.iterator_types.network,\n"
+		    "                                               elliptics.iterator_flags.size_range |\n"
+		    "                                               elliptics.iterator_flags.sample,\n"
+		    "                                               elliptics.Time(0, 0), elliptics.Time(0, 0), flt)\n")
+
+		.def("resume_iterator", &elliptics_session::resume_iterator,
+		     bp::args("id", "ranges", "type", "flags", "time_begin", "time_end", "filter", "position"),
+		    "resume_iterator(id, ranges, type, flags, time_begin, time_end, filter, position)\n"
+		    "    The same as start_filtered_iterator but skips records before @position.\n"
+		    "    Every iterator response contains position which iteration may be resumed from,\n"
+		    "    so interrupted iteration is continued by passing position of the last received response.\n"
+		    "    Records may be sent twice around the position.\n"
+		    "    -- position - elliptics.IteratorPosition\n\n"
+		    "    iterator = session.resume_iterator(id, [], elliptics.iterator_types.network,\n"
+		    "                                       elliptics.iterator_flags.default,\n"
+		    "                                       elliptics.Time(0, 0), elliptics.Time(0, 0),\n"
+		    "                                       elliptics.IteratorFilter(), last.response.position)\n")
+
+		.def("start_journal_iterator", &elliptics_session::start_journal_iterator,
+		     bp::args("id", "ranges", "flags", "journal_seq", "time_begin", "time_end"),
+		    "start_journal_iterator(id, ranges, flags, journal_seq, time_begin, time_end)\n"
+		    "    Iterates change journal of the Elliptics node specified by @id: every write and removal\n"
+		    "    made since @journal_seq record (or since @time_begin if iterator_flags.ts_range is set)\n"
+		    "    is returned, response has journal_seq and removed properties.\n"
+		    "    Fails with -ERANGE (-34) if journal does not cover all requested changes\n"
+		    "    and with -ENOTSUP (-95) if journal is disabled on the node. Return elliptics.AsyncResult.\n"
+		    "    -- id - elliptics.Id of the node where iteration should be executed\n"
+		    "    -- ranges - list of elliptics.IteratorRange by which keys on the node should be filtered\n"
+		    "    -- flags - bits set of elliptics.iterator_flags, data is not supported\n"
+		    "    -- journal_seq - first journal record to return\n"
+		    "    -- time_begin - start of time range by which changes should be filtered\n"
+		    "    -- time_end - end of time range by which changes should be filtered\n\n"
+		    "    seq = 0\n"
+		    "    for result in session.start_journal_iterator(id, [], elliptics.iterator_flags.default,\n"
+		    "                                                 seq, elliptics.Time(0, 0), elliptics.Time(0, 0)):\n"
+		    "        seq = result.response.journal_seq + 1\n"
+		    "        print result.response.key, result.response.removed\n")
+
 		.def("pause_iterator", &elliptics_session::pause_iterator,
 		     bp::args("id", "iterator_id"),
 		    "pause_iterator(id, iterator_id)\n"
@@ -1378,6 +1641,35 @@ void init_elliptics_session() {
 		    "    iterator = session.cancel_iterator(id, iterator_id)\n"
 		    "    iterator.wait()\n")
 
+		.def("range_hash", &elliptics_session::range_hash,
+		     bp::args("id", "ranges", "depth"),
+		    "range_hash(id, ranges, depth)\n"
+		    "    Returns hashes of keys stored on the node specified by @id.\n"
+		    "    Key space is split into 2^@depth cells by the first @depth bits of the key,\n"
+		    "    result is the list of (prefix, count, hash) tuples sorted by prefix for every cell\n"
+		    "    which intersects @ranges. Replicas with equal (count, hash) store the same keys\n"
+		    "    with the same timestamps.\n"
+		    "    -- id - elliptics.Id of the node\n"
+		    "    -- ranges - list of elliptics.IteratorRange, empty list means the whole key space\n"
+		    "    -- depth - number of key bits in cell prefix, up to 16\n\n"
+		    "    id = session.routes.get_address_id(Address.from_host_port('host.com:1025'))\n"
+		    "    for prefix, count, hash in session.range_hash(id, [], 8):\n"
+		    "        print prefix, count, hash\n")
+
+		.def("copy", &elliptics_session::copy,
+		     bp::args("id", "keys", "groups", "flags"),
+		    "copy(id, keys, groups, flags)\n"
+		    "    Asks the node specified by @id to send its records with @keys to @groups\n"
+		    "    directly, data does not go through the client.\n"
+		    "    Returns list of (id, group_id, status, size) tuples for every key and group.\n"
+		    "    -- id - elliptics.Id of the source node\n"
+		    "    -- keys - iterable object which provides set of elliptics.Id or strings\n"
+		    "    -- groups - list of destination groups\n"
+		    "    -- flags - elliptics.copy_flags, with copy_flags.newer records which are\n"
+		    "       not older in destination group are skipped with -EALREADY (-114) status\n\n"
+		    "    for eid, group, status, size in session.copy(id, keys, [2, 3], elliptics.copy_flags.newer):\n"
+		    "        print eid, group, status, size\n")
+
 // Index operations
 
 		.def("set_indexes", &elliptics_session::set_indexes,
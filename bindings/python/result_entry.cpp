@@ -79,6 +79,21 @@ uint64_t iterator_response_get_size(dnet_iterator_response *response)
 	return response->size;
 }
 
+dnet_iterator_position iterator_response_get_position(dnet_iterator_response *response)
+{
+	return response->position;
+}
+
+uint64_t iterator_response_get_journal_seq(dnet_iterator_response *response)
+{
+	return response->journal_seq;
+}
+
+bool iterator_response_get_removed(dnet_iterator_response *response)
+{
+	return response->cmd == DNET_CMD_DEL;
+}
+
 std::string read_result_get_data(read_result_entry &result)
 {
 	return result.file().to_string();
@@ -384,6 +399,12 @@ void init_result_entry() {
 		              "Custom user-defined flags of iterated key")
 		.add_property("size", iterator_response_get_size,
 		              "Size of iterated key data")
+		.add_property("position", iterator_response_get_position,
+		              "elliptics.IteratorPosition which iteration may be resumed from if it is interrupted")
+		.add_property("journal_seq", iterator_response_get_journal_seq,
+		              "Sequence number of change journal record, journal iterator only")
+		.add_property("removed", iterator_response_get_removed,
+		              "True if the key has been removed, journal iterator only")
 	;
 
 	bp::class_<read_result_entry>("ReadResultEntry")
@@ -91,6 +91,10 @@ int cache_manager::lookup(const unsigned char *id, dnet_net_state *st, dnet_cmd
 	return m_caches[idx(id)]->lookup(id, st, cmd);
 }
 
+int cache_manager::timestamp(const unsigned char *id, dnet_time *ts) {
+	return m_caches[idx(id)]->timestamp(id, ts);
+}
+
 int cache_manager::indexes_find(dnet_cmd *cmd, dnet_indexes_request *request) {
 	(void) cmd;
 	(void) request;
@@ -323,6 +327,23 @@ int dnet_cmd_cache_lookup(struct dnet_net_state *st, struct dnet_cmd *cmd)
 	return err;
 }
 
+int dnet_cache_timestamp(struct dnet_node *n, struct dnet_id *id, struct dnet_time *ts)
+{
+	if (!n->cache) {
+		return -ENOTSUP;
+	}
+
+	cache_manager *cache = (cache_manager *)n->cache;
+
+	try {
+		return cache->timestamp(id->id, ts);
+	} catch (const std::exception &e) {
+		dnet_log_raw(n, DNET_LOG_ERROR, "%s: cache timestamp lookup failed: %s\n",
+				dnet_dump_id(id), e.what());
+		return -ENOENT;
+	}
+}
+
 int dnet_cache_init(struct dnet_node *n)
 {
 	if (!n->cache_size)
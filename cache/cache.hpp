@@ -355,6 +355,8 @@ class cache_manager {
 
 		int lookup(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd);
 
+		int timestamp(const unsigned char *id, dnet_time *ts);
+
 		int indexes_find(dnet_cmd *cmd, dnet_indexes_request *request);
 
 		int indexes_update(dnet_cmd *cmd, dnet_indexes_request *request);
@@ -390,6 +390,18 @@ int slru_cache_t::lookup(const unsigned char *id, dnet_net_state *st, dnet_cmd *
 	return dnet_send_reply(st, cmd, data.data(), data.size(), 0);
 }
 
+int slru_cache_t::timestamp(const unsigned char *id, dnet_time *ts) {
+	elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "%s: CACHE TIMESTAMP: %p", dnet_dump_id_str(id), this);
+
+	data_t* it = m_treap.find(id);
+	if (!it) {
+		return -ENOENT;
+	}
+
+	*ts = it->timestamp();
+	return 0;
+}
+
 void slru_cache_t::clear() {
 	auto clear_guard(make_action_guard(ACTION_CACHE_CLEAR));
 
@@ -749,6 +761,7 @@ void slru_cache_t::life_check(void) {
 					break;
 
 				data_t *elem = *it;
+				size_t synced_size = 0;
 				memcpy(id.id, elem->id().id, DNET_ID_SIZE);
 
 				start_action(ACTION_CACHE_DNET_OPLOCK);
@@ -758,10 +771,15 @@ void slru_cache_t::life_check(void) {
 				// sync_element uses local_session which always uses DNET_FLAGS_NOLOCK
 				if (elem->is_syncing()) {
 					sync_element(id, elem->only_append(), elem->data()->data(), elem->user_flags(), elem->timestamp());
+					synced_size = elem->data()->size();
 					elem->set_sync_state(data_t::sync_state_t::ERASE_PHASE);
 				}
 
 				dnet_opunlock(m_node, &id);
+
+				// Write-back shares background IO budget, throttle it without holding the key lock
+				if (synced_size)
+					dnet_io_sched_consume(m_node, DNET_IO_CLASS_SYNC, synced_size);
 			}
 			stop_action(ACTION_CACHE_SYNC_ITERATE);
 			start_action(ACTION_CACHE_REMOVE_LOCAL);
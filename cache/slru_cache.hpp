@@ -38,6 +38,8 @@ public:
 
 	int lookup(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd);
 
+	int timestamp(const unsigned char *id, dnet_time *ts);
+
 	void clear();
 
 	cache_stats get_cache_stats() const;
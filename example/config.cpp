@@ -163,6 +163,18 @@ static int dnet_simple_set(config_data *data, const char *key, unsigned long lon
 		data->cfg_state.indexes_shard_count = value;
 	else if (!strcmp(key, "monitor_port"))
 		data->cfg_state.monitor_port = value;
+	else if (!strcmp(key, "journal_segment_records"))
+		data->cfg_state.journal_segment_records = value;
+	else if (!strcmp(key, "journal_segments"))
+		data->cfg_state.journal_segments = value;
+	else if (!strcmp(key, "io_sched_latency_target"))
+		data->cfg_state.io_sched_latency_target = value;
+	else if (!strcmp(key, "io_sched_iterator_rate"))
+		data->cfg_state.io_sched_iterator_rate = value;
+	else if (!strcmp(key, "io_sched_sync_rate"))
+		data->cfg_state.io_sched_sync_rate = value;
+	else if (!strcmp(key, "io_sched_recovery_rate"))
+		data->cfg_state.io_sched_recovery_rate = value;
 	else
 		return -1;
 
@@ -585,7 +597,13 @@ void parse_options(config_data *data, const rapidjson::Value &options)
 		{"caches_number", dnet_set_caches_number},
 		{"cache_pages_proportions", dnet_set_cache_pages_proportions},
 		{"indexes_shard_count", dnet_simple_set},
-		{"monitor_port", dnet_simple_set}
+		{"monitor_port", dnet_simple_set},
+		{"journal_segment_records", dnet_simple_set},
+		{"journal_segments", dnet_simple_set},
+		{"io_sched_latency_target", dnet_simple_set},
+		{"io_sched_iterator_rate", dnet_simple_set},
+		{"io_sched_sync_rate", dnet_simple_set},
+		{"io_sched_recovery_rate", dnet_simple_set}
 	};
 
 	for (auto it = options.MemberBegin(); it != options.MemberEnd(); ++it) {
@@ -624,6 +642,7 @@ void parse_backends(config_data *data, const rapidjson::Value &backends)
 		dnet_config_backend *backends_info[] = {
 			dnet_eblob_backend_info(),
 			dnet_file_backend_info(),
+			dnet_ram_backend_info(),
 #ifdef HAVE_MODULE_BACKEND_SUPPORT
 			dnet_module_backend_info(),
 #endif
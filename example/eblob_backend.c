@@ -44,6 +44,7 @@
 #include "elliptics/backends.h"
 
 #include "common.h"
+#include "group_commit.h"
 
 #include "reverbrain_react.h"
 
@@ -94,14 +95,197 @@ struct eblob_backend_config {
 	int				random_access;
 	int				last_read_index;
 	struct eblob_read_params	last_reads[100];
+
+	int				group_commit;
+	long				group_commit_window;
+	long				group_commit_max_delay;
+	struct dnet_group_commit	gc;
+};
+
+/*
+ * Every iterator thread asks kernel to read this much of mapped blob data
+ * ahead of the record it currently processes, if iteration needs data.
+ */
+#define BLOB_ITERATE_READAHEAD		(4 * 1024 * 1024)
+
+/* Every iterator thread reports checkpoint to elliptics once per this number of its records */
+#define BLOB_ITERATE_CHECKPOINT		1024
+
+/* Per-thread iterator state */
+struct blob_iterate_thread {
+	/* Mapped range which was already prefetched */
+	unsigned char			*start, *end;
+
+	/* Position of the record being processed, private to the thread */
+	struct dnet_iterator_position	current;
+	struct eblob_base_ctl		*bctl;
+	uint64_t			records;
+
+	/* Position published to other threads every BLOB_ITERATE_CHECKPOINT records, protected by iterator lock */
+	struct dnet_iterator_position	position;
+	int				used;
 };
 
+/*
+ * Iterator state shared by all threads.
+ *
+ * Eblob does not export blob index, so blob number is counted by changes
+ * of the base control. This relies on eblob iterating blobs one after another
+ * and joining all threads of the blob before starting the next one: records
+ * of different blobs are never interleaved.
+ *
+ * Records inside blob are processed in index order, several threads take them
+ * by chunks, so the smallest position among threads is the checkpoint: every
+ * record before it has already been processed. Published positions lag behind
+ * real ones, which only makes checkpoint older.
+ */
+struct blob_iterate_private {
+	struct dnet_iterator_ctl	*ictl;
+
+	pthread_mutex_t			lock;
+	struct eblob_base_ctl		*bctl;
+	uint64_t			blob;
+
+	int				thread_num;
+	struct blob_iterate_thread	*threads;
+};
+
+static inline int blob_iterate_position_cmp(const struct dnet_iterator_position *p1,
+		const struct dnet_iterator_position *p2)
+{
+	if (p1->blob != p2->blob)
+		return p1->blob < p2->blob ? -1 : 1;
+	if (p1->offset != p2->offset)
+		return p1->offset < p2->offset ? -1 : 1;
+	return 0;
+}
+
+static int blob_iterate_init(struct eblob_iterate_control *ctl, void **thread_priv)
+{
+	struct blob_iterate_private *p = ctl->priv;
+	struct blob_iterate_thread *t = NULL;
+	int i;
+
+	pthread_mutex_lock(&p->lock);
+	for (i = 0; i < p->thread_num; ++i) {
+		if (!p->threads[i].used) {
+			t = &p->threads[i];
+			memset(t, 0, sizeof(struct blob_iterate_thread));
+			t->position.blob = p->blob;
+			t->current = t->position;
+			t->used = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	if (!t)
+		return -ENOMEM;
+
+	*thread_priv = t;
+	return 0;
+}
+
+static int blob_iterate_free(struct eblob_iterate_control *ctl, void **thread_priv)
+{
+	struct blob_iterate_private *p = ctl->priv;
+	struct blob_iterate_thread *t = *thread_priv;
+
+	pthread_mutex_lock(&p->lock);
+	t->used = 0;
+	pthread_mutex_unlock(&p->lock);
+
+	*thread_priv = NULL;
+	return 0;
+}
+
+/*
+ * Updates position of the current thread and decides whether record should be skipped
+ * because it is before the start position. Iterator lock is taken only when thread
+ * moves to the next blob and when it publishes its position and reports checkpoint.
+ */
+static int blob_iterate_position(struct blob_iterate_private *p, struct blob_iterate_thread *t,
+		struct eblob_ram_control *rctl)
+{
+	struct dnet_iterator_ctl *ictl = p->ictl;
+	struct dnet_iterator_position checkpoint;
+	int i;
+
+	if (rctl->bctl != t->bctl) {
+		pthread_mutex_lock(&p->lock);
+		if (rctl->bctl != p->bctl) {
+			if (p->bctl)
+				p->blob++;
+			p->bctl = rctl->bctl;
+		}
+		t->current.blob = p->blob;
+		pthread_mutex_unlock(&p->lock);
+
+		t->bctl = rctl->bctl;
+	}
+
+	t->current.offset = rctl->index_offset;
+
+	if (blob_iterate_position_cmp(&t->current, &ictl->start) < 0)
+		return 1;
+
+	if (ictl->checkpoint && ++t->records % BLOB_ITERATE_CHECKPOINT == 0) {
+		pthread_mutex_lock(&p->lock);
+		t->position = t->current;
+
+		checkpoint = t->position;
+		for (i = 0; i < p->thread_num; ++i) {
+			if (p->threads[i].used && blob_iterate_position_cmp(&p->threads[i].position, &checkpoint) < 0)
+				checkpoint = p->threads[i].position;
+		}
+
+		/* Reported under the lock, so that reports of different threads are not reordered */
+		ictl->checkpoint(ictl->callback_private, &checkpoint);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	return 0;
+}
+
+/*
+ * Issues readahead for the mapped data of the current record and records which
+ * follow it, unless it has been already done for this part of the mapping.
+ */
+static void blob_iterate_readahead(struct blob_iterate_thread *ra, void *data, uint64_t size)
+{
+	static long page_size;
+	unsigned char *start, *end;
+	uint64_t window;
+
+	if (!ra)
+		return;
+
+	start = data;
+	end = start + size;
+	if (start >= ra->start && end <= ra->end)
+		return;
+
+	if (!page_size)
+		page_size = sysconf(_SC_PAGESIZE);
+
+	window = size > BLOB_ITERATE_READAHEAD ? size : BLOB_ITERATE_READAHEAD;
+	start = (unsigned char *)((uintptr_t)data & ~((uintptr_t)page_size - 1));
+	end = (unsigned char *)data + window;
+
+	/* Errors are not fatal, data will be read on page faults */
+	madvise(start, end - start, MADV_WILLNEED);
+
+	ra->start = start;
+	ra->end = end;
+}
+
 /* Pre-callback that formats arguments and calls ictl->callback */
 static int blob_iterate_callback(struct eblob_disk_control *dc,
-		struct eblob_ram_control *rctl __unused,
-		void *data, void *priv, void *thread_priv __unused)
+		struct eblob_ram_control *rctl,
+		void *data, void *priv, void *thread_priv)
 {
-	struct dnet_iterator_ctl *ictl = priv;
+	struct blob_iterate_private *p = priv;
+	struct dnet_iterator_ctl *ictl = p->ictl;
 	struct dnet_ext_list elist;
 	uint64_t size;
 	int err;
@@ -109,7 +293,19 @@ static int blob_iterate_callback(struct eblob_disk_control *dc,
 	assert(dc != NULL);
 	assert(data != NULL);
 
+	/* Skip records before the start position without touching their data */
+	if (blob_iterate_position(p, thread_priv, rctl))
+		return 0;
+
+	if (ictl->key_filter && !ictl->key_filter(ictl->callback_private, (struct dnet_raw_id *)&dc->key))
+		return 0;
+
 	size = dc->data_size;
+
+	/* Metadata-only iteration reads just the ext header, there is nothing to read ahead */
+	if (ictl->flags & DNET_IFLAGS_DATA)
+		blob_iterate_readahead(thread_priv, data, size);
+
 	dnet_ext_list_init(&elist);
 
 	/* If it's an extended record - extract header, move data pointer */
@@ -137,17 +333,47 @@ static int blob_iterate(struct eblob_backend_config *c, struct dnet_iterator_ctl
 
 	/* Init iterator config */
 	struct eblob_backend *b = c->eblob;
+	struct blob_iterate_private p = {
+		.ictl = ictl,
+		.thread_num = c->data.iterate_threads > 0 ? c->data.iterate_threads : 1,
+	};
 	struct eblob_iterate_control eictl = {
-		.priv = ictl,
+		.priv = &p,
 		.b = b,
 		.log = c->data.log,
+		.thread_num = p.thread_num,
 		.flags = EBLOB_ITERATE_FLAGS_ALL | EBLOB_ITERATE_FLAGS_READONLY,
 		.iterator_cb = {
 			.iterator = blob_iterate_callback,
+			.iterator_init = blob_iterate_init,
+			.iterator_free = blob_iterate_free,
 		},
 	};
+	int err;
+
+	p.threads = calloc(p.thread_num, sizeof(struct blob_iterate_thread));
+	if (!p.threads) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
 
-	return eblob_iterate(b, &eictl);
+	err = pthread_mutex_init(&p.lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_free;
+	}
+
+	if (ictl->start.blob || ictl->start.offset)
+		dnet_backend_log(c->blog, DNET_LOG_INFO, "blob: iterate: resuming from position: %" PRIu64 ":%" PRIu64 "\n",
+				ictl->start.blob, ictl->start.offset);
+
+	err = eblob_iterate(b, &eictl);
+
+	pthread_mutex_destroy(&p.lock);
+err_out_free:
+	free(p.threads);
+err_out_exit:
+	return err;
 }
 
 static int blob_write(struct eblob_backend_config *c, void *state,
@@ -246,6 +472,18 @@ static int blob_write(struct eblob_backend_config *c, void *state,
 		}
 	}
 
+	if (c->group_commit) {
+		const int fds[] = { wc.data_fd, wc.index_fd };
+
+		err = dnet_group_commit_sync(&c->gc, fds, ARRAY_SIZE(fds));
+		if (err) {
+			dnet_backend_log(c->blog, DNET_LOG_ERROR, "%s: EBLOB: blob-write: group-commit: "
+					"data-fd: %d, index-fd: %d: %s %d\n", dnet_dump_id_str(io->id),
+					wc.data_fd, wc.index_fd, strerror(-err), err);
+			goto err_out_exit;
+		}
+	}
+
 	if (io->flags & DNET_IO_FLAGS_WRITE_NO_FILE_INFO) {
 		cmd->flags |= DNET_FLAGS_NEED_ACK;
 		err = 0;
@@ -762,6 +1000,59 @@ err_out_exit:
 	return err;
 }
 
+static int eblob_backend_lookup_timestamp(struct dnet_node *n __unused, void *priv, struct dnet_id *id, struct dnet_time *ts)
+{
+	struct eblob_backend_config *c = priv;
+	struct eblob_write_control wc;
+	struct eblob_key key;
+	struct dnet_ext_list elist;
+	static const size_t ehdr_size = sizeof(struct dnet_ext_list_hdr);
+	uint64_t size;
+	int err;
+
+	dnet_ext_list_init(&elist);
+
+	memcpy(key.id, id->id, EBLOB_ID_SIZE);
+	err = eblob_read_return(c->eblob, &key, EBLOB_READ_NOCSUM, &wc);
+	if (err < 0)
+		goto err_out_exit;
+
+	size = wc.total_data_size;
+
+	if (wc.flags & BLOB_DISK_CTL_EXTHDR) {
+		struct dnet_ext_list_hdr ehdr;
+
+		/* Sanity */
+		if (size < ehdr_size) {
+			err = -ERANGE;
+			goto err_out_exit;
+		}
+
+		err = dnet_ext_hdr_read(&ehdr, wc.data_fd, wc.data_offset);
+		if (err != 0)
+			goto err_out_exit;
+		dnet_ext_hdr_to_list(&ehdr, &elist);
+
+		size -= ehdr_size;
+	}
+
+	/* Zero-size record is not found by lookup either */
+	if (size == 0) {
+		err = -ENOENT;
+		goto err_out_exit;
+	}
+
+	*ts = elist.timestamp;
+	err = 0;
+
+err_out_exit:
+	if (err && err != -ENOENT)
+		dnet_backend_log(c->blog, DNET_LOG_ERROR, "%s: EBLOB: blob-lookup-timestamp: %d: %s.\n",
+				dnet_dump_id_str(id->id), err, strerror(-err));
+	dnet_ext_list_destroy(&elist);
+	return err;
+}
+
 static int blob_start_defrag(struct eblob_backend_config *c, struct dnet_cmd *cmd, void *data)
 {
 	start_action(ACTION_EBLOB_START_DEFRAG);
@@ -980,6 +1271,20 @@ static int dnet_blob_set_blob_flags(struct dnet_config_backend *b, char *key __u
 	return 0;
 }
 
+static int dnet_blob_set_group_commit(struct dnet_config_backend *b, char *key, char *value)
+{
+	struct eblob_backend_config *c = b->data;
+
+	if (!strcmp(key, "group_commit"))
+		c->group_commit = atoi(value);
+	else if (!strcmp(key, "group_commit_window"))
+		c->group_commit_window = strtol(value, NULL, 0);
+	else if (!strcmp(key, "group_commit_max_delay"))
+		c->group_commit_max_delay = strtol(value, NULL, 0);
+
+	return 0;
+}
+
 int eblob_backend_storage_stat(void *priv, struct dnet_stat *st)
 {
 	int err;
@@ -1025,6 +1330,9 @@ static void eblob_backend_cleanup(void *priv)
 {
 	struct eblob_backend_config *c = priv;
 
+	if (c->group_commit)
+		dnet_group_commit_cleanup(&c->gc);
+
 	eblob_cleanup(c->eblob);
 
 	pthread_mutex_destroy(&c->last_read_lock);
@@ -1070,6 +1378,19 @@ static int dnet_blob_config_init(struct dnet_config_backend *b, struct dnet_conf
 		goto err_out_exit;
 	}
 
+	/*
+	 * Group commit replaces eblob's own per-write sync (zero @sync) only,
+	 * the same as in file backend. If periodic sync (positive @sync) is configured,
+	 * writes are not synced one by one and group commit is not started.
+	 */
+	if (c->group_commit && c->data.sync > 0) {
+		dnet_backend_log(c->blog, DNET_LOG_INFO, "blob: periodic sync is configured, group commit is disabled.\n");
+		c->group_commit = 0;
+	}
+
+	if (c->group_commit && c->data.sync == 0)
+		c->data.sync = -1;
+
 	c->eblob = eblob_init(&c->data);
 	if (!c->eblob) {
 		err = -EINVAL;
@@ -1079,7 +1400,15 @@ static int dnet_blob_config_init(struct dnet_config_backend *b, struct dnet_conf
 	memset(&st, 0, sizeof(struct dnet_stat));
 	err = eblob_backend_storage_stat(c, &st);
 	if (err)
-		goto err_out_last_read_lock_destroy;
+		goto err_out_eblob_cleanup;
+
+	if (c->group_commit) {
+		err = dnet_group_commit_init(&c->gc, -1, c->group_commit_window, c->group_commit_max_delay);
+		if (err) {
+			dnet_backend_log(c->blog, DNET_LOG_ERROR, "blob: could not start group commit thread: %d.\n", err);
+			goto err_out_eblob_cleanup;
+		}
+	}
 
 	c->vm_total = st.vm_total * st.vm_total * 1024 * 1024;
 
@@ -1093,11 +1422,14 @@ static int dnet_blob_config_init(struct dnet_config_backend *b, struct dnet_conf
 	b->cb.command_handler = eblob_backend_command_handler;
 	b->cb.backend_cleanup = eblob_backend_cleanup;
 	b->cb.checksum = eblob_backend_checksum;
+	b->cb.lookup_timestamp = eblob_backend_lookup_timestamp;
 
 	b->cb.iterator = dnet_eblob_iterator;
 
 	return 0;
 
+err_out_eblob_cleanup:
+	eblob_cleanup(c->eblob);
 err_out_last_read_lock_destroy:
 	pthread_mutex_destroy(&c->last_read_lock);
 err_out_exit:
@@ -1125,6 +1457,9 @@ static struct dnet_config_entry dnet_cfg_entries_blobsystem[] = {
 	{"blob_size_limit", dnet_blob_set_blob_size},
 	{"index_block_size", dnet_blob_set_index_block_size},
 	{"index_block_bloom_length", dnet_blob_set_index_block_bloom_length},
+	{"group_commit", dnet_blob_set_group_commit},
+	{"group_commit_window", dnet_blob_set_group_commit},
+	{"group_commit_max_delay", dnet_blob_set_group_commit},
 };
 
 static struct dnet_config_backend dnet_eblob_backend = {
@@ -24,11 +24,13 @@
 #include <sys/socket.h>
 #include <sys/mman.h>
 #include <sys/wait.h>
+#include <sys/xattr.h>
 
 #include <ctype.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -40,11 +42,39 @@
 #include "elliptics/backends.h"
 
 #include "common.h"
+#include "group_commit.h"
 
 #ifndef __unused
 #define __unused	__attribute__ ((unused))
 #endif
 
+#define FILE_BACKEND_EHDR_XATTR		"user.elliptics.ehdr"
+#define FILE_BACKEND_FD_CACHE_DEFAULT	1024
+
+struct file_fd_entry {
+	struct file_fd_entry	*hnext;
+	struct file_fd_entry	*lru_prev, *lru_next;
+
+	unsigned char		id[DNET_ID_SIZE];
+	int			fd;
+	int			refcnt;
+	int			removed;
+
+	/*
+	 * Descriptor is shared by all writers of the key, appends have to
+	 * serialize size lookup and write, or they would overwrite each other
+	 */
+	pthread_mutex_t		write_lock;
+};
+
+struct file_fd_cache {
+	pthread_mutex_t		lock;
+	struct file_fd_entry	**hash;
+	unsigned int		hash_size;
+	struct file_fd_entry	lru;
+	int			num, max;
+};
+
 struct file_backend_root
 {
 	char			*root;
@@ -58,6 +88,18 @@ struct file_backend_root
 	int			defrag_percentage;
 	int			defrag_timeout;
 
+	int			group_commit;
+	long			group_commit_window;
+	long			group_commit_max_delay;
+	struct dnet_group_commit	gc;
+
+	int			fd_cache_size;
+	int			fd_cache_size_set;
+	struct file_fd_cache	fd_cache;
+
+	/* Set when filesystem does not support user xattrs */
+	int			no_xattr;
+
 	struct dnet_log		*blog;
 	struct eblob_log	log;
 	struct eblob_backend	*meta;
@@ -120,60 +162,411 @@ static void dnet_remove_file_local(struct file_backend_root *r, struct dnet_io_a
 	remove(file);
 }
 
-static int file_write_raw(struct file_backend_root *r, struct dnet_io_attr *io)
+/*
+ * Cache of opened file descriptors.
+ * Entries are refcounted, evicted entry is closed when the last user puts it back.
+ */
+static void file_fd_cache_lru_unlink(struct file_fd_entry *e)
+{
+	e->lru_prev->lru_next = e->lru_next;
+	e->lru_next->lru_prev = e->lru_prev;
+	e->lru_prev = e->lru_next = e;
+}
+
+static void file_fd_cache_lru_add(struct file_fd_cache *c, struct file_fd_entry *e)
+{
+	e->lru_next = c->lru.lru_next;
+	e->lru_prev = &c->lru;
+	c->lru.lru_next->lru_prev = e;
+	c->lru.lru_next = e;
+}
+
+static inline unsigned int file_fd_cache_hash(struct file_fd_cache *c, const unsigned char *id)
+{
+	unsigned int h;
+
+	memcpy(&h, id, sizeof(h));
+	return h % c->hash_size;
+}
+
+static struct file_fd_entry *file_fd_cache_search_nolock(struct file_fd_cache *c, const unsigned char *id)
+{
+	struct file_fd_entry *e;
+
+	for (e = c->hash[file_fd_cache_hash(c, id)]; e; e = e->hnext) {
+		if (!memcmp(e->id, id, DNET_ID_SIZE))
+			return e;
+	}
+
+	return NULL;
+}
+
+/* Removes entry from hash and LRU list, caller must close it if it is not referenced */
+static void file_fd_cache_unlink_nolock(struct file_fd_cache *c, struct file_fd_entry *e)
+{
+	struct file_fd_entry **pe;
+
+	for (pe = &c->hash[file_fd_cache_hash(c, e->id)]; *pe; pe = &(*pe)->hnext) {
+		if (*pe == e) {
+			*pe = e->hnext;
+			break;
+		}
+	}
+
+	file_fd_cache_lru_unlink(e);
+	e->hnext = NULL;
+	e->removed = 1;
+	c->num--;
+}
+
+static void file_fd_entry_free(struct file_fd_entry *e)
 {
-	/* null byte + maximum directory length (32 bits in hex) + '/' directory prefix */
+	pthread_mutex_destroy(&e->write_lock);
+	close(e->fd);
+	free(e);
+}
+
+static int file_fd_cache_init(struct file_fd_cache *c, int max)
+{
+	int err;
+
+	memset(c, 0, sizeof(struct file_fd_cache));
+
+	c->lru.lru_next = c->lru.lru_prev = &c->lru;
+	c->max = max;
+
+	if (!max)
+		return 0;
+
+	c->hash_size = max;
+	c->hash = calloc(c->hash_size, sizeof(struct file_fd_entry *));
+	if (!c->hash)
+		return -ENOMEM;
+
+	err = pthread_mutex_init(&c->lock, NULL);
+	if (err) {
+		free(c->hash);
+		c->hash = NULL;
+		return -err;
+	}
+
+	return 0;
+}
+
+static void file_fd_cache_cleanup(struct file_fd_cache *c)
+{
+	struct file_fd_entry *e, *tmp;
+
+	if (!c->max)
+		return;
+
+	for (e = c->lru.lru_next; e != &c->lru; e = tmp) {
+		tmp = e->lru_next;
+		file_fd_entry_free(e);
+	}
+
+	pthread_mutex_destroy(&c->lock);
+	free(c->hash);
+}
+
+/*
+ * Returns referenced entry with opened descriptor for given id.
+ * When @create is set, missing file (and its directory) will be created.
+ */
+static int file_fd_cache_get(struct file_backend_root *r, const unsigned char *id, int create,
+		struct file_fd_entry **ep)
+{
+	struct file_fd_cache *c = &r->fd_cache;
 	char file[DNET_ID_SIZE * 2 + 8 + 8 + 2];
-	int oflags = O_RDWR | O_CREAT | O_LARGEFILE | O_CLOEXEC;
-	void *data = io + 1;
-	int fd;
-	ssize_t err;
+	int oflags = O_RDWR | O_LARGEFILE | O_CLOEXEC;
+	struct file_fd_entry *e, *old, *evict = NULL;
+	int fd, err;
 
-	file_backend_setup_file(r, file, sizeof(file), io->id);
+	if (c->max) {
+		pthread_mutex_lock(&c->lock);
+		e = file_fd_cache_search_nolock(c, id);
+		if (e) {
+			e->refcnt++;
+			file_fd_cache_lru_unlink(e);
+			file_fd_cache_lru_add(c, e);
+			pthread_mutex_unlock(&c->lock);
+
+			*ep = e;
+			return 0;
+		}
+		pthread_mutex_unlock(&c->lock);
+	}
+
+	if (create)
+		oflags |= O_CREAT;
+
+	file_backend_setup_file(r, file, sizeof(file), id);
 
-	if (io->flags & DNET_IO_FLAGS_APPEND)
-		oflags |= O_APPEND;
-	else if (!io->offset)
-		oflags |= O_TRUNC;
-	
 	fd = open(file, oflags, 0644);
+	if (fd < 0 && errno == ENOENT && create) {
+		char dir[2*DNET_ID_SIZE+1];
+
+		/* Directories are created at startup, but someone could have removed it */
+		file_backend_get_dir(id, r->bit_num, dir);
+		mkdir(dir, 0755);
+
+		fd = open(file, oflags, 0644);
+	}
+
 	if (fd < 0) {
 		err = -errno;
-		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: %s: OPEN: %zd: %s.\n",
-				dnet_dump_id_str(io->id), file, err, strerror(-err));
+		dnet_backend_log(r->blog, create ? DNET_LOG_ERROR : DNET_LOG_NOTICE, "%s: FILE: %s: OPEN: %d: %s.\n",
+				dnet_dump_id_str(id), file, err, strerror(-err));
+		return err;
+	}
+
+	e = malloc(sizeof(struct file_fd_entry));
+	if (!e) {
+		close(fd);
+		return -ENOMEM;
+	}
+
+	memset(e, 0, sizeof(struct file_fd_entry));
+
+	err = pthread_mutex_init(&e->write_lock, NULL);
+	if (err) {
+		free(e);
+		close(fd);
+		return -err;
+	}
+
+	memcpy(e->id, id, DNET_ID_SIZE);
+	e->fd = fd;
+	e->refcnt = 1;
+	e->lru_next = e->lru_prev = e;
+
+	if (!c->max) {
+		e->removed = 1;
+		*ep = e;
+		return 0;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	old = file_fd_cache_search_nolock(c, id);
+	if (old) {
+		/* Someone has opened the same file in parallel */
+		old->refcnt++;
+		pthread_mutex_unlock(&c->lock);
+
+		file_fd_entry_free(e);
+		*ep = old;
+		return 0;
+	}
+
+	e->hnext = c->hash[file_fd_cache_hash(c, id)];
+	c->hash[file_fd_cache_hash(c, id)] = e;
+	file_fd_cache_lru_add(c, e);
+	c->num++;
+
+	if (c->num > c->max) {
+		for (old = c->lru.lru_prev; old != &c->lru; old = old->lru_prev) {
+			if (old->refcnt == 0)
+				break;
+		}
+
+		if (old != &c->lru) {
+			file_fd_cache_unlink_nolock(c, old);
+			evict = old;
+		}
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	if (evict)
+		file_fd_entry_free(evict);
+
+	*ep = e;
+	return 0;
+}
+
+static void file_fd_cache_put(struct file_backend_root *r, struct file_fd_entry *e)
+{
+	struct file_fd_cache *c = &r->fd_cache;
+	int drop;
+
+	if (!c->max) {
+		file_fd_entry_free(e);
+		return;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	drop = (--e->refcnt == 0) && e->removed;
+	pthread_mutex_unlock(&c->lock);
+
+	if (drop)
+		file_fd_entry_free(e);
+}
+
+static void file_fd_cache_remove(struct file_backend_root *r, const unsigned char *id)
+{
+	struct file_fd_cache *c = &r->fd_cache;
+	struct file_fd_entry *e;
+	int drop = 0;
+
+	if (!c->max)
+		return;
+
+	pthread_mutex_lock(&c->lock);
+	e = file_fd_cache_search_nolock(c, id);
+	if (e) {
+		file_fd_cache_unlink_nolock(c, e);
+		drop = (e->refcnt == 0);
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	if (drop)
+		file_fd_entry_free(e);
+}
+
+/*
+ * Extended header lives in file's xattr. If filesystem does not support
+ * user xattrs, or record was written by older version, metadata eblob is used.
+ */
+static int file_ext_hdr_write(struct file_backend_root *r, struct eblob_key *key, int fd,
+		struct dnet_ext_list_hdr *ehdr)
+{
+	static const size_t ehdr_size = sizeof(struct dnet_ext_list_hdr);
+	int err;
+
+	if (!r->no_xattr) {
+		err = fsetxattr(fd, FILE_BACKEND_EHDR_XATTR, ehdr, ehdr_size, 0);
+		if (!err)
+			return 0;
+
+		if (errno != ENOTSUP && errno != EOPNOTSUPP)
+			return -errno;
+
+		dnet_backend_log(r->blog, DNET_LOG_INFO, "FILE: xattrs are not supported, "
+				"falling back to metadata blob.\n");
+		r->no_xattr = 1;
+	}
+
+	return eblob_write(r->meta, key, ehdr, 0, ehdr_size, 0);
+}
+
+static int file_ext_hdr_read(struct file_backend_root *r, struct eblob_key *key, int fd,
+		struct dnet_ext_list_hdr *ehdr)
+{
+	static const size_t ehdr_size = sizeof(struct dnet_ext_list_hdr);
+	struct eblob_write_control wc;
+	ssize_t size;
+	int err;
+
+	if (!r->no_xattr) {
+		size = fgetxattr(fd, FILE_BACKEND_EHDR_XATTR, ehdr, ehdr_size);
+		if (size == (ssize_t)ehdr_size)
+			return 0;
+
+		if (size >= 0)
+			return -ERANGE;
+		if (errno != ENODATA && errno != ENOTSUP && errno != EOPNOTSUPP)
+			return -errno;
+	}
+
+	err = eblob_read_return(r->meta, key, EBLOB_READ_NOCSUM, &wc);
+	if (err)
+		return err;
+
+	if (wc.total_data_size != ehdr_size)
+		return -ERANGE;
+
+	return dnet_ext_hdr_read(ehdr, wc.data_fd, wc.offset);
+}
+
+static int file_write_raw(struct file_backend_root *r, struct dnet_io_attr *io, struct file_fd_entry **ep)
+{
+	struct file_fd_entry *e;
+	void *data = io + 1;
+	uint64_t offset = io->offset;
+	struct stat st;
+	ssize_t err;
+
+	err = file_fd_cache_get(r, io->id, 1, &e);
+	if (err)
 		goto err_out_exit;
+
+	pthread_mutex_lock(&e->write_lock);
+
+	if ((io->flags & DNET_IO_FLAGS_APPEND) && !r->fd_cache.max) {
+		/*
+		 * Without cache every write has its own descriptor and entry lock
+		 * does not help, kernel positions O_APPEND writes atomically
+		 */
+		err = fcntl(e->fd, F_GETFL);
+		if (err >= 0)
+			err = fcntl(e->fd, F_SETFL, err | O_APPEND);
+		if (err < 0) {
+			err = -errno;
+			dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: APPEND-FLAGS: %zd: %s.\n",
+					dnet_dump_id_str(io->id), err, strerror(-err));
+			goto err_out_unlock;
+		}
+
+		err = write(e->fd, data, io->size);
+	} else {
+		if (io->flags & DNET_IO_FLAGS_APPEND) {
+			err = fstat(e->fd, &st);
+			if (err) {
+				err = -errno;
+				dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: APPEND-STAT: %zd: %s.\n",
+						dnet_dump_id_str(io->id), err, strerror(-err));
+				goto err_out_unlock;
+			}
+
+			offset = st.st_size;
+		}
+
+		err = pwrite(e->fd, data, io->size, offset);
 	}
 
-	err = pwrite(fd, data, io->size, io->offset);
 	if (err != (ssize_t)io->size) {
 		err = -errno;
-		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: %s: WRITE: %zd: offset: %llu, size: %llu: %s.\n",
-			dnet_dump_id_str(io->id), file, err,
-			(unsigned long long)io->offset, (unsigned long long)io->size,
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: WRITE: %zd: offset: %llu, size: %llu: %s.\n",
+			dnet_dump_id_str(io->id), err,
+			(unsigned long long)offset, (unsigned long long)io->size,
 			strerror(-err));
-		goto err_out_close;
+		goto err_out_unlock;
 	}
 
-	if (!r->sync)
-		fsync(fd);
+	/* Cached descriptor can not be opened with O_TRUNC */
+	if (!(io->flags & DNET_IO_FLAGS_APPEND) && !io->offset) {
+		err = ftruncate(e->fd, io->size);
+		if (err) {
+			err = -errno;
+			dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: TRUNCATE: %zd: size: %llu: %s.\n",
+					dnet_dump_id_str(io->id), err, (unsigned long long)io->size, strerror(-err));
+			goto err_out_unlock;
+		}
+	}
 
-	return fd;
+	pthread_mutex_unlock(&e->write_lock);
 
-err_out_close:
-	dnet_remove_file_if_empty_raw(file);
-	close(fd);
+	if (!r->sync && !r->group_commit)
+		fsync(e->fd);
+
+	*ep = e;
+	return 0;
+
+err_out_unlock:
+	pthread_mutex_unlock(&e->write_lock);
+	file_fd_cache_put(r, e);
+	file_fd_cache_remove(r, io->id);
+	dnet_remove_file_if_empty(r, io);
 err_out_exit:
 	return err;
 }
 
 static int file_write(struct file_backend_root *r, void *state __unused, struct dnet_cmd *cmd, void *data)
 {
-	int err, fd;
-	char dir[2*DNET_ID_SIZE+1];
+	int err;
 	struct dnet_io_attr *io = data;
+	struct file_fd_entry *e;
 	struct eblob_key key;
 	struct dnet_ext_list elist;
-	static const size_t ehdr_size = sizeof(struct dnet_ext_list_hdr);
 	struct dnet_ext_list_hdr ehdr;
 
 	dnet_convert_io_attr(io);
@@ -182,61 +575,57 @@ static int file_write(struct file_backend_root *r, void *state __unused, struct
 	dnet_ext_io_to_list(io, &elist);
 
 	memcpy(key.id, io->id, EBLOB_ID_SIZE);
-	
-	data += sizeof(struct dnet_io_attr);
-
-	file_backend_get_dir(io->id, r->bit_num, dir);
 
-	err = mkdir(dir, 0755);
-	if (err < 0) {
-		if (errno != EEXIST) {
-			err = -errno;
-			dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: %s: dir-create: %d: %s.\n",
-					dnet_dump_id(&cmd->id), dir, err, strerror(-err));
-			goto err_out_exit;
-		}
-	}
+	data += sizeof(struct dnet_io_attr);
 
-	err = file_write_raw(r, io);
+	err = file_write_raw(r, io, &e);
 	if (err < 0)
-		goto err_out_check_remove;
-
-	fd = err;
+		goto err_out_exit;
 
 	/* Copy data from elist to ehdr */
 	dnet_ext_list_to_hdr(&elist, &ehdr);
 
-	err = eblob_write(r->meta, &key, &ehdr, 0, ehdr_size, 0);
-
+	err = file_ext_hdr_write(r, &key, e->fd, &ehdr);
 	if (err) {
-		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: %s: META WRITE: %d: %s.\n",
-				dnet_dump_id(&cmd->id), dir, err, strerror(-err));
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: META WRITE: %d: %s.\n",
+				dnet_dump_id(&cmd->id), err, strerror(-err));
 		goto err_out_remove;
 	}
 
-	dnet_backend_log(r->blog, DNET_LOG_INFO, "%s: FILE: %s: WRITE: Ok: offset: %llu, size: %llu.\n",
-			dnet_dump_id(&cmd->id), dir, (unsigned long long)io->offset, (unsigned long long)io->size);
+	if (!r->sync && r->group_commit) {
+		err = dnet_group_commit_sync(&r->gc, &e->fd, 1);
+		if (err) {
+			dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: GROUP COMMIT: %d: %s.\n",
+					dnet_dump_id(&cmd->id), err, strerror(-err));
+			goto err_out_put;
+		}
+	}
+
+	dnet_backend_log(r->blog, DNET_LOG_INFO, "%s: FILE: WRITE: Ok: offset: %llu, size: %llu.\n",
+			dnet_dump_id(&cmd->id), (unsigned long long)io->offset, (unsigned long long)io->size);
 
 	if (io->flags & DNET_IO_FLAGS_WRITE_NO_FILE_INFO) {
 		cmd->flags |= DNET_FLAGS_NEED_ACK;
 		err = 0;
-		goto err_out_close;
+		goto err_out_put;
 	}
 
-	err = dnet_send_file_info(state, cmd, fd, 0, -1);
+	err = dnet_send_file_info(state, cmd, e->fd, 0, -1);
 	if (err)
-		goto err_out_close;
+		goto err_out_put;
 
-	close(fd);
+	file_fd_cache_put(r, e);
+	dnet_ext_list_destroy(&elist);
 
 	return 0;
 
 err_out_remove:
+	file_fd_cache_put(r, e);
+	file_fd_cache_remove(r, io->id);
 	dnet_remove_file_local(r, io);
-err_out_close:
-	close(fd);
-err_out_check_remove:
-	dnet_remove_file_if_empty(r, io);
+	goto err_out_exit;
+err_out_put:
+	file_fd_cache_put(r, e);
 err_out_exit:
 	dnet_ext_list_destroy(&elist);
 	return err;
@@ -245,22 +634,30 @@ err_out_exit:
 static int file_read(struct file_backend_root *r, void *state, struct dnet_cmd *cmd, void *data)
 {
 	struct dnet_io_attr *io = data;
+	struct file_fd_entry *e;
 	int fd, err;
 	ssize_t size;
-	char file[DNET_ID_SIZE * 2 + 8 + 8 + 2];
 	struct stat st;
 
 	data += sizeof(struct dnet_io_attr);
 
 	dnet_convert_io_attr(io);
 
-	file_backend_setup_file(r, file, sizeof(file), io->id);
+	err = file_fd_cache_get(r, io->id, 0, &e);
+	if (err)
+		goto err_out_exit;
+
+	/*
+	 * Data is sent asynchronously from network thread,
+	 * so it gets its own descriptor which is closed when sending completes.
+	 */
+	fd = dup(e->fd);
+	file_fd_cache_put(r, e);
 
-	fd = open(file, O_RDONLY | O_CLOEXEC, 0644);
 	if (fd < 0) {
 		err = -errno;
-		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: %s: READ: %d: %s.\n",
-				dnet_dump_id(&cmd->id), file, err, strerror(-err));
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: READ: dup: %d: %s.\n",
+				dnet_dump_id(&cmd->id), err, strerror(-err));
 		goto err_out_exit;
 	}
 
@@ -269,8 +666,8 @@ static int file_read(struct file_backend_root *r, void *state, struct dnet_cmd *
 	err = fstat(fd, &st);
 	if (err) {
 		err = -errno;
-		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: %s: read-stat: %d: %s.\n",
-				dnet_dump_id(&cmd->id), file, err, strerror(-err));
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: read-stat: %d: %s.\n",
+				dnet_dump_id(&cmd->id), err, strerror(-err));
 		goto err_out_close_fd;
 	}
 
@@ -303,10 +700,13 @@ static int file_del(struct file_backend_root *r, void *state __unused, struct dn
 	file_backend_get_dir(cmd->id.id, r->bit_num, dir);
 	memcpy(key.id, cmd->id.id, EBLOB_ID_SIZE);
 
+	file_fd_cache_remove(r, cmd->id.id);
+
 	snprintf(file, sizeof(file), "%s/%s",
 		dir, dnet_dump_id_len_raw(cmd->id.id, DNET_ID_SIZE, id));
 	remove(file);
 
+	/* Records written before xattr support have their headers in metadata blob */
 	eblob_remove(r->meta, &key);
 
 	return 0;
@@ -314,63 +714,36 @@ static int file_del(struct file_backend_root *r, void *state __unused, struct dn
 
 static int file_info(struct file_backend_root *r, void *state, struct dnet_cmd *cmd)
 {
-	char file[DNET_ID_SIZE * 2 + 2*DNET_ID_SIZE + 2]; /* file + dir + suffix + slash + 0-byte */
-	char dir[2*DNET_ID_SIZE+1];
-	char id[2*DNET_ID_SIZE+1];
-	int fd, err;
-	struct eblob_write_control wc;
+	struct file_fd_entry *e;
 	struct eblob_key key;
 	struct dnet_ext_list elist;
-	static const size_t ehdr_size = sizeof(struct dnet_ext_list_hdr);
+	struct dnet_ext_list_hdr ehdr;
+	int err;
 
 	memcpy(key.id, cmd->id.id, EBLOB_ID_SIZE);
 
 	dnet_ext_list_init(&elist);
 
-	file_backend_get_dir(cmd->id.id, r->bit_num, dir);
-
-	snprintf(file, sizeof(file), "%s/%s",
-		dir, dnet_dump_id_len_raw(cmd->id.id, DNET_ID_SIZE, id));
-
-	err = open(file, O_RDONLY | O_CLOEXEC);
-	if (err < 0) {
-		err = -errno;
-		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: %s: info-stat-open-csum: %d: %s.\n",
-			dnet_dump_id(&cmd->id), file, err, strerror(-err));
+	err = file_fd_cache_get(r, cmd->id.id, 0, &e);
+	if (err)
 		goto err_out_exit;
-	}
-	fd = err;
-
-	err = eblob_read_return(r->meta, &key, EBLOB_READ_NOCSUM, &wc);
-
-	if (!err && wc.total_data_size != ehdr_size) {
-		err = -ERANGE;
-	}
 
+	err = file_ext_hdr_read(r, &key, e->fd, &ehdr);
 	if (err) {
-		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: %s: meta-read-return: %d: %s.\n",
-			dnet_dump_id(&cmd->id), file, err, strerror(-err));
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: meta-read-hdr: %d: %s.\n",
+			dnet_dump_id(&cmd->id), err, strerror(-err));
 	} else {
-		struct dnet_ext_list_hdr ehdr;
-
-		err = dnet_ext_hdr_read(&ehdr, wc.data_fd, wc.offset);
-
-		if (err) {
-			dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: FILE: %s: meta-read-hdr: %d: %s.\n",
-				dnet_dump_id(&cmd->id), file, err, strerror(-err));
-		} else {
-			dnet_ext_hdr_to_list(&ehdr, &elist);
-		}
+		dnet_ext_hdr_to_list(&ehdr, &elist);
 	}
 
-	err = dnet_send_file_info_ts(state, cmd, fd, 0, -1, &elist.timestamp);
+	err = dnet_send_file_info_ts(state, cmd, e->fd, 0, -1, &elist.timestamp);
 	if (err)
-		goto err_out_close;
-	
+		goto err_out_put;
+
 	err = 0;
 
-err_out_close:
-	close(fd);
+err_out_put:
+	file_fd_cache_put(r, e);
 err_out_exit:
 	dnet_ext_list_destroy(&elist);
 	return err;
@@ -466,6 +839,31 @@ static int dnet_file_set_sync(struct dnet_config_backend *b, char *key __unused,
 	return 0;
 }
 
+static int dnet_file_set_group_commit(struct dnet_config_backend *b, char *key, char *value)
+{
+	struct file_backend_root *r = b->data;
+
+	if (!strcmp(key, "group_commit"))
+		r->group_commit = atoi(value);
+	else if (!strcmp(key, "group_commit_window"))
+		r->group_commit_window = strtol(value, NULL, 0);
+	else if (!strcmp(key, "group_commit_max_delay"))
+		r->group_commit_max_delay = strtol(value, NULL, 0);
+
+	return 0;
+}
+
+static int dnet_file_set_fd_cache_size(struct dnet_config_backend *b, char *key __unused, char *value)
+{
+	struct file_backend_root *r = b->data;
+
+	r->fd_cache_size = atoi(value);
+	if (r->fd_cache_size < 0)
+		r->fd_cache_size = 0;
+	r->fd_cache_size_set = 1;
+	return 0;
+}
+
 static int dnet_file_set_root(struct dnet_config_backend *b, char *key __unused, char *root)
 {
 	struct file_backend_root *r = b->data;
@@ -559,6 +957,10 @@ static void file_backend_cleanup(void *priv)
 {
 	struct file_backend_root *r = priv;
 
+	if (!r->sync && r->group_commit)
+		dnet_group_commit_cleanup(&r->gc);
+
+	file_fd_cache_cleanup(&r->fd_cache);
 	dnet_file_db_cleanup(r);
 	close(r->rootfd);
 	free(r->root);
@@ -574,6 +976,73 @@ static int file_backend_checksum(struct dnet_node *n, void *priv, struct dnet_id
 	return dnet_checksum_file(n, file, 0, 0, csum, *csize);
 }
 
+static int file_backend_lookup_timestamp(struct dnet_node *n __unused, void *priv, struct dnet_id *id, struct dnet_time *ts)
+{
+	struct file_backend_root *r = priv;
+	struct file_fd_entry *e;
+	struct eblob_key key;
+	struct dnet_ext_list elist;
+	struct dnet_ext_list_hdr ehdr;
+	int err;
+
+	memcpy(key.id, id->id, EBLOB_ID_SIZE);
+
+	dnet_ext_list_init(&elist);
+
+	err = file_fd_cache_get(r, id->id, 0, &e);
+	if (err)
+		goto err_out_exit;
+
+	/* Records without header have zero timestamp, the same as in lookup reply */
+	if (!file_ext_hdr_read(r, &key, e->fd, &ehdr))
+		dnet_ext_hdr_to_list(&ehdr, &elist);
+
+	*ts = elist.timestamp;
+
+	file_fd_cache_put(r, e);
+err_out_exit:
+	dnet_ext_list_destroy(&elist);
+	return err;
+}
+
+/*
+ * Creates every directory for configured number of bits at once,
+ * so that writes do not have to check it every time.
+ */
+static int file_backend_create_dirs(struct file_backend_root *r)
+{
+	unsigned char id[DNET_ID_SIZE];
+	char dir[2*DNET_ID_SIZE+1];
+	int nbytes = (r->bit_num + 7) / 8;
+	uint64_t i, val;
+	int j, err;
+
+	/* Larger layouts are still created lazily on the first write into directory */
+	if (r->bit_num <= 0 || r->bit_num > 16)
+		return 0;
+
+	memset(id, 0, sizeof(id));
+
+	for (i = 0; i < (1ULL << r->bit_num); ++i) {
+		val = i << (nbytes * 8 - r->bit_num);
+
+		for (j = 0; j < nbytes; ++j)
+			id[j] = val >> ((nbytes - j - 1) * 8);
+
+		file_backend_get_dir(id, r->bit_num, dir);
+
+		err = mkdir(dir, 0755);
+		if (err < 0 && errno != EEXIST) {
+			err = -errno;
+			dnet_backend_log(r->blog, DNET_LOG_ERROR, "FILE: %s: dir-create: %d: %s.\n",
+					dir, err, strerror(-err));
+			return err;
+		}
+	}
+
+	return 0;
+}
+
 static int dnet_file_config_init(struct dnet_config_backend *b, struct dnet_config *c)
 {
 	struct file_backend_root *r = b->data;
@@ -586,6 +1055,7 @@ static int dnet_file_config_init(struct dnet_config_backend *b, struct dnet_conf
 
 	b->cb.command_handler = file_backend_command_handler;
 	b->cb.checksum = file_backend_checksum;
+	b->cb.lookup_timestamp = file_backend_lookup_timestamp;
 
 	c->storage_size = b->storage_size;
 	c->storage_free = b->storage_free;
@@ -593,10 +1063,38 @@ static int dnet_file_config_init(struct dnet_config_backend *b, struct dnet_conf
 	b->cb.storage_stat = file_backend_storage_stat;
 	b->cb.backend_cleanup = file_backend_cleanup;
 
+	err = file_backend_create_dirs(r);
+	if (err)
+		return err;
+
+	if (!r->fd_cache_size_set)
+		r->fd_cache_size = FILE_BACKEND_FD_CACHE_DEFAULT;
+
+	err = file_fd_cache_init(&r->fd_cache, r->fd_cache_size);
+	if (err) {
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "Failed to initialize descriptor cache: %s.\n",
+				strerror(-err));
+		return err;
+	}
+
 	mkdir("history", 0755);
 	err = dnet_file_db_init(r, c, "history");
-	if (err)
+	if (err) {
+		file_fd_cache_cleanup(&r->fd_cache);
 		return err;
+	}
+
+	if (!r->sync && r->group_commit) {
+		err = dnet_group_commit_init(&r->gc, r->rootfd,
+				r->group_commit_window, r->group_commit_max_delay);
+		if (err) {
+			dnet_backend_log(r->blog, DNET_LOG_ERROR, "Failed to start group commit thread: %s.\n",
+					strerror(-err));
+			file_fd_cache_cleanup(&r->fd_cache);
+			dnet_file_db_cleanup(r);
+			return err;
+		}
+	}
 
 	return 0;
 }
@@ -616,6 +1114,10 @@ static struct dnet_config_entry dnet_cfg_entries_filesystem[] = {
 	{"blob_size", dnet_file_set_blob_size},
 	{"defrag_timeout", dnet_file_set_defrag_timeout},
 	{"defrag_percentage", dnet_file_set_defrag_percentage},
+	{"group_commit", dnet_file_set_group_commit},
+	{"group_commit_window", dnet_file_set_group_commit},
+	{"group_commit_max_delay", dnet_file_set_group_commit},
+	{"fd_cache_size", dnet_file_set_fd_cache_size},
 };
 
 static struct dnet_config_backend dnet_file_backend = {
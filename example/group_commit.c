@@ -0,0 +1,286 @@
+/*
+ * Copyright 2008+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "group_commit.h"
+
+struct dnet_group_commit_waiter {
+	struct dnet_group_commit_waiter	*next;
+
+	int			fds[DNET_GROUP_COMMIT_MAX_FDS];
+	int			num;
+
+	int			done;
+	int			err;
+};
+
+static void dnet_group_commit_timespec_add(struct timespec *ts, long usec)
+{
+	ts->tv_sec += usec / 1000000;
+	ts->tv_nsec += (usec % 1000000) * 1000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static int dnet_group_commit_timespec_before(const struct timespec *t1, const struct timespec *t2)
+{
+	if (t1->tv_sec != t2->tv_sec)
+		return t1->tv_sec < t2->tv_sec;
+	return t1->tv_nsec < t2->tv_nsec;
+}
+
+static int dnet_group_commit_fd_compare(const void *p1, const void *p2)
+{
+	return *(const int *)p1 - *(const int *)p2;
+}
+
+/*
+ * Syncs every unique descriptor in batch, or whole filesystem if batch is large.
+ * Called without lock held.
+ */
+static int dnet_group_commit_flush(struct dnet_group_commit *gc, struct dnet_group_commit_waiter *head,
+		int pending, uint64_t *syncs)
+{
+	struct dnet_group_commit_waiter *w;
+	int *fds, num = 0, unique = 0;
+	int i, err = 0;
+
+	fds = malloc(pending * DNET_GROUP_COMMIT_MAX_FDS * sizeof(int));
+	if (!fds) {
+		/* No memory for sorting, sync every descriptor as is */
+		for (w = head; w; w = w->next) {
+			for (i = 0; i < w->num; ++i) {
+				if (fdatasync(w->fds[i]) && !err)
+					err = -errno;
+				++*syncs;
+			}
+		}
+		return err;
+	}
+
+	for (w = head; w; w = w->next) {
+		for (i = 0; i < w->num; ++i)
+			fds[num++] = w->fds[i];
+	}
+
+	qsort(fds, num, sizeof(int), dnet_group_commit_fd_compare);
+	for (i = 0; i < num; ++i) {
+		if (!unique || fds[unique - 1] != fds[i])
+			fds[unique++] = fds[i];
+	}
+
+	if (gc->syncfs_fd >= 0 && unique > DNET_GROUP_COMMIT_SYNCFS_THRESHOLD) {
+		if (syncfs(gc->syncfs_fd))
+			err = -errno;
+		++*syncs;
+	} else {
+		for (i = 0; i < unique; ++i) {
+			if (fdatasync(fds[i]) && !err)
+				err = -errno;
+			++*syncs;
+		}
+	}
+
+	free(fds);
+	return err;
+}
+
+static void *dnet_group_commit_process(void *data)
+{
+	struct dnet_group_commit *gc = data;
+	struct dnet_group_commit_waiter *head, *w, *next;
+	struct timespec deadline, idle, now;
+	uint64_t syncs;
+	int pending, err;
+
+	pthread_mutex_lock(&gc->lock);
+	while (1) {
+		while (!gc->head && !gc->need_exit)
+			pthread_cond_wait(&gc->flush_wait, &gc->lock);
+
+		if (!gc->head)
+			break;
+
+		/*
+		 * Collect writers until nobody arrives during @window
+		 * or batch becomes older than @max_delay.
+		 */
+		deadline = gc->batch_start;
+		dnet_group_commit_timespec_add(&deadline, gc->max_delay);
+
+		while (!gc->need_exit) {
+			pending = gc->pending;
+
+			clock_gettime(CLOCK_REALTIME, &now);
+			if (!dnet_group_commit_timespec_before(&now, &deadline))
+				break;
+
+			idle = now;
+			dnet_group_commit_timespec_add(&idle, gc->window);
+			if (dnet_group_commit_timespec_before(&deadline, &idle))
+				idle = deadline;
+
+			if (gc->window)
+				pthread_cond_timedwait(&gc->flush_wait, &gc->lock, &idle);
+
+			if (gc->pending == pending)
+				break;
+		}
+
+		head = gc->head;
+		pending = gc->pending;
+		gc->head = NULL;
+		gc->tail = &gc->head;
+		gc->pending = 0;
+		pthread_mutex_unlock(&gc->lock);
+
+		syncs = 0;
+		err = dnet_group_commit_flush(gc, head, pending, &syncs);
+
+		pthread_mutex_lock(&gc->lock);
+		gc->stat.batches++;
+		gc->stat.writes += pending;
+		gc->stat.syncs += syncs;
+
+		for (w = head; w; w = next) {
+			next = w->next;
+			w->err = err;
+			w->done = 1;
+		}
+		pthread_cond_broadcast(&gc->done_wait);
+	}
+	pthread_mutex_unlock(&gc->lock);
+
+	return NULL;
+}
+
+int dnet_group_commit_init(struct dnet_group_commit *gc, int syncfs_fd, long window, long max_delay)
+{
+	int err;
+
+	memset(gc, 0, sizeof(struct dnet_group_commit));
+
+	gc->tail = &gc->head;
+	gc->syncfs_fd = syncfs_fd;
+	gc->window = window > 0 ? window : 0;
+	gc->max_delay = max_delay > gc->window ? max_delay : gc->window;
+
+	err = pthread_mutex_init(&gc->lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_exit;
+	}
+
+	err = pthread_cond_init(&gc->flush_wait, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_lock_destroy;
+	}
+
+	err = pthread_cond_init(&gc->done_wait, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_flush_wait_destroy;
+	}
+
+	err = pthread_create(&gc->tid, NULL, dnet_group_commit_process, gc);
+	if (err) {
+		err = -err;
+		goto err_out_done_wait_destroy;
+	}
+
+	return 0;
+
+err_out_done_wait_destroy:
+	pthread_cond_destroy(&gc->done_wait);
+err_out_flush_wait_destroy:
+	pthread_cond_destroy(&gc->flush_wait);
+err_out_lock_destroy:
+	pthread_mutex_destroy(&gc->lock);
+err_out_exit:
+	return err;
+}
+
+void dnet_group_commit_cleanup(struct dnet_group_commit *gc)
+{
+	pthread_mutex_lock(&gc->lock);
+	gc->need_exit = 1;
+	pthread_cond_broadcast(&gc->flush_wait);
+	pthread_mutex_unlock(&gc->lock);
+
+	pthread_join(gc->tid, NULL);
+
+	pthread_cond_destroy(&gc->done_wait);
+	pthread_cond_destroy(&gc->flush_wait);
+	pthread_mutex_destroy(&gc->lock);
+}
+
+int dnet_group_commit_sync(struct dnet_group_commit *gc, const int *fds, int num)
+{
+	struct dnet_group_commit_waiter w;
+	int i;
+
+	memset(&w, 0, sizeof(w));
+	for (i = 0; i < num && w.num < DNET_GROUP_COMMIT_MAX_FDS; ++i) {
+		if (fds[i] >= 0)
+			w.fds[w.num++] = fds[i];
+	}
+
+	if (!w.num)
+		return 0;
+
+	pthread_mutex_lock(&gc->lock);
+	if (gc->need_exit) {
+		pthread_mutex_unlock(&gc->lock);
+		return -ESHUTDOWN;
+	}
+
+	if (!gc->head) {
+		clock_gettime(CLOCK_REALTIME, &gc->batch_start);
+		pthread_cond_signal(&gc->flush_wait);
+	}
+
+	*gc->tail = &w;
+	gc->tail = &w.next;
+	gc->pending++;
+
+	while (!w.done)
+		pthread_cond_wait(&gc->done_wait, &gc->lock);
+	pthread_mutex_unlock(&gc->lock);
+
+	return w.err;
+}
+
+void dnet_group_commit_get_stat(struct dnet_group_commit *gc, struct dnet_group_commit_stat *st)
+{
+	pthread_mutex_lock(&gc->lock);
+	*st = gc->stat;
+	pthread_mutex_unlock(&gc->lock);
+}
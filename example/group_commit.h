@@ -0,0 +1,97 @@
+/*
+ * Copyright 2008+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DNET_GROUP_COMMIT_H
+#define __DNET_GROUP_COMMIT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Group commit: writers put file descriptors they have just written to
+ * into the current batch and sleep, single flusher thread collects batch,
+ * issues one fdatasync() per unique descriptor (or single syncfs() when batch
+ * is too large) and wakes up every writer in batch with sync result.
+ */
+
+#define DNET_GROUP_COMMIT_MAX_FDS		2
+
+/* When batch has more unique descriptors than this, syncfs() is used instead */
+#define DNET_GROUP_COMMIT_SYNCFS_THRESHOLD	4
+
+struct dnet_group_commit_waiter;
+
+struct dnet_group_commit_stat {
+	uint64_t		batches;
+	uint64_t		writes;
+	uint64_t		syncs;
+};
+
+struct dnet_group_commit {
+	pthread_mutex_t		lock;
+	pthread_cond_t		flush_wait;
+	pthread_cond_t		done_wait;
+	pthread_t		tid;
+
+	struct dnet_group_commit_waiter	*head, **tail;
+	int			pending;
+	struct timespec		batch_start;
+
+	/* Descriptor used for syncfs(), -1 disables syncfs() fallback */
+	int			syncfs_fd;
+
+	/* Flusher waits for new writers this long after the last one arrived */
+	long			window;
+	/* ... but never longer than this since the first writer in batch */
+	long			max_delay;
+
+	int			need_exit;
+
+	struct dnet_group_commit_stat	stat;
+};
+
+/*
+ * Starts flusher thread.
+ * @window and @max_delay are in microseconds, @syncfs_fd may be -1.
+ * Zero @window means batch is flushed as soon as flusher is idle, it still
+ * merges all writers which arrived while previous sync was in progress.
+ */
+int dnet_group_commit_init(struct dnet_group_commit *gc, int syncfs_fd, long window, long max_delay);
+
+/* Flushes pending batch and stops flusher thread */
+void dnet_group_commit_cleanup(struct dnet_group_commit *gc);
+
+/*
+ * Blocks until all @fds (up to DNET_GROUP_COMMIT_MAX_FDS, negative entries are skipped)
+ * are synced to disk by the flusher. Returns sync result (0 or negative errno).
+ */
+int dnet_group_commit_sync(struct dnet_group_commit *gc, const int *fds, int num);
+
+void dnet_group_commit_get_stat(struct dnet_group_commit *gc, struct dnet_group_commit_stat *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DNET_GROUP_COMMIT_H */
@@ -22,6 +22,8 @@
 #include <set>
 #include <iostream>
 
+#include <sys/time.h>
+
 #include <boost/program_options.hpp>
 
 #include <elliptics/cppdef.h>
@@ -29,12 +31,17 @@
 struct Ctx {
 	Ctx()
 	: iflags(0)
-	{}
+	, bench(false)
+	{
+		memset(&filter, 0, sizeof(filter));
+	}
 
 	std::vector<int> groups;
 	uint64_t iflags;
+	bool bench;
 	dnet_iterator_range key_range;
 	dnet_time time_begin, time_end;
+	dnet_iterator_request filter;
 	std::unique_ptr<ioremap::elliptics::session> session;
 	std::vector<std::pair<struct dnet_id, struct dnet_addr>> routes;
 };
@@ -62,9 +69,35 @@ void iterate_node(Ctx &ctx, const dnet_addr &node) {
 
 	ctx.session->set_groups(std::vector<int>(1, id.group_id));
 
-	auto res = ctx.session->start_iterator(ioremap::elliptics::key(id),
-	                                       ranges, DNET_ITYPE_NETWORK,
-	                                       ctx.iflags, ctx.time_begin, ctx.time_end);
+	dnet_iterator_request req = ctx.filter;
+	req.itype = DNET_ITYPE_NETWORK;
+	req.flags = ctx.iflags;
+	req.time_begin = ctx.time_begin;
+	req.time_end = ctx.time_end;
+
+	auto res = ctx.session->start_iterator(ioremap::elliptics::key(id), ranges, req);
+
+	if (ctx.bench) {
+		uint64_t keys = 0, bytes = 0;
+		struct timeval start_time, end_time;
+
+		gettimeofday(&start_time, NULL);
+		for (auto it = res.begin(), end = res.end(); it != end; ++it) {
+			++keys;
+			bytes += it->reply_data().size();
+		}
+		gettimeofday(&end_time, NULL);
+
+		double diff = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_usec - start_time.tv_usec) / 1000000.;
+		std::cout << "node: "     << dnet_server_convert_dnet_addr(const_cast<dnet_addr*>(&node)) << node.family
+		          << ", keys: "   << keys
+		          << ", data: "   << bytes
+		          << ", time: "   << diff << " sec"
+		          << ", keys/s: " << (diff > 0 ? keys / diff : 0)
+		          << ", MB/s: "   << (diff > 0 ? bytes / diff / (1024 * 1024) : 0)
+		          << std::endl;
+		return;
+	}
 
 	char buffer[2*DNET_ID_SIZE + 1] = {0};
 	for (auto it = res.begin(), end = res.end(); it != end; ++it) {
@@ -170,8 +203,16 @@ int main(int argc, char *argv[]) {
 	("key-end,K", boost::program_options::value<std::string>(), "End key of range for iterating")
 	("time-begin,t", boost::program_options::value<std::string>(), "Begin timestamp of time range for iterating")
 	("time-end,T", boost::program_options::value<std::string>(), "End timestamp of time range for iterating")
+	("user-flags-mask", boost::program_options::value<uint64_t>(), "Iterate only keys with (user_flags & mask) == value")
+	("user-flags-value", boost::program_options::value<uint64_t>()->default_value(0), "User flags value for --user-flags-mask")
+	("size-begin", boost::program_options::value<uint64_t>(), "Minimal size of iterated keys")
+	("size-end", boost::program_options::value<uint64_t>(), "Maximal size of iterated keys")
+	("sample", boost::program_options::value<uint32_t>(), "Iterate only given number of every million keys")
+	("data-offset", boost::program_options::value<uint64_t>(), "Offset of requested data, implies --data")
+	("data-size", boost::program_options::value<uint64_t>(), "Size of requested data, implies --data")
 	("nodes,n", "Iterate nodes")
 	("groups,G", "Iterate nodes in groups")
+	("bench,b", "Do not print keys, only measure iteration speed")
 	("help,h", "this help");
 
 	boost::program_options::variables_map vm;
@@ -207,10 +248,36 @@ int main(int argc, char *argv[]) {
 			ctx.time_end = parse_time(vm["time-end"].as<std::string>());
 			ctx.iflags |= DNET_IFLAGS_TS_RANGE;
 		}
+		if (vm.count("user-flags-mask")) {
+			ctx.filter.user_flags_mask = vm["user-flags-mask"].as<uint64_t>();
+			ctx.filter.user_flags_value = vm["user-flags-value"].as<uint64_t>();
+			ctx.iflags |= DNET_IFLAGS_USER_FLAGS;
+		}
+		if (vm.count("size-begin") || vm.count("size-end")) {
+			ctx.filter.size_end = ~0ULL;
+			if (vm.count("size-begin"))
+				ctx.filter.size_begin = vm["size-begin"].as<uint64_t>();
+			if (vm.count("size-end"))
+				ctx.filter.size_end = vm["size-end"].as<uint64_t>();
+			ctx.iflags |= DNET_IFLAGS_SIZE_RANGE;
+		}
+		if (vm.count("sample")) {
+			ctx.filter.sample_rate = vm["sample"].as<uint32_t>();
+			ctx.iflags |= DNET_IFLAGS_SAMPLE;
+		}
+		if (vm.count("data-offset") || vm.count("data-size")) {
+			if (vm.count("data-offset"))
+				ctx.filter.data_offset = vm["data-offset"].as<uint64_t>();
+			if (vm.count("data-size"))
+				ctx.filter.data_size = vm["data-size"].as<uint64_t>();
+			ctx.iflags |= DNET_IFLAGS_DATA | DNET_IFLAGS_DATA_RANGE;
+		}
 		if (vm.count("groups"))
 			iter_groups = true;
 		if (vm.count("nodes"))
 			iter_node = true;
+		if (vm.count("bench"))
+			ctx.bench = true;
 
 		boost::program_options::notify(vm);
 	} catch(boost::program_options::error& e) {
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2008+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Client lookup benchmark: single thread writes one small key and then
+ * looks it up keeping given number of requests in flight.
+ * Prints lookups per second, which is mostly bound by client CPU
+ * when server keeps data in memory (ram backend or cache).
+ */
+
+#include <sys/time.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <deque>
+#include <iostream>
+
+#include "elliptics/cppdef.h"
+
+#include "common.h"
+
+using namespace ioremap::elliptics;
+
+static void lookup_bench_usage(char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -r addr:port:family       - remote node to connect to\n"
+			"  -g group                  - group to write and lookup key in (default: 1)\n"
+			"  -k key                    - key to lookup (default: lookup-bench)\n"
+			"  -n lookups                - number of lookups (default: 100000)\n"
+			"  -w window                 - number of lookups in flight (default: 1)\n"
+			"  -l log                    - log file (default: /dev/stderr)\n"
+			"  -h                        - this help\n"
+			, p);
+	exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct dnet_config cfg;
+	char *remote_addr = NULL;
+	int remote_port, remote_family;
+	const char *logfile = "/dev/stderr";
+	std::string key_name = "lookup-bench";
+	int group = 1, num = 100000, window = 1;
+	int ch, err, i, failed = 0;
+	struct timeval start, end;
+	long diff;
+
+	memset(&cfg, 0, sizeof(struct dnet_config));
+	cfg.wait_timeout = 60;
+
+	while ((ch = getopt(argc, argv, "r:g:k:n:w:l:h")) != -1) {
+		switch (ch) {
+			case 'r':
+				err = dnet_parse_addr(optarg, &remote_port, &remote_family);
+				if (err)
+					return err;
+				remote_addr = optarg;
+				break;
+			case 'g':
+				group = atoi(optarg);
+				break;
+			case 'k':
+				key_name = optarg;
+				break;
+			case 'n':
+				num = atoi(optarg);
+				break;
+			case 'w':
+				window = atoi(optarg);
+				break;
+			case 'l':
+				logfile = optarg;
+				break;
+			case 'h':
+			default:
+				lookup_bench_usage(argv[0]);
+		}
+	}
+
+	if (!remote_addr) {
+		fprintf(stderr, "No remote node specified to route requests.\n");
+		return -ENOENT;
+	}
+
+	if (num <= 0 || window <= 0)
+		lookup_bench_usage(argv[0]);
+
+	try {
+		file_logger log(logfile, DNET_LOG_ERROR);
+		node n(log, cfg);
+		session sess(n);
+
+		n.add_remote(remote_addr, remote_port, remote_family);
+		sess.set_groups(std::vector<int>(1, group));
+		sess.set_exceptions_policy(session::no_exceptions);
+
+		key id(key_name);
+		sess.write_data(id, std::string("lookup-bench data"), 0).wait();
+
+		std::deque<async_lookup_result> inflight;
+
+		gettimeofday(&start, NULL);
+
+		for (i = 0; i < num; ++i) {
+			if ((int)inflight.size() >= window) {
+				inflight.front().wait();
+				failed += !!inflight.front().error();
+				inflight.pop_front();
+			}
+
+			inflight.emplace_back(sess.lookup(id));
+		}
+
+		while (!inflight.empty()) {
+			inflight.front().wait();
+			failed += !!inflight.front().error();
+			inflight.pop_front();
+		}
+
+		gettimeofday(&end, NULL);
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+
+	diff = (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
+	if (!diff)
+		diff = 1;
+
+	printf("lookups: %d, failed: %d, window: %d, time: %ld usecs, lookups/sec: %.1f\n",
+			num, failed, window, diff, (double)num * 1000000 / diff);
+
+	return failed ? -EIO : 0;
+}
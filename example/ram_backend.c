@@ -0,0 +1,1487 @@
+/*
+ * Copyright 2008+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * In-memory backend.
+ *
+ * Records live in sharded hash table, every shard is protected by its own
+ * rwlock. Values are allocated from per-shard arena of large chunks, space
+ * freed by overwrites and removals is reclaimed by compacting the arena when
+ * it becomes mostly garbage. Large values are allocated separately.
+ *
+ * Optionally whole storage is saved into mmap'ed snapshot file at exit
+ * (and periodically) and loaded back at startup.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "elliptics/packet.h"
+#include "elliptics/backends.h"
+
+#ifndef __unused
+#define __unused	__attribute__ ((unused))
+#endif
+
+#define RAM_SHARD_NUM			64
+#define RAM_HASH_INITIAL_SIZE		256
+
+/* Arena chunks start small and double until they reach maximum size */
+#define RAM_ARENA_CHUNK_MIN_SIZE	(64 * 1024)
+#define RAM_ARENA_CHUNK_SIZE		(1024 * 1024)
+/* Values larger than this are not allocated from arena */
+#define RAM_ARENA_LARGE_VALUE		(RAM_ARENA_CHUNK_SIZE / 4)
+#define RAM_ARENA_ALIGN			16
+
+#define RAM_SNAPSHOT_MAGIC		"DNETRAM1"
+
+struct ram_record {
+	struct ram_record	*next;
+
+	unsigned char		id[DNET_ID_SIZE];
+	struct dnet_ext_list_hdr	ehdr;
+
+	uint64_t		size;
+	uint64_t		capacity;
+	int			large;
+	void			*data;
+};
+
+struct ram_chunk {
+	struct ram_chunk	*next;
+	uint64_t		size, used;
+	char			data[0];
+};
+
+struct ram_shard {
+	pthread_rwlock_t	lock;
+
+	struct ram_record	**hash;
+	uint64_t		hash_size;
+	uint64_t		num;
+
+	/* Head chunk is the one new values are allocated from */
+	struct ram_chunk	*chunks;
+	uint64_t		arena_size;
+	/* Bytes occupied by live values and by freed ones */
+	uint64_t		live, garbage;
+};
+
+struct ram_backend {
+	struct dnet_log		*blog;
+
+	struct ram_shard	shards[RAM_SHARD_NUM];
+
+	uint64_t		memory_limit;
+	/* Updated atomically, includes arena chunks, large values and record headers */
+	uint64_t		used;
+
+	char			*snapshot;
+	long			snapshot_interval;
+	int			snapshot_started;
+	int			need_exit;
+	pthread_t		snapshot_tid;
+	pthread_mutex_t		snapshot_lock;
+	pthread_cond_t		snapshot_wait;
+};
+
+struct ram_snapshot_header {
+	char			magic[8];
+	uint64_t		num;
+} __attribute__ ((packed));
+
+struct ram_snapshot_record {
+	unsigned char		id[DNET_ID_SIZE];
+	struct dnet_ext_list_hdr	ehdr;
+	uint64_t		size;
+} __attribute__ ((packed));
+
+static inline uint64_t ram_align(uint64_t size, uint64_t align)
+{
+	return (size + align - 1) & ~(align - 1);
+}
+
+static inline struct ram_shard *ram_get_shard(struct ram_backend *r, const unsigned char *id)
+{
+	return &r->shards[id[0] % RAM_SHARD_NUM];
+}
+
+static inline uint64_t ram_hash(struct ram_shard *s, const unsigned char *id)
+{
+	uint64_t h;
+
+	/* Keys are already hashed, shard is selected by the first byte */
+	memcpy(&h, id + 1, sizeof(h));
+	return h % s->hash_size;
+}
+
+static int ram_mem_reserve(struct ram_backend *r, uint64_t size)
+{
+	uint64_t used = __sync_add_and_fetch(&r->used, size);
+
+	if (r->memory_limit && used > r->memory_limit) {
+		__sync_sub_and_fetch(&r->used, size);
+		return -ENOSPC;
+	}
+
+	return 0;
+}
+
+static inline void ram_mem_release(struct ram_backend *r, uint64_t size)
+{
+	__sync_sub_and_fetch(&r->used, size);
+}
+
+/*
+ * Arena.
+ * All functions below are called with shard write lock held.
+ */
+static int ram_value_alloc(struct ram_backend *r, struct ram_shard *s, struct ram_record *rec, uint64_t size)
+{
+	struct ram_chunk *c;
+	uint64_t csize;
+	int err;
+
+	rec->data = NULL;
+	rec->capacity = 0;
+	rec->large = 0;
+
+	if (!size)
+		return 0;
+
+	size = ram_align(size, RAM_ARENA_ALIGN);
+
+	if (size >= RAM_ARENA_LARGE_VALUE) {
+		err = ram_mem_reserve(r, size);
+		if (err)
+			return err;
+
+		rec->data = malloc(size);
+		if (!rec->data) {
+			ram_mem_release(r, size);
+			return -ENOMEM;
+		}
+
+		rec->large = 1;
+		rec->capacity = size;
+		return 0;
+	}
+
+	c = s->chunks;
+	if (!c || c->size - c->used < size) {
+		csize = s->arena_size;
+		if (csize < RAM_ARENA_CHUNK_MIN_SIZE)
+			csize = RAM_ARENA_CHUNK_MIN_SIZE;
+		if (csize > RAM_ARENA_CHUNK_SIZE)
+			csize = RAM_ARENA_CHUNK_SIZE;
+		if (csize < size)
+			csize = size;
+
+		err = ram_mem_reserve(r, csize);
+		if (err)
+			return err;
+
+		c = malloc(sizeof(struct ram_chunk) + csize);
+		if (!c) {
+			ram_mem_release(r, csize);
+			return -ENOMEM;
+		}
+
+		c->size = csize;
+		c->used = 0;
+		c->next = s->chunks;
+		s->chunks = c;
+		s->arena_size += c->size;
+	}
+
+	rec->data = c->data + c->used;
+	rec->capacity = size;
+	c->used += size;
+	s->live += size;
+
+	return 0;
+}
+
+static void ram_value_free(struct ram_backend *r, struct ram_shard *s, struct ram_record *rec)
+{
+	if (rec->large) {
+		free(rec->data);
+		ram_mem_release(r, rec->capacity);
+	} else {
+		s->live -= rec->capacity;
+		s->garbage += rec->capacity;
+	}
+
+	rec->data = NULL;
+	rec->capacity = 0;
+	rec->large = 0;
+}
+
+/*
+ * Moves every arena value into single new chunk and frees old ones.
+ * Compaction does not check memory limit, since it only reduces memory usage.
+ */
+static void ram_shard_compact(struct ram_backend *r, struct ram_shard *s)
+{
+	struct ram_chunk *c, *old, *next;
+	struct ram_record *rec;
+	uint64_t i, size, old_size;
+
+	if (s->garbage < RAM_ARENA_CHUNK_MIN_SIZE || s->garbage < s->arena_size / 2)
+		return;
+
+	old = s->chunks;
+	old_size = s->arena_size;
+
+	if (s->live) {
+		size = s->live > RAM_ARENA_CHUNK_MIN_SIZE ? s->live : RAM_ARENA_CHUNK_MIN_SIZE;
+
+		c = malloc(sizeof(struct ram_chunk) + size);
+		if (!c)
+			return;
+
+		__sync_add_and_fetch(&r->used, size);
+
+		c->size = size;
+		c->used = 0;
+		c->next = NULL;
+
+		for (i = 0; i < s->hash_size; ++i) {
+			for (rec = s->hash[i]; rec; rec = rec->next) {
+				if (rec->large || !rec->capacity)
+					continue;
+
+				memcpy(c->data + c->used, rec->data, rec->size);
+				rec->data = c->data + c->used;
+				c->used += rec->capacity;
+			}
+		}
+
+		s->chunks = c;
+		s->arena_size = c->size;
+	} else {
+		s->chunks = NULL;
+		s->arena_size = 0;
+	}
+
+	s->garbage = 0;
+
+	for (; old; old = next) {
+		next = old->next;
+		free(old);
+	}
+	ram_mem_release(r, old_size);
+}
+
+static void ram_shard_arena_cleanup(struct ram_shard *s)
+{
+	struct ram_chunk *c, *next;
+
+	for (c = s->chunks; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+
+	s->chunks = NULL;
+	s->arena_size = s->live = s->garbage = 0;
+}
+
+/*
+ * Makes sure @rec can hold @size bytes, preserving first @keep bytes of data.
+ */
+static int ram_record_reserve(struct ram_backend *r, struct ram_shard *s, struct ram_record *rec,
+		uint64_t size, uint64_t keep)
+{
+	struct ram_record tmp;
+	uint64_t cap;
+	int err;
+
+	if (size <= rec->capacity)
+		return 0;
+
+	/* Grow geometrically, so that series of appends does not copy data every time */
+	cap = rec->capacity + (rec->capacity < RAM_ARENA_CHUNK_SIZE ? rec->capacity : RAM_ARENA_CHUNK_SIZE);
+	if (cap < size)
+		cap = size;
+
+	err = ram_value_alloc(r, s, &tmp, cap);
+	if (err && cap != size)
+		err = ram_value_alloc(r, s, &tmp, size);
+	if (err)
+		return err;
+
+	if (keep > rec->size)
+		keep = rec->size;
+	if (keep)
+		memcpy(tmp.data, rec->data, keep);
+
+	if (rec->capacity)
+		ram_value_free(r, s, rec);
+
+	rec->data = tmp.data;
+	rec->capacity = tmp.capacity;
+	rec->large = tmp.large;
+
+	return 0;
+}
+
+/*
+ * Hash table.
+ * Lookup requires shard lock held for reading, modifications - for writing.
+ */
+static struct ram_record *ram_record_search(struct ram_shard *s, const unsigned char *id)
+{
+	struct ram_record *rec;
+
+	for (rec = s->hash[ram_hash(s, id)]; rec; rec = rec->next) {
+		if (!memcmp(rec->id, id, DNET_ID_SIZE))
+			return rec;
+	}
+
+	return NULL;
+}
+
+static void ram_shard_grow(struct ram_shard *s)
+{
+	struct ram_record **old = s->hash, **hash, *rec, *next;
+	uint64_t i, old_size = s->hash_size;
+
+	hash = calloc(old_size * 2, sizeof(struct ram_record *));
+	if (!hash)
+		return;
+
+	s->hash = hash;
+	s->hash_size = old_size * 2;
+
+	for (i = 0; i < old_size; ++i) {
+		for (rec = old[i]; rec; rec = next) {
+			uint64_t h = ram_hash(s, rec->id);
+
+			next = rec->next;
+			rec->next = hash[h];
+			hash[h] = rec;
+		}
+	}
+
+	free(old);
+}
+
+static int ram_record_create(struct ram_backend *r, struct ram_shard *s, const unsigned char *id,
+		struct ram_record **recp)
+{
+	struct ram_record *rec;
+	uint64_t h;
+	int err;
+
+	err = ram_mem_reserve(r, sizeof(struct ram_record));
+	if (err)
+		return err;
+
+	rec = malloc(sizeof(struct ram_record));
+	if (!rec) {
+		ram_mem_release(r, sizeof(struct ram_record));
+		return -ENOMEM;
+	}
+
+	memset(rec, 0, sizeof(struct ram_record));
+	memcpy(rec->id, id, DNET_ID_SIZE);
+
+	if (s->num >= s->hash_size * 2)
+		ram_shard_grow(s);
+
+	h = ram_hash(s, id);
+	rec->next = s->hash[h];
+	s->hash[h] = rec;
+	s->num++;
+
+	*recp = rec;
+	return 0;
+}
+
+static int ram_record_remove(struct ram_backend *r, struct ram_shard *s, const unsigned char *id)
+{
+	struct ram_record **prec, *rec;
+
+	for (prec = &s->hash[ram_hash(s, id)]; *prec; prec = &(*prec)->next) {
+		rec = *prec;
+
+		if (!memcmp(rec->id, id, DNET_ID_SIZE)) {
+			*prec = rec->next;
+			s->num--;
+
+			ram_value_free(r, s, rec);
+			free(rec);
+			ram_mem_release(r, sizeof(struct ram_record));
+
+			ram_shard_compact(r, s);
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+static int ram_write(struct ram_backend *r, void *state, struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_io_attr *io = data;
+	struct ram_shard *s;
+	struct ram_record *rec;
+	struct dnet_ext_list elist;
+	uint64_t offset, end, reserve, size;
+	int created = 0, err;
+
+	dnet_convert_io_attr(io);
+
+	dnet_ext_list_init(&elist);
+	dnet_ext_io_to_list(io, &elist);
+
+	data += sizeof(struct dnet_io_attr);
+
+	s = ram_get_shard(r, io->id);
+
+	pthread_rwlock_wrlock(&s->lock);
+
+	rec = ram_record_search(s, io->id);
+	if (!rec) {
+		err = ram_record_create(r, s, io->id, &rec);
+		if (err)
+			goto err_out_unlock;
+
+		created = 1;
+	}
+
+	/* Prepare without append starts new record */
+	size = rec->size;
+	if ((io->flags & DNET_IO_FLAGS_PREPARE) && !(io->flags & DNET_IO_FLAGS_APPEND))
+		size = 0;
+
+	offset = (io->flags & DNET_IO_FLAGS_APPEND) ? size : io->offset;
+	end = offset + io->size;
+
+	reserve = end;
+	if ((io->flags & DNET_IO_FLAGS_PREPARE) && size + io->num > reserve)
+		reserve = size + io->num;
+	if ((io->flags & DNET_IO_FLAGS_COMMIT) && (io->flags & DNET_IO_FLAGS_PLAIN_WRITE) && io->num > reserve)
+		reserve = io->num;
+
+	err = ram_record_reserve(r, s, rec, reserve, size);
+	if (err) {
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: RAM: WRITE: reserve: size: %llu, used: %llu, limit: %llu: %s %d\n",
+				dnet_dump_id_str(io->id), (unsigned long long)reserve,
+				(unsigned long long)r->used, (unsigned long long)r->memory_limit,
+				strerror(-err), err);
+		goto err_out_remove;
+	}
+
+	/* Data between old end of record and write offset must not be garbage */
+	if (offset > size)
+		memset(rec->data + size, 0, offset - size);
+
+	if (io->size)
+		memcpy(rec->data + offset, data, io->size);
+
+	if (!offset && !(io->flags & (DNET_IO_FLAGS_PLAIN_WRITE | DNET_IO_FLAGS_PREPARE)))
+		size = end;
+	else if (end > size)
+		size = end;
+
+	if ((io->flags & DNET_IO_FLAGS_COMMIT) && (io->flags & DNET_IO_FLAGS_PLAIN_WRITE)) {
+		if (io->num > size)
+			memset(rec->data + size, 0, io->num - size);
+		size = io->num;
+	}
+
+	rec->size = size;
+	dnet_ext_list_to_hdr(&elist, &rec->ehdr);
+
+	dnet_backend_log(r->blog, DNET_LOG_INFO, "%s: RAM: WRITE: Ok: offset: %llu, size: %llu, record-size: %llu, ioflags: 0x%x.\n",
+			dnet_dump_id_str(io->id), (unsigned long long)offset, (unsigned long long)io->size,
+			(unsigned long long)rec->size, io->flags);
+
+	if (io->flags & DNET_IO_FLAGS_WRITE_NO_FILE_INFO) {
+		cmd->flags |= DNET_FLAGS_NEED_ACK;
+		err = 0;
+		goto err_out_unlock;
+	}
+
+	/* Reply is copied (and checksummed) synchronously, so lock must be held */
+	err = dnet_send_file_info_ts_without_fd(state, cmd, rec->data, rec->size, &elist.timestamp);
+	goto err_out_unlock;
+
+err_out_remove:
+	if (created)
+		ram_record_remove(r, s, io->id);
+err_out_unlock:
+	pthread_rwlock_unlock(&s->lock);
+	dnet_ext_list_destroy(&elist);
+	return err;
+}
+
+static int ram_read(struct ram_backend *r, void *state, struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_io_attr *io = data;
+	struct ram_shard *s;
+	struct ram_record *rec;
+	struct dnet_ext_list elist;
+	uint64_t size;
+	int err;
+
+	dnet_convert_io_attr(io);
+	dnet_ext_list_init(&elist);
+
+	s = ram_get_shard(r, io->id);
+
+	pthread_rwlock_rdlock(&s->lock);
+
+	rec = ram_record_search(s, io->id);
+	if (!rec) {
+		err = -ENOENT;
+		dnet_backend_log(r->blog, DNET_LOG_NOTICE, "%s: RAM: READ: no such record.\n",
+				dnet_dump_id_str(io->id));
+		goto err_out_unlock;
+	}
+
+	size = rec->size;
+	if (io->offset) {
+		if (io->offset >= size) {
+			err = -E2BIG;
+			goto err_out_unlock;
+		}
+		size -= io->offset;
+	}
+
+	if (io->size && size > io->size)
+		size = io->size;
+
+	dnet_ext_hdr_to_list(&rec->ehdr, &elist);
+	dnet_ext_list_to_io(&elist, io);
+
+	io->total_size = rec->size;
+	io->size = size;
+
+	/* Data is copied into reply before this returns */
+	err = dnet_send_read_data(state, cmd, io, rec->data + io->offset, -1, 0, 0);
+
+err_out_unlock:
+	pthread_rwlock_unlock(&s->lock);
+	dnet_ext_list_destroy(&elist);
+	return err;
+}
+
+static int ram_del(struct ram_backend *r, struct dnet_cmd *cmd)
+{
+	struct ram_shard *s = ram_get_shard(r, cmd->id.id);
+	int err;
+
+	pthread_rwlock_wrlock(&s->lock);
+	err = ram_record_remove(r, s, cmd->id.id);
+	pthread_rwlock_unlock(&s->lock);
+
+	if (err) {
+		dnet_backend_log(r->blog, DNET_LOG_NOTICE, "%s: RAM: DEL: %d: %s.\n",
+				dnet_dump_id(&cmd->id), err, strerror(-err));
+	}
+
+	return err;
+}
+
+static int ram_file_info(struct ram_backend *r, void *state, struct dnet_cmd *cmd)
+{
+	struct ram_shard *s = ram_get_shard(r, cmd->id.id);
+	struct ram_record *rec;
+	struct dnet_ext_list elist;
+	int err;
+
+	dnet_ext_list_init(&elist);
+
+	pthread_rwlock_rdlock(&s->lock);
+
+	rec = ram_record_search(s, cmd->id.id);
+	if (!rec || !rec->size) {
+		err = -ENOENT;
+		dnet_backend_log(r->blog, DNET_LOG_INFO, "%s: RAM: LOOKUP: %s.\n",
+				dnet_dump_id(&cmd->id), rec ? "zero-size record" : "no such record");
+		goto err_out_unlock;
+	}
+
+	dnet_ext_hdr_to_list(&rec->ehdr, &elist);
+
+	err = dnet_send_file_info_ts_without_fd(state, cmd, rec->data, rec->size, &elist.timestamp);
+
+err_out_unlock:
+	pthread_rwlock_unlock(&s->lock);
+	dnet_ext_list_destroy(&elist);
+	return err;
+}
+
+static int ram_cmp_id(const void *id1, const void *id2)
+{
+	return memcmp(id1, id2, DNET_ID_SIZE);
+}
+
+/*
+ * Collects ids within [@start, @end] from every shard.
+ * Returned array is sorted, since hash order means nothing to the client.
+ */
+static int ram_range_collect(struct ram_backend *r, const unsigned char *start, const unsigned char *end,
+		struct dnet_raw_id **idsp, uint64_t *nump)
+{
+	struct dnet_raw_id *ids = NULL, *tmp;
+	uint64_t num = 0, size = 0, i;
+	struct ram_record *rec;
+	struct ram_shard *s;
+	int j, err = 0;
+
+	for (j = 0; j < RAM_SHARD_NUM; ++j) {
+		s = &r->shards[j];
+
+		pthread_rwlock_rdlock(&s->lock);
+		for (i = 0; i < s->hash_size; ++i) {
+			for (rec = s->hash[i]; rec; rec = rec->next) {
+				if (memcmp(rec->id, start, DNET_ID_SIZE) < 0 || memcmp(rec->id, end, DNET_ID_SIZE) > 0)
+					continue;
+
+				if (num == size) {
+					size = size ? size * 2 : 1000;
+
+					tmp = realloc(ids, size * sizeof(struct dnet_raw_id));
+					if (!tmp) {
+						err = -ENOMEM;
+						pthread_rwlock_unlock(&s->lock);
+						goto err_out_free;
+					}
+					ids = tmp;
+				}
+
+				memcpy(ids[num].id, rec->id, DNET_ID_SIZE);
+				num++;
+			}
+		}
+		pthread_rwlock_unlock(&s->lock);
+	}
+
+	qsort(ids, num, sizeof(struct dnet_raw_id), ram_cmp_id);
+
+	*idsp = ids;
+	*nump = num;
+	return 0;
+
+err_out_free:
+	free(ids);
+	return err;
+}
+
+static int ram_read_range_one(struct ram_backend *r, void *state, struct dnet_cmd *cmd,
+		struct dnet_io_attr *req, const unsigned char *id)
+{
+	struct ram_shard *s = ram_get_shard(r, id);
+	struct ram_record *rec;
+	struct dnet_ext_list elist;
+	struct dnet_io_attr io;
+	int err = 0;
+
+	dnet_ext_list_init(&elist);
+
+	pthread_rwlock_rdlock(&s->lock);
+
+	/* Record could have been removed after ids were collected */
+	rec = ram_record_search(s, id);
+	if (!rec || req->offset > rec->size)
+		goto err_out_unlock;
+
+	memset(&io, 0, sizeof(struct dnet_io_attr));
+
+	dnet_ext_hdr_to_list(&rec->ehdr, &elist);
+	dnet_ext_list_to_io(&elist, &io);
+
+	memcpy(io.id, id, DNET_ID_SIZE);
+	memcpy(io.parent, req->parent, DNET_ID_SIZE);
+	io.offset = req->offset;
+	io.size = rec->size - req->offset;
+	io.total_size = rec->size;
+
+	err = dnet_send_read_data(state, cmd, &io, rec->data + io.offset, -1, 0, 0);
+
+err_out_unlock:
+	pthread_rwlock_unlock(&s->lock);
+	dnet_ext_list_destroy(&elist);
+	return err;
+}
+
+static int ram_read_range(struct ram_backend *r, void *state, struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_io_attr *io = data;
+	struct dnet_raw_id *ids = NULL;
+	uint64_t i, num = 0, start_from = 0;
+	struct ram_shard *s;
+	int err;
+
+	dnet_convert_io_attr(io);
+
+	err = ram_range_collect(r, io->id, io->parent, &ids, &num);
+	if (err) {
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: RAM: read-range: %d: %s\n",
+				dnet_dump_id_str(io->id), err, strerror(-err));
+		goto err_out_exit;
+	}
+
+	if (cmd->cmd == DNET_CMD_READ_RANGE)
+		start_from = io->start;
+
+	for (i = start_from; i < num; ++i) {
+		if (cmd->cmd == DNET_CMD_READ_RANGE) {
+			if ((io->num > 0) && (i >= io->num + start_from))
+				break;
+
+			if (io->flags & DNET_IO_FLAGS_NODATA)
+				continue;
+
+			err = ram_read_range_one(r, state, cmd, io, ids[i].id);
+		} else {
+			s = ram_get_shard(r, ids[i].id);
+
+			pthread_rwlock_wrlock(&s->lock);
+			ram_record_remove(r, s, ids[i].id);
+			pthread_rwlock_unlock(&s->lock);
+		}
+
+		if (err) {
+			dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: RAM: read-range: err: %d\n",
+					dnet_dump_id_str(ids[i].id), err);
+			goto err_out_free;
+		}
+	}
+
+	if (num > start_from) {
+		struct dnet_io_attr reply;
+
+		memcpy(&reply, io, sizeof(struct dnet_io_attr));
+		reply.num = num - start_from;
+		reply.offset = reply.size = 0;
+
+		err = dnet_send_read_data(state, cmd, &reply, NULL, -1, 0, 0);
+	}
+
+err_out_free:
+	free(ids);
+err_out_exit:
+	return err;
+}
+
+static int ram_backend_storage_stat(void *priv, struct dnet_stat *st)
+{
+	struct ram_backend *r = priv;
+	uint64_t used = r->used, files = 0;
+	int err, i;
+
+	memset(st, 0, sizeof(struct dnet_stat));
+
+	/* Load average and VM counters */
+	err = backend_stat_low_level(r->blog, ".", st);
+	if (err)
+		return err;
+
+	for (i = 0; i < RAM_SHARD_NUM; ++i)
+		files += r->shards[i].num;
+
+	dnet_convert_stat(st);
+
+	st->bsize = st->frsize = 4096;
+	st->namemax = DNET_ID_SIZE * 2;
+	st->files = files;
+	st->ffree = st->favail = 0;
+	st->node_files = files;
+
+	if (r->memory_limit) {
+		st->blocks = r->memory_limit / st->frsize;
+		st->bfree = st->bavail = used < r->memory_limit ? (r->memory_limit - used) / st->frsize : 0;
+	} else {
+		st->blocks = st->vm_total * 1024 / st->frsize;
+		st->bfree = st->bavail = st->vm_free * 1024 / st->frsize;
+	}
+
+	dnet_convert_stat(st);
+
+	return 0;
+}
+
+static int ram_stat(struct ram_backend *r, void *state, struct dnet_cmd *cmd)
+{
+	struct dnet_stat st;
+	int err;
+
+	err = ram_backend_storage_stat(r, &st);
+	if (err)
+		return err;
+
+	return dnet_send_reply(state, cmd, &st, sizeof(struct dnet_stat), 0);
+}
+
+static int ram_backend_command_handler(void *state, void *priv, struct dnet_cmd *cmd, void *data)
+{
+	struct ram_backend *r = priv;
+	int err;
+
+	switch (cmd->cmd) {
+		case DNET_CMD_LOOKUP:
+			err = ram_file_info(r, state, cmd);
+			break;
+		case DNET_CMD_WRITE:
+			err = ram_write(r, state, cmd, data);
+			break;
+		case DNET_CMD_READ:
+			err = ram_read(r, state, cmd, data);
+			break;
+		case DNET_CMD_READ_RANGE:
+		case DNET_CMD_DEL_RANGE:
+			err = ram_read_range(r, state, cmd, data);
+			break;
+		case DNET_CMD_STAT:
+			err = ram_stat(r, state, cmd);
+			break;
+		case DNET_CMD_DEL:
+			err = ram_del(r, cmd);
+			break;
+		default:
+			err = -ENOTSUP;
+			break;
+	}
+
+	return err;
+}
+
+static int ram_backend_checksum(struct dnet_node *n, void *priv, struct dnet_id *id, void *csum, int *csize)
+{
+	struct ram_backend *r = priv;
+	struct ram_shard *s = ram_get_shard(r, id->id);
+	struct ram_record *rec;
+	int err = 0;
+
+	pthread_rwlock_rdlock(&s->lock);
+
+	rec = ram_record_search(s, id->id);
+	if (!rec) {
+		err = -ENOENT;
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "%s: RAM: checksum: no such record.\n",
+				dnet_dump_id_str(id->id));
+	} else if (!rec->size) {
+		memset(csum, 0, *csize);
+	} else {
+		err = dnet_checksum_data(n, rec->data, rec->size, csum, *csize);
+	}
+
+	pthread_rwlock_unlock(&s->lock);
+	return err;
+}
+
+static int ram_backend_lookup_timestamp(struct dnet_node *n __unused, void *priv, struct dnet_id *id, struct dnet_time *ts)
+{
+	struct ram_backend *r = priv;
+	struct ram_shard *s = ram_get_shard(r, id->id);
+	struct ram_record *rec;
+	struct dnet_ext_list elist;
+	int err = 0;
+
+	dnet_ext_list_init(&elist);
+
+	pthread_rwlock_rdlock(&s->lock);
+
+	rec = ram_record_search(s, id->id);
+	if (!rec || !rec->size) {
+		err = -ENOENT;
+	} else {
+		dnet_ext_hdr_to_list(&rec->ehdr, &elist);
+		*ts = elist.timestamp;
+	}
+
+	pthread_rwlock_unlock(&s->lock);
+	dnet_ext_list_destroy(&elist);
+	return err;
+}
+
+/*
+ * Iterator takes snapshot of shard's ids and then copies every record
+ * into private buffer, so that callback is invoked without any lock held.
+ */
+static int ram_backend_iterator(struct dnet_iterator_ctl *ictl)
+{
+	struct ram_backend *r = ictl->iterate_private;
+	struct dnet_raw_id *ids = NULL, *tmp_ids;
+	struct dnet_ext_list elist;
+	struct ram_record *rec;
+	struct ram_shard *s;
+	void *buf = NULL, *tmp;
+	uint64_t buf_size = 0, ids_size = 0, num, i, size;
+	int j, err = 0;
+
+	for (j = 0; j < RAM_SHARD_NUM; ++j) {
+		s = &r->shards[j];
+
+		pthread_rwlock_rdlock(&s->lock);
+		if (s->num > ids_size) {
+			tmp_ids = realloc(ids, s->num * sizeof(struct dnet_raw_id));
+			if (!tmp_ids) {
+				pthread_rwlock_unlock(&s->lock);
+				err = -ENOMEM;
+				goto err_out_free;
+			}
+
+			ids = tmp_ids;
+			ids_size = s->num;
+		}
+
+		num = 0;
+		for (i = 0; i < s->hash_size; ++i) {
+			for (rec = s->hash[i]; rec; rec = rec->next) {
+				memcpy(ids[num].id, rec->id, DNET_ID_SIZE);
+
+				if (!ictl->key_filter || ictl->key_filter(ictl->callback_private, &ids[num]))
+					++num;
+			}
+		}
+		pthread_rwlock_unlock(&s->lock);
+
+		for (i = 0; i < num; ++i) {
+			dnet_ext_list_init(&elist);
+
+			pthread_rwlock_rdlock(&s->lock);
+			rec = ram_record_search(s, ids[i].id);
+			if (!rec) {
+				pthread_rwlock_unlock(&s->lock);
+				continue;
+			}
+
+			size = rec->size;
+			if (size > buf_size) {
+				tmp = realloc(buf, size);
+				if (!tmp) {
+					pthread_rwlock_unlock(&s->lock);
+					err = -ENOMEM;
+					goto err_out_free;
+				}
+
+				buf = tmp;
+				buf_size = size;
+			}
+
+			if (size)
+				memcpy(buf, rec->data, size);
+			dnet_ext_hdr_to_list(&rec->ehdr, &elist);
+			pthread_rwlock_unlock(&s->lock);
+
+			err = ictl->callback(ictl->callback_private, &ids[i], buf, size, &elist);
+			dnet_ext_list_destroy(&elist);
+
+			if (err)
+				goto err_out_free;
+		}
+	}
+
+err_out_free:
+	free(buf);
+	free(ids);
+	return err;
+}
+
+/*
+ * Snapshot file: header followed by records, every record's data is padded to 8 bytes.
+ * It is written into temporary file and renamed over the old one, numbers are in host byte order.
+ */
+static int ram_snapshot_save(struct ram_backend *r)
+{
+	struct ram_snapshot_header *hdr;
+	struct ram_snapshot_record *srec;
+	struct ram_record *rec;
+	char tmp_path[strlen(r->snapshot) + 5];
+	uint64_t size = sizeof(struct ram_snapshot_header), num = 0, i;
+	void *map;
+	char *ptr;
+	int fd, j, err;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", r->snapshot);
+
+	fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		err = -errno;
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "RAM: snapshot: %s: open: %s [%d].\n",
+				tmp_path, strerror(-err), err);
+		goto err_out_exit;
+	}
+
+	/* Storage is frozen while it is copied into the snapshot */
+	for (j = 0; j < RAM_SHARD_NUM; ++j)
+		pthread_rwlock_rdlock(&r->shards[j].lock);
+
+	for (j = 0; j < RAM_SHARD_NUM; ++j) {
+		struct ram_shard *s = &r->shards[j];
+
+		for (i = 0; i < s->hash_size; ++i) {
+			for (rec = s->hash[i]; rec; rec = rec->next) {
+				size += sizeof(struct ram_snapshot_record) + ram_align(rec->size, 8);
+				num++;
+			}
+		}
+	}
+
+	err = ftruncate(fd, size);
+	if (err) {
+		err = -errno;
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "RAM: snapshot: %s: truncate: size: %llu: %s [%d].\n",
+				tmp_path, (unsigned long long)size, strerror(-err), err);
+		goto err_out_unlock;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		err = -errno;
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "RAM: snapshot: %s: mmap: size: %llu: %s [%d].\n",
+				tmp_path, (unsigned long long)size, strerror(-err), err);
+		goto err_out_unlock;
+	}
+
+	hdr = map;
+	memcpy(hdr->magic, RAM_SNAPSHOT_MAGIC, sizeof(hdr->magic));
+	hdr->num = num;
+
+	ptr = (char *)(hdr + 1);
+	for (j = 0; j < RAM_SHARD_NUM; ++j) {
+		struct ram_shard *s = &r->shards[j];
+
+		for (i = 0; i < s->hash_size; ++i) {
+			for (rec = s->hash[i]; rec; rec = rec->next) {
+				srec = (struct ram_snapshot_record *)ptr;
+
+				memcpy(srec->id, rec->id, DNET_ID_SIZE);
+				srec->ehdr = rec->ehdr;
+				srec->size = rec->size;
+
+				ptr += sizeof(struct ram_snapshot_record);
+				if (rec->size)
+					memcpy(ptr, rec->data, rec->size);
+				ptr += ram_align(rec->size, 8);
+			}
+		}
+	}
+
+	for (j = RAM_SHARD_NUM - 1; j >= 0; --j)
+		pthread_rwlock_unlock(&r->shards[j].lock);
+
+	err = msync(map, size, MS_SYNC);
+	if (err)
+		err = -errno;
+	munmap(map, size);
+
+	if (!err && fsync(fd))
+		err = -errno;
+	if (err) {
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "RAM: snapshot: %s: sync: %s [%d].\n",
+				tmp_path, strerror(-err), err);
+		goto err_out_close;
+	}
+
+	err = rename(tmp_path, r->snapshot);
+	if (err) {
+		err = -errno;
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "RAM: snapshot: rename %s -> %s: %s [%d].\n",
+				tmp_path, r->snapshot, strerror(-err), err);
+		goto err_out_close;
+	}
+
+	close(fd);
+
+	dnet_backend_log(r->blog, DNET_LOG_INFO, "RAM: snapshot: %s: saved %llu records, %llu bytes.\n",
+			r->snapshot, (unsigned long long)num, (unsigned long long)size);
+	return 0;
+
+err_out_unlock:
+	for (j = RAM_SHARD_NUM - 1; j >= 0; --j)
+		pthread_rwlock_unlock(&r->shards[j].lock);
+err_out_close:
+	close(fd);
+	unlink(tmp_path);
+err_out_exit:
+	return err;
+}
+
+static int ram_snapshot_load(struct ram_backend *r)
+{
+	struct ram_snapshot_header *hdr;
+	struct ram_snapshot_record *srec;
+	struct ram_record *rec;
+	struct ram_shard *s;
+	struct stat st;
+	uint64_t i, size, pos;
+	void *map;
+	char *ptr;
+	int fd, err;
+
+	fd = open(r->snapshot, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		err = -errno;
+		if (err == -ENOENT)
+			return 0;
+
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "RAM: snapshot: %s: open: %s [%d].\n",
+				r->snapshot, strerror(-err), err);
+		goto err_out_exit;
+	}
+
+	err = fstat(fd, &st);
+	if (err) {
+		err = -errno;
+		goto err_out_close;
+	}
+
+	size = st.st_size;
+	if (size < sizeof(struct ram_snapshot_header)) {
+		err = -EINVAL;
+		goto err_out_corrupted;
+	}
+
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		err = -errno;
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "RAM: snapshot: %s: mmap: %s [%d].\n",
+				r->snapshot, strerror(-err), err);
+		goto err_out_close;
+	}
+
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	hdr = map;
+	if (memcmp(hdr->magic, RAM_SNAPSHOT_MAGIC, sizeof(hdr->magic))) {
+		err = -EINVAL;
+		goto err_out_unmap;
+	}
+
+	ptr = map;
+	pos = sizeof(struct ram_snapshot_header);
+
+	for (i = 0; i < hdr->num; ++i) {
+		if (size - pos < sizeof(struct ram_snapshot_record)) {
+			err = -EINVAL;
+			goto err_out_unmap;
+		}
+
+		srec = (struct ram_snapshot_record *)(ptr + pos);
+		pos += sizeof(struct ram_snapshot_record);
+
+		if (size - pos < srec->size) {
+			err = -EINVAL;
+			goto err_out_unmap;
+		}
+
+		s = ram_get_shard(r, srec->id);
+
+		err = ram_record_create(r, s, srec->id, &rec);
+		if (!err)
+			err = ram_value_alloc(r, s, rec, srec->size);
+		if (err) {
+			dnet_backend_log(r->blog, DNET_LOG_ERROR, "RAM: snapshot: %s: record %llu/%llu: %s [%d].\n",
+					r->snapshot, (unsigned long long)i, (unsigned long long)hdr->num,
+					strerror(-err), err);
+			goto err_out_unmap_nolog;
+		}
+
+		rec->ehdr = srec->ehdr;
+		rec->size = srec->size;
+		if (rec->size)
+			memcpy(rec->data, ptr + pos, rec->size);
+
+		pos += ram_align(srec->size, 8);
+		if (pos > size)
+			pos = size;
+	}
+
+	dnet_backend_log(r->blog, DNET_LOG_INFO, "RAM: snapshot: %s: loaded %llu records.\n",
+			r->snapshot, (unsigned long long)hdr->num);
+
+	munmap(map, size);
+	close(fd);
+	return 0;
+
+err_out_unmap:
+	munmap(map, size);
+err_out_corrupted:
+	dnet_backend_log(r->blog, DNET_LOG_ERROR, "RAM: snapshot: %s: corrupted snapshot.\n", r->snapshot);
+	goto err_out_close;
+err_out_unmap_nolog:
+	munmap(map, size);
+err_out_close:
+	close(fd);
+err_out_exit:
+	return err;
+}
+
+static void *ram_snapshot_process(void *data)
+{
+	struct ram_backend *r = data;
+	struct timespec ts;
+
+	pthread_mutex_lock(&r->snapshot_lock);
+	while (!r->need_exit) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += r->snapshot_interval;
+
+		pthread_cond_timedwait(&r->snapshot_wait, &r->snapshot_lock, &ts);
+		if (r->need_exit)
+			break;
+
+		pthread_mutex_unlock(&r->snapshot_lock);
+		ram_snapshot_save(r);
+		pthread_mutex_lock(&r->snapshot_lock);
+	}
+	pthread_mutex_unlock(&r->snapshot_lock);
+
+	return NULL;
+}
+
+static int ram_shards_init(struct ram_backend *r)
+{
+	struct ram_shard *s;
+	int i, err;
+
+	for (i = 0; i < RAM_SHARD_NUM; ++i) {
+		s = &r->shards[i];
+
+		s->hash_size = RAM_HASH_INITIAL_SIZE;
+		s->hash = calloc(s->hash_size, sizeof(struct ram_record *));
+		if (!s->hash) {
+			err = -ENOMEM;
+			goto err_out_cleanup;
+		}
+
+		err = pthread_rwlock_init(&s->lock, NULL);
+		if (err) {
+			err = -err;
+			free(s->hash);
+			goto err_out_cleanup;
+		}
+	}
+
+	return 0;
+
+err_out_cleanup:
+	while (--i >= 0) {
+		pthread_rwlock_destroy(&r->shards[i].lock);
+		free(r->shards[i].hash);
+	}
+	return err;
+}
+
+static void ram_shards_cleanup(struct ram_backend *r)
+{
+	struct ram_record *rec, *next;
+	struct ram_shard *s;
+	uint64_t i;
+	int j;
+
+	for (j = 0; j < RAM_SHARD_NUM; ++j) {
+		s = &r->shards[j];
+
+		for (i = 0; i < s->hash_size; ++i) {
+			for (rec = s->hash[i]; rec; rec = next) {
+				next = rec->next;
+
+				if (rec->large)
+					free(rec->data);
+				free(rec);
+			}
+		}
+
+		ram_shard_arena_cleanup(s);
+		pthread_rwlock_destroy(&s->lock);
+		free(s->hash);
+	}
+}
+
+static void ram_backend_cleanup(void *priv)
+{
+	struct ram_backend *r = priv;
+
+	if (r->snapshot_started) {
+		pthread_mutex_lock(&r->snapshot_lock);
+		r->need_exit = 1;
+		pthread_cond_broadcast(&r->snapshot_wait);
+		pthread_mutex_unlock(&r->snapshot_lock);
+
+		pthread_join(r->snapshot_tid, NULL);
+
+		pthread_cond_destroy(&r->snapshot_wait);
+		pthread_mutex_destroy(&r->snapshot_lock);
+	}
+
+	if (r->snapshot)
+		ram_snapshot_save(r);
+
+	ram_shards_cleanup(r);
+	free(r->snapshot);
+}
+
+static int dnet_ram_set_memory_limit(struct dnet_config_backend *b, char *key __unused, char *value)
+{
+	struct ram_backend *r = b->data;
+	uint64_t val = strtoull(value, NULL, 0);
+
+	if (strchr(value, 'T'))
+		val *= 1024*1024*1024*1024ULL;
+	else if (strchr(value, 'G'))
+		val *= 1024*1024*1024ULL;
+	else if (strchr(value, 'M'))
+		val *= 1024*1024;
+	else if (strchr(value, 'K'))
+		val *= 1024;
+
+	r->memory_limit = val;
+	return 0;
+}
+
+static int dnet_ram_set_snapshot(struct dnet_config_backend *b, char *key __unused, char *value)
+{
+	struct ram_backend *r = b->data;
+
+	free(r->snapshot);
+	r->snapshot = strdup(value);
+	if (!r->snapshot)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int dnet_ram_set_snapshot_interval(struct dnet_config_backend *b, char *key __unused, char *value)
+{
+	struct ram_backend *r = b->data;
+
+	r->snapshot_interval = strtol(value, NULL, 0);
+	return 0;
+}
+
+static int dnet_ram_config_init(struct dnet_config_backend *b, struct dnet_config *c)
+{
+	struct ram_backend *r = b->data;
+	int err;
+
+	r->blog = b->log;
+
+	err = ram_shards_init(r);
+	if (err) {
+		dnet_backend_log(r->blog, DNET_LOG_ERROR, "RAM: failed to initialize shards: %s.\n", strerror(-err));
+		goto err_out_exit;
+	}
+
+	if (r->snapshot) {
+		err = ram_snapshot_load(r);
+		if (err)
+			goto err_out_shards_cleanup;
+	}
+
+	if (r->snapshot && r->snapshot_interval > 0) {
+		err = pthread_mutex_init(&r->snapshot_lock, NULL);
+		if (err) {
+			err = -err;
+			goto err_out_shards_cleanup;
+		}
+
+		err = pthread_cond_init(&r->snapshot_wait, NULL);
+		if (err) {
+			err = -err;
+			goto err_out_snapshot_lock_destroy;
+		}
+
+		err = pthread_create(&r->snapshot_tid, NULL, ram_snapshot_process, r);
+		if (err) {
+			err = -err;
+			dnet_backend_log(r->blog, DNET_LOG_ERROR, "RAM: failed to start snapshot thread: %s.\n",
+					strerror(-err));
+			goto err_out_snapshot_wait_destroy;
+		}
+
+		r->snapshot_started = 1;
+	}
+
+	if (r->memory_limit) {
+		b->storage_size = r->memory_limit;
+		b->storage_free = r->memory_limit > r->used ? r->memory_limit - r->used : 0;
+	} else {
+		b->storage_size = (unsigned long long)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+		b->storage_free = (unsigned long long)sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+	}
+
+	c->cb = &b->cb;
+	c->storage_size = b->storage_size;
+	c->storage_free = b->storage_free;
+
+	b->cb.command_private = r;
+	b->cb.command_handler = ram_backend_command_handler;
+	b->cb.storage_stat = ram_backend_storage_stat;
+	b->cb.backend_cleanup = ram_backend_cleanup;
+	b->cb.checksum = ram_backend_checksum;
+	b->cb.lookup_timestamp = ram_backend_lookup_timestamp;
+	b->cb.iterator = ram_backend_iterator;
+
+	return 0;
+
+err_out_snapshot_wait_destroy:
+	pthread_cond_destroy(&r->snapshot_wait);
+err_out_snapshot_lock_destroy:
+	pthread_mutex_destroy(&r->snapshot_lock);
+err_out_shards_cleanup:
+	ram_shards_cleanup(r);
+err_out_exit:
+	return err;
+}
+
+static void dnet_ram_config_cleanup(struct dnet_config_backend *b)
+{
+	struct ram_backend *r = b->data;
+
+	ram_backend_cleanup(r);
+}
+
+static struct dnet_config_entry dnet_cfg_entries_ram[] = {
+	{"memory_limit", dnet_ram_set_memory_limit},
+	{"snapshot", dnet_ram_set_snapshot},
+	{"snapshot_interval", dnet_ram_set_snapshot_interval},
+};
+
+static struct dnet_config_backend dnet_ram_backend = {
+	.name			= "ram",
+	.ent			= dnet_cfg_entries_ram,
+	.num			= ARRAY_SIZE(dnet_cfg_entries_ram),
+	.size			= sizeof(struct ram_backend),
+	.init			= dnet_ram_config_init,
+	.cleanup		= dnet_ram_config_cleanup,
+};
+
+struct dnet_config_backend *dnet_ram_backend_info(void)
+{
+	return &dnet_ram_backend;
+}
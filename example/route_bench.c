@@ -0,0 +1,288 @@
+/*
+ * Copyright 2008+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Route lookup benchmark: fills route table of a standalone node with given
+ * number of fake states and ids, then every thread resolves random keys
+ * with dnet_state_get_first() using locked group search (baseline)
+ * and lock-free route table. Prints lookups per second of both.
+ * No connections are created, so it measures only route search and locking.
+ */
+
+#include <sys/time.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "library/elliptics.h"
+
+#define ROUTE_BENCH_KEYS	(1 << 16)
+
+struct route_bench {
+	struct dnet_node	*n;
+	struct dnet_id		*keys;
+	long			lookups;
+	long			missed;
+};
+
+static void route_bench_usage(char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -n nodes                  - number of nodes (default: 10000)\n"
+			"  -i ids                    - number of ids of every node (default: 100)\n"
+			"  -g groups                 - number of groups (default: 1)\n"
+			"  -l lookups                - number of lookups per thread (default: 1000000)\n"
+			"  -t threads                - number of threads (default: 1)\n"
+			"  -h                        - this help\n"
+			, p);
+	exit(-1);
+}
+
+static void route_bench_random_id(unsigned char *id, unsigned int *seed)
+{
+	int i;
+
+	for (i = 0; i < DNET_ID_SIZE; ++i)
+		id[i] = rand_r(seed);
+}
+
+static int route_bench_compare(const void *k1, const void *k2)
+{
+	const struct dnet_state_id *id1 = k1;
+	const struct dnet_state_id *id2 = k2;
+
+	return dnet_id_cmp_str(id1->raw.id, id2->raw.id);
+}
+
+/*
+ * Adds group with @node_num states having @id_num random ids each,
+ * the same way dnet_idc_create() lays them out
+ */
+static int route_bench_add_group(struct dnet_node *n, unsigned int group_id,
+		struct dnet_net_state **states, int node_num, int id_num, unsigned int *seed)
+{
+	struct dnet_group *g;
+	struct dnet_idc *idc;
+	int i, j;
+
+	g = calloc(1, sizeof(struct dnet_group));
+	if (!g)
+		return -ENOMEM;
+
+	g->group_id = group_id;
+	INIT_LIST_HEAD(&g->state_list);
+	atomic_init(&g->refcnt, 1);
+
+	g->ids = malloc((size_t)node_num * id_num * sizeof(struct dnet_state_id));
+	if (!g->ids) {
+		free(g);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < node_num; ++i) {
+		idc = calloc(1, sizeof(struct dnet_idc));
+		if (!idc)
+			return -ENOMEM;
+
+		idc->st = states[i];
+		idc->group = g;
+		idc->id_num = id_num;
+
+		for (j = 0; j < id_num; ++j) {
+			struct dnet_state_id *sid = &g->ids[g->id_num++];
+
+			route_bench_random_id(sid->raw.id, seed);
+			sid->idc = idc;
+		}
+	}
+
+	qsort(g->ids, g->id_num, sizeof(struct dnet_state_id), route_bench_compare);
+	list_add_tail(&g->group_entry, &n->group_list);
+
+	return 0;
+}
+
+static void *route_bench_thread(void *priv)
+{
+	struct route_bench *b = priv;
+	struct dnet_net_state *st;
+	long i;
+
+	for (i = 0; i < b->lookups; ++i) {
+		st = dnet_state_get_first(b->n, &b->keys[i & (ROUTE_BENCH_KEYS - 1)]);
+		if (!st) {
+			b->missed++;
+			continue;
+		}
+
+		dnet_state_put(st);
+	}
+
+	return NULL;
+}
+
+static double route_bench_run(struct route_bench *b, int thread_num, const char *name)
+{
+	pthread_t *tids;
+	struct timeval start, end;
+	long diff, missed = 0;
+	int i, err;
+
+	tids = calloc(thread_num, sizeof(pthread_t));
+	if (!tids) {
+		fprintf(stderr, "Could not allocate threads\n");
+		exit(-1);
+	}
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < thread_num; ++i) {
+		err = pthread_create(&tids[i], NULL, route_bench_thread, &b[i]);
+		if (err) {
+			fprintf(stderr, "Could not create thread: %s\n", strerror(err));
+			exit(-1);
+		}
+	}
+
+	for (i = 0; i < thread_num; ++i) {
+		pthread_join(tids[i], NULL);
+		missed += b[i].missed;
+		b[i].missed = 0;
+	}
+
+	gettimeofday(&end, NULL);
+	free(tids);
+
+	diff = (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
+	if (!diff)
+		diff = 1;
+
+	printf("%s: threads: %d, lookups: %ld, missed: %ld, time: %ld usecs, lookups/sec: %.1f\n",
+			name, thread_num, b->lookups * thread_num, missed, diff,
+			(double)b->lookups * thread_num * 1000000 / diff);
+
+	return (double)b->lookups * thread_num * 1000000 / diff;
+}
+
+int main(int argc, char *argv[])
+{
+	struct dnet_node *n;
+	struct dnet_net_state **states;
+	struct dnet_id *keys;
+	struct dnet_group *g;
+	struct route_bench *b;
+	unsigned int seed = 0;
+	int node_num = 10000, id_num = 100, group_num = 1, thread_num = 1;
+	long lookups = 1000000;
+	double locked, lockfree;
+	int ch, err, i;
+
+	while ((ch = getopt(argc, argv, "n:i:g:l:t:h")) != -1) {
+		switch (ch) {
+			case 'n':
+				node_num = atoi(optarg);
+				break;
+			case 'i':
+				id_num = atoi(optarg);
+				break;
+			case 'g':
+				group_num = atoi(optarg);
+				break;
+			case 'l':
+				lookups = atol(optarg);
+				break;
+			case 't':
+				thread_num = atoi(optarg);
+				break;
+			case 'h':
+			default:
+				route_bench_usage(argv[0]);
+		}
+	}
+
+	if (node_num <= 0 || id_num <= 0 || group_num <= 0 || lookups <= 0 || thread_num <= 0)
+		route_bench_usage(argv[0]);
+
+	n = calloc(1, sizeof(struct dnet_node));
+	states = calloc(node_num, sizeof(struct dnet_net_state *));
+	keys = calloc(ROUTE_BENCH_KEYS, sizeof(struct dnet_id));
+	b = calloc(thread_num, sizeof(struct route_bench));
+	if (!n || !states || !keys || !b) {
+		fprintf(stderr, "Could not allocate benchmark data\n");
+		return -ENOMEM;
+	}
+
+	INIT_LIST_HEAD(&n->group_list);
+	pthread_mutex_init(&n->state_lock, NULL);
+
+	/* States are never freed by lookups, the initial reference is held till exit */
+	for (i = 0; i < node_num; ++i) {
+		states[i] = calloc(1, sizeof(struct dnet_net_state));
+		if (!states[i]) {
+			fprintf(stderr, "Could not allocate benchmark data\n");
+			return -ENOMEM;
+		}
+
+		states[i]->n = n;
+		atomic_init(&states[i]->refcnt, 1);
+	}
+
+	for (i = 0; i < group_num; ++i) {
+		err = route_bench_add_group(n, i + 1, states, node_num, id_num, &seed);
+		if (err) {
+			fprintf(stderr, "Could not create group %d: %s\n", i + 1, strerror(-err));
+			return err;
+		}
+	}
+
+	for (i = 0; i < ROUTE_BENCH_KEYS; ++i) {
+		route_bench_random_id(keys[i].id, &seed);
+		keys[i].group_id = rand_r(&seed) % group_num + 1;
+	}
+
+	for (i = 0; i < thread_num; ++i) {
+		b[i].n = n;
+		b[i].keys = keys;
+		b[i].lookups = lookups;
+	}
+
+	printf("nodes: %d, ids: %d, groups: %d\n", node_num, id_num, group_num);
+
+	locked = route_bench_run(b, thread_num, "locked");
+
+	pthread_mutex_lock(&n->state_lock);
+	list_for_each_entry(g, &n->group_list, group_entry)
+		dnet_route_table_update(n, g);
+	pthread_mutex_unlock(&n->state_lock);
+
+	if (!n->route_table) {
+		fprintf(stderr, "Could not build route table\n");
+		return -ENOMEM;
+	}
+
+	lockfree = route_bench_run(b, thread_num, "lock-free");
+
+	printf("speedup: %.2f\n", lockfree / locked);
+
+	return 0;
+}
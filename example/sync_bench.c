@@ -0,0 +1,234 @@
+/*
+ * Copyright 2008+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Durable writes benchmark: every thread writes small files the same way
+ * filesystem backend does (open/pwrite/close) and makes them durable either
+ * with per-write fsync() or through group commit. Prints writes per second.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "group_commit.h"
+
+struct sync_bench {
+	char			*dir;
+	int			rootfd;
+	int			threads;
+	int			writes;
+	int			size;
+	int			group;
+	struct dnet_group_commit	gc;
+};
+
+struct sync_bench_thread {
+	struct sync_bench	*b;
+	pthread_t		tid;
+	int			idx;
+	int			err;
+};
+
+static void sync_bench_usage(char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -d dir                    - directory to write files into\n"
+			"  -t threads                - number of writing threads (default: 16)\n"
+			"  -n writes                 - number of writes per thread (default: 1000)\n"
+			"  -s size                   - size of every write in bytes (default: 4096)\n"
+			"  -g                        - use group commit instead of per-write fsync()\n"
+			"  -w usecs                  - group commit batch window (default: 0)\n"
+			"  -m usecs                  - group commit maximum delay (default: 0)\n"
+			"  -h                        - this help\n"
+			, p);
+	exit(-1);
+}
+
+static void *sync_bench_process(void *data)
+{
+	struct sync_bench_thread *t = data;
+	struct sync_bench *b = t->b;
+	char file[1024];
+	void *buf;
+	int i, fd, err = 0;
+
+	buf = malloc(b->size);
+	if (!buf) {
+		t->err = -ENOMEM;
+		return NULL;
+	}
+	memset(buf, t->idx, b->size);
+
+	for (i = 0; i < b->writes; ++i) {
+		snprintf(file, sizeof(file), "%s/%d.%d", b->dir, t->idx, i);
+
+		fd = open(file, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			err = -errno;
+			fprintf(stderr, "Failed to open '%s': %s [%d]\n", file, strerror(errno), errno);
+			break;
+		}
+
+		if (pwrite(fd, buf, b->size, 0) != b->size) {
+			err = -errno;
+			fprintf(stderr, "Failed to write '%s': %s [%d]\n", file, strerror(errno), errno);
+			close(fd);
+			break;
+		}
+
+		if (b->group)
+			err = dnet_group_commit_sync(&b->gc, &fd, 1);
+		else if (fsync(fd))
+			err = -errno;
+
+		close(fd);
+
+		if (err) {
+			fprintf(stderr, "Failed to sync '%s': %s [%d]\n", file, strerror(-err), err);
+			break;
+		}
+	}
+
+	free(buf);
+	t->err = err;
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sync_bench b;
+	struct sync_bench_thread *threads;
+	struct dnet_group_commit_stat st;
+	struct timeval start, end;
+	long window = 0, max_delay = 0;
+	double diff;
+	int ch, i, err = 0;
+
+	memset(&b, 0, sizeof(b));
+	b.threads = 16;
+	b.writes = 1000;
+	b.size = 4096;
+
+	while ((ch = getopt(argc, argv, "d:t:n:s:gw:m:h")) != -1) {
+		switch (ch) {
+			case 'd':
+				b.dir = optarg;
+				break;
+			case 't':
+				b.threads = atoi(optarg);
+				break;
+			case 'n':
+				b.writes = atoi(optarg);
+				break;
+			case 's':
+				b.size = atoi(optarg);
+				break;
+			case 'g':
+				b.group = 1;
+				break;
+			case 'w':
+				window = strtol(optarg, NULL, 0);
+				break;
+			case 'm':
+				max_delay = strtol(optarg, NULL, 0);
+				break;
+			case 'h':
+			default:
+				sync_bench_usage(argv[0]);
+				/* not reached */
+		}
+	}
+
+	if (!b.dir || b.threads <= 0 || b.writes <= 0 || b.size <= 0)
+		sync_bench_usage(argv[0]);
+
+	b.rootfd = open(b.dir, O_RDONLY | O_CLOEXEC);
+	if (b.rootfd < 0) {
+		fprintf(stderr, "Failed to open '%s': %s [%d]\n", b.dir, strerror(errno), errno);
+		return -errno;
+	}
+
+	if (b.group) {
+		err = dnet_group_commit_init(&b.gc, b.rootfd, window, max_delay);
+		if (err) {
+			fprintf(stderr, "Failed to start group commit: %s [%d]\n", strerror(-err), err);
+			goto err_out_close;
+		}
+	}
+
+	threads = calloc(b.threads, sizeof(struct sync_bench_thread));
+	if (!threads) {
+		err = -ENOMEM;
+		goto err_out_group_cleanup;
+	}
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < b.threads; ++i) {
+		threads[i].b = &b;
+		threads[i].idx = i;
+
+		err = pthread_create(&threads[i].tid, NULL, sync_bench_process, &threads[i]);
+		if (err) {
+			err = -err;
+			fprintf(stderr, "Failed to start thread: %s [%d]\n", strerror(-err), err);
+			b.threads = i;
+			break;
+		}
+	}
+
+	for (i = 0; i < b.threads; ++i) {
+		pthread_join(threads[i].tid, NULL);
+		if (threads[i].err && !err)
+			err = threads[i].err;
+	}
+
+	gettimeofday(&end, NULL);
+
+	diff = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.;
+
+	printf("%s: threads: %d, writes: %d, size: %d, time: %.3f sec, durable writes/sec: %.1f\n",
+			b.group ? "group-commit" : "fsync", b.threads, b.threads * b.writes, b.size,
+			diff, b.threads * b.writes / diff);
+
+	if (b.group) {
+		dnet_group_commit_get_stat(&b.gc, &st);
+		printf("group-commit: window: %ld usecs, max-delay: %ld usecs, batches: %llu, syncs: %llu, "
+				"writes per batch: %.1f\n",
+				window, max_delay, (unsigned long long)st.batches, (unsigned long long)st.syncs,
+				st.batches ? (double)st.writes / st.batches : 0.);
+	}
+
+	free(threads);
+err_out_group_cleanup:
+	if (b.group)
+		dnet_group_commit_cleanup(&b.gc);
+err_out_close:
+	close(b.rootfd);
+	return err;
+}
@@ -118,6 +118,11 @@ class async_result
 		 */
 		 dnet_time elapsed_time() const;
 
+		/*!
+		 * Returns exceptions policy inherited from session
+		 */
+		 uint32_t exceptions_policy() const;
+
 		/*!
 		 * Blocks current thread until all entries are received, then
 		 * returns all of them as list.
@@ -134,6 +134,7 @@ int dnet_backend_register(struct dnet_config_data *data, struct dnet_config_back
 
 struct dnet_config_backend *dnet_eblob_backend_info(void);
 struct dnet_config_backend *dnet_file_backend_info(void);
+struct dnet_config_backend *dnet_ram_backend_info(void);
 struct dnet_config_backend *dnet_module_backend_info(void);
 
 int dnet_file_backend_init(void);
@@ -0,0 +1,163 @@
+/*
+ * 2008+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef ELLIPTICS_COROUTINE_HPP
+#define ELLIPTICS_COROUTINE_HPP
+
+#include "session.hpp"
+
+/*
+ * Library itself is built as C++0x, coroutines support is header-only
+ * and is available for clients compiled with C++20 coroutines
+ */
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <atomic>
+#include <coroutine>
+
+namespace ioremap { namespace elliptics {
+
+/*!
+ * Executor which is used to resume coroutine awaiting for async_result.
+ *
+ * It receives a function which must be invoked in executor's thread.
+ */
+typedef std::function<void (const std::function<void ()> &)> async_result_executor;
+
+/*!
+ * async_result_awaiter makes async_result awaitable by C++20 coroutines:
+ * \code
+ * std::vector<read_result_entry> result = co_await sess.read_data(id, 0, 0);
+ * \endcode
+ *
+ * Coroutine is suspended until all entries are received and is resumed
+ * with the list of them. If session::throw_at_get flag is activated and
+ * there were errors during procession the request the exception is thrown.
+ *
+ * By default coroutine is resumed right in elliptics IO thread which has
+ * received the last reply, so it must not block there. Use resume_on() to
+ * resume it by user's executor instead.
+ *
+ * \note Awaiter keeps reference to async_result, so it must be awaited
+ * in the same expression where async_result is created, and async_result
+ * can be awaited only once.
+ */
+template <typename T>
+class async_result_awaiter
+{
+	public:
+		async_result_awaiter(async_result<T> &result, const async_result_executor &executor = async_result_executor())
+		: m_result(result), m_state(std::make_shared<state>())
+		{
+			m_state->executor = executor;
+		}
+
+		bool await_ready() const
+		{
+			return m_result.ready();
+		}
+
+		/*
+		 * Final handler may be invoked right from connect() if result has been completed
+		 * after await_ready(), in this case coroutine is not suspended at all.
+		 * Otherwise whoever is the second of final handler and await_suspend() resumes it.
+		 */
+		bool await_suspend(std::coroutine_handle<> handle)
+		{
+			std::shared_ptr<state> st = m_state;
+
+			st->handle = handle;
+			m_result.connect([st] (const std::vector<T> &results, const error_info &error) {
+				st->results = results;
+				st->error = error;
+
+				if (st->completed.exchange(true))
+					st->resume();
+			});
+
+			return !st->completed.exchange(true);
+		}
+
+		std::vector<T> await_resume()
+		{
+			// await_ready() has found result completed, there was no suspension
+			if (!m_state->completed)
+				return m_result.get();
+
+			if (m_state->error && (m_result.exceptions_policy() & session::throw_at_get))
+				m_state->error.throw_error();
+
+			return std::move(m_state->results);
+		}
+
+	private:
+		struct state
+		{
+			void resume()
+			{
+				if (executor) {
+					std::coroutine_handle<> h = handle;
+					executor([h] () { h.resume(); });
+				} else {
+					handle.resume();
+				}
+			}
+
+			async_result_executor executor;
+			std::coroutine_handle<> handle;
+			std::atomic<bool> completed{false};
+			std::vector<T> results;
+			error_info error;
+		};
+
+		async_result<T> &m_result;
+		std::shared_ptr<state> m_state;
+};
+
+template <typename T>
+async_result_awaiter<T> operator co_await(async_result<T> &result)
+{
+	return async_result_awaiter<T>(result);
+}
+
+template <typename T>
+async_result_awaiter<T> operator co_await(async_result<T> &&result)
+{
+	return async_result_awaiter<T>(result);
+}
+
+/*!
+ * Returns awaiter which resumes coroutine by \a executor:
+ * \code
+ * auto result = co_await resume_on(sess.lookup(id), executor);
+ * \endcode
+ */
+template <typename T>
+async_result_awaiter<T> resume_on(async_result<T> &&result, const async_result_executor &executor)
+{
+	return async_result_awaiter<T>(result, executor);
+}
+
+template <typename T>
+async_result_awaiter<T> resume_on(async_result<T> &result, const async_result_executor &executor)
+{
+	return async_result_awaiter<T>(result, executor);
+}
+
+}} /* namespace ioremap::elliptics */
+
+#endif /* __cpp_impl_coroutine */
+
+#endif // ELLIPTICS_COROUTINE_HPP
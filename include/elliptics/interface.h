@@ -153,6 +153,32 @@ struct dnet_io_control {
  */
 int dnet_read_object(struct dnet_session *s, struct dnet_io_control *ctl);
 
+/*
+ * Takes ownership of the receive buffer of reply @cmd while it is being passed
+ * to completion callback, so its data can be used without copying.
+ * There is room for struct dnet_addr right before @cmd in the buffer.
+ *
+ * Returns malloc()'ed block to be freed by the caller, reply stays valid until then.
+ * Returns NULL if @cmd is not a received reply (for example transaction
+ * is being destroyed) or its buffer was already adopted.
+ */
+void *dnet_reply_adopt(struct dnet_cmd *cmd);
+
+/*
+ * IO batch collects read, write and lookup requests described by dnet_io_control
+ * (with group set in ctl->id) and sends all requests which go to the same node
+ * by single network write. Requests with file descriptor or large data
+ * are sent immediately by dnet_io_batch_add().
+ *
+ * Every added request gets exactly one completion with destroy flag,
+ * dnet_io_batch_add() returns negative error if it was already called.
+ * dnet_io_batch_send() sends collected requests and frees the batch.
+ */
+struct dnet_io_batch;
+struct dnet_io_batch *dnet_io_batch_alloc(struct dnet_session *s);
+int dnet_io_batch_add(struct dnet_io_batch *b, struct dnet_io_control *ctl);
+int dnet_io_batch_send(struct dnet_io_batch *b);
+
 int dnet_search_range(struct dnet_node *n, struct dnet_id *id,
 		struct dnet_raw_id *start, struct dnet_raw_id *next);
 
@@ -230,7 +256,7 @@ enum dnet_log_level {
  */
 #define DNET_CFG_JOIN_NETWORK		(1<<0)		/* given node joins network and becomes part of the storage */
 #define DNET_CFG_NO_ROUTE_LIST		(1<<1)		/* do not request route table from remote nodes */
-#define DNET_CFG_MIX_STATES		(1<<2)		/* mix states according to their weights before reading data */
+#define DNET_CFG_MIX_STATES		(1<<2)		/* order replicas by latency, load and timeouts before reading data */
 #define DNET_CFG_NO_CSUM		(1<<3)		/* globally disable checksum verification and update */
 #define DNET_CFG_RANDOMIZE_STATES	(1<<5)		/* randomize states for read requests */
 #define DNET_CFG_KEEPS_IDS_IN_CLUSTER	(1<<6)		/* keeps ids in elliptics cluster */
@@ -255,12 +281,36 @@ struct dnet_iterator_ctl {
 	void				*callback_private;
 	int				(* callback)(void *priv, struct dnet_raw_id *key,
 			void *data, uint64_t dsize, struct dnet_ext_list *elist);
+
+	/*
+	 * Optional checkpoints support.
+	 * Backend skips records before @start and from time to time reports position
+	 * which iteration can be resumed from: all records before it have already
+	 * been passed to @callback. Backends which do not support it ignore both.
+	 */
+	struct dnet_iterator_position	start;
+	void				(* checkpoint)(void *priv, struct dnet_iterator_position *position);
+
+	/*
+	 * Optional key filter.
+	 * Backend calls it before touching record's data or metadata and skips
+	 * the record if it returns 0. Backends which do not support it pass
+	 * every record to @callback.
+	 */
+	int				(* key_filter)(void *priv, struct dnet_raw_id *key);
+
+	/*
+	 * DNET_IFLAGS_* of the iteration. If DNET_IFLAGS_DATA is not set,
+	 * @callback does not look at the data and backend may avoid reading it.
+	 */
+	uint64_t			flags;
 };
 
 /*
  * Iterator result container routines
  */
 int dnet_iterator_response_container_sort(int fd, size_t size);
+int dnet_iterator_response_container_sort_ext(int fd, size_t size, size_t memory_limit, int thread_num);
 int dnet_iterator_response_container_append(const struct dnet_iterator_response
 		*response, int fd, uint64_t pos);
 int dnet_iterator_response_container_read(int fd, uint64_t pos,
@@ -268,6 +318,17 @@ int dnet_iterator_response_container_read(int fd, uint64_t pos,
 int64_t dnet_iterator_response_container_diff(int diff_fd, int left_fd, uint64_t left_size,
 		int right_fd, uint64_t right_size);
 
+/*
+ * Buffered container writer, records are written at @pos and further.
+ * Appended records are not visible in container until writer is flushed.
+ */
+struct dnet_iterator_container_writer;
+struct dnet_iterator_container_writer *dnet_iterator_container_writer_create(int fd, uint64_t pos);
+int dnet_iterator_container_writer_append(struct dnet_iterator_container_writer *w,
+		const struct dnet_iterator_response *response);
+int dnet_iterator_container_writer_flush(struct dnet_iterator_container_writer *w);
+void dnet_iterator_container_writer_destroy(struct dnet_iterator_container_writer *w);
+
 struct dnet_backend_callbacks {
 	/* command handler processes DNET_CMD_* commands */
 	int			(* command_handler)(void *state, void *priv, struct dnet_cmd *cmd, void *data);
@@ -291,6 +352,12 @@ struct dnet_backend_callbacks {
 	 */
 	int			(* checksum)(struct dnet_node *n, void *priv, struct dnet_id *id, void *csum, int *csize);
 
+	/*
+	 * reads timestamp of the record stored for @id into @ts
+	 * without reading its data, returns -ENOENT if there is no such record
+	 */
+	int			(* lookup_timestamp)(struct dnet_node *n, void *priv, struct dnet_id *id, struct dnet_time *ts);
+
 	/*
 	 * Iterator.
 	 * Invokes callback on each record's data and metadata.
@@ -429,8 +496,24 @@ struct dnet_config
 	 */
 	unsigned int		monitor_port;
 
+	/*
+	 * Change journal: number of records in one segment (0 disables journal)
+	 * and number of segments after which the oldest ones are compacted
+	 */
+	int			journal_segment_records;
+	int			journal_segments;
+
+	/*
+	 * Background IO scheduler: foreground p99 latency target in usecs (0 disables adaptation)
+	 * and budgets of background IO classes in MB/s (0 is unlimited)
+	 */
+	int			io_sched_latency_target;
+	int			io_sched_iterator_rate;
+	int			io_sched_sync_rate;
+	int			io_sched_recovery_rate;
+
 	/* so that we do not change major version frequently */
-	int			reserved_for_future_use[8 - (sizeof(unsigned int*) / sizeof(int))];
+	int			reserved_for_future_use[2 - (sizeof(unsigned int*) / sizeof(int))];
 };
 
 struct dnet_node *dnet_get_node_from_state(void *state);
@@ -607,6 +690,19 @@ int dnet_node_state_num(struct dnet_node *n);
 struct dnet_net_state *dnet_state_get_first(struct dnet_node *n, struct dnet_id *id);
 void dnet_state_put(struct dnet_net_state *st);
 
+/*
+ * Returns expected reply time in usecs of the state responsible for @id:
+ * its latency estimate plus timeout penalty, or negative error if there is no such state.
+ */
+long dnet_state_latency(struct dnet_node *n, struct dnet_id *id);
+
+/*
+ * Returns latency in usecs which is not exceeded by @permille of successful requests
+ * sent to the state responsible for @id since it was connected (999 gives p99.9),
+ * -ENOENT if there were no such requests or -ENXIO if there is no such state.
+ */
+long dnet_state_latency_percentile(struct dnet_node *n, struct dnet_id *id, int permille);
+
 #define DNET_DUMP_NUM	6
 #define DNET_DUMP_ID_LEN(name, id_struct, data_length) \
 	char name[2 * DNET_ID_SIZE + 16 + 3]; \
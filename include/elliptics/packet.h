@@ -66,6 +66,9 @@ enum dnet_commands {
 	DNET_CMD_INDEXES_INTERNAL,		/* Update identificators table for certain secondary index. Internal usage only */
 	DNET_CMD_INDEXES_FIND,		/* Find all objects by indexes */
 	DNET_CMD_MONITOR_STAT,		/* Gather monitor json statistics */
+	DNET_CMD_RANGE_HASH,			/* Get hashes of keys and timestamps in given key ranges */
+	DNET_CMD_COPY,				/* Copy local records to other groups directly from this node */
+	DNET_CMD_IO_SCHED,			/* Get or change background IO scheduler budgets */
 	DNET_CMD_UNKNOWN,			/* This slot is allocated for statistics gathered for unknown commands */
 	__DNET_CMD_MAX,
 };
@@ -372,6 +375,14 @@ static inline void dnet_convert_list(struct dnet_list *l)
  */
 #define DNET_IO_FLAGS_WRITE_NO_FILE_INFO	(1<<14)
 
+/*
+ * DNET_IO_FLAGS_NEWER
+ *
+ * Write only if stored record is older than dnet_io_attr.timestamp,
+ * otherwise write fails with -EALREADY
+ */
+#define DNET_IO_FLAGS_NEWER		(1<<15)
+
 /*
  * DNET_INDEXES_FLAGS_INTERSECT
  *
@@ -826,9 +837,34 @@ enum {
 #define DNET_IFLAGS_KEY_RANGE		(1<<1)
 /* When set timestamp range is used */
 #define DNET_IFLAGS_TS_RANGE		(1<<2)
+/*
+ * When set change journal is iterated instead of backend starting from dnet_iterator_request.journal_seq,
+ * response contains every change of the key, not only the last one.
+ * If journal does not cover all changes since journal_seq (or time_begin if DNET_IFLAGS_TS_RANGE is set),
+ * iterator fails with -ERANGE. Can not be used with DNET_IFLAGS_DATA.
+ */
+#define DNET_IFLAGS_JOURNAL		(1<<3)
+/* When set only keys with (user_flags & user_flags_mask) == user_flags_value are sent */
+#define DNET_IFLAGS_USER_FLAGS		(1<<4)
+/* When set only keys with size in [size_begin, size_end] are sent */
+#define DNET_IFLAGS_SIZE_RANGE		(1<<5)
+/*
+ * When set only sample_rate of every DNET_ITERATOR_SAMPLE_SCALE keys are sent.
+ * Choice depends only on the key, so the same keys are chosen on every node and on every run.
+ */
+#define DNET_IFLAGS_SAMPLE		(1<<6)
+/*
+ * When set together with DNET_IFLAGS_DATA only data_size bytes of data starting from data_offset
+ * are sent (till the end if data_size is zero), response size still contains the whole size.
+ */
+#define DNET_IFLAGS_DATA_RANGE		(1<<7)
 /* Sanity */
 #define DNET_IFLAGS_ALL			(DNET_IFLAGS_DATA	\
-		| DNET_IFLAGS_KEY_RANGE | DNET_IFLAGS_TS_RANGE)
+		| DNET_IFLAGS_KEY_RANGE | DNET_IFLAGS_TS_RANGE | DNET_IFLAGS_JOURNAL	\
+		| DNET_IFLAGS_USER_FLAGS | DNET_IFLAGS_SIZE_RANGE | DNET_IFLAGS_SAMPLE	\
+		| DNET_IFLAGS_DATA_RANGE)
+
+#define DNET_ITERATOR_SAMPLE_SCALE	1000000
 
 /*
  * Defines how iterator should behave
@@ -866,6 +902,24 @@ struct dnet_iterator_range
 	struct dnet_raw_id	key_end;	/* End key */
 } __attribute__ ((packed));
 
+/*
+ * Iterator checkpoint: position in the backend which iteration can be resumed from.
+ * It is opaque for client, for eblob backend it is number of blob since
+ * the first one and offset of the record in its index.
+ * Zero position is the beginning of the backend.
+ */
+struct dnet_iterator_position
+{
+	uint64_t		blob;
+	uint64_t		offset;
+} __attribute__ ((packed));
+
+static inline void dnet_convert_iterator_position(struct dnet_iterator_position *p)
+{
+	p->blob = dnet_bswap64(p->blob);
+	p->offset = dnet_bswap64(p->offset);
+}
+
 /*
  * Iteration request
  */
@@ -878,12 +932,31 @@ struct dnet_iterator_request
 	struct dnet_time		time_end;	/* End time */
 	uint32_t			itype;		/* Callback to use: Net/File, XXX: enum */
 	uint64_t			flags;		/* DNET_IFLAGS_* */
-	uint64_t			reserved[5];
+	uint64_t			journal_seq;	/* First journal record to send if DNET_IFLAGS_JOURNAL is set */
+	uint64_t			user_flags_mask;	/* DNET_IFLAGS_USER_FLAGS */
+	uint64_t			user_flags_value;
+	uint64_t			size_begin;	/* DNET_IFLAGS_SIZE_RANGE, inclusive */
+	uint64_t			size_end;
+	uint64_t			data_offset;	/* DNET_IFLAGS_DATA_RANGE */
+	uint64_t			data_size;
+	uint32_t			sample_rate;	/* DNET_IFLAGS_SAMPLE, per DNET_ITERATOR_SAMPLE_SCALE keys */
+	uint32_t			reserved1;
+	struct dnet_iterator_position	position;	/* Resume iteration from this checkpoint */
+	uint64_t			reserved[2];
 } __attribute__ ((packed));
 
 static inline void dnet_convert_iterator_request(struct dnet_iterator_request *r)
 {
 	r->flags = dnet_bswap64(r->flags);
+	r->journal_seq = dnet_bswap64(r->journal_seq);
+	r->user_flags_mask = dnet_bswap64(r->user_flags_mask);
+	r->user_flags_value = dnet_bswap64(r->user_flags_value);
+	r->size_begin = dnet_bswap64(r->size_begin);
+	r->size_end = dnet_bswap64(r->size_end);
+	r->data_offset = dnet_bswap64(r->data_offset);
+	r->data_size = dnet_bswap64(r->data_size);
+	r->sample_rate = dnet_bswap32(r->sample_rate);
+	dnet_convert_iterator_position(&r->position);
 	r->id = dnet_bswap64(r->id);
 	r->itype = dnet_bswap32(r->itype);
 	r->action = dnet_bswap32(r->action);
@@ -904,16 +977,161 @@ struct dnet_iterator_response
 	struct dnet_time		timestamp;	/* Timestamp from extended header */
 	uint64_t			user_flags;	/* User flags set in extended header */
 	uint64_t			size;
-	uint64_t			reserved[4];
+	uint64_t			journal_seq;	/* Journal record sequence number, DNET_IFLAGS_JOURNAL only */
+	uint32_t			cmd;		/* DNET_CMD_WRITE or DNET_CMD_DEL, DNET_IFLAGS_JOURNAL only */
+	uint32_t			reserved1;
+	struct dnet_iterator_position	position;	/* The last checkpoint, iteration may be resumed from it */
 } __attribute__ ((packed));
 
 static inline void dnet_convert_iterator_response(struct dnet_iterator_response *r)
 {
 	r->status = dnet_bswap32(r->status);
+	r->journal_seq = dnet_bswap64(r->journal_seq);
+	r->cmd = dnet_bswap32(r->cmd);
+	dnet_convert_iterator_position(&r->position);
 	r->user_flags = dnet_bswap32(r->user_flags);
 	dnet_convert_time(&r->timestamp);
 }
 
+/*
+ * Range hash request
+ *
+ * Key space is split into 2^depth cells, every cell contains keys
+ * which share the first @depth bits. Reply contains dnet_range_hash
+ * for every cell which intersects any of @range_num dnet_iterator_range
+ * structures following the request, cells are sorted by prefix.
+ * Replicas with equal (count, hash) pair of the cell store the same keys
+ * with the same timestamps, so recovery only has to iterate cells which differ.
+ */
+#define DNET_RANGE_HASH_DEPTH_MAX	16
+
+struct dnet_range_hash_request
+{
+	uint64_t			flags;
+	uint32_t			depth;		/* Number of key bits in cell prefix */
+	uint32_t			range_num;	/* Number of ranges following the request */
+	uint64_t			reserved[4];
+} __attribute__ ((packed));
+
+static inline void dnet_convert_range_hash_request(struct dnet_range_hash_request *r)
+{
+	r->flags = dnet_bswap64(r->flags);
+	r->depth = dnet_bswap32(r->depth);
+	r->range_num = dnet_bswap32(r->range_num);
+}
+
+struct dnet_range_hash
+{
+	uint32_t			prefix;		/* First @depth bits of keys in the cell */
+	uint32_t			depth;
+	uint64_t			count;		/* Number of keys in the cell */
+	uint64_t			hash;		/* Sum of hashes of keys and their timestamps */
+	uint64_t			reserved[2];
+} __attribute__ ((packed));
+
+static inline void dnet_convert_range_hash(struct dnet_range_hash *h)
+{
+	h->prefix = dnet_bswap32(h->prefix);
+	h->depth = dnet_bswap32(h->depth);
+	h->count = dnet_bswap64(h->count);
+	h->hash = dnet_bswap64(h->hash);
+}
+
+/*
+ * Copy request
+ *
+ * Request is followed by @group_num uint32_t destination groups
+ * and @key_num dnet_raw_id keys. Node reads every key from its backend
+ * and writes it to the nodes responsible for the key in every destination group.
+ * Reply contains dnet_copy_status for every (key, group) pair, key-major.
+ */
+#define DNET_COPY_FLAGS_NEWER		(1<<0)	/* Do not overwrite records with the same or newer timestamp */
+
+struct dnet_copy_request
+{
+	uint64_t			flags;
+	uint32_t			group_num;	/* Number of destination groups following the request */
+	uint32_t			key_num;	/* Number of keys following the groups */
+	uint64_t			reserved[4];
+} __attribute__ ((packed));
+
+static inline void dnet_convert_copy_request(struct dnet_copy_request *r)
+{
+	r->flags = dnet_bswap64(r->flags);
+	r->group_num = dnet_bswap32(r->group_num);
+	r->key_num = dnet_bswap32(r->key_num);
+}
+
+struct dnet_copy_status
+{
+	struct dnet_raw_id		key;
+	uint32_t			group_id;	/* Destination group */
+	int32_t				status;		/* Write status, -EALREADY if destination record is not older,
+							   -ELOOP if this node is responsible for the key in destination group */
+	uint64_t			size;		/* Record size */
+	uint64_t			reserved[2];
+} __attribute__ ((packed));
+
+static inline void dnet_convert_copy_status(struct dnet_copy_status *s)
+{
+	s->group_id = dnet_bswap32(s->group_id);
+	s->status = dnet_bswap32(s->status);
+	s->size = dnet_bswap64(s->size);
+}
+
+/*
+ * Classes of IO accounted by node-wide IO scheduler.
+ * Foreground requests are never delayed, their latency drives budgets of the other classes.
+ */
+enum dnet_io_class {
+	DNET_IO_CLASS_FOREGROUND = 0,	/* Client reads, writes, lookups and removals */
+	DNET_IO_CLASS_ITERATOR,		/* Server-side iterators */
+	DNET_IO_CLASS_DEFRAG,		/* Defragmentation, it is not started while foreground is slow */
+	DNET_IO_CLASS_SYNC,		/* Cache write-back */
+	DNET_IO_CLASS_RECOVERY,		/* Server-side copy used by recovery */
+	__DNET_IO_CLASS_MAX
+};
+
+/* Number of class slots in dnet_io_sched_ctl, so that new classes do not change its size */
+#define DNET_IO_SCHED_CLASSES		8
+
+/* Apply dnet_io_sched_ctl.latency_target */
+#define DNET_IO_SCHED_FLAGS_SET_LATENCY	(1<<0)
+/* Apply dnet_io_sched_ctl.rate */
+#define DNET_IO_SCHED_FLAGS_SET_RATE	(1<<1)
+
+/*
+ * DNET_CMD_IO_SCHED request and reply.
+ * Request changes parameters specified by flags, reply contains current state.
+ */
+struct dnet_io_sched_ctl
+{
+	uint64_t			flags;
+	uint64_t			latency_target;	/* Foreground p99 latency target, usecs, 0 disables adaptation */
+	uint64_t			latency_p99;	/* Reply only: foreground p99 latency in the last interval, usecs */
+	uint64_t			rate[DNET_IO_SCHED_CLASSES];		/* Configured budgets, bytes/s, 0 is unlimited */
+	uint64_t			current_rate[DNET_IO_SCHED_CLASSES];	/* Reply only: budgets adapted to foreground latency */
+	uint64_t			bytes[DNET_IO_SCHED_CLASSES];		/* Reply only: accounted bytes */
+	uint64_t			wait_time[DNET_IO_SCHED_CLASSES];	/* Reply only: time spent waiting for budget, usecs */
+	uint64_t			reserved[4];
+} __attribute__ ((packed));
+
+static inline void dnet_convert_io_sched_ctl(struct dnet_io_sched_ctl *ctl)
+{
+	int i;
+
+	ctl->flags = dnet_bswap64(ctl->flags);
+	ctl->latency_target = dnet_bswap64(ctl->latency_target);
+	ctl->latency_p99 = dnet_bswap64(ctl->latency_p99);
+
+	for (i = 0; i < DNET_IO_SCHED_CLASSES; ++i) {
+		ctl->rate[i] = dnet_bswap64(ctl->rate[i]);
+		ctl->current_rate[i] = dnet_bswap64(ctl->current_rate[i]);
+		ctl->bytes[i] = dnet_bswap64(ctl->bytes[i]);
+		ctl->wait_time[i] = dnet_bswap64(ctl->wait_time[i]);
+	}
+}
+
 /*
  * Indexes request entry
  */
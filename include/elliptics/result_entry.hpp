@@ -21,8 +21,11 @@
 #include "elliptics/async_result.hpp"
 
 #include <map>
+#include <memory>
 #include <vector>
 
+struct dnet_iterator_container_writer;
+
 namespace ioremap { namespace elliptics {
 
 class callback_result_data;
@@ -216,9 +219,11 @@ class iterator_result_container
 			: m_fd(fd), m_sorted(sorted), m_write_position(write_position) {
 				m_count = m_write_position / sizeof(dnet_iterator_response);
 			}
-		// Appends one result to container
+		// Appends one result to container, appended results are buffered
 		void append(const iterator_result_entry &result);
 		void append(const dnet_iterator_response *response);
+		// Writes buffered results to container file
+		void flush() const;
 		// Sorts container
 		void sort();
 		//! Puts difference between \a this and \a other into \a diff
@@ -230,6 +235,10 @@ class iterator_result_container
 		bool m_sorted;
 		uint64_t m_count;
 		uint64_t m_write_position;
+
+	private:
+		// Shared by copies of container, flushed when the last one is destroyed
+		std::shared_ptr<dnet_iterator_container_writer> m_writer;
 };
 
 typedef lookup_result_entry write_result_entry;
@@ -150,6 +150,19 @@ class file_logger : public logger
 
 class node_data;
 class session_data;
+class session_batch;
+class batch_data;
+
+/*!
+ * Statistics of node's read cache
+ */
+struct read_cache_stats
+{
+	uint64_t		hits;
+	uint64_t		misses;
+	uint64_t		entries;
+	uint64_t		size;
+};
 
 class node
 {
@@ -170,6 +183,20 @@ class node
 
 		void			set_keepalive(int idle, int cnt, int interval);
 
+		/*!
+		 * Sets percent of reads which may be additionally sent
+		 * to the next group by sessions with hedged reads enabled
+		 */
+		void			set_hedge_budget(int percent);
+
+		/*!
+		 * Sets size of client-side cache of objects read by sessions with
+		 * cached reads enabled, entries expire after \a lifetime milliseconds.
+		 * Zero \a max_size (default) disables and clears the cache.
+		 */
+		void			set_read_cache(size_t max_size, long lifetime);
+		read_cache_stats	get_read_cache_stats() const;
+
 		logger get_log() const;
 		dnet_node *	get_native();
 		dnet_node *	get_native() const;
@@ -368,6 +395,28 @@ class session
 		void			set_trace_id(uint32_t trace_id);
 		uint32_t		get_trace_id();
 
+		/*!
+		 * Sets/gets hedged reads delay in microseconds.
+		 *
+		 * If group being read does not reply within \a usecs, the same read
+		 * is sent to the next group and the first successful reply wins.
+		 * Zero derives delay from the latency of the replica being read,
+		 * negative value (default) disables hedged reads.
+		 * Number of hedged reads is limited by node::set_hedge_budget().
+		 */
+		void			set_hedge_delay(long usecs);
+		long			get_hedge_delay() const;
+
+		/*!
+		 * Sets/gets whether whole object reads are served by node's read cache.
+		 *
+		 * Cached object is returned without network round trip until it expires
+		 * or is written/removed through the same node, so changes made by other
+		 * clients are seen after cache lifetime passed.
+		 */
+		void			set_cached_reads(bool cached);
+		bool			get_cached_reads() const;
+
 		/*!
 		 * Read file by key \a id to \a file by \a offset and \a size.
 		 */
@@ -426,6 +475,23 @@ class session
 		 */
 		async_read_result read_latest(const key &id, uint64_t offset, uint64_t size);
 
+		/*!
+		 * Reads the latest data from server by the key \a id, \a offset and \a size
+		 * in a single round trip: read limited to \a size_limit bytes is sent
+		 * to all groups at once and reply with the latest timestamp wins.
+		 * Result is returned once the majority of groups have replied,
+		 * the rest are not waited for unless none of replied groups has the object.
+		 *
+		 * If the latest object does not fit into \a size_limit, the rest of it
+		 * is read by the second request to the groups ordered by their timestamps
+		 * and joined with already received part. If the rest belongs to another
+		 * version of the object, the whole range is read again.
+		 * Zero \a size_limit is the same as read_latest() with lookups.
+		 *
+		 * Returns async_read_result.
+		 */
+		async_read_result read_latest(const key &id, uint64_t offset, uint64_t size, uint64_t size_limit);
+
 		/*!
 		 * Writes data to server by the dnet_io_control \a ctl.
 		 *
@@ -628,14 +694,69 @@ class session
 		 */
 		std::vector<std::pair<dnet_id, dnet_addr> > get_routes();
 
+		/*!
+		 * Starts iterator described by \a request on the node responsible for \a id.
+		 * Besides type, flags and time range \a request may contain filters enabled by
+		 * DNET_IFLAGS_USER_FLAGS, DNET_IFLAGS_SIZE_RANGE, DNET_IFLAGS_SAMPLE and DNET_IFLAGS_DATA_RANGE.
+		 * Action and number of ranges are set by the session.
+		 */
+		async_iterator_result start_iterator(const key &id, const std::vector<dnet_iterator_range>& ranges,
+								const dnet_iterator_request &request);
 		async_iterator_result start_iterator(const key &id, const std::vector<dnet_iterator_range>& ranges,
 								uint32_t type, uint64_t flags,
 								const dnet_time& time_begin = dnet_time(),
 								const dnet_time& time_end = dnet_time());
+		/*!
+		 * Sends changes (writes and removals) made on the node responsible for \a id
+		 * since \a journal_seq change journal record, or since \a time_begin if DNET_IFLAGS_TS_RANGE is set.
+		 * Every response contains journal_seq and cmd of the change, iteration may be continued
+		 * from the last received journal_seq + 1 later.
+		 *
+		 * Fails with -ERANGE if journal does not cover all requested changes and with -ENOTSUP
+		 * if journal is disabled on the node, full iterator should be used then.
+		 */
+		async_iterator_result start_journal_iterator(const key &id, const std::vector<dnet_iterator_range>& ranges,
+								uint64_t flags, uint64_t journal_seq,
+								const dnet_time& time_begin = dnet_time(),
+								const dnet_time& time_end = dnet_time());
 		async_iterator_result pause_iterator(const key &id, uint64_t iterator_id);
 		async_iterator_result continue_iterator(const key &id, uint64_t iterator_id);
 		async_iterator_result cancel_iterator(const key &id, uint64_t iterator_id);
 
+		/*!
+		 * Requests hashes of keys and their timestamps stored by the node responsible for \a id
+		 * in the first group. Key space is split into 2^\a depth cells, result data contains
+		 * dnet_range_hash for every cell which intersects \a ranges (the whole key space if empty).
+		 *
+		 * Replicas with equal cell hashes store the same keys, so only differing cells
+		 * have to be iterated during recovery.
+		 */
+		async_generic_result range_hash(const key &id, const std::vector<dnet_iterator_range> &ranges, uint32_t depth);
+
+		/*!
+		 * Asks the node responsible for \a id in the first group to copy \a keys
+		 * from its storage to \a groups. Data is sent from node to node and never reaches the client.
+		 * \a flags are DNET_COPY_FLAGS_*, with DNET_COPY_FLAGS_NEWER records which are not older
+		 * than stored in destination group are skipped with -EALREADY status.
+		 *
+		 * Result data contains dnet_copy_status for every (key, group) pair.
+		 */
+		async_generic_result copy(const key &id, const std::vector<dnet_raw_id> &keys,
+				const std::vector<int> &groups, uint64_t flags);
+
+		/*!
+		 * Sends \a ctl to the IO scheduler of the node responsible for \a id in the first group.
+		 * Latency target and budgets are changed if DNET_IO_SCHED_FLAGS_* are set in \a ctl.flags.
+		 *
+		 * Result data contains dnet_io_sched_ctl with current state of the scheduler.
+		 */
+		async_generic_result io_sched(const key &id, const dnet_io_sched_ctl &ctl);
+
+		/*!
+		 * Returns batch which collects requests of this session and sends them at once.
+		 */
+		session_batch batch();
+
 		/*!
 		 * Starts execution for \a id of the given \a event with \a data.
 		 *
@@ -780,6 +901,57 @@ class session
 		async_find_indexes_result find_indexes_internal(const std::vector<dnet_raw_id> &indexes, bool intersect);
 
 		error_info mix_states(const key &id, std::vector<int> &groups) __attribute__((warn_unused_result));
+
+		friend class session_batch;
+};
+
+/*!
+ * Collects read, write and lookup requests and sends them at once:
+ * requests to the same node are packed into single network write
+ * and replies of all of them are delivered by single async_result.
+ *
+ * Unlike session methods failed reads and lookups are not retried in other groups.
+ */
+class session_batch
+{
+	public:
+		explicit session_batch(const session &sess);
+		session_batch(const session_batch &other);
+		~session_batch();
+
+		session_batch &operator =(const session_batch &other);
+
+		/*!
+		 * Reads \a size bytes of \a id at \a offset from the first group of session::mix_states().
+		 */
+		void read_data(const key &id, uint64_t offset, uint64_t size);
+
+		/*!
+		 * Writes \a file to \a id at \a remote_offset to all groups of the session.
+		 */
+		void write_data(const key &id, const data_pointer &file, uint64_t remote_offset);
+
+		/*!
+		 * Looks up \a id in the first group of session::mix_states().
+		 */
+		void lookup(const key &id);
+
+		/*!
+		 * Returns number of collected requests.
+		 */
+		size_t size() const;
+
+		/*!
+		 * Sends collected requests, batch becomes empty.
+		 *
+		 * Returns async_generic_result with replies to all requests, their
+		 * entries may be cast to read_result_entry or lookup_result_entry
+		 * according to the command.
+		 */
+		async_generic_result execute();
+
+	private:
+		std::shared_ptr<batch_data> m_data;
 };
 
 }} /* namespace ioremap::elliptics */
@@ -233,6 +233,20 @@ class data_pointer_base
 			return tmp;
 		}
 
+		/*
+		 * Takes ownership of malloc()'ed \a block which holds \a size bytes at \a data.
+		 * Reference counter is placed at the beginning of the block, so the first
+		 * sizeof(atomic_type) bytes of it must not be used by \a data.
+		 */
+		static data_pointer_base adopt(void *block, void *data, size_t size)
+		{
+			data_pointer_base tmp;
+			tmp.m_counter = new (block) atomic_type(1);
+			tmp.m_data = data;
+			tmp.m_size = size;
+			return tmp;
+		}
+
 		static data_pointer_base from_raw(void *data, size_t size)
 		{
 			data_pointer_base pointer;
@@ -0,0 +1,573 @@
+/*
+ * Copyright 2008+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Server-to-server copy.
+ *
+ * Every key is read through the usual local command path into a private state
+ * which never sends anything, read reply (descriptor and offset in the blob or
+ * data in memory) is turned into WRITE transaction and queued to the node
+ * responsible for the key in destination group, so data goes from local storage
+ * to the destination socket via sendfile() and never reaches the client.
+ *
+ * Copy does not block processing thread: reply with per-key statuses and the
+ * final ack are sent to the client when the last write transaction completes.
+ * Writes share recovery budget of the IO scheduler, if it is exhausted they are
+ * deferred to the scheduler thread instead of waiting in the IO thread.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+struct dnet_copy_ctl;
+
+struct dnet_copy_entry {
+	struct dnet_copy_ctl	*ctl;
+	struct dnet_copy_status	*status;
+};
+
+struct dnet_copy_ctl {
+	atomic_t		refcnt;		/* In-flight writes plus request handler itself */
+	struct dnet_net_state	*st;
+	struct dnet_cmd		cmd;
+	int			num;
+	struct dnet_copy_entry	*entries;
+	struct dnet_copy_status	status[0];
+};
+
+/*
+ * Writes of one key into all destination groups, they may be deferred by IO scheduler
+ */
+struct dnet_copy_key {
+	struct dnet_node	*n;
+	struct dnet_copy_entry	*entries;
+	int			num;
+	uint64_t		flags;
+	struct dnet_io_req	*r;
+};
+
+static int dnet_local_state_process(struct dnet_net_state *st __unused, struct epoll_event *ev __unused)
+{
+	return 0;
+}
+
+/*
+ * Creates state which collects replies in its send list instead of sending them
+ */
+static struct dnet_net_state *dnet_local_state_create(struct dnet_node *n)
+{
+	struct dnet_net_state *st;
+	struct dnet_addr addr;
+	int err;
+
+	st = malloc(sizeof(struct dnet_net_state));
+	if (!st)
+		goto err_out_exit;
+
+	memset(st, 0, sizeof(struct dnet_net_state));
+	memset(&addr, 0, sizeof(struct dnet_addr));
+
+	st->__need_exit = -1;
+	st->write_s = -1;
+	st->read_s = -1;
+
+	err = dnet_state_micro_init(st, n, &addr, 0, dnet_local_state_process);
+	if (err)
+		goto err_out_free;
+
+	return st;
+
+err_out_free:
+	free(st);
+err_out_exit:
+	return NULL;
+}
+
+static void dnet_local_state_clear(struct dnet_net_state *st)
+{
+	struct dnet_io_req *r, *tmp;
+
+	list_for_each_entry_safe(r, tmp, &st->send_list, req_entry) {
+		list_del(&r->req_entry);
+		dnet_io_req_free(r);
+	}
+}
+
+/*
+ * Returns the first reply with data queued into local state, it is removed from the list
+ */
+static struct dnet_io_req *dnet_local_state_reply(struct dnet_net_state *st, int *errp)
+{
+	struct dnet_io_req *r, *tmp;
+	struct dnet_cmd *cmd;
+
+	*errp = -ENOENT;
+
+	list_for_each_entry_safe(r, tmp, &st->send_list, req_entry) {
+		cmd = r->header ? r->header : r->data;
+
+		if (cmd->status) {
+			*errp = cmd->status;
+			break;
+		}
+
+		if (cmd->size) {
+			list_del(&r->req_entry);
+			*errp = 0;
+			return r;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Reads timestamp of the local record via synthetic LOOKUP command,
+ * used only for backends which do not provide lookup_timestamp callback.
+ */
+static int dnet_lookup_timestamp_cmd(struct dnet_node *n, struct dnet_id *id, struct dnet_time *ts)
+{
+	struct dnet_net_state *st;
+	struct dnet_io_req *r;
+	struct dnet_cmd cmd, *rcmd;
+	struct dnet_file_info *info;
+	int err;
+
+	st = dnet_local_state_create(n);
+	if (!st) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	memset(&cmd, 0, sizeof(struct dnet_cmd));
+	cmd.id = *id;
+	cmd.cmd = DNET_CMD_LOOKUP;
+	cmd.flags = DNET_FLAGS_NOLOCK;
+
+	err = dnet_process_cmd_raw(st, &cmd, NULL, 0);
+	if (err)
+		goto err_out_put;
+
+	r = dnet_local_state_reply(st, &err);
+	if (!r)
+		goto err_out_put;
+
+	rcmd = r->header ? r->header : r->data;
+	if (rcmd->size < sizeof(struct dnet_addr) + sizeof(struct dnet_file_info)) {
+		err = -EINVAL;
+		goto err_out_free;
+	}
+
+	info = (struct dnet_file_info *)((struct dnet_addr *)(rcmd + 1) + 1);
+	dnet_convert_file_info(info);
+
+	*ts = info->mtime;
+	err = 0;
+
+err_out_free:
+	dnet_io_req_free(r);
+err_out_put:
+	dnet_local_state_clear(st);
+	dnet_state_put(st);
+err_out_exit:
+	return err;
+}
+
+/*
+ * Returns timestamp of the local record: cached record is the most recent one,
+ * otherwise backend reads it from record's header without any command round.
+ */
+static int dnet_lookup_timestamp_local(struct dnet_node *n, struct dnet_id *id, struct dnet_time *ts)
+{
+	int err;
+
+	err = dnet_cache_timestamp(n, id, ts);
+	if (err != -ENOENT && err != -ENOTSUP)
+		return err;
+
+	if (!n->cb->lookup_timestamp)
+		return dnet_lookup_timestamp_cmd(n, id, ts);
+
+	return n->cb->lookup_timestamp(n, n->cb->command_private, id, ts);
+}
+
+/*
+ * Checks whether local record is older than @ts.
+ * Returns 0 if record should be overwritten, -EALREADY if stored record has the same or newer timestamp.
+ * Must be called with key lock held, since timestamp is read without locking.
+ */
+int dnet_check_newer_local(struct dnet_node *n, struct dnet_id *id, struct dnet_time *ts)
+{
+	struct dnet_time stored;
+	int err;
+
+	err = dnet_lookup_timestamp_local(n, id, &stored);
+	if (err) {
+		/* There is nothing to overwrite */
+		if (err == -ENOENT)
+			err = 0;
+		return err;
+	}
+
+	if (dnet_time_cmp(&stored, ts) >= 0)
+		err = -EALREADY;
+
+	dnet_log(n, DNET_LOG_NOTICE, "%s: newer: stored: %lld.%09lld, new: %lld.%09lld, err: %d\n",
+			dnet_dump_id(id),
+			(unsigned long long)stored.tsec, (unsigned long long)stored.tnsec,
+			(unsigned long long)ts->tsec, (unsigned long long)ts->tnsec, err);
+
+	return err;
+}
+
+static void dnet_copy_put(struct dnet_copy_ctl *ctl)
+{
+	int i;
+
+	if (!atomic_dec_and_test(&ctl->refcnt))
+		return;
+
+	for (i = 0; i < ctl->num; ++i)
+		dnet_convert_copy_status(&ctl->status[i]);
+
+	dnet_send_reply(ctl->st, &ctl->cmd, ctl->status, ctl->num * sizeof(struct dnet_copy_status), 0);
+	dnet_send_ack(ctl->st, &ctl->cmd, 0, 0);
+
+	dnet_state_put(ctl->st);
+	free(ctl->entries);
+	free(ctl);
+}
+
+static int dnet_copy_complete(struct dnet_net_state *st, struct dnet_cmd *cmd, void *priv)
+{
+	struct dnet_copy_entry *e = priv;
+
+	if (is_trans_destroyed(st, cmd)) {
+		if (!e->status->status)
+			e->status->status = cmd ? cmd->status : -ETIMEDOUT;
+
+		dnet_copy_put(e->ctl);
+		return 0;
+	}
+
+	if (cmd->status)
+		e->status->status = cmd->status;
+
+	return 0;
+}
+
+/*
+ * Sends local read reply @r as WRITE into the node responsible for the key in @e->status->group_id.
+ * Completion is always called, even if sending failed.
+ */
+static int dnet_copy_send(struct dnet_node *n, struct dnet_copy_entry *e, struct dnet_io_req *r,
+		uint64_t flags, int last)
+{
+	struct dnet_copy_status *status = e->status;
+	struct dnet_net_state *st;
+	struct dnet_trans *t;
+	struct dnet_io_req req;
+	struct dnet_cmd *cmd, *rcmd = r->header ? r->header : r->data;
+	struct dnet_io_attr *io;
+	char header[sizeof(struct dnet_cmd) + sizeof(struct dnet_io_attr)];
+	int err;
+
+	cmd = (struct dnet_cmd *)header;
+	io = (struct dnet_io_attr *)(cmd + 1);
+
+	memset(cmd, 0, sizeof(struct dnet_cmd));
+	dnet_setup_id(&cmd->id, status->group_id, status->key.id);
+
+	memcpy(io, rcmd + 1, sizeof(struct dnet_io_attr));
+	dnet_convert_io_attr(io);
+
+	io->flags = DNET_IO_FLAGS_COMMIT | DNET_IO_FLAGS_NOCSUM;
+	if (flags & DNET_COPY_FLAGS_NEWER)
+		io->flags |= DNET_IO_FLAGS_NEWER;
+	io->offset = 0;
+	io->num = io->size;
+	io->total_size = 0;
+	memcpy(io->parent, io->id, DNET_ID_SIZE);
+
+	status->size = io->size;
+
+	st = dnet_state_get_first(n, &cmd->id);
+	if (!st) {
+		/* Key belongs to this node, there is nowhere to copy it */
+		status->status = -ELOOP;
+		dnet_copy_complete(NULL, NULL, e);
+		return 0;
+	}
+
+	t = dnet_trans_alloc(n, 0);
+	if (!t) {
+		err = -ENOMEM;
+		status->status = err;
+		dnet_copy_complete(NULL, NULL, e);
+		goto err_out_put_state;
+	}
+
+	t->complete = dnet_copy_complete;
+	t->priv = e;
+	t->wait_ts = n->wait_ts;
+
+	cmd->flags = DNET_FLAGS_NEED_ACK;
+	cmd->size = sizeof(struct dnet_io_attr) + io->size;
+	cmd->cmd = t->command = DNET_CMD_WRITE;
+	cmd->trans = t->rcv_trans = t->trans = atomic_inc(&n->trans);
+
+	memcpy(&t->cmd, cmd, sizeof(struct dnet_cmd));
+	t->st = dnet_state_get(st);
+
+	dnet_convert_io_attr(io);
+	dnet_convert_cmd(cmd);
+
+	memset(&req, 0, sizeof(req));
+	req.st = st;
+	req.header = header;
+	req.hsize = sizeof(header);
+	req.fd = -1;
+
+	if (r->fd >= 0 && r->fsize) {
+		req.fd = r->fd;
+		req.local_offset = r->local_offset;
+		req.fsize = r->fsize;
+
+		/*
+		 * The last destination takes ownership of the descriptor,
+		 * others get their own copy if it has to be closed after sending.
+		 */
+		if (last) {
+			req.on_exit = r->on_exit;
+			r->on_exit = 0;
+		} else if (r->on_exit & DNET_IO_REQ_FLAGS_CLOSE) {
+			req.fd = dup(r->fd);
+			if (req.fd < 0) {
+				err = -errno;
+				dnet_log(n, DNET_LOG_ERROR, "%s: copy: trans: %llu -> %s: could not duplicate descriptor: %s [%d]\n",
+						dnet_dump_id(&t->cmd.id), (unsigned long long)t->trans,
+						dnet_server_convert_dnet_addr(&st->addr), strerror(-err), err);
+				status->status = err;
+				dnet_trans_put(t);
+				goto err_out_put_state;
+			}
+			req.on_exit = DNET_IO_REQ_FLAGS_CLOSE;
+		}
+	} else {
+		req.data = r->data;
+		req.dsize = r->dsize;
+	}
+
+	dnet_log(n, DNET_LOG_INFO, "%s: copy: trans: %llu -> %s, size: %llu, fd: %d\n",
+			dnet_dump_id(&t->cmd.id), (unsigned long long)t->trans,
+			dnet_server_convert_dnet_addr(&st->addr), (unsigned long long)status->size, req.fd);
+
+	err = dnet_trans_send(t, &req);
+	if (err) {
+		status->status = err;
+
+		/* Descriptor was not queued, return it back to the read request or close our copy */
+		if (req.fd == r->fd)
+			r->on_exit |= req.on_exit;
+		else if (req.fd >= 0)
+			close(req.fd);
+
+		/* Completion is called when the last transaction reference is dropped */
+		dnet_trans_put(t);
+	}
+
+err_out_put_state:
+	dnet_state_put(st);
+	return err;
+}
+
+static void dnet_copy_send_key(void *priv, int err)
+{
+	struct dnet_copy_key *k = priv;
+	int j;
+
+	for (j = 0; j < k->num; ++j) {
+		if (err) {
+			k->entries[j].status->status = err;
+			dnet_copy_complete(NULL, NULL, &k->entries[j]);
+			continue;
+		}
+
+		dnet_copy_send(k->n, &k->entries[j], k->r, k->flags, j + 1 == k->num);
+	}
+
+	dnet_io_req_free(k->r);
+	free(k);
+}
+
+int dnet_cmd_copy(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_node *n = st->n;
+	struct dnet_copy_request *req = data;
+	struct dnet_net_state *local;
+	struct dnet_copy_ctl *ctl;
+	struct dnet_copy_key *k;
+	struct dnet_raw_id *keys;
+	struct dnet_io_req *r;
+	struct dnet_cmd rcmd;
+	struct dnet_io_attr io;
+	uint32_t *groups;
+	uint32_t i, j;
+	int err;
+
+	if (cmd->size < sizeof(struct dnet_copy_request)) {
+		err = -EINVAL;
+		goto err_out_exit;
+	}
+
+	dnet_convert_copy_request(req);
+
+	if (cmd->size != sizeof(struct dnet_copy_request) + req->group_num * sizeof(uint32_t) +
+				(uint64_t)req->key_num * sizeof(struct dnet_raw_id) ||
+			!req->group_num || !req->key_num) {
+		dnet_log(n, DNET_LOG_ERROR, "%s: copy: invalid request: groups: %u, keys: %u, size: %llu\n",
+				dnet_dump_id(&cmd->id), req->group_num, req->key_num, (unsigned long long)cmd->size);
+		err = -EINVAL;
+		goto err_out_exit;
+	}
+
+	groups = (uint32_t *)(req + 1);
+	keys = (struct dnet_raw_id *)(groups + req->group_num);
+
+	local = dnet_local_state_create(n);
+	if (!local) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	ctl = malloc(sizeof(struct dnet_copy_ctl) + req->key_num * req->group_num * sizeof(struct dnet_copy_status));
+	if (!ctl) {
+		err = -ENOMEM;
+		goto err_out_put_local;
+	}
+	memset(ctl, 0, sizeof(struct dnet_copy_ctl) + req->key_num * req->group_num * sizeof(struct dnet_copy_status));
+
+	ctl->entries = calloc(req->key_num * req->group_num, sizeof(struct dnet_copy_entry));
+	if (!ctl->entries) {
+		err = -ENOMEM;
+		goto err_out_free;
+	}
+
+	atomic_init(&ctl->refcnt, 1);
+	ctl->st = dnet_state_get(st);
+	ctl->cmd = *cmd;
+	ctl->num = req->key_num * req->group_num;
+
+	for (i = 0; i < req->key_num; ++i) {
+		for (j = 0; j < req->group_num; ++j) {
+			struct dnet_copy_entry *e = &ctl->entries[i * req->group_num + j];
+
+			e->ctl = ctl;
+			e->status = &ctl->status[i * req->group_num + j];
+			e->status->key = keys[i];
+			e->status->group_id = dnet_bswap32(groups[j]);
+		}
+	}
+
+	/* Final reply and ack are sent when the last write completes */
+	cmd->flags &= ~DNET_FLAGS_NEED_ACK;
+
+	/* Key lock is dropped like in bulk read, since every key is read through dnet_process_cmd_raw() */
+	if (!(cmd->flags & DNET_FLAGS_NOLOCK))
+		dnet_opunlock(n, &cmd->id);
+
+	for (i = 0; i < req->key_num; ++i) {
+		struct dnet_copy_entry *e = &ctl->entries[i * req->group_num];
+
+		memset(&io, 0, sizeof(struct dnet_io_attr));
+		memcpy(io.id, keys[i].id, DNET_ID_SIZE);
+		memcpy(io.parent, keys[i].id, DNET_ID_SIZE);
+
+		memset(&rcmd, 0, sizeof(struct dnet_cmd));
+		dnet_setup_id(&rcmd.id, n->id.group_id, keys[i].id);
+		rcmd.cmd = DNET_CMD_READ;
+		rcmd.size = sizeof(struct dnet_io_attr);
+
+		err = dnet_process_cmd_raw(local, &rcmd, &io, 0);
+		r = NULL;
+		if (!err)
+			r = dnet_local_state_reply(local, &err);
+
+		if (!r) {
+			for (j = 0; j < req->group_num; ++j)
+				e[j].status->status = err;
+			dnet_local_state_clear(local);
+			continue;
+		}
+
+		/* Every write holds control reference until its completion */
+		for (j = 0; j < req->group_num; ++j)
+			atomic_inc(&ctl->refcnt);
+
+		k = malloc(sizeof(struct dnet_copy_key));
+		if (!k) {
+			for (j = 0; j < req->group_num; ++j) {
+				e[j].status->status = -ENOMEM;
+				dnet_copy_complete(NULL, NULL, &e[j]);
+			}
+			dnet_io_req_free(r);
+			dnet_local_state_clear(local);
+			continue;
+		}
+
+		k->n = n;
+		k->entries = e;
+		k->num = req->group_num;
+		k->flags = req->flags;
+		k->r = r;
+
+		/* Recovery goes through server-side copy, it shares background IO budget */
+		dnet_io_sched_defer(n, DNET_IO_CLASS_RECOVERY, r->fd >= 0 ? r->fsize : r->dsize, dnet_copy_send_key, k);
+
+		dnet_local_state_clear(local);
+	}
+
+	dnet_log(n, DNET_LOG_NOTICE, "%s: copy: keys: %u, groups: %u, flags: 0x%llx\n",
+			dnet_dump_id(&cmd->id), req->key_num, req->group_num, (unsigned long long)req->flags);
+
+	if (!(cmd->flags & DNET_FLAGS_NOLOCK))
+		dnet_oplock(n, &cmd->id);
+
+	dnet_state_put(local);
+	dnet_copy_put(ctl);
+	return 0;
+
+err_out_free:
+	free(ctl);
+err_out_put_local:
+	dnet_state_put(local);
+err_out_exit:
+	return err;
+}
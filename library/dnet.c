@@ -635,28 +635,127 @@ int dnet_send_ack(struct dnet_net_state *st, struct dnet_cmd *cmd, int err, int
 	return err;
 }
 
+static void dnet_iterator_entries_free(struct dnet_iterator_queue_entry *entries)
+{
+	struct dnet_iterator_queue_entry *e, *next;
+
+	for (e = entries; e; e = next) {
+		next = e->next;
+		free(e);
+	}
+}
+
 /*!
  * Internal callback that writes result to \a fd opened in append mode
  */
-static int dnet_iterator_callback_file(void *priv, void *data, uint64_t dsize)
+static int dnet_iterator_callback_file(void *priv, struct dnet_iterator_queue_entry *entries)
 {
 	struct dnet_iterator_file_private *file = priv;
-	ssize_t err;
+	struct dnet_iterator_queue_entry *e;
+	ssize_t err = 0;
 
-	err = write(file->fd, data, dsize);
-	if (err == -1)
-		return -errno;
-	if (err != (ssize_t)dsize)
-		return -EINTR;
-	return 0;
+	for (e = entries; e; e = e->next) {
+		err = write(file->fd, e->data, e->size);
+		if (err == -1) {
+			err = -errno;
+			break;
+		}
+		if (err != (ssize_t)e->size) {
+			err = -EINTR;
+			break;
+		}
+		err = 0;
+	}
+
+	dnet_iterator_entries_free(entries);
+	return err;
+}
+
+/*!
+ * Fills reply header of the response the same way dnet_send_reply() does
+ */
+static void dnet_iterator_fill_reply(struct dnet_cmd *c, struct dnet_cmd *cmd, uint64_t size)
+{
+	*c = *cmd;
+	c->flags |= DNET_FLAGS_MORE;
+	c->size = size;
+	c->trans |= DNET_TRANS_REPLY;
+
+	dnet_convert_cmd(c);
+}
+
+/*!
+ * Queues single response to the network as is, without copying
+ */
+static int dnet_iterator_send_entry(struct dnet_iterator_send_private *send, struct dnet_iterator_queue_entry *e)
+{
+	struct dnet_io_req *r = &e->req;
+
+	dnet_iterator_fill_reply(&e->cmd, send->cmd, e->size);
+
+	memset(r, 0, sizeof(struct dnet_io_req));
+	r->data = &e->cmd;
+	r->dsize = sizeof(struct dnet_cmd) + e->size;
+	r->fd = -1;
+
+	return dnet_io_req_queue_threshold(send->st, r);
+}
+
+/*!
+ * Copies \a num small responses starting from \a entries into single request
+ * of \a total bytes, so that they are sent with single syscall. Frees entries.
+ */
+static int dnet_iterator_send_merged(struct dnet_iterator_send_private *send,
+		struct dnet_iterator_queue_entry *entries, int num, uint64_t total)
+{
+	struct dnet_iterator_queue_entry *e, *next;
+	struct dnet_io_req *r;
+	unsigned char *position;
+	int i;
+
+	if (num == 1)
+		return dnet_iterator_send_entry(send, entries);
+
+	r = malloc(sizeof(struct dnet_io_req) + total);
+	if (!r) {
+		for (i = 0, e = entries; i < num; ++i, e = next) {
+			next = e->next;
+			free(e);
+		}
+		return -ENOMEM;
+	}
+	memset(r, 0, sizeof(struct dnet_io_req));
+	r->data = position = (unsigned char *)(r + 1);
+	r->dsize = total;
+	r->fd = -1;
+
+	for (i = 0, e = entries; i < num; ++i, e = next) {
+		next = e->next;
+
+		dnet_iterator_fill_reply(&e->cmd, send->cmd, e->size);
+		memcpy(position, &e->cmd, sizeof(struct dnet_cmd) + e->size);
+		position += sizeof(struct dnet_cmd) + e->size;
+
+		free(e);
+	}
+
+	return dnet_io_req_queue_threshold(send->st, r);
 }
 
 /*!
  * Internal callback that sends result to state \a st
+ *
+ * Responses larger than DNET_ITERATOR_MERGE_SIZE are queued to the network
+ * as is, without copying. Runs of smaller responses are copied once more
+ * into single request, so that they are sent with single syscall.
  */
-static int dnet_iterator_callback_send(void *priv, void *data, uint64_t dsize)
+static int dnet_iterator_callback_send(void *priv, struct dnet_iterator_queue_entry *entries)
 {
 	struct dnet_iterator_send_private *send = priv;
+	struct dnet_iterator_queue_entry *e, *next, *run = NULL;
+	uint64_t total = 0;
+	int num = 0;
+	int err = 0;
 
 	/*
 	 * If need_exit is set - skips sending reply and return -EINTR to
@@ -666,10 +765,48 @@ static int dnet_iterator_callback_send(void *priv, void *data, uint64_t dsize)
 		dnet_log(send->st->n, DNET_LOG_ERROR,
 				"%s: Interrupting iterator because peer has been disconnected\n",
 				dnet_dump_id(&send->cmd->id));
-		return -EINTR;
+		err = -EINTR;
+		goto err_out_free;
+	}
+
+	for (e = entries; e; e = next) {
+		next = e->next;
+
+		if (e->size < DNET_ITERATOR_MERGE_SIZE) {
+			if (!run)
+				run = e;
+			num++;
+			total += sizeof(struct dnet_cmd) + e->size;
+			continue;
+		}
+
+		if (run) {
+			err = dnet_iterator_send_merged(send, run, num, total);
+			run = NULL;
+			num = 0;
+			total = 0;
+
+			if (err) {
+				entries = e;
+				goto err_out_free;
+			}
+		}
+
+		err = dnet_iterator_send_entry(send, e);
+		if (err) {
+			entries = next;
+			goto err_out_free;
+		}
 	}
 
-	return dnet_send_reply_threshold(send->st, send->cmd, data, dsize, 1);
+	if (run)
+		err = dnet_iterator_send_merged(send, run, num, total);
+
+	return err;
+
+err_out_free:
+	dnet_iterator_entries_free(entries);
+	return err;
 }
 
 /*!
@@ -692,72 +829,267 @@ static int dnet_iterator_flow_control(struct dnet_iterator_common_private *ipriv
 	return err;
 }
 
+static int dnet_iterator_queue_init(struct dnet_iterator_queue *q, uint64_t limit)
+{
+	int err;
+
+	memset(q, 0, sizeof(struct dnet_iterator_queue));
+	q->tail = &q->head;
+	q->limit = limit;
+
+	err = pthread_mutex_init(&q->lock, NULL);
+	if (err)
+		goto err_out_exit;
+
+	err = pthread_cond_init(&q->not_empty, NULL);
+	if (err)
+		goto err_out_lock_destroy;
+
+	err = pthread_cond_init(&q->not_full, NULL);
+	if (err)
+		goto err_out_not_empty_destroy;
+
+	return 0;
+
+err_out_not_empty_destroy:
+	pthread_cond_destroy(&q->not_empty);
+err_out_lock_destroy:
+	pthread_mutex_destroy(&q->lock);
+err_out_exit:
+	return -err;
+}
+
+static void dnet_iterator_queue_cleanup(struct dnet_iterator_queue *q)
+{
+	dnet_iterator_entries_free(q->head);
+
+	pthread_cond_destroy(&q->not_full);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_mutex_destroy(&q->lock);
+}
+
+/*!
+ * Puts response into the queue, blocks while queue is full.
+ * Entry is freed on error, which is the one returned by the sender.
+ */
+static int dnet_iterator_queue_push(struct dnet_iterator_queue *q, struct dnet_iterator_queue_entry *e)
+{
+	int err;
+
+	e->next = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	/* Response larger than the limit is still accepted by the empty queue */
+	while (!q->err && q->size && q->size + e->size > q->limit)
+		pthread_cond_wait(&q->not_full, &q->lock);
+
+	err = q->err;
+	if (!err) {
+		*q->tail = e;
+		q->tail = &e->next;
+		q->size += e->size;
+		pthread_cond_signal(&q->not_empty);
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	if (err)
+		free(e);
+	return err;
+}
+
+/*!
+ * Tells the sender that no more responses will be queued
+ */
+static void dnet_iterator_queue_finish(struct dnet_iterator_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->done = 1;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/*!
+ * Sender thread: passes queued responses to the next callback.
+ * Responses which are already in the queue are passed together up to DNET_ITERATOR_BATCH_SIZE bytes.
+ * After the first error remaining responses are dropped and producers are woken up.
+ */
+static void *dnet_iterator_sender(void *priv)
+{
+	struct dnet_iterator_common_private *ipriv = priv;
+	struct dnet_iterator_queue *q = ipriv->queue;
+	struct dnet_iterator_queue_entry *batch, *e, **tail;
+	uint64_t batch_size;
+	int err;
+
+	pthread_mutex_lock(&q->lock);
+	while (1) {
+		while (!q->head && !q->done)
+			pthread_cond_wait(&q->not_empty, &q->lock);
+
+		if (!q->head)
+			break;
+
+		batch = NULL;
+		tail = &batch;
+		batch_size = 0;
+
+		do {
+			e = q->head;
+			q->head = e->next;
+			q->size -= e->size;
+
+			*tail = e;
+			tail = &e->next;
+			batch_size += sizeof(struct dnet_cmd) + e->size;
+		} while (q->head && batch_size + sizeof(struct dnet_cmd) + q->head->size <= DNET_ITERATOR_BATCH_SIZE);
+
+		*tail = NULL;
+		if (!q->head)
+			q->tail = &q->head;
+		pthread_cond_broadcast(&q->not_full);
+
+		err = q->err;
+		pthread_mutex_unlock(&q->lock);
+
+		if (!err)
+			err = ipriv->next_callback(ipriv->next_private, batch);
+		else
+			dnet_iterator_entries_free(batch);
+
+		pthread_mutex_lock(&q->lock);
+		if (err && !q->err) {
+			q->err = err;
+			pthread_cond_broadcast(&q->not_full);
+		}
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return NULL;
+}
+
+/*!
+ * Checks whether \a key belongs to one of \a num ranges.
+ * Ranges are sorted and do not overlap, see dnet_iterator_check_key_range().
+ */
+static int dnet_iterator_key_in_ranges(const struct dnet_raw_id *key,
+		const struct dnet_iterator_range *range, uint64_t num)
+{
+	uint64_t low = 0, high = num, mid;
+
+	/* Find the first range which starts after the key... */
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (dnet_id_cmp_str(key->id, range[mid].key_begin.id) >= 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	/* ...only the previous one may contain it */
+	return low && dnet_id_cmp_str(key->id, range[low - 1].key_end.id) < 0;
+}
+
+/*!
+ * Decides whether \a key gets into DNET_IFLAGS_SAMPLE sample.
+ * Leading bytes of the key select its node, so bytes from the middle are used.
+ */
+static inline int dnet_iterator_key_sampled(const struct dnet_raw_id *key, uint32_t rate)
+{
+	const unsigned char *id = key->id + 8;
+	uint32_t v = ((uint32_t)id[0] << 24) | (id[1] << 16) | (id[2] << 8) | id[3];
+
+	return v % DNET_ITERATOR_SAMPLE_SCALE < rate;
+}
+
+/*!
+ * Reads the last checkpoint without taking position lock, since it is done
+ * for every record by every backend thread, while checkpoint changes rarely.
+ */
+static void dnet_iterator_position_read(struct dnet_iterator_common_private *ipriv,
+		struct dnet_iterator_position *position)
+{
+	unsigned int seq;
+
+	do {
+		seq = *(volatile unsigned int *)&ipriv->position_seq;
+		__sync_synchronize();
+
+		*position = ipriv->position;
+
+		__sync_synchronize();
+	} while ((seq & 1) || seq != *(volatile unsigned int *)&ipriv->position_seq);
+}
+
 /*!
- * Common callback part that is run by all iterator types.
+ * Common part that is run by all iterator types.
  * It's responsible for sanity checks and flow control.
  *
  * Also now it "prepares" data for next callback by combining data itself with
- * fixed-size response header.
+ * fixed-size response header and queues it to the sender thread.
+ * Large responses are later sent to the network from this buffer as is,
+ * small ones are copied once more when merged, see dnet_iterator_callback_send().
+ * Backend may call it from several threads at once.
  */
-static int dnet_iterator_callback_common(void *priv, struct dnet_raw_id *key,
-		void *data, uint64_t dsize, struct dnet_ext_list *elist)
+static int dnet_iterator_push(struct dnet_iterator_common_private *ipriv,
+		struct dnet_iterator_response *r, void *data, uint64_t dsize)
 {
-	struct dnet_iterator_common_private *ipriv = priv;
+	struct dnet_iterator_request *ireq = ipriv->req;
+	struct dnet_iterator_queue_entry *entry;
 	struct dnet_iterator_response *response;
 	static const uint64_t response_size = sizeof(struct dnet_iterator_response);
 	uint64_t size;
-	const uint64_t fsize = dsize;
-	unsigned char *combined = NULL, *position;
+	unsigned char *combined, *position;
 	int err = 0;
 
-	/* Sanity */
-	if (ipriv == NULL || key == NULL || data == NULL || elist == NULL)
-		return -EINVAL;
-
-	/* If DNET_IFLAGS_KEY_RANGE is set... */
-	if (ipriv->req->flags & DNET_IFLAGS_KEY_RANGE) {
-		/* ...skip keys not in key ranges */
-		struct dnet_iterator_range *curr = ipriv->range;
-		struct dnet_iterator_range *end = curr + ipriv->req->range_num;
-		for (; curr < end; ++curr) {
-			if (dnet_id_cmp_str(key->id, curr->key_begin.id) >= 0
-					&& dnet_id_cmp_str(key->id, curr->key_end.id) < 0)
-				goto key_range_found;
-		}
-		/* no range contains the key */
+	/* If DNET_IFLAGS_KEY_RANGE is set skip keys not in key ranges */
+	if ((ireq->flags & DNET_IFLAGS_KEY_RANGE)
+			&& !dnet_iterator_key_in_ranges(&r->key, ipriv->range, ireq->range_num))
 		goto err_out_exit;
-	}
 
-key_range_found:
+	/* If DNET_IFLAGS_SAMPLE is set skip keys out of sample */
+	if ((ireq->flags & DNET_IFLAGS_SAMPLE) && !dnet_iterator_key_sampled(&r->key, ireq->sample_rate))
+		goto err_out_exit;
 
 	/* If DNET_IFLAGS_TS_RANGE is set... */
-	if (ipriv->req->flags & DNET_IFLAGS_TS_RANGE)
+	if (ireq->flags & DNET_IFLAGS_TS_RANGE)
 		/* ...skip ts not in ts range */
-			if (dnet_time_cmp(&elist->timestamp, &ipriv->req->time_begin) < 0
-					|| dnet_time_cmp(&elist->timestamp, &ipriv->req->time_end) > 0)
+			if (dnet_time_cmp(&r->timestamp, &ireq->time_begin) < 0
+					|| dnet_time_cmp(&r->timestamp, &ireq->time_end) > 0)
 				goto err_out_exit;
 
-	/* Set data to NULL in case it's not requested */
-	if (!(ipriv->req->flags & DNET_IFLAGS_DATA)) {
-		data = NULL;
-		dsize = 0;
-	}
+	/* If DNET_IFLAGS_USER_FLAGS is set skip keys with not matching user flags */
+	if ((ireq->flags & DNET_IFLAGS_USER_FLAGS)
+			&& (r->user_flags & ireq->user_flags_mask) != ireq->user_flags_value)
+		goto err_out_exit;
+
+	/* If DNET_IFLAGS_SIZE_RANGE is set skip keys with size not in size range */
+	if ((ireq->flags & DNET_IFLAGS_SIZE_RANGE)
+			&& (r->size < ireq->size_begin || r->size > ireq->size_end))
+		goto err_out_exit;
+
+	/*
+	 * Every record before the checkpoint has already been queued,
+	 * so client may resume from it as soon as it receives this response
+	 */
+	dnet_iterator_position_read(ipriv, &r->position);
+
 	size = response_size + dsize;
 
+	/* Iterators share background IO budget */
+	dnet_io_sched_consume(ipriv->n, DNET_IO_CLASS_ITERATOR, size);
+
 	/* Prepare combined buffer */
-	position = combined = malloc(size);
-	if (combined == NULL) {
+	entry = malloc(sizeof(struct dnet_iterator_queue_entry) + size);
+	if (entry == NULL) {
 		err = -ENOMEM;
 		goto err_out_exit;
 	}
+	entry->size = size;
+	position = combined = entry->data;
 
 	/* Response */
 	response = (struct dnet_iterator_response *)combined;
-	memset(response, 0, response_size);
-	response->key = *key;
-	response->timestamp = elist->timestamp;
-	response->user_flags = elist->flags;
-	response->size = fsize;
+	memcpy(response, r, response_size);
 	dnet_convert_iterator_response(response);
 
 	/* Data */
@@ -766,8 +1098,8 @@ key_range_found:
 		memcpy(position, data, dsize);
 	}
 
-	/* Finally run next callback */
-	err = ipriv->next_callback(ipriv->next_private, combined, size);
+	/* Finally pass it to the sender, which runs next callback */
+	err = dnet_iterator_queue_push(ipriv->queue, entry);
 	if (err)
 		goto err_out_exit;
 
@@ -775,15 +1107,99 @@ key_range_found:
 	err = dnet_iterator_flow_control(ipriv);
 
 err_out_exit:
-	free(combined);
 	return err;
 }
 
+/*!
+ * Callback called by backend iterator for every record
+ */
+static int dnet_iterator_callback_common(void *priv, struct dnet_raw_id *key,
+		void *data, uint64_t dsize, struct dnet_ext_list *elist)
+{
+	struct dnet_iterator_common_private *ipriv = priv;
+	struct dnet_iterator_response response;
+
+	/* Sanity */
+	if (ipriv == NULL || key == NULL || data == NULL || elist == NULL)
+		return -EINVAL;
+
+	memset(&response, 0, sizeof(struct dnet_iterator_response));
+	response.key = *key;
+	response.timestamp = elist->timestamp;
+	response.user_flags = elist->flags;
+	response.size = dsize;
+
+	/* Set data to NULL in case it's not requested */
+	if (!(ipriv->req->flags & DNET_IFLAGS_DATA)) {
+		data = NULL;
+		dsize = 0;
+	} else if (ipriv->req->flags & DNET_IFLAGS_DATA_RANGE) {
+		/* Send only requested part of the data */
+		if (ipriv->req->data_offset >= dsize) {
+			dsize = 0;
+		} else {
+			data += ipriv->req->data_offset;
+			dsize -= ipriv->req->data_offset;
+			if (ipriv->req->data_size && ipriv->req->data_size < dsize)
+				dsize = ipriv->req->data_size;
+		}
+	}
+
+	return dnet_iterator_push(ipriv, &response, data, dsize);
+}
+
+/*!
+ * Called by backend iterator with position which iteration can be resumed from
+ */
+static void dnet_iterator_checkpoint(void *priv, struct dnet_iterator_position *position)
+{
+	struct dnet_iterator_common_private *ipriv = priv;
+
+	pthread_mutex_lock(&ipriv->position_lock);
+	ipriv->position_seq++;
+	__sync_synchronize();
+
+	ipriv->position = *position;
+
+	__sync_synchronize();
+	ipriv->position_seq++;
+	pthread_mutex_unlock(&ipriv->position_lock);
+}
+
+/*!
+ * Callback called for every change journal record, see DNET_IFLAGS_JOURNAL
+ */
+static int dnet_iterator_callback_journal(void *priv, struct dnet_journal_record *r)
+{
+	struct dnet_iterator_common_private *ipriv = priv;
+	struct dnet_iterator_response response;
+
+	memset(&response, 0, sizeof(struct dnet_iterator_response));
+	response.key = r->key;
+	response.timestamp = r->timestamp;
+	response.size = r->size;
+	response.journal_seq = r->seq;
+	response.cmd = r->cmd;
+
+	return dnet_iterator_push(ipriv, &response, NULL, 0);
+}
+
+static int dnet_iterator_range_cmp(const void *r1, const void *r2)
+{
+	const struct dnet_iterator_range *range1 = r1, *range2 = r2;
+
+	return dnet_id_cmp_str(range1->key_begin.id, range2->key_begin.id);
+}
+
+/*!
+ * Checks key ranges, sorts them and merges overlapping ones,
+ * so that dnet_iterator_key_in_ranges() could use binary search.
+ */
 static int dnet_iterator_check_key_range(struct dnet_net_state *st, struct dnet_cmd *cmd,
 		struct dnet_iterator_request *ireq,
 		struct dnet_iterator_range *irange)
 {
-	struct dnet_iterator_range *i = NULL;
+	struct dnet_iterator_range *i = NULL, *last;
 	struct dnet_iterator_range *end = irange + ireq->range_num;
 
 	if (ireq->flags & DNET_IFLAGS_KEY_RANGE) {
@@ -811,6 +1227,20 @@ static int dnet_iterator_check_key_range(struct dnet_net_state *st, struct dnet_
 			}
 		}
 	}
+	if ((ireq->flags & DNET_IFLAGS_KEY_RANGE) && ireq->range_num) {
+		qsort(irange, ireq->range_num, sizeof(struct dnet_iterator_range), dnet_iterator_range_cmp);
+
+		for (i = irange + 1, last = irange; i < end; ++i) {
+			if (dnet_id_cmp_str(i->key_begin.id, last->key_end.id) > 0) {
+				*++last = *i;
+			} else if (dnet_id_cmp_str(i->key_end.id, last->key_end.id) > 0) {
+				last->key_end = i->key_end;
+			}
+		}
+
+		ireq->range_num = last - irange + 1;
+		end = last + 1;
+	}
 	if (ireq->flags & DNET_IFLAGS_KEY_RANGE) {
 		const short id_len = 6, buf_sz = id_len * 2 + 1;
 		char buf1[buf_sz], buf2[buf_sz];
@@ -853,21 +1283,59 @@ static int dnet_iterator_check_ts_range(struct dnet_net_state *st, struct dnet_c
 	return 0;
 }
 
+static int dnet_iterator_check_filters(struct dnet_net_state *st, struct dnet_cmd *cmd,
+		struct dnet_iterator_request *ireq)
+{
+	/* Journal does not store user flags */
+	if ((ireq->flags & DNET_IFLAGS_USER_FLAGS) && (ireq->flags & DNET_IFLAGS_JOURNAL))
+		return -ENOTSUP;
+
+	if ((ireq->flags & DNET_IFLAGS_SIZE_RANGE) && ireq->size_begin > ireq->size_end) {
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: size_begin > size_end: %" PRIu64 " > %" PRIu64 "\n",
+				dnet_dump_id(&cmd->id), ireq->size_begin, ireq->size_end);
+		return -ERANGE;
+	}
+
+	if ((ireq->flags & DNET_IFLAGS_SAMPLE) && ireq->sample_rate > DNET_ITERATOR_SAMPLE_SCALE) {
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: invalid sample rate: %u\n",
+				dnet_dump_id(&cmd->id), ireq->sample_rate);
+		return -ERANGE;
+	}
+
+	if ((ireq->flags & DNET_IFLAGS_DATA_RANGE) && !(ireq->flags & DNET_IFLAGS_DATA))
+		return -EINVAL;
+
+	if (ireq->flags & (DNET_IFLAGS_USER_FLAGS | DNET_IFLAGS_SIZE_RANGE | DNET_IFLAGS_SAMPLE | DNET_IFLAGS_DATA_RANGE))
+		dnet_log(st->n, DNET_LOG_NOTICE, "%s: using filters: user_flags: 0x%" PRIx64 "/0x%" PRIx64
+				", size: %" PRIu64 "...%" PRIu64 ", sample: %u/%u, data: %" PRIu64 "+%" PRIu64 ", flags: 0x%" PRIx64 "\n",
+				dnet_dump_id(&cmd->id), ireq->user_flags_value, ireq->user_flags_mask,
+				ireq->size_begin, ireq->size_end, ireq->sample_rate, DNET_ITERATOR_SAMPLE_SCALE,
+				ireq->data_offset, ireq->data_size, ireq->flags);
+	return 0;
+}
+
 static int dnet_iterator_start(struct dnet_net_state *st, struct dnet_cmd *cmd,
 		struct dnet_iterator_request *ireq,
 		struct dnet_iterator_range *irange)
 {
 	struct dnet_iterator_common_private cpriv = {
+		.n = st->n,
 		.req = ireq,
 		.range = irange,
+		.position = ireq->position,
 	};
 	struct dnet_iterator_ctl ictl = {
 		.iterate_private = st->n->cb->command_private,
 		.callback = dnet_iterator_callback_common,
 		.callback_private = &cpriv,
+		.start = ireq->position,
+		.checkpoint = dnet_iterator_checkpoint,
+		.flags = ireq->flags,
 	};
 	struct dnet_iterator_send_private spriv;
 	struct dnet_iterator_file_private fpriv;
+	struct dnet_iterator_queue queue;
+	pthread_t sender;
 	int err;
 
 	/* Check flags */
@@ -875,14 +1343,26 @@ static int dnet_iterator_start(struct dnet_net_state *st, struct dnet_cmd *cmd,
 		err = -ENOTSUP;
 		goto err_out_exit;
 	}
+	/* Journal does not store data */
+	if ((ireq->flags & DNET_IFLAGS_JOURNAL) && (ireq->flags & DNET_IFLAGS_DATA)) {
+		err = -ENOTSUP;
+		goto err_out_exit;
+	}
 	/* Check callback type */
 	if (ireq->itype <= DNET_ITYPE_FIRST || ireq->itype >= DNET_ITYPE_LAST) {
 		err = -ENOTSUP;
 		goto err_out_exit;
 	}
-	/* Check ranges */
+	/* Ranges are sorted in place, so they must be really there */
+	if (ireq->range_num > (cmd->size - sizeof(struct dnet_iterator_request)) /
+			sizeof(struct dnet_iterator_range)) {
+		err = -EINVAL;
+		goto err_out_exit;
+	}
+	/* Check ranges and filters */
 	if ((err = dnet_iterator_check_key_range(st, cmd, ireq, irange)) ||
-			(err = dnet_iterator_check_ts_range(st, cmd, ireq)))
+			(err = dnet_iterator_check_ts_range(st, cmd, ireq)) ||
+			(err = dnet_iterator_check_filters(st, cmd, ireq)))
 		goto err_out_exit;
 
 	switch (ireq->itype) {
@@ -914,9 +1394,52 @@ static int dnet_iterator_start(struct dnet_net_state *st, struct dnet_cmd *cmd,
 		goto err_out_exit;
 	}
 
-	/* Run iterator */
-	err = st->n->cb->iterator(&ictl);
+	err = dnet_iterator_queue_init(&queue, DNET_ITERATOR_QUEUE_SIZE);
+	if (err)
+		goto err_out_destroy;
+	cpriv.queue = &queue;
 
+	err = pthread_mutex_init(&cpriv.position_lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_queue_cleanup;
+	}
+
+	err = pthread_create(&sender, NULL, dnet_iterator_sender, &cpriv);
+	if (err) {
+		err = -err;
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to start iterator sender thread: %d\n",
+				dnet_dump_id(&cmd->id), err);
+		goto err_out_position_cleanup;
+	}
+
+	/*
+	 * Run iterator.
+	 * Backend reads records (possibly in several threads) while sender
+	 * thread sends already prepared responses.
+	 */
+	if (ireq->flags & DNET_IFLAGS_JOURNAL)
+		err = dnet_journal_iterate(st->n, ireq->journal_seq,
+				(ireq->flags & DNET_IFLAGS_TS_RANGE) ? &ireq->time_begin : NULL,
+				dnet_iterator_callback_journal, &cpriv);
+	else
+		err = st->n->cb->iterator(&ictl);
+
+	dnet_iterator_queue_finish(&queue);
+	pthread_join(sender, NULL);
+
+	if (!err)
+		err = queue.err;
+
+	if (err)
+		dnet_log(st->n, DNET_LOG_INFO, "%s: iteration may be resumed from position: %" PRIu64 ":%" PRIu64 "\n",
+				dnet_dump_id(&cmd->id), cpriv.position.blob, cpriv.position.offset);
+
+err_out_position_cleanup:
+	pthread_mutex_destroy(&cpriv.position_lock);
+err_out_queue_cleanup:
+	dnet_iterator_queue_cleanup(&queue);
+err_out_destroy:
 	/* Remove iterator */
 	dnet_iterator_destroy(st->n, cpriv.it);
 
@@ -940,7 +1463,7 @@ static int dnet_cmd_iterator(struct dnet_net_state *st, struct dnet_cmd *cmd, vo
 	/*
 	 * Sanity
 	 */
-	if (ireq == NULL || st == NULL || cmd == NULL)
+	if (ireq == NULL || st == NULL || cmd == NULL || cmd->size < sizeof(struct dnet_iterator_request))
 		return -EINVAL;
 	dnet_convert_iterator_request(ireq);
 
@@ -1074,6 +1597,22 @@ int dnet_cas_local(struct dnet_node *n, struct dnet_id *id, void *remote_csum, i
 	return err;
 }
 
+/*
+ * Defragmentation can not be throttled once backend has started it,
+ * so it is not started at all while foreground requests are too slow.
+ * Status requests are always allowed.
+ */
+static int dnet_defrag_throttled(struct dnet_node *n, struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_defrag_ctl *ctl = data;
+
+	if (cmd->size >= sizeof(struct dnet_defrag_ctl) &&
+			(dnet_bswap64(ctl->flags) & DNET_DEFRAG_FLAGS_STATUS))
+		return 0;
+
+	return !dnet_io_sched_defrag_allowed(n);
+}
+
 int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int recursive)
 {
 	int err = 0;
@@ -1183,6 +1722,15 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 		case DNET_CMD_MONITOR_STAT:
 			err = dnet_monitor_process_cmd(st, cmd, data);
 			break;
+		case DNET_CMD_RANGE_HASH:
+			err = dnet_cmd_range_hash(st, cmd, data);
+			break;
+		case DNET_CMD_COPY:
+			err = dnet_cmd_copy(st, cmd, data);
+			break;
+		case DNET_CMD_IO_SCHED:
+			err = dnet_cmd_io_sched(st, cmd, data);
+			break;
 		case DNET_CMD_READ:
 		case DNET_CMD_WRITE:
 		case DNET_CMD_DEL:
@@ -1204,6 +1752,12 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 			if (n->flags & DNET_CFG_NO_CSUM)
 				io->flags |= DNET_IO_FLAGS_NOCSUM;
 
+			if ((io->flags & DNET_IO_FLAGS_NEWER) && (cmd->cmd == DNET_CMD_WRITE)) {
+				err = dnet_check_newer_local(n, &cmd->id, &io->timestamp);
+				if (err)
+					break;
+			}
+
 			if (!(io->flags & DNET_IO_FLAGS_NOCACHE)) {
 				err = dnet_cmd_cache_io(st, cmd, io, data + sizeof(struct dnet_io_attr));
 
@@ -1222,6 +1776,13 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 
 			dnet_convert_io_attr(io);
 		default:
+			if (cmd->cmd == DNET_CMD_DEFRAG && dnet_defrag_throttled(n, cmd, data)) {
+				dnet_log(n, DNET_LOG_NOTICE, "%s: defragmentation is postponed: foreground latency exceeds target\n",
+						dnet_dump_id(&cmd->id));
+				err = -EAGAIN;
+				break;
+			}
+
 			if (cmd->cmd == DNET_CMD_LOOKUP && !(cmd->flags & DNET_FLAGS_NOCACHE)) {
 				err = dnet_cmd_cache_lookup(st, cmd);
 
@@ -1252,6 +1813,15 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 			break;
 	}
 
+	/* Range hashes of modified keys have to be recalculated, changes go to the journal */
+	if (!err) {
+		if ((cmd->cmd == DNET_CMD_WRITE) || (cmd->cmd == DNET_CMD_DEL)) {
+			dnet_range_hash_invalidate(n, &cmd->id);
+			dnet_journal_append(n, cmd, io);
+		} else if (cmd->cmd == DNET_CMD_DEL_RANGE)
+			dnet_range_hash_invalidate_all(n);
+	}
+
 	dnet_stat_inc(st->stat, cmd->cmd, err);
 	if (st->__join_state == DNET_JOIN)
 		dnet_counter_inc(n, cmd->cmd, err);
@@ -1263,6 +1833,12 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 	diff = DIFF(start, end);
 	monitor_command_counter(n, cmd->cmd, tid, err, handled_in_cache, io ? io->size : 0, diff);
 
+	/* Only client requests which reached backend drive background IO budgets */
+	if (!recursive && !handled_in_cache && st->read_s >= 0 &&
+			((cmd->cmd == DNET_CMD_READ) || (cmd->cmd == DNET_CMD_WRITE) ||
+			 (cmd->cmd == DNET_CMD_LOOKUP) || (cmd->cmd == DNET_CMD_DEL)))
+		dnet_io_sched_complete(n, io ? io->size : 0, diff);
+
 	if ((cmd->cmd == DNET_CMD_READ) || (cmd->cmd == DNET_CMD_WRITE)) {
 		char time_str[64];
 		struct tm io_tm;
@@ -154,6 +154,9 @@ static char *dnet_cmd_strings[] = {
 	[DNET_CMD_INDEXES_INTERNAL] = "INDEXES_INTERNAL",
 	[DNET_CMD_INDEXES_FIND] = "INDEXES_FIND",
 	[DNET_CMD_MONITOR_STAT] = "MONITOR_STAT",
+	[DNET_CMD_RANGE_HASH] = "RANGE_HASH",
+	[DNET_CMD_COPY] = "COPY",
+	[DNET_CMD_IO_SCHED] = "IO_SCHED",
 	[DNET_CMD_UNKNOWN] = "UNKNOWN",
 };
 
@@ -275,7 +278,12 @@ static int dnet_add_received_state(struct dnet_net_state *connected_state,
 	nst = dnet_state_search_by_addr(n, addr);
 	if (nst) {
 		dnet_copy_addrs(nst, cnt->addrs, cnt->addr_num);
-		err = -EEXIST;
+
+		/* State is already connected, only changes of its ids are applied */
+		err = dnet_idc_update(nst, group_id, ids, id_num);
+		if (!err || err == -EINVAL)
+			err = -EEXIST;
+
 		dnet_state_put(nst);
 		goto err_out_exit;
 	}
@@ -756,10 +764,14 @@ err_out_exit:
 	return 0;
 }
 
-static struct dnet_trans *dnet_io_trans_create(struct dnet_session *s, struct dnet_io_control *ctl, int *errp)
+/*
+ * Allocates IO transaction and fills @req to send it, but does not send.
+ * Completion callback is invoked if transaction can not be created.
+ */
+static struct dnet_trans *dnet_io_trans_prepare(struct dnet_session *s, struct dnet_io_control *ctl,
+		struct dnet_io_req *req, int *errp)
 {
 	struct dnet_node *n = s->node;
-	struct dnet_io_req req;
 	struct dnet_trans *t = NULL;
 	struct dnet_io_attr *io;
 	struct dnet_cmd *cmd;
@@ -818,39 +830,35 @@ static struct dnet_trans *dnet_io_trans_create(struct dnet_session *s, struct dn
 	cmd->trans = t->rcv_trans = t->trans = atomic_inc(&n->trans);
 
 	dnet_log(n, DNET_LOG_INFO, "%s: created trans: %llu, cmd: %s, cflags: 0x%llx, size: %llu, offset: %llu, "
-			"fd: %d, local_offset: %llu -> %s weight: %f, mrt: %ld, wait-ts: %ld.\n",
+			"fd: %d, local_offset: %llu -> %s latency: %ld, inflight: %d, wait-ts: %ld.\n",
 			dnet_dump_id(&ctl->id),
 			(unsigned long long)t->trans,
 			dnet_cmd_string(ctl->cmd), (unsigned long long)cmd->flags,
 			(unsigned long long)ctl->io.size, (unsigned long long)ctl->io.offset,
 			ctl->fd,
 			(unsigned long long)ctl->local_offset,
-			dnet_server_convert_dnet_addr(&t->st->addr), t->st->weight, t->st->median_read_time,
+			dnet_server_convert_dnet_addr(&t->st->addr), t->st->latency_ewma, t->st->inflight,
 			t->wait_ts.tv_sec);
 
 	dnet_convert_cmd(cmd);
 	dnet_convert_io_attr(io);
 
 
-	memset(&req, 0, sizeof(req));
-	req.st = t->st;
-	req.header = cmd;
-	req.hsize = tsize;
+	memset(req, 0, sizeof(struct dnet_io_req));
+	req->st = t->st;
+	req->header = cmd;
+	req->hsize = tsize;
 
-	req.fd = ctl->fd;
+	req->fd = ctl->fd;
 
 	if (ctl->fd >= 0) {
-		req.local_offset = ctl->local_offset;
-		req.fsize = size;
+		req->local_offset = ctl->local_offset;
+		req->fsize = size;
 	} else if (size >= DNET_COPY_IO_SIZE) {
-		req.data = (void *)ctl->data;
-		req.dsize = size;
+		req->data = (void *)ctl->data;
+		req->dsize = size;
 	}
 
-	err = dnet_trans_send(t, &req);
-	if (err)
-		goto err_out_destroy;
-
 	return t;
 
 err_out_complete:
@@ -865,6 +873,119 @@ err_out_destroy:
 	return NULL;
 }
 
+static struct dnet_trans *dnet_io_trans_create(struct dnet_session *s, struct dnet_io_control *ctl, int *errp)
+{
+	struct dnet_io_req req;
+	struct dnet_trans *t;
+	int err;
+
+	t = dnet_io_trans_prepare(s, ctl, &req, errp);
+	if (!t)
+		return NULL;
+
+	err = dnet_trans_send(t, &req);
+	if (err) {
+		dnet_trans_put(t);
+		*errp = err;
+		return NULL;
+	}
+
+	return t;
+}
+
+struct dnet_io_batch {
+	struct dnet_session	*s;
+	int			num, size;
+	struct dnet_trans	**trans;
+};
+
+struct dnet_io_batch *dnet_io_batch_alloc(struct dnet_session *s)
+{
+	struct dnet_io_batch *b;
+
+	b = calloc(1, sizeof(struct dnet_io_batch));
+	if (!b)
+		return NULL;
+
+	b->s = s;
+	return b;
+}
+
+int dnet_io_batch_add(struct dnet_io_batch *b, struct dnet_io_control *ctl)
+{
+	struct dnet_io_req req;
+	struct dnet_trans *t;
+	int err;
+
+	/* Only requests which are copied into transaction are packed, others are sent as usual */
+	if (ctl->fd >= 0 || (ctl->cmd != DNET_CMD_READ && ctl->io.size >= DNET_COPY_IO_SIZE)) {
+		if (!dnet_io_trans_create(b->s, ctl, &err))
+			return err;
+		return 0;
+	}
+
+	t = dnet_io_trans_prepare(b->s, ctl, &req, &err);
+	if (!t)
+		return err;
+
+	if (b->num == b->size) {
+		int size = b->size ? b->size * 2 : 16;
+		struct dnet_trans **trans;
+
+		trans = realloc(b->trans, size * sizeof(struct dnet_trans *));
+		if (!trans) {
+			err = dnet_trans_send(t, &req);
+			if (err) {
+				dnet_trans_put(t);
+				return err;
+			}
+			return 0;
+		}
+
+		b->trans = trans;
+		b->size = size;
+	}
+
+	b->trans[b->num++] = t;
+	return 0;
+}
+
+static int dnet_io_batch_cmp(const void *p1, const void *p2)
+{
+	const struct dnet_trans *t1 = *(const struct dnet_trans **)p1;
+	const struct dnet_trans *t2 = *(const struct dnet_trans **)p2;
+
+	if (t1->st < t2->st)
+		return -1;
+	if (t1->st > t2->st)
+		return 1;
+	return 0;
+}
+
+int dnet_io_batch_send(struct dnet_io_batch *b)
+{
+	int i, start, err = 0, states = 0;
+
+	qsort(b->trans, b->num, sizeof(struct dnet_trans *), dnet_io_batch_cmp);
+
+	for (start = 0, i = 1; i <= b->num; ++i) {
+		if (i < b->num && b->trans[i]->st == b->trans[start]->st)
+			continue;
+
+		err = dnet_trans_send_batch(b->trans[start]->st, b->trans + start, i - start);
+		++states;
+		start = i;
+	}
+
+	dnet_log(b->s->node, DNET_LOG_NOTICE, "io-batch: sent %d transactions to %d states, err: %d\n",
+			b->num, states, err);
+
+	free(b->trans);
+	free(b);
+
+	return err;
+}
+
 int dnet_trans_create_send_all(struct dnet_session *s, struct dnet_io_control *ctl)
 {
 	int num = 0, i, err;
@@ -1977,37 +2098,33 @@ err_out_exit:
 }
 
 struct dnet_weight {
-	int			weight;
+	uint64_t		score;
 	int			group_id;
 };
 
-static int dnet_weight_compare(const void *v1, const void *v2)
-{
-	const struct dnet_weight *w1 = v1;
-	const struct dnet_weight *w2 = v2;
-
-	return w2->weight - w1->weight;
-}
-
-static int dnet_weight_get_winner(struct dnet_weight *w, int num)
+/*
+ * Orders groups by power of two choices: every position is taken by the better
+ * of two random groups out of those which are left. Requests go to fast and
+ * idle replicas, but not all clients rush to the single best one.
+ */
+static void dnet_weight_order(struct dnet_weight *w, int num)
 {
-	long sum = 0, pos;
-	float r;
-	int i;
+	struct dnet_weight tmp;
+	int i, a, b, winner;
 
-	for (i = 0; i < num; ++i)
-		sum += w[i].weight;
+	for (i = 0; i < num - 1; ++i) {
+		/* Candidates are distinct, at least two groups are left */
+		a = i + rand() % (num - i);
+		b = i + rand() % (num - i - 1);
+		if (b >= a)
+			b++;
 
-	r = (float)rand() / (float)RAND_MAX;
-	pos = r * sum;
+		winner = (w[a].score <= w[b].score) ? a : b;
 
-	for (i = 0; i < num; ++i) {
-		pos -= w[i].weight;
-		if (pos <= 0)
-			return i;
+		tmp = w[i];
+		w[i] = w[winner];
+		w[winner] = tmp;
 	}
-
-	return num - 1;
 }
 
 int dnet_mix_states(struct dnet_session *s, struct dnet_id *id, int **groupsp)
@@ -2017,6 +2134,7 @@ int dnet_mix_states(struct dnet_session *s, struct dnet_id *id, int **groupsp)
 	int *groups;
 	int group_num, i, num;
 	struct dnet_net_state *st;
+	time_t now;
 
 	if (!s->group_num)
 		return -ENXIO;
@@ -2035,7 +2153,7 @@ int dnet_mix_states(struct dnet_session *s, struct dnet_id *id, int **groupsp)
 
 	if (n->flags & DNET_CFG_RANDOMIZE_STATES) {
 		for (i = 0; i < group_num; ++i) {
-			weights[i].weight = rand();
+			weights[i].score = rand();
 			weights[i].group_id = groups[i];
 		}
 		num = group_num;
@@ -2046,13 +2164,14 @@ int dnet_mix_states(struct dnet_session *s, struct dnet_id *id, int **groupsp)
 		}
 
 		memset(weights, 0, group_num * sizeof(*weights));
+		now = time(NULL);
 
 		for (i = 0, num = 0; i < group_num; ++i) {
 			id->group_id = groups[i];
 
 			st = dnet_state_get_first(n, id);
 			if (st) {
-				weights[num].weight = (int)st->weight;
+				weights[num].score = dnet_state_score(st, now);
 				weights[num].group_id = id->group_id;
 
 				dnet_state_put(st);
@@ -2068,17 +2187,10 @@ int dnet_mix_states(struct dnet_session *s, struct dnet_id *id, int **groupsp)
 	}
 
 	group_num = num;
-	if (group_num) {
-		qsort(weights, group_num, sizeof(struct dnet_weight), dnet_weight_compare);
-
-		for (i = 0; i < group_num; ++i) {
-			int pos = dnet_weight_get_winner(weights, group_num - i);
-			groups[i] = weights[pos].group_id;
+	dnet_weight_order(weights, group_num);
 
-			if (pos < group_num - 1)
-				memmove(&weights[pos], &weights[pos + 1], (group_num - 1 - pos) * sizeof(struct dnet_weight));
-		}
-	}
+	for (i = 0; i < group_num; ++i)
+		groups[i] = weights[i].group_id;
 
 	*groupsp = groups;
 	return group_num;
@@ -2260,220 +2372,6 @@ err_out_exit:
 	return err;
 }
 
-/*!
- * Compares responses firt by key, then by timestamp
- */
-static int dnet_iterator_response_cmp(const void *r1, const void *r2)
-{
-	const struct dnet_iterator_response *a = r1, *b = r2;
-	int diff = dnet_id_cmp_str(a->key.id, b->key.id);
-
-	if (diff == 0) {
-		diff = dnet_time_cmp(&b->timestamp, &a->timestamp);
-		if (diff == 0) {
-			if (a->size > b->size)
-				diff = -1;
-			if(a->size < b->size)
-				diff = 1;
-		}
-	}
-
-	return diff;
-}
-
-/*!
- * Sort responses using \fn dnet_iterator_response_cmp
- */
-int dnet_iterator_response_container_sort(int fd, size_t size)
-{
-	struct dnet_map_fd map = { .fd = fd, .size = size };
-	const ssize_t resp_size = sizeof(struct dnet_iterator_response);
-	const size_t nel = size / resp_size;
-	int err;
-
-	/* Sanity */
-	if (fd < 0)
-		return -EINVAL;
-	if (size % resp_size != 0)
-		return -EINVAL;
-
-	/* If size is zero - it's already sorted */
-	if (size == 0)
-		return 0;
-
-	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
-
-	if ((err = dnet_data_map_rw(&map)) != 0)
-		return err;
-	qsort(map.data, nel, resp_size, dnet_iterator_response_cmp);
-	dnet_data_unmap(&map);
-
-	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
-
-	return 0;
-}
-
-/*!
- * Appends one dnet_iterator_response to fd
- */
-int dnet_iterator_response_container_append(const struct dnet_iterator_response *response,
-		int fd, uint64_t pos)
-{
-	struct dnet_iterator_response copy;
-	const ssize_t resp_size = sizeof(struct dnet_iterator_response);
-	ssize_t err;
-
-	/* Sanity */
-	if (pos % resp_size != 0)
-		return -EINVAL;
-	if (response == NULL)
-		return -EINVAL;
-
-	copy = *response;
-	dnet_convert_iterator_response(&copy);
-	if ((err = pwrite(fd, &copy, resp_size, pos)) != resp_size)
-		return (err == -1) ? -errno : -EINTR;
-
-	return 0;
-}
-
-/*!
- * Reads one dnet_iterator_response from \a fd at position \a pos and stores it
- * in \a response
- */
-int dnet_iterator_response_container_read(int fd, uint64_t pos,
-		struct dnet_iterator_response *response)
-{
-	const ssize_t resp_size = sizeof(struct dnet_iterator_response);
-	ssize_t err;
-
-	/* Sanity */
-	if (fd < 0 || response == NULL)
-		return -EINVAL;
-	if (pos % resp_size != 0)
-		return -EINVAL;
-
-	if ((err = pread(fd, response, resp_size, pos)) != resp_size)
-		return (err == -1) ? -errno : -EINTR;
-	dnet_convert_iterator_response(response);
-
-	return 0;
-}
-
-/*!
- * Shifts offset and skips response with equal keys.
- */
-static inline void dnet_iterator_response_skip_equal_keys(const struct dnet_iterator_response *resp,
-		uint64_t *offset, uint64_t size)
-{
-	const ssize_t resp_size = sizeof(struct dnet_iterator_response);
-	uint64_t next_offset = *offset + resp_size;
-
-	while (next_offset < size) {
-		const uint64_t current_pos = *offset / resp_size;
-		const uint64_t next_pos = next_offset / resp_size;
-		const struct dnet_iterator_response *curr = resp + current_pos;
-		const struct dnet_iterator_response *next = resp + next_pos;
-
-		if (dnet_id_cmp_str(curr->key.id, next->key.id))
-			break;
-
-		*offset += resp_size;
-		next_offset += resp_size;
-	}
-
-	*offset += resp_size;
-}
-
-/*!
- * Computes difference for two containers and writes it to diff_fd.
- * Returns size of new container.
- *
- * NB! For now only right outer difference is supported, so returned container
- * has only items that exist only in right, or exist in both but right one is
- * newer (w.r.t. timestamp).
- */
-int64_t dnet_iterator_response_container_diff(int diff_fd, int left_fd, uint64_t left_size,
-		int right_fd, uint64_t right_size)
-{
-	struct dnet_map_fd left_map = { .fd = left_fd, .size = left_size };
-	struct dnet_map_fd right_map = { .fd = right_fd, .size = right_size };
-	const ssize_t resp_size = sizeof(struct dnet_iterator_response);
-	uint64_t left_offset = 0, right_offset = 0;
-	int64_t diff_offset = 0, err = 0;
-
-	/* Sanity */
-	if (diff_fd < 0 || left_fd < 0 || right_fd < 0)
-		return -EINVAL;
-	if (left_size % resp_size != 0)
-		return -EINVAL;
-	if (right_size % resp_size != 0)
-		return -EINVAL;
-
-	/* mmap both containers */
-	if ((err = dnet_data_map(&left_map)) != 0)
-		goto err;
-	if ((err = dnet_data_map(&right_map)) != 0)
-		goto err_unmap_left;
-
-	/*
-	 * Compute difference between two sorted lists.
-	 * - We add elements from right list to diff until they are than
-	 *   current element in left list;
-	 * - We skip elements in left list until they are ge then current
-	 * element in right one;
-	 * - In case elements are equal skip both.
-	 */
-	while (right_offset < right_size) {
-		const uint64_t left_pos = left_offset / resp_size;
-		const uint64_t right_pos = right_offset / resp_size;
-		const struct dnet_iterator_response *left =
-			(struct dnet_iterator_response *)left_map.data + left_pos;
-		const struct dnet_iterator_response *right =
-			(struct dnet_iterator_response *)right_map.data + right_pos;
-		const int cmp_id = dnet_id_cmp_str(left->key.id, right->key.id);
-		const int cmp = dnet_iterator_response_cmp(left, right);
-
-		if (left_offset < left_size && cmp <= 0) {
-			/*
-			 * If we can move left pointer and left key is less or
-			 * same but with lesser timestamp we skip record.
-			 */
-			dnet_iterator_response_skip_equal_keys(left_map.data, &left_offset, left_size);
-
-			/* For same key we move both pointers */
-			if (cmp_id == 0)
-				dnet_iterator_response_skip_equal_keys(right_map.data, &right_offset, right_size);
-		} else {
-			/*
-			 * If we can move left pointer or left key is greater
-			 * or same but less timestamp we add record to
-			 * differene because it should be recovered.
-			 */
-			err = dnet_iterator_response_container_append(right, diff_fd, diff_offset);
-			if (err != 0)
-				goto err_unmap_right;
-			diff_offset += resp_size;
-
-			dnet_iterator_response_skip_equal_keys(right_map.data, &right_offset, right_size);
-
-			/* For same key we move both pointers */
-			if (cmp_id == 0 && left_offset < left_size)
-				dnet_iterator_response_skip_equal_keys(left_map.data, &left_offset, left_size);
-		}
-		assert(left_offset <= left_size);
-		assert(diff_offset <= (int64_t)right_size);
-	}
-	assert(right_offset == right_size);
-
-err_unmap_right:
-	dnet_data_unmap(&right_map);
-err_unmap_left:
-	dnet_data_unmap(&left_map);
-err:
-	return err ? err : diff_offset;
-}
-
 int dnet_parse_numeric_id(const char *value, unsigned char *id)
 {
 	unsigned char ch[5];
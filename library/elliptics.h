@@ -46,6 +46,7 @@ typedef unsigned short u_short;
 #include "rbtree.h"
 
 #include "atomic.h"
+#include "latency.h"
 #include "lock.h"
 
 #include "elliptics/packet.h"
@@ -100,7 +101,10 @@ struct dnet_io_req {
 /* Attached data should be discarded */
 #define DNET_IO_DROP		(1<<1)
 
-#define DNET_STATE_MAX_WEIGHT		(1024 * 10)
+/* Latency estimate of the state which has not replied yet, usecs */
+#define DNET_STATE_DEFAULT_LATENCY	1000
+/* Timeout penalty of the state is halved every DNET_STATE_PENALTY_HALF_LIFE seconds */
+#define DNET_STATE_PENALTY_HALF_LIFE	5
 
 /* Iterator watermarks for sending data and sleeping */
 #define DNET_SEND_WATERMARK_HIGH	(1024 * 100)
@@ -113,6 +117,8 @@ struct dnet_net_state
 {
 	struct list_head	state_entry;
 	struct list_head	storage_state_entry;
+	/* Entry in node's address hash, only states with route ids are there */
+	struct list_head	addr_entry;
 
 	struct dnet_node	*n;
 
@@ -162,8 +168,20 @@ struct dnet_net_state
 
 	int			la;
 	unsigned long long	free;
-	float			weight;
-	long			median_read_time;
+
+	/*
+	 * Replica selection, see dnet_state_score():
+	 * EWMA of read and lookup latency in usecs, number of transactions
+	 * waiting for reply (changed under trans_lock) and timeout penalty
+	 * in usecs which decays since penalty_time
+	 */
+	long			latency_ewma;
+	int			inflight;
+	long			penalty;
+	time_t			penalty_time;
+
+	/* Log-linear histogram of latencies of all successful requests, see latency.h */
+	uint64_t		latency_hist[DNET_LATENCY_BUCKETS];
 
 	struct dnet_idc		*idc;
 
@@ -192,6 +210,7 @@ struct dnet_idc {
 };
 
 int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id *ids, int id_num);
+int dnet_idc_update(struct dnet_net_state *st, int group_id, struct dnet_raw_id *ids, int id_num);
 void dnet_idc_destroy_nolock(struct dnet_net_state *st);
 
 int dnet_state_micro_init(struct dnet_net_state *st, struct dnet_node *n, struct dnet_addr *addr, int join,
@@ -291,10 +310,24 @@ static inline void dnet_wait_put(struct dnet_wait *w)
 
 struct dnet_notify_bucket
 {
-	struct list_head		notify_list;
+	struct list_head		key_list;
 	pthread_rwlock_t		notify_lock;
 };
 
+/*
+ * Events of subscribed keys written on this node,
+ * notify thread sends them to subscribers
+ */
+struct dnet_notify_queue
+{
+	pthread_mutex_t			lock;
+	pthread_cond_t			wait;
+	struct list_head		events;
+	int				num;
+	int				need_exit;
+	pthread_t			tid;
+};
+
 int dnet_update_notify(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data);
 
 int dnet_notify_add(struct dnet_net_state *st, struct dnet_cmd *cmd);
@@ -330,6 +363,36 @@ static inline void dnet_group_put(struct dnet_group *g)
 		dnet_group_destroy(g);
 }
 
+/*
+ * Immutable copy of group route tables used for lock-free state lookup.
+ * Every group is a dense array sorted by id, the first 8 bytes of ids
+ * are kept contiguously as integers, so binary search rarely touches full ids.
+ * New table is published under state_lock every time ids of some group change,
+ * old one is freed once all readers which could see it have left, see node.c.
+ */
+struct dnet_route_group {
+	unsigned int		group_id;
+	int			id_num;
+	uint64_t		*prefixes;
+	struct dnet_net_state	**states;
+	struct dnet_raw_id	*ids;
+};
+
+struct dnet_route_table {
+	int			group_num;
+	unsigned int		*group_ids;	/* Sorted */
+	struct dnet_route_group	**groups;
+};
+
+/* Padded so that counters of different epochs do not share cache line */
+struct dnet_route_readers {
+	long			count;
+	char			pad[64 - sizeof(long)];
+};
+
+void dnet_route_table_update(struct dnet_node *n, struct dnet_group *g);
+void dnet_route_table_destroy(struct dnet_node *n);
+
 struct dnet_transform
 {
 	void			*priv;
@@ -435,6 +498,8 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg);
 void dnet_io_exit(struct dnet_node *n);
 
 void dnet_io_req_free(struct dnet_io_req *r);
+int dnet_io_req_queue_nocopy(struct dnet_net_state *st, struct dnet_io_req *r);
+int dnet_io_req_queue_threshold(struct dnet_net_state *st, struct dnet_io_req *r);
 
 struct dnet_locks_entry {
 	struct rb_node		lock_tree_entry;
@@ -458,6 +523,74 @@ void dnet_oplock(struct dnet_node *n, struct dnet_id *key);
 void dnet_opunlock(struct dnet_node *n, struct dnet_id *key);
 int dnet_optrylock(struct dnet_node *n, struct dnet_id *key);
 
+/*
+ * Range hash cache.
+ * Key space is split into cells by the first DNET_RANGE_HASH_DEPTH_MAX bits of the key,
+ * every cell holds number of keys and sum of per-key hashes of key and its timestamp.
+ * Writes and removals only mark cells dirty, dirty cells are recalculated by
+ * single metadata-only backend iteration when somebody asks for hashes.
+ */
+#define DNET_RANGE_HASH_CELLS		(1 << DNET_RANGE_HASH_DEPTH_MAX)
+
+struct dnet_range_hash_cell {
+	uint64_t		count;
+	uint64_t		hash;
+};
+
+struct dnet_range_hash_cache {
+	pthread_mutex_t		lock;		/* Serializes recalculation */
+	struct dnet_range_hash_cell	cells[DNET_RANGE_HASH_CELLS];
+	unsigned char		dirty[DNET_RANGE_HASH_CELLS];
+};
+
+int dnet_range_hash_init(struct dnet_node *n);
+void dnet_range_hash_cleanup(struct dnet_node *n);
+void dnet_range_hash_invalidate(struct dnet_node *n, const struct dnet_id *id);
+void dnet_range_hash_invalidate_all(struct dnet_node *n);
+int dnet_cmd_range_hash(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data);
+
+int dnet_cmd_copy(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data);
+int dnet_check_newer_local(struct dnet_node *n, struct dnet_id *id, struct dnet_time *ts);
+
+/*
+ * Change journal: records of successful writes and removals ordered by sequence number,
+ * kept on disk in $history/journal, see journal.c
+ */
+#define DNET_JOURNAL_DEFAULT_SEGMENTS	16
+
+struct dnet_journal_record {
+	uint64_t		seq;
+	struct dnet_raw_id	key;
+	struct dnet_time	timestamp;
+	uint64_t		size;
+	uint32_t		cmd;		/* DNET_CMD_WRITE or DNET_CMD_DEL */
+	uint32_t		reserved;
+};
+
+struct dnet_journal;
+
+int dnet_journal_init(struct dnet_node *n, struct dnet_config *cfg);
+void dnet_journal_cleanup(struct dnet_node *n);
+void dnet_journal_append(struct dnet_node *n, struct dnet_cmd *cmd, struct dnet_io_attr *io);
+int dnet_journal_iterate(struct dnet_node *n, uint64_t seq, struct dnet_time *since,
+		int (* callback)(void *priv, struct dnet_journal_record *r), void *priv);
+
+/*
+ * Node-wide background IO scheduler, see io_sched.c
+ */
+struct dnet_io_sched;
+
+int dnet_io_sched_init(struct dnet_node *n, struct dnet_config *cfg);
+void dnet_io_sched_stop(struct dnet_node *n);
+void dnet_io_sched_cleanup(struct dnet_node *n);
+void dnet_io_sched_consume(struct dnet_node *n, int io_class, uint64_t size);
+void dnet_io_sched_defer(struct dnet_node *n, int io_class, uint64_t size,
+		void (* run)(void *priv, int err), void *priv);
+void dnet_io_sched_complete(struct dnet_node *n, uint64_t size, long usecs);
+int dnet_io_sched_defrag_allowed(struct dnet_node *n);
+void dnet_io_sched_stat(struct dnet_node *n, struct dnet_io_sched_ctl *ctl);
+int dnet_cmd_io_sched(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data);
+
 struct dnet_config_data {
 	void (*destroy_config_data) (struct dnet_config_data *);
 
@@ -498,6 +631,19 @@ struct dnet_node
 	pthread_mutex_t		state_lock;
 	struct list_head	group_list;
 
+	/*
+	 * Lock-free copy of group_list routes, updated under state_lock.
+	 * Readers announce themselves in route_readers[route_epoch].
+	 */
+	struct dnet_route_table	*route_table;
+	int			route_epoch;
+	struct dnet_route_readers	route_readers[2];
+
+	/* States which have route ids hashed by address, protected by state_lock */
+	struct list_head	*addr_hash;
+	unsigned int		addr_hash_size;
+	unsigned int		addr_hash_num;
+
 	/* hosts client states, i.e. those who didn't join network */
 	struct list_head	empty_state_list;
 
@@ -534,6 +680,7 @@ struct dnet_node
 
 	unsigned int		notify_hash_size;
 	struct dnet_notify_bucket	*notify_hash;
+	struct dnet_notify_queue	notify_queue;
 
 	pthread_mutex_t		reconnect_lock;
 	struct list_head	reconnect_list;
@@ -565,6 +712,15 @@ struct dnet_node
 	 */
 	pthread_mutex_t		iterator_lock;
 
+	/* Hashes of key ranges used by recovery, server only */
+	struct dnet_range_hash_cache	*range_hash;
+
+	/* Change journal, server only, NULL if disabled */
+	struct dnet_journal	*journal;
+
+	/* Background IO scheduler, server only */
+	struct dnet_io_sched	*io_sched;
+
 	size_t			cache_size;
 	size_t			caches_number;
 	size_t			cache_pages_number;
@@ -714,6 +870,8 @@ static inline void dnet_trans_put(struct dnet_trans *t)
 }
 
 int dnet_trans_insert_nolock(struct rb_root *root, struct dnet_trans *a);
+long dnet_state_penalty(struct dnet_net_state *st, time_t now);
+uint64_t dnet_state_score(struct dnet_net_state *st, time_t now);
 void dnet_trans_remove(struct dnet_trans *t);
 void dnet_trans_remove_nolock(struct rb_root *root, struct dnet_trans *t);
 struct dnet_trans *dnet_trans_search(struct rb_root *root, uint64_t trans);
@@ -723,6 +881,7 @@ int dnet_trans_iterate_move_transaction(struct dnet_net_state *st, struct list_h
 int dnet_state_reset_nolock_noclean(struct dnet_net_state *st, int error, struct list_head *head);
 
 int dnet_trans_send(struct dnet_trans *t, struct dnet_io_req *req);
+int dnet_trans_send_batch(struct dnet_net_state *st, struct dnet_trans **trans, int num);
 
 int dnet_recv_list(struct dnet_node *n, struct dnet_net_state *st);
 
@@ -780,6 +939,8 @@ void dnet_cache_cleanup(struct dnet_node *n);
 int dnet_cmd_cache_io(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_io_attr *io, char *data);
 int dnet_cmd_cache_indexes(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_indexes_request *request);
 int dnet_cmd_cache_lookup(struct dnet_net_state *st, struct dnet_cmd *cmd);
+/* Returns timestamp of the cached record, -ENOENT if it is not cached, -ENOTSUP if there is no cache */
+int dnet_cache_timestamp(struct dnet_node *n, struct dnet_id *id, struct dnet_time *ts);
 
 int dnet_indexes_init(struct dnet_node *, struct dnet_config *);
 void dnet_indexes_cleanup(struct dnet_node *);
@@ -828,15 +989,60 @@ int dnet_iterator_list_remove(struct dnet_node *n, uint64_t id);
 /* Misc routines */
 uint64_t dnet_iterator_list_next_id_nolock(struct dnet_node *n);
 
+/*
+ * Bounded multi-producer single-consumer queue of prepared responses.
+ * Backend iterator threads put responses into it, single sender thread
+ * passes them to the next callback in order they were queued.
+ */
+#define DNET_ITERATOR_QUEUE_SIZE	(16 * 1024 * 1024)
+
+/* Sender merges already queued responses up to this size into single network request */
+#define DNET_ITERATOR_BATCH_SIZE	(64 * 1024)
+/* Larger responses are not merged and are sent from their queue entries without copying */
+#define DNET_ITERATOR_MERGE_SIZE	(4 * 1024)
+
+/*
+ * Entry is allocated as a whole network request: reply header @cmd is directly
+ * followed by response in @data, so entry can be queued for sending without copying.
+ */
+struct dnet_iterator_queue_entry {
+	struct dnet_io_req		req;		/* Must be the first, entry is freed by dnet_io_req_free() */
+	struct dnet_iterator_queue_entry	*next;
+	uint64_t			size;		/* Size of response in @data */
+	struct dnet_cmd			cmd;		/* Filled by the sender */
+	unsigned char			data[0];
+};
+
+struct dnet_iterator_queue {
+	pthread_mutex_t			lock;
+	pthread_cond_t			not_empty;	/* Sender waits here for new responses */
+	pthread_cond_t			not_full;	/* Producers wait here for free space */
+	struct dnet_iterator_queue_entry	*head, **tail;
+	uint64_t			size;		/* Bytes queued */
+	uint64_t			limit;		/* Producers block when it is exceeded */
+	int				done;		/* Producers have finished */
+	int				err;		/* First error returned by the sender */
+};
+
 /*
  * Common private data:
  * Request + next callback and it's argument.
  */
 struct dnet_iterator_common_private {
+	struct dnet_node		*n;
 	struct dnet_iterator_request	*req;		/* Original request */
 	struct dnet_iterator_range		*range;		/* Original ranges */
 	struct dnet_iterator		*it;		/* Iterator control structure */
-	int				(*next_callback)(void *priv, void *data, uint64_t dsize);
+	struct dnet_iterator_queue	*queue;		/* Responses go to the sender through it */
+	/*
+	 * The last checkpoint reported by backend. Writers take position_lock,
+	 * readers retry while position_seq is odd or changes (seqlock).
+	 */
+	pthread_mutex_t			position_lock;
+	unsigned int			position_seq;
+	struct dnet_iterator_position	position;
+	/* Takes ownership of the list of queued responses */
+	int				(*next_callback)(void *priv, struct dnet_iterator_queue_entry *entries);
 	void				*next_private;	/* One of predefined callbacks */
 };
 
@@ -0,0 +1,563 @@
+/*
+ * Copyright 2008+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Background IO scheduler.
+ *
+ * Every background IO class has token bucket refilled with its budget in bytes
+ * per second. Background work takes tokens for the bytes it has read or written,
+ * zero budget means class is not limited. If bucket goes into debt, work running
+ * in its own thread (cache sync, iterators) sleeps, while work started by IO pool
+ * threads (server-side copy) is deferred: it is queued to the scheduler thread,
+ * which runs it once debt is repaid, so IO threads never wait for the budget.
+ *
+ * Foreground requests are never delayed, their latencies are collected
+ * into log2 histogram instead. Once per DNET_IO_SCHED_INTERVAL foreground p99
+ * is compared with latency target: if target is exceeded, budgets are halved
+ * down to 1/DNET_IO_SCHED_SHARE_MAX of configured ones, otherwise they grow back
+ * by 1/DNET_IO_SCHED_SHARE_MAX of configured budget per interval.
+ *
+ * Defragmentation is done by backend on its own and can not be throttled,
+ * so it is just not started while foreground p99 exceeds target.
+ */
+
+#include <sys/time.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "elliptics.h"
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+#define DNET_IO_SCHED_INTERVAL		1000000		/* usecs */
+#define DNET_IO_SCHED_SHARE_MAX		16
+#define DNET_IO_SCHED_HIST_SIZE		32
+/* Longest single sleep, so that node does not wait for throttled threads on exit */
+#define DNET_IO_SCHED_SLEEP_MAX		100000		/* usecs */
+
+struct dnet_io_bucket {
+	uint64_t		rate;		/* Configured budget, bytes/s */
+	uint64_t		current_rate;	/* Budget scaled by current share */
+	int64_t			tokens;
+	uint64_t		refill_time;
+	uint64_t		bytes;
+	uint64_t		wait_time;
+};
+
+struct dnet_io_sched_work {
+	struct list_head	work_entry;
+	uint64_t		deadline;
+	void			(* run)(void *priv, int err);
+	void			*priv;
+};
+
+struct dnet_io_sched {
+	pthread_mutex_t		lock;
+
+	uint64_t		latency_target;
+	uint64_t		latency_p99;
+	/* Current share of configured budgets in 1/DNET_IO_SCHED_SHARE_MAX units */
+	int			share;
+	uint64_t		interval_start;
+
+	/* Foreground latencies of the current interval, i-th entry counts latencies in [2^i, 2^(i+1)) usecs */
+	uint64_t		hist[DNET_IO_SCHED_HIST_SIZE];
+
+	struct dnet_io_bucket	buckets[__DNET_IO_CLASS_MAX];
+
+	/* Deferred work sorted by deadline, protected by work_lock */
+	pthread_mutex_t		work_lock;
+	pthread_cond_t		work_wait;
+	struct list_head	work_list;
+	pthread_t		tid;
+	int			need_exit;
+};
+
+static uint64_t dnet_io_sched_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static inline uint64_t dnet_io_sched_mb(int rate)
+{
+	return rate > 0 ? (uint64_t)rate * 1024 * 1024 : 0;
+}
+
+/*
+ * Must be called with scheduler lock held
+ */
+static void dnet_io_sched_update_rates(struct dnet_io_sched *s)
+{
+	int i;
+
+	for (i = 0; i < __DNET_IO_CLASS_MAX; ++i) {
+		struct dnet_io_bucket *b = &s->buckets[i];
+
+		b->current_rate = b->rate * s->share / DNET_IO_SCHED_SHARE_MAX;
+		if (b->rate && !b->current_rate)
+			b->current_rate = 1;
+
+		if (b->current_rate && b->tokens > (int64_t)b->current_rate)
+			b->tokens = b->current_rate;
+	}
+}
+
+static uint64_t dnet_io_sched_p99(struct dnet_io_sched *s)
+{
+	uint64_t hist[DNET_IO_SCHED_HIST_SIZE];
+	uint64_t total = 0, count = 0;
+	int i;
+
+	for (i = 0; i < DNET_IO_SCHED_HIST_SIZE; ++i) {
+		hist[i] = __sync_fetch_and_and(&s->hist[i], 0);
+		total += hist[i];
+	}
+
+	if (!total)
+		return 0;
+
+	for (i = 0; i < DNET_IO_SCHED_HIST_SIZE; ++i) {
+		count += hist[i];
+		if (count * 100 >= total * 99)
+			break;
+	}
+
+	/* Upper bound of the bucket, so that estimate is never lower than real p99 */
+	return (2ULL << i) - 1;
+}
+
+/*
+ * Closes current interval and adapts budgets to foreground latency.
+ * Only one thread does it, others do not wait for it.
+ */
+static void dnet_io_sched_tick(struct dnet_io_sched *s, uint64_t now)
+{
+	if (now - s->interval_start < DNET_IO_SCHED_INTERVAL)
+		return;
+
+	if (pthread_mutex_trylock(&s->lock))
+		return;
+
+	if (now - s->interval_start >= DNET_IO_SCHED_INTERVAL) {
+		s->interval_start = now;
+		s->latency_p99 = dnet_io_sched_p99(s);
+
+		if (s->latency_target && s->latency_p99 > s->latency_target) {
+			s->share /= 2;
+			if (!s->share)
+				s->share = 1;
+		} else if (s->share < DNET_IO_SCHED_SHARE_MAX) {
+			s->share++;
+		}
+
+		dnet_io_sched_update_rates(s);
+	}
+
+	pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * Takes @size tokens from the bucket of @io_class, returns how long caller must wait
+ * before doing the IO, in usecs
+ */
+static uint64_t dnet_io_sched_take(struct dnet_io_sched *s, int io_class, uint64_t size, uint64_t now)
+{
+	struct dnet_io_bucket *b = &s->buckets[io_class];
+	uint64_t elapsed, wait = 0;
+
+	dnet_io_sched_tick(s, now);
+
+	pthread_mutex_lock(&s->lock);
+	b->bytes += size;
+
+	if (b->current_rate) {
+		elapsed = now > b->refill_time ? now - b->refill_time : 0;
+		if (elapsed > DNET_IO_SCHED_INTERVAL)
+			elapsed = DNET_IO_SCHED_INTERVAL;
+
+		/* Bucket holds at most one second of budget */
+		b->tokens += elapsed * b->current_rate / 1000000;
+		if (b->tokens > (int64_t)b->current_rate)
+			b->tokens = b->current_rate;
+		b->refill_time = now;
+
+		b->tokens -= size;
+		if (b->tokens < 0) {
+			wait = (uint64_t)(-b->tokens) * 1000000 / b->current_rate;
+			b->wait_time += wait;
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	return wait;
+}
+
+/*
+ * Must only be called from threads dedicated to background work, never from IO pool
+ */
+void dnet_io_sched_consume(struct dnet_node *n, int io_class, uint64_t size)
+{
+	struct dnet_io_sched *s = n->io_sched;
+	uint64_t wait;
+
+	if (!s || io_class <= DNET_IO_CLASS_FOREGROUND || io_class >= __DNET_IO_CLASS_MAX)
+		return;
+
+	wait = dnet_io_sched_take(s, io_class, size, dnet_io_sched_now());
+
+	while (wait && !n->need_exit) {
+		uint64_t chunk = wait < DNET_IO_SCHED_SLEEP_MAX ? wait : DNET_IO_SCHED_SLEEP_MAX;
+		struct timespec ts = {
+			.tv_sec = 0,
+			.tv_nsec = chunk * 1000,
+		};
+
+		nanosleep(&ts, NULL);
+		wait -= chunk;
+	}
+}
+
+/*
+ * Accounts @size bytes of @io_class and runs @run when budget allows it.
+ * If there is no debt @run is called right away, otherwise it is called by the scheduler thread.
+ * If node exits before deadline, @run is called with -EINTR from dnet_io_sched_stop(),
+ * work deferred after scheduler has been stopped fails with -EINTR right away.
+ */
+void dnet_io_sched_defer(struct dnet_node *n, int io_class, uint64_t size,
+		void (* run)(void *priv, int err), void *priv)
+{
+	struct dnet_io_sched *s = n->io_sched;
+	struct dnet_io_sched_work *w, *pos;
+	uint64_t now, wait;
+
+	if (!s || io_class <= DNET_IO_CLASS_FOREGROUND || io_class >= __DNET_IO_CLASS_MAX)
+		goto err_out_run;
+
+	now = dnet_io_sched_now();
+	wait = dnet_io_sched_take(s, io_class, size, now);
+	if (!wait)
+		goto err_out_run;
+
+	/* It is better to do IO without delay than to fail it */
+	w = malloc(sizeof(struct dnet_io_sched_work));
+	if (!w)
+		goto err_out_run;
+
+	w->deadline = now + wait;
+	w->run = run;
+	w->priv = priv;
+
+	pthread_mutex_lock(&s->work_lock);
+
+	if (s->need_exit) {
+		pthread_mutex_unlock(&s->work_lock);
+		free(w);
+		run(priv, -EINTR);
+		return;
+	}
+
+	/* Debt only grows, so new work usually goes to the tail */
+	list_for_each_entry_reverse(pos, &s->work_list, work_entry) {
+		if (pos->deadline <= w->deadline)
+			break;
+	}
+	list_add(&w->work_entry, &pos->work_entry);
+
+	if (s->work_list.next == &w->work_entry)
+		pthread_cond_signal(&s->work_wait);
+	pthread_mutex_unlock(&s->work_lock);
+	return;
+
+err_out_run:
+	run(priv, 0);
+}
+
+static void *dnet_io_sched_process(void *priv)
+{
+	struct dnet_node *n = priv;
+	struct dnet_io_sched *s = n->io_sched;
+	struct dnet_io_sched_work *w;
+	struct timespec ts;
+	uint64_t now, deadline;
+
+	dnet_set_name("dnet_io_sched");
+
+	pthread_mutex_lock(&s->work_lock);
+	while (!s->need_exit) {
+		now = dnet_io_sched_now();
+
+		/* Closes intervals even if there is no IO at all, so that stale p99 expires */
+		dnet_io_sched_tick(s, now);
+
+		deadline = now + DNET_IO_SCHED_INTERVAL;
+		if (!list_empty(&s->work_list)) {
+			w = list_first_entry(&s->work_list, struct dnet_io_sched_work, work_entry);
+
+			if (w->deadline <= now) {
+				list_del(&w->work_entry);
+				pthread_mutex_unlock(&s->work_lock);
+
+				w->run(w->priv, 0);
+				free(w);
+
+				pthread_mutex_lock(&s->work_lock);
+				continue;
+			}
+
+			if (w->deadline < deadline)
+				deadline = w->deadline;
+		}
+
+		ts.tv_sec = deadline / 1000000;
+		ts.tv_nsec = (deadline % 1000000) * 1000;
+		pthread_cond_timedwait(&s->work_wait, &s->work_lock, &ts);
+	}
+	pthread_mutex_unlock(&s->work_lock);
+
+	return NULL;
+}
+
+int dnet_io_sched_init(struct dnet_node *n, struct dnet_config *cfg)
+{
+	struct dnet_io_sched *s;
+	int err;
+
+	s = calloc(1, sizeof(struct dnet_io_sched));
+	if (!s) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	err = pthread_mutex_init(&s->lock, NULL);
+	if (err) {
+		err = -err;
+		dnet_log(n, DNET_LOG_ERROR, "Could not create IO scheduler lock: %s [%d]\n", strerror(-err), err);
+		goto err_out_free;
+	}
+
+	err = pthread_mutex_init(&s->work_lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_lock_destroy;
+	}
+
+	err = pthread_cond_init(&s->work_wait, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_work_lock_destroy;
+	}
+
+	INIT_LIST_HEAD(&s->work_list);
+
+	s->latency_target = cfg->io_sched_latency_target > 0 ? cfg->io_sched_latency_target : 0;
+	s->share = DNET_IO_SCHED_SHARE_MAX;
+	s->interval_start = dnet_io_sched_now();
+
+	s->buckets[DNET_IO_CLASS_ITERATOR].rate = dnet_io_sched_mb(cfg->io_sched_iterator_rate);
+	s->buckets[DNET_IO_CLASS_SYNC].rate = dnet_io_sched_mb(cfg->io_sched_sync_rate);
+	s->buckets[DNET_IO_CLASS_RECOVERY].rate = dnet_io_sched_mb(cfg->io_sched_recovery_rate);
+	dnet_io_sched_update_rates(s);
+
+	dnet_log(n, DNET_LOG_INFO, "io-sched: latency target: %llu usecs, iterator: %d MB/s, sync: %d MB/s, recovery: %d MB/s\n",
+			(unsigned long long)s->latency_target, cfg->io_sched_iterator_rate,
+			cfg->io_sched_sync_rate, cfg->io_sched_recovery_rate);
+
+	n->io_sched = s;
+
+	err = pthread_create(&s->tid, NULL, dnet_io_sched_process, n);
+	if (err) {
+		err = -err;
+		dnet_log(n, DNET_LOG_ERROR, "Could not start IO scheduler thread: %s [%d]\n", strerror(-err), err);
+		n->io_sched = NULL;
+		goto err_out_cond_destroy;
+	}
+
+	return 0;
+
+err_out_cond_destroy:
+	pthread_cond_destroy(&s->work_wait);
+err_out_work_lock_destroy:
+	pthread_mutex_destroy(&s->work_lock);
+err_out_lock_destroy:
+	pthread_mutex_destroy(&s->lock);
+err_out_free:
+	free(s);
+err_out_exit:
+	return err;
+}
+
+/*
+ * Stops scheduler thread and completes pending work with -EINTR.
+ * Deferred work sends replies and uses backend, so it must be called while
+ * states and backend are still alive. Scheduler itself is not freed,
+ * since IO threads can still account their requests.
+ */
+void dnet_io_sched_stop(struct dnet_node *n)
+{
+	struct dnet_io_sched *s = n->io_sched;
+	struct dnet_io_sched_work *w;
+
+	if (!s)
+		return;
+
+	pthread_mutex_lock(&s->work_lock);
+	if (s->need_exit) {
+		pthread_mutex_unlock(&s->work_lock);
+		return;
+	}
+
+	s->need_exit = 1;
+	pthread_cond_signal(&s->work_wait);
+	pthread_mutex_unlock(&s->work_lock);
+
+	pthread_join(s->tid, NULL);
+
+	/* Work which has not reached its deadline is not run, but it has to release its resources */
+	while (!list_empty(&s->work_list)) {
+		w = list_first_entry(&s->work_list, struct dnet_io_sched_work, work_entry);
+		list_del(&w->work_entry);
+
+		w->run(w->priv, -EINTR);
+		free(w);
+	}
+}
+
+void dnet_io_sched_cleanup(struct dnet_node *n)
+{
+	struct dnet_io_sched *s = n->io_sched;
+
+	if (!s)
+		return;
+
+	dnet_io_sched_stop(n);
+
+	n->io_sched = NULL;
+
+	pthread_cond_destroy(&s->work_wait);
+	pthread_mutex_destroy(&s->work_lock);
+	pthread_mutex_destroy(&s->lock);
+	free(s);
+}
+
+void dnet_io_sched_complete(struct dnet_node *n, uint64_t size, long usecs)
+{
+	struct dnet_io_sched *s = n->io_sched;
+	int bucket = 0;
+
+	if (!s)
+		return;
+
+	while (usecs > 1 && bucket < DNET_IO_SCHED_HIST_SIZE - 1) {
+		usecs >>= 1;
+		++bucket;
+	}
+
+	__sync_fetch_and_add(&s->hist[bucket], 1);
+	__sync_fetch_and_add(&s->buckets[DNET_IO_CLASS_FOREGROUND].bytes, size);
+
+	dnet_io_sched_tick(s, dnet_io_sched_now());
+}
+
+int dnet_io_sched_defrag_allowed(struct dnet_node *n)
+{
+	struct dnet_io_sched *s = n->io_sched;
+
+	if (!s || !s->latency_target)
+		return 1;
+
+	/* Node may have gone idle after a slow interval, do not trust p99 of a closed window */
+	dnet_io_sched_tick(s, dnet_io_sched_now());
+
+	return s->latency_p99 <= s->latency_target;
+}
+
+void dnet_io_sched_stat(struct dnet_node *n, struct dnet_io_sched_ctl *ctl)
+{
+	struct dnet_io_sched *s = n->io_sched;
+	int i;
+
+	memset(ctl, 0, sizeof(struct dnet_io_sched_ctl));
+	if (!s)
+		return;
+
+	pthread_mutex_lock(&s->lock);
+	ctl->latency_target = s->latency_target;
+	ctl->latency_p99 = s->latency_p99;
+
+	for (i = 0; i < __DNET_IO_CLASS_MAX; ++i) {
+		ctl->rate[i] = s->buckets[i].rate;
+		ctl->current_rate[i] = s->buckets[i].current_rate;
+		ctl->bytes[i] = s->buckets[i].bytes;
+		ctl->wait_time[i] = s->buckets[i].wait_time;
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+int dnet_cmd_io_sched(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_node *n = st->n;
+	struct dnet_io_sched *s = n->io_sched;
+	struct dnet_io_sched_ctl *ctl = data;
+	struct dnet_io_sched_ctl reply;
+	int i;
+
+	if (!s)
+		return -ENOTSUP;
+
+	if (cmd->size != sizeof(struct dnet_io_sched_ctl)) {
+		dnet_log(n, DNET_LOG_ERROR, "%s: io-sched: invalid request size: %llu, must be: %zu\n",
+				dnet_dump_id(&cmd->id), (unsigned long long)cmd->size, sizeof(struct dnet_io_sched_ctl));
+		return -EINVAL;
+	}
+
+	dnet_convert_io_sched_ctl(ctl);
+
+	if (ctl->flags & (DNET_IO_SCHED_FLAGS_SET_LATENCY | DNET_IO_SCHED_FLAGS_SET_RATE)) {
+		pthread_mutex_lock(&s->lock);
+
+		if (ctl->flags & DNET_IO_SCHED_FLAGS_SET_LATENCY)
+			s->latency_target = ctl->latency_target;
+
+		/* Foreground is never limited */
+		if (ctl->flags & DNET_IO_SCHED_FLAGS_SET_RATE) {
+			for (i = DNET_IO_CLASS_FOREGROUND + 1; i < __DNET_IO_CLASS_MAX; ++i)
+				s->buckets[i].rate = ctl->rate[i];
+		}
+
+		dnet_io_sched_update_rates(s);
+		pthread_mutex_unlock(&s->lock);
+
+		dnet_log(n, DNET_LOG_INFO, "%s: io-sched: flags: 0x%llx, latency target: %llu usecs\n",
+				dnet_dump_id(&cmd->id), (unsigned long long)ctl->flags,
+				(unsigned long long)ctl->latency_target);
+	}
+
+	dnet_io_sched_stat(n, &reply);
+	dnet_convert_io_sched_ctl(&reply);
+
+	return dnet_send_reply(st, cmd, &reply, sizeof(struct dnet_io_sched_ctl), 0);
+}
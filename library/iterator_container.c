@@ -0,0 +1,724 @@
+/*
+ * Copyright 2008+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Iterator result containers: files of fixed-size dnet_iterator_response
+ * records which are appended through buffered writer, sorted by
+ * (key, timestamp, size) and diffed against each other.
+ *
+ * Container which does not fit into memory limit is sorted externally:
+ * it is split into runs, every run is read, sorted in memory and written
+ * back in place, then all runs are merged with k-way merge.
+ * In-memory sort distributes records into 256 buckets by the first key byte
+ * and sorts buckets in parallel.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+/* Memory used by container sort when caller does not specify it */
+#define DNET_ITERATOR_SORT_MEMORY		(256 * 1024 * 1024)
+
+/* Containers smaller than this are sorted with single qsort() */
+#define DNET_ITERATOR_SORT_PARALLEL_MIN		(64 * 1024)
+
+#define DNET_ITERATOR_SORT_THREADS_MAX		16
+
+/* Number of records buffered by container writer */
+#define DNET_ITERATOR_WRITER_NUM		1024
+
+/* Minimal number of records buffered for every run during merge */
+#define DNET_ITERATOR_MERGE_BUFFER_MIN		64
+
+static const size_t resp_size = sizeof(struct dnet_iterator_response);
+
+struct dnet_iterator_container_writer {
+	int				fd;
+	uint64_t			pos;		/* Where buffered records will be written */
+	size_t				num;		/* Number of buffered records */
+	size_t				max;
+	struct dnet_iterator_response	*buf;
+};
+
+/*!
+ * Compares responses firt by key, then by timestamp
+ */
+static int dnet_iterator_response_cmp(const void *r1, const void *r2)
+{
+	const struct dnet_iterator_response *a = r1, *b = r2;
+	int diff = dnet_id_cmp_str(a->key.id, b->key.id);
+
+	if (diff == 0) {
+		diff = dnet_time_cmp(&b->timestamp, &a->timestamp);
+		if (diff == 0) {
+			if (a->size > b->size)
+				diff = -1;
+			if(a->size < b->size)
+				diff = 1;
+		}
+	}
+
+	return diff;
+}
+
+static int dnet_iterator_pread(int fd, void *data, size_t size, uint64_t pos)
+{
+	ssize_t err;
+
+	while (size) {
+		err = pread(fd, data, size, pos);
+		if (err == -1) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (err == 0)
+			return -ENODATA;
+
+		data += err;
+		size -= err;
+		pos += err;
+	}
+
+	return 0;
+}
+
+static int dnet_iterator_pwrite(int fd, const void *data, size_t size, uint64_t pos)
+{
+	ssize_t err;
+
+	while (size) {
+		err = pwrite(fd, data, size, pos);
+		if (err == -1) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		data += err;
+		size -= err;
+		pos += err;
+	}
+
+	return 0;
+}
+
+static struct dnet_iterator_container_writer *dnet_iterator_container_writer_create_ll(int fd,
+		uint64_t pos, size_t max)
+{
+	struct dnet_iterator_container_writer *w;
+
+	w = malloc(sizeof(struct dnet_iterator_container_writer) + max * resp_size);
+	if (!w)
+		return NULL;
+
+	w->fd = fd;
+	w->pos = pos;
+	w->num = 0;
+	w->max = max;
+	w->buf = (struct dnet_iterator_response *)(w + 1);
+
+	return w;
+}
+
+struct dnet_iterator_container_writer *dnet_iterator_container_writer_create(int fd, uint64_t pos)
+{
+	if (fd < 0 || pos % resp_size != 0)
+		return NULL;
+
+	return dnet_iterator_container_writer_create_ll(fd, pos, DNET_ITERATOR_WRITER_NUM);
+}
+
+void dnet_iterator_container_writer_destroy(struct dnet_iterator_container_writer *w)
+{
+	free(w);
+}
+
+int dnet_iterator_container_writer_flush(struct dnet_iterator_container_writer *w)
+{
+	int err;
+
+	if (!w->num)
+		return 0;
+
+	err = dnet_iterator_pwrite(w->fd, w->buf, w->num * resp_size, w->pos);
+	if (err)
+		return err;
+
+	w->pos += w->num * resp_size;
+	w->num = 0;
+	return 0;
+}
+
+/*
+ * Puts already converted response into writer buffer
+ */
+static int dnet_iterator_container_writer_put(struct dnet_iterator_container_writer *w,
+		const struct dnet_iterator_response *response)
+{
+	int err;
+
+	if (w->num == w->max) {
+		err = dnet_iterator_container_writer_flush(w);
+		if (err)
+			return err;
+	}
+
+	w->buf[w->num++] = *response;
+	return 0;
+}
+
+int dnet_iterator_container_writer_append(struct dnet_iterator_container_writer *w,
+		const struct dnet_iterator_response *response)
+{
+	struct dnet_iterator_response copy;
+
+	if (response == NULL)
+		return -EINVAL;
+
+	copy = *response;
+	dnet_convert_iterator_response(&copy);
+
+	return dnet_iterator_container_writer_put(w, &copy);
+}
+
+struct dnet_iterator_sort_ctl {
+	struct dnet_iterator_response	*data;
+	size_t				offsets[257];	/* Bucket boundaries in @data */
+	int				next;		/* Next bucket to sort */
+};
+
+static void *dnet_iterator_sort_process(void *priv)
+{
+	struct dnet_iterator_sort_ctl *ctl = priv;
+	int bucket;
+
+	while ((bucket = __sync_fetch_and_add(&ctl->next, 1)) < 256) {
+		const size_t start = ctl->offsets[bucket];
+		const size_t num = ctl->offsets[bucket + 1] - start;
+
+		if (num > 1)
+			qsort(ctl->data + start, num, resp_size, dnet_iterator_response_cmp);
+	}
+
+	return NULL;
+}
+
+/*!
+ * Sorts \a nel responses in \a data using \a tmp of the same size as scratch space.
+ * Returns pointer to the sorted records, which is either \a data or \a tmp.
+ */
+static struct dnet_iterator_response *dnet_iterator_sort_memory(struct dnet_iterator_response *data,
+		struct dnet_iterator_response *tmp, size_t nel, int thread_num)
+{
+	struct dnet_iterator_sort_ctl ctl;
+	pthread_t tids[DNET_ITERATOR_SORT_THREADS_MAX];
+	size_t counts[256], pos[256];
+	size_t i;
+	int t, started = 0;
+
+	if (thread_num <= 1 || nel < DNET_ITERATOR_SORT_PARALLEL_MIN) {
+		qsort(data, nel, resp_size, dnet_iterator_response_cmp);
+		return data;
+	}
+
+	/* Keys are compared byte by byte, so buckets of the first byte are already in order */
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < nel; ++i)
+		counts[data[i].key.id[0]]++;
+
+	ctl.offsets[0] = 0;
+	for (i = 0; i < 256; ++i) {
+		pos[i] = ctl.offsets[i];
+		ctl.offsets[i + 1] = ctl.offsets[i] + counts[i];
+	}
+
+	for (i = 0; i < nel; ++i)
+		tmp[pos[data[i].key.id[0]]++] = data[i];
+
+	ctl.data = tmp;
+	ctl.next = 0;
+
+	for (t = 0; t < thread_num - 1; ++t) {
+		if (pthread_create(&tids[t], NULL, dnet_iterator_sort_process, &ctl))
+			break;
+		started++;
+	}
+
+	/* Current thread sorts buckets too, so sort completes even if no thread was started */
+	dnet_iterator_sort_process(&ctl);
+
+	for (t = 0; t < started; ++t)
+		pthread_join(tids[t], NULL);
+
+	return tmp;
+}
+
+struct dnet_iterator_run {
+	uint64_t			pos, end;	/* Unread part of the run in container */
+	struct dnet_iterator_response	*buf;
+	size_t				num, cur;	/* Records in @buf and current one */
+};
+
+static int dnet_iterator_run_fill(int fd, struct dnet_iterator_run *run, size_t max)
+{
+	size_t num = (run->end - run->pos) / resp_size;
+	int err;
+
+	if (num > max)
+		num = max;
+
+	err = dnet_iterator_pread(fd, run->buf, num * resp_size, run->pos);
+	if (err)
+		return err;
+
+	run->pos += num * resp_size;
+	run->num = num;
+	run->cur = 0;
+	return 0;
+}
+
+static inline const struct dnet_iterator_response *dnet_iterator_run_head(struct dnet_iterator_run *run)
+{
+	return run->buf + run->cur;
+}
+
+static void dnet_iterator_heap_down(struct dnet_iterator_run **heap, size_t num, size_t i)
+{
+	struct dnet_iterator_run *tmp;
+	size_t child;
+
+	while ((child = 2 * i + 1) < num) {
+		if (child + 1 < num && dnet_iterator_response_cmp(dnet_iterator_run_head(heap[child + 1]),
+					dnet_iterator_run_head(heap[child])) < 0)
+			child++;
+
+		if (dnet_iterator_response_cmp(dnet_iterator_run_head(heap[i]),
+					dnet_iterator_run_head(heap[child])) <= 0)
+			break;
+
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+/*!
+ * Merges sorted runs of \a run_size bytes (the last one may be shorter)
+ * from the first \a size bytes of container to writer \a w.
+ */
+static int dnet_iterator_merge_runs(int fd, size_t size, size_t run_size,
+		void *buf, size_t buf_size, struct dnet_iterator_container_writer *w)
+{
+	const size_t run_num = (size + run_size - 1) / run_size;
+	struct dnet_iterator_run *runs, **heap;
+	size_t heap_num = 0, run_max, i;
+	int err = 0;
+
+	runs = calloc(run_num, sizeof(struct dnet_iterator_run) + sizeof(struct dnet_iterator_run *));
+	if (!runs)
+		return -ENOMEM;
+	heap = (struct dnet_iterator_run **)(runs + run_num);
+
+	run_max = buf_size / resp_size / run_num;
+	if (run_max < DNET_ITERATOR_MERGE_BUFFER_MIN) {
+		run_max = DNET_ITERATOR_MERGE_BUFFER_MIN;
+		buf = NULL;
+	}
+
+	for (i = 0; i < run_num; ++i) {
+		struct dnet_iterator_run *run = &runs[i];
+
+		run->pos = i * run_size;
+		run->end = run->pos + run_size;
+		if (run->end > size)
+			run->end = size;
+
+		if (buf) {
+			run->buf = (struct dnet_iterator_response *)buf + i * run_max;
+		} else {
+			run->buf = malloc(run_max * resp_size);
+			if (!run->buf) {
+				err = -ENOMEM;
+				goto err_out_free;
+			}
+		}
+
+		err = dnet_iterator_run_fill(fd, run, run_max);
+		if (err)
+			goto err_out_free;
+
+		heap[heap_num++] = run;
+	}
+
+	for (i = heap_num / 2; i > 0; --i)
+		dnet_iterator_heap_down(heap, heap_num, i - 1);
+
+	while (heap_num) {
+		struct dnet_iterator_run *run = heap[0];
+
+		err = dnet_iterator_container_writer_put(w, dnet_iterator_run_head(run));
+		if (err)
+			goto err_out_free;
+
+		if (++run->cur == run->num) {
+			if (run->pos == run->end) {
+				heap[0] = heap[--heap_num];
+			} else {
+				err = dnet_iterator_run_fill(fd, run, run_max);
+				if (err)
+					goto err_out_free;
+			}
+		}
+
+		dnet_iterator_heap_down(heap, heap_num, 0);
+	}
+
+	err = dnet_iterator_container_writer_flush(w);
+
+err_out_free:
+	if (!buf) {
+		for (i = 0; i < run_num; ++i)
+			free(runs[i].buf);
+	}
+	free(runs);
+	return err;
+}
+
+/*!
+ * Moves \a size bytes at \a from to the beginning of container and truncates it
+ */
+static int dnet_iterator_container_move(int fd, uint64_t from, size_t size, void *buf, size_t buf_size)
+{
+	uint64_t pos = 0;
+	size_t sz;
+	int err;
+
+	while (pos < size) {
+		sz = size - pos;
+		if (sz > buf_size)
+			sz = buf_size;
+
+		err = dnet_iterator_pread(fd, buf, sz, from + pos);
+		if (err)
+			return err;
+
+		err = dnet_iterator_pwrite(fd, buf, sz, pos);
+		if (err)
+			return err;
+
+		pos += sz;
+	}
+
+	if (ftruncate(fd, size))
+		return -errno;
+
+	return 0;
+}
+
+/*!
+ * Sort responses using \fn dnet_iterator_response_cmp
+ *
+ * At most \a memory_limit bytes are used for records, container which does not fit
+ * is sorted externally: sorted runs are merged into the end of the container,
+ * which is then moved to the beginning, so container temporarily takes twice its size.
+ * Zero \a thread_num means number of online CPUs.
+ */
+int dnet_iterator_response_container_sort_ext(int fd, size_t size, size_t memory_limit, int thread_num)
+{
+	struct dnet_iterator_container_writer *w;
+	struct dnet_iterator_response *data, *tmp, *sorted;
+	size_t nel = size / resp_size;
+	size_t run_nel, run_size, pos;
+	int err;
+
+	/* Sanity */
+	if (fd < 0)
+		return -EINVAL;
+	if (size % resp_size != 0)
+		return -EINVAL;
+
+	/* If size is zero - it's already sorted */
+	if (size == 0)
+		return 0;
+
+	if (thread_num <= 0)
+		thread_num = sysconf(_SC_NPROCESSORS_ONLN);
+	if (thread_num > DNET_ITERATOR_SORT_THREADS_MAX)
+		thread_num = DNET_ITERATOR_SORT_THREADS_MAX;
+
+	/* Run and scratch space for it */
+	run_nel = memory_limit / resp_size / 2;
+	if (run_nel < DNET_ITERATOR_WRITER_NUM)
+		run_nel = DNET_ITERATOR_WRITER_NUM;
+	if (run_nel > nel)
+		run_nel = nel;
+	run_size = run_nel * resp_size;
+
+	data = malloc(2 * run_size);
+	if (!data)
+		return -ENOMEM;
+	tmp = data + run_nel;
+
+	posix_fadvise(fd, 0, size, POSIX_FADV_SEQUENTIAL);
+
+	/* Sort every run in place */
+	for (pos = 0; pos < size; pos += run_size) {
+		size_t sz = size - pos;
+		if (sz > run_size)
+			sz = run_size;
+
+		err = dnet_iterator_pread(fd, data, sz, pos);
+		if (err)
+			goto err_out_free;
+
+		sorted = dnet_iterator_sort_memory(data, tmp, sz / resp_size, thread_num);
+
+		err = dnet_iterator_pwrite(fd, sorted, sz, pos);
+		if (err)
+			goto err_out_free;
+	}
+
+	if (run_size == size)
+		goto err_out_free;
+
+	w = dnet_iterator_container_writer_create_ll(fd, size, DNET_ITERATOR_WRITER_NUM);
+	if (!w) {
+		err = -ENOMEM;
+		goto err_out_free;
+	}
+
+	err = dnet_iterator_merge_runs(fd, size, run_size, data, 2 * run_size, w);
+	dnet_iterator_container_writer_destroy(w);
+	if (err)
+		goto err_out_truncate;
+
+	err = dnet_iterator_container_move(fd, size, size, data, 2 * run_size);
+	if (err)
+		goto err_out_truncate;
+
+	free(data);
+	return 0;
+
+err_out_truncate:
+	/* Runs are left in place, but container is not sorted */
+	if (ftruncate(fd, size) == -1 && !err)
+		err = -errno;
+err_out_free:
+	free(data);
+	return err;
+}
+
+int dnet_iterator_response_container_sort(int fd, size_t size)
+{
+	return dnet_iterator_response_container_sort_ext(fd, size, DNET_ITERATOR_SORT_MEMORY, 0);
+}
+
+/*!
+ * Appends one dnet_iterator_response to fd
+ */
+int dnet_iterator_response_container_append(const struct dnet_iterator_response *response,
+		int fd, uint64_t pos)
+{
+	struct dnet_iterator_response copy;
+
+	/* Sanity */
+	if (pos % resp_size != 0)
+		return -EINVAL;
+	if (response == NULL)
+		return -EINVAL;
+
+	copy = *response;
+	dnet_convert_iterator_response(&copy);
+
+	return dnet_iterator_pwrite(fd, &copy, resp_size, pos);
+}
+
+/*!
+ * Reads one dnet_iterator_response from \a fd at position \a pos and stores it
+ * in \a response
+ */
+int dnet_iterator_response_container_read(int fd, uint64_t pos,
+		struct dnet_iterator_response *response)
+{
+	ssize_t err;
+
+	/* Sanity */
+	if (fd < 0 || response == NULL)
+		return -EINVAL;
+	if (pos % resp_size != 0)
+		return -EINVAL;
+
+	if ((err = pread(fd, response, resp_size, pos)) != (ssize_t)resp_size)
+		return (err == -1) ? -errno : -EINTR;
+	dnet_convert_iterator_response(response);
+
+	return 0;
+}
+
+/*!
+ * Shifts offset and skips response with equal keys.
+ */
+static inline void dnet_iterator_response_skip_equal_keys(const struct dnet_iterator_response *resp,
+		uint64_t *offset, uint64_t size)
+{
+	uint64_t next_offset = *offset + resp_size;
+
+	while (next_offset < size) {
+		const uint64_t current_pos = *offset / resp_size;
+		const uint64_t next_pos = next_offset / resp_size;
+		const struct dnet_iterator_response *curr = resp + current_pos;
+		const struct dnet_iterator_response *next = resp + next_pos;
+
+		if (dnet_id_cmp_str(curr->key.id, next->key.id))
+			break;
+
+		*offset += resp_size;
+		next_offset += resp_size;
+	}
+
+	*offset += resp_size;
+}
+
+/*!
+ * Computes difference for two containers and writes it to diff_fd.
+ * Returns size of new container.
+ *
+ * NB! For now only right outer difference is supported, so returned container
+ * has only items that exist only in right, or exist in both but right one is
+ * newer (w.r.t. timestamp).
+ */
+int64_t dnet_iterator_response_container_diff(int diff_fd, int left_fd, uint64_t left_size,
+		int right_fd, uint64_t right_size)
+{
+	struct dnet_map_fd left_map = { .fd = left_fd, .size = left_size };
+	struct dnet_map_fd right_map = { .fd = right_fd, .size = right_size };
+	struct dnet_iterator_container_writer *w;
+	uint64_t left_offset = 0, right_offset = 0;
+	int64_t diff_offset = 0, err = 0;
+
+	/* Sanity */
+	if (diff_fd < 0 || left_fd < 0 || right_fd < 0)
+		return -EINVAL;
+	if (left_size % resp_size != 0)
+		return -EINVAL;
+	if (right_size % resp_size != 0)
+		return -EINVAL;
+
+	/* Nothing can be newer in empty right container */
+	if (right_size == 0)
+		return 0;
+
+	w = dnet_iterator_container_writer_create(diff_fd, 0);
+	if (!w)
+		return -ENOMEM;
+
+	/* mmap both containers */
+	if (left_size) {
+		if ((err = dnet_data_map(&left_map)) != 0)
+			goto err_out_destroy;
+		madvise(left_map.mapped_data, left_map.mapped_size, MADV_SEQUENTIAL);
+	}
+	if ((err = dnet_data_map(&right_map)) != 0)
+		goto err_unmap_left;
+	madvise(right_map.mapped_data, right_map.mapped_size, MADV_SEQUENTIAL);
+
+	/*
+	 * Compute difference between two sorted lists.
+	 * - We add elements from right list to diff until they are than
+	 *   current element in left list;
+	 * - We skip elements in left list until they are ge then current
+	 * element in right one;
+	 * - In case elements are equal skip both.
+	 */
+	while (right_offset < right_size) {
+		const uint64_t right_pos = right_offset / resp_size;
+		const struct dnet_iterator_response *right =
+			(struct dnet_iterator_response *)right_map.data + right_pos;
+		int cmp_id = 1, cmp = 1;
+
+		if (left_offset < left_size) {
+			const uint64_t left_pos = left_offset / resp_size;
+			const struct dnet_iterator_response *left =
+				(struct dnet_iterator_response *)left_map.data + left_pos;
+
+			cmp_id = dnet_id_cmp_str(left->key.id, right->key.id);
+			cmp = dnet_iterator_response_cmp(left, right);
+		}
+
+		if (left_offset < left_size && cmp <= 0) {
+			/*
+			 * If we can move left pointer and left key is less or
+			 * same but with lesser timestamp we skip record.
+			 */
+			dnet_iterator_response_skip_equal_keys(left_map.data, &left_offset, left_size);
+
+			/* For same key we move both pointers */
+			if (cmp_id == 0)
+				dnet_iterator_response_skip_equal_keys(right_map.data, &right_offset, right_size);
+		} else {
+			/*
+			 * If we can move left pointer or left key is greater
+			 * or same but less timestamp we add record to
+			 * differene because it should be recovered.
+			 */
+			err = dnet_iterator_container_writer_put(w, right);
+			if (err != 0)
+				goto err_unmap_right;
+			diff_offset += resp_size;
+
+			dnet_iterator_response_skip_equal_keys(right_map.data, &right_offset, right_size);
+
+			/* For same key we move both pointers */
+			if (cmp_id == 0 && left_offset < left_size)
+				dnet_iterator_response_skip_equal_keys(left_map.data, &left_offset, left_size);
+		}
+		assert(left_offset <= left_size);
+		assert(diff_offset <= (int64_t)right_size);
+	}
+	assert(right_offset == right_size);
+
+	err = dnet_iterator_container_writer_flush(w);
+
+err_unmap_right:
+	dnet_data_unmap(&right_map);
+err_unmap_left:
+	if (left_size)
+		dnet_data_unmap(&left_map);
+err_out_destroy:
+	dnet_iterator_container_writer_destroy(w);
+	return err ? err : diff_offset;
+}
@@ -0,0 +1,863 @@
+/*
+ * Copyright 2008+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Change journal.
+ *
+ * Every successful write and removal appends fixed-size record with key,
+ * timestamp, command and size to the journal, records get increasing sequence numbers.
+ * Journal lives in $history/journal and is split into segment files of
+ * journal_segment_records records, file name is the sequence number
+ * the segment was started with. Readers mmap segments, so tailing
+ * changes since given sequence number costs O(changes). Timestamps are set
+ * by clients and are not ordered, so tailing since given time skips
+ * only segments whose newest record is older than requested time.
+ *
+ * When there are more than journal_segments segments, background thread
+ * merges two oldest ones keeping only the latest record of every key,
+ * which is enough to know the final state of every changed key.
+ * If journal still takes more than journal_segment_records * journal_segments records,
+ * the oldest segment is dropped and journal does not cover its changes anymore:
+ * segment header remembers the first sequence number journal can be tailed from
+ * and the newest timestamp it has lost.
+ *
+ * Journal is written after backend has completed the command and is not synced,
+ * so it may miss the last changes if node crashes.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+#define DNET_JOURNAL_MAGIC		0x6c6e726a74656e64ULL	/* "dnetjrnl" */
+
+struct dnet_journal_header {
+	uint64_t		magic;
+	uint64_t		first_seq;	/* Journal can be tailed starting from this sequence number */
+	struct dnet_time	horizon;	/* Newest timestamp of records which have been lost */
+	uint64_t		reserved[4];
+};
+
+struct dnet_journal_segment {
+	struct list_head	entry;
+	uint64_t		start;		/* Sequence number used as file name */
+	uint64_t		num;		/* Number of records */
+	struct dnet_time	newest;		/* Newest timestamp of its records */
+	int			fd;
+};
+
+struct dnet_journal {
+	pthread_mutex_t		lock;
+	pthread_cond_t		wait;
+	pthread_t		compact_tid;
+	int			need_exit;
+
+	char			path[1024];
+
+	uint64_t		seq;		/* Sequence number of the next record */
+	uint64_t		first_seq;
+	struct dnet_time	horizon;
+
+	uint64_t		segment_records;
+	int			max_segments;
+
+	int			segment_num;
+	struct list_head	segments;	/* Sorted by start, the last one is being appended */
+};
+
+struct dnet_journal_map {
+	struct dnet_journal_record	*records;
+	uint64_t			num;
+	size_t				size;
+	void				*addr;
+};
+
+static void dnet_journal_segment_path(struct dnet_journal *j, uint64_t start, char *path, size_t size)
+{
+	snprintf(path, size, "%s/%016llx", j->path, (unsigned long long)start);
+}
+
+static void dnet_journal_segment_free(struct dnet_journal_segment *s)
+{
+	if (s->fd >= 0)
+		close(s->fd);
+	free(s);
+}
+
+static void dnet_journal_segment_account(struct dnet_journal_segment *s, struct dnet_journal_record *r)
+{
+	if (dnet_time_cmp(&r->timestamp, &s->newest) > 0)
+		s->newest = r->timestamp;
+}
+
+static int dnet_journal_write_header(struct dnet_node *n, struct dnet_journal *j, int fd)
+{
+	struct dnet_journal_header h;
+	ssize_t err;
+
+	memset(&h, 0, sizeof(struct dnet_journal_header));
+	h.magic = DNET_JOURNAL_MAGIC;
+	h.first_seq = j->first_seq;
+	h.horizon = j->horizon;
+
+	err = pwrite(fd, &h, sizeof(struct dnet_journal_header), 0);
+	if (err != sizeof(struct dnet_journal_header)) {
+		err = err < 0 ? -errno : -EIO;
+		dnet_log(n, DNET_LOG_ERROR, "journal: %s: failed to write header: %s [%zd]\n",
+				j->path, strerror(-err), err);
+		return err;
+	}
+
+	return 0;
+}
+
+/*
+ * Stores journal horizon into the oldest segment. Must be called with journal lock held.
+ */
+static void dnet_journal_sync_header(struct dnet_node *n, struct dnet_journal *j)
+{
+	struct dnet_journal_segment *s;
+
+	if (list_empty(&j->segments))
+		return;
+
+	s = list_first_entry(&j->segments, struct dnet_journal_segment, entry);
+	dnet_journal_write_header(n, j, s->fd);
+}
+
+/*
+ * Journal can not be trusted for the records before current one anymore
+ */
+static void dnet_journal_lose(struct dnet_node *n, struct dnet_journal *j, uint64_t first_seq, struct dnet_time *ts)
+{
+	if (first_seq > j->first_seq)
+		j->first_seq = first_seq;
+	if (dnet_time_cmp(ts, &j->horizon) > 0)
+		j->horizon = *ts;
+
+	dnet_journal_sync_header(n, j);
+}
+
+static struct dnet_journal_segment *dnet_journal_segment_create(struct dnet_node *n, struct dnet_journal *j, uint64_t start)
+{
+	struct dnet_journal_segment *s;
+	char path[sizeof(j->path) + 32];
+	int err;
+
+	s = malloc(sizeof(struct dnet_journal_segment));
+	if (!s)
+		goto err_out_exit;
+
+	memset(s, 0, sizeof(struct dnet_journal_segment));
+	s->start = start;
+
+	dnet_journal_segment_path(j, start, path, sizeof(path));
+
+	s->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (s->fd < 0) {
+		err = -errno;
+		dnet_log(n, DNET_LOG_ERROR, "journal: %s: failed to create segment: %s [%d]\n",
+				path, strerror(-err), err);
+		goto err_out_free;
+	}
+
+	err = dnet_journal_write_header(n, j, s->fd);
+	if (err)
+		goto err_out_unlink;
+
+	return s;
+
+err_out_unlink:
+	unlink(path);
+err_out_free:
+	dnet_journal_segment_free(s);
+err_out_exit:
+	return NULL;
+}
+
+static int dnet_journal_map(int fd, uint64_t num, struct dnet_journal_map *m)
+{
+	m->num = num;
+	m->size = sizeof(struct dnet_journal_header) + num * sizeof(struct dnet_journal_record);
+
+	m->addr = mmap(NULL, m->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (m->addr == MAP_FAILED)
+		return -errno;
+
+	m->records = (struct dnet_journal_record *)((char *)m->addr + sizeof(struct dnet_journal_header));
+	return 0;
+}
+
+static int dnet_journal_segment_open(struct dnet_node *n, struct dnet_journal *j, const char *name)
+{
+	struct dnet_journal_segment *s, *pos;
+	struct dnet_journal_header h;
+	char path[sizeof(j->path) + 32];
+	struct stat st;
+	char *end;
+	uint64_t start;
+	int err;
+
+	start = strtoull(name, &end, 16);
+	if (*end != '\0' || end - name != 16)
+		return 0;
+
+	s = malloc(sizeof(struct dnet_journal_segment));
+	if (!s) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	memset(s, 0, sizeof(struct dnet_journal_segment));
+	s->start = start;
+
+	snprintf(path, sizeof(path), "%s/%s", j->path, name);
+
+	s->fd = open(path, O_RDWR | O_CLOEXEC);
+	if (s->fd < 0) {
+		err = -errno;
+		goto err_out_free;
+	}
+
+	err = fstat(s->fd, &st);
+	if (err) {
+		err = -errno;
+		goto err_out_free;
+	}
+
+	err = pread(s->fd, &h, sizeof(struct dnet_journal_header), 0);
+	if (err != sizeof(struct dnet_journal_header) || h.magic != DNET_JOURNAL_MAGIC) {
+		err = -EINVAL;
+		goto err_out_free;
+	}
+
+	s->num = (st.st_size - sizeof(struct dnet_journal_header)) / sizeof(struct dnet_journal_record);
+
+	/* Drop partially written record */
+	if (ftruncate(s->fd, sizeof(struct dnet_journal_header) + s->num * sizeof(struct dnet_journal_record))) {
+		err = -errno;
+		goto err_out_free;
+	}
+
+	if (s->num) {
+		struct dnet_journal_map m;
+		uint64_t i;
+
+		err = dnet_journal_map(s->fd, s->num, &m);
+		if (err)
+			goto err_out_free;
+
+		for (i = 0; i < m.num; ++i)
+			dnet_journal_segment_account(s, &m.records[i]);
+
+		munmap(m.addr, m.size);
+	}
+
+	/* Insertion sort, there are only journal_segments files */
+	list_for_each_entry(pos, &j->segments, entry) {
+		if (pos->start > start)
+			break;
+	}
+	list_add_tail(&s->entry, &pos->entry);
+	j->segment_num++;
+
+	return 0;
+
+err_out_free:
+	dnet_log(n, DNET_LOG_ERROR, "journal: %s: failed to open segment: %s [%d]\n",
+			path, strerror(-err), err);
+	dnet_journal_segment_free(s);
+err_out_exit:
+	return err;
+}
+
+static int dnet_journal_load(struct dnet_node *n, struct dnet_journal *j)
+{
+	struct dnet_journal_segment *s;
+	struct dnet_journal_header h;
+	struct dnet_journal_record r;
+	struct dirent *d;
+	struct timeval tv;
+	DIR *dir;
+	int err = 0;
+
+	dir = opendir(j->path);
+	if (!dir) {
+		err = -errno;
+		dnet_log(n, DNET_LOG_ERROR, "journal: %s: failed to open directory: %s [%d]\n",
+				j->path, strerror(-err), err);
+		goto err_out_exit;
+	}
+
+	while ((d = readdir(dir)) != NULL) {
+		err = dnet_journal_segment_open(n, j, d->d_name);
+		if (err)
+			break;
+	}
+	closedir(dir);
+
+	if (err)
+		goto err_out_exit;
+
+	if (list_empty(&j->segments)) {
+		/* Changes made before journal was created are not known */
+		gettimeofday(&tv, NULL);
+		j->horizon.tsec = tv.tv_sec;
+		j->horizon.tnsec = tv.tv_usec * 1000;
+		j->first_seq = j->seq = 0;
+		goto out_create;
+	}
+
+	s = list_first_entry(&j->segments, struct dnet_journal_segment, entry);
+	err = pread(s->fd, &h, sizeof(struct dnet_journal_header), 0);
+	if (err != sizeof(struct dnet_journal_header)) {
+		err = -EIO;
+		goto err_out_exit;
+	}
+
+	j->first_seq = j->seq = h.first_seq;
+	j->horizon = h.horizon;
+
+	list_for_each_entry(s, &j->segments, entry) {
+		if (s->start > j->seq)
+			j->seq = s->start;
+
+		if (!s->num)
+			continue;
+
+		err = pread(s->fd, &r, sizeof(struct dnet_journal_record),
+				sizeof(struct dnet_journal_header) + (s->num - 1) * sizeof(struct dnet_journal_record));
+		if (err != sizeof(struct dnet_journal_record)) {
+			err = -EIO;
+			goto err_out_exit;
+		}
+
+		if (r.seq + 1 > j->seq)
+			j->seq = r.seq + 1;
+	}
+
+	s = list_entry(j->segments.prev, struct dnet_journal_segment, entry);
+	if (s->num < j->segment_records)
+		goto out;
+
+out_create:
+	s = dnet_journal_segment_create(n, j, j->seq);
+	if (!s) {
+		err = -EIO;
+		goto err_out_exit;
+	}
+	list_add_tail(&s->entry, &j->segments);
+	j->segment_num++;
+
+	dnet_journal_sync_header(n, j);
+out:
+	return 0;
+
+err_out_exit:
+	return err;
+}
+
+static int dnet_journal_record_key_cmp(const void *p1, const void *p2)
+{
+	const struct dnet_journal_record *r1 = *(const struct dnet_journal_record **)p1;
+	const struct dnet_journal_record *r2 = *(const struct dnet_journal_record **)p2;
+	int cmp;
+
+	cmp = dnet_id_cmp_str(r1->key.id, r2->key.id);
+	if (cmp)
+		return cmp;
+
+	return (r1->seq > r2->seq) - (r1->seq < r2->seq);
+}
+
+static int dnet_journal_record_seq_cmp(const void *p1, const void *p2)
+{
+	const struct dnet_journal_record *r1 = *(const struct dnet_journal_record **)p1;
+	const struct dnet_journal_record *r2 = *(const struct dnet_journal_record **)p2;
+
+	return (r1->seq > r2->seq) - (r1->seq < r2->seq);
+}
+
+/*
+ * Merges two oldest segments, keeps the latest record of every key.
+ * Drops the oldest segment if journal is still too large.
+ */
+static int dnet_journal_compact(struct dnet_node *n, struct dnet_journal *j)
+{
+	struct dnet_journal_segment *first, *second, *s;
+	struct dnet_journal_record **records = NULL, **selected;
+	struct dnet_journal_map maps[2];
+	char path[sizeof(j->path) + 32], tmp[sizeof(j->path) + 32];
+	uint64_t i, num, total = 0, kept = 0;
+	int fd, err;
+
+	pthread_mutex_lock(&j->lock);
+	first = list_first_entry(&j->segments, struct dnet_journal_segment, entry);
+	second = list_entry(first->entry.next, struct dnet_journal_segment, entry);
+
+	err = dnet_journal_map(first->fd, first->num, &maps[0]);
+	if (!err) {
+		err = dnet_journal_map(second->fd, second->num, &maps[1]);
+		if (err)
+			munmap(maps[0].addr, maps[0].size);
+	}
+
+	list_for_each_entry(s, &j->segments, entry)
+		total += s->num;
+	pthread_mutex_unlock(&j->lock);
+
+	if (err)
+		goto err_out_exit;
+
+	num = maps[0].num + maps[1].num;
+	records = malloc(num * sizeof(struct dnet_journal_record *));
+	if (!records) {
+		err = -ENOMEM;
+		goto err_out_unmap;
+	}
+
+	for (i = 0; i < maps[0].num; ++i)
+		records[i] = &maps[0].records[i];
+	for (i = 0; i < maps[1].num; ++i)
+		records[maps[0].num + i] = &maps[1].records[i];
+
+	qsort(records, num, sizeof(struct dnet_journal_record *), dnet_journal_record_key_cmp);
+
+	selected = records;
+	for (i = 0; i < num; ++i) {
+		if (i + 1 < num && !dnet_id_cmp_str(records[i]->key.id, records[i + 1]->key.id))
+			continue;
+		selected[kept++] = records[i];
+	}
+
+	qsort(selected, kept, sizeof(struct dnet_journal_record *), dnet_journal_record_seq_cmp);
+
+	snprintf(tmp, sizeof(tmp), "%s/compact.tmp", j->path);
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		err = -errno;
+		goto err_out_free;
+	}
+
+	pthread_mutex_lock(&j->lock);
+	err = dnet_journal_write_header(n, j, fd);
+	pthread_mutex_unlock(&j->lock);
+	if (err)
+		goto err_out_close;
+
+	for (i = 0; i < kept; ++i) {
+		err = pwrite(fd, selected[i], sizeof(struct dnet_journal_record),
+				sizeof(struct dnet_journal_header) + i * sizeof(struct dnet_journal_record));
+		if (err != sizeof(struct dnet_journal_record)) {
+			err = err < 0 ? -errno : -EIO;
+			goto err_out_close;
+		}
+	}
+
+	total -= num - kept;
+
+	pthread_mutex_lock(&j->lock);
+
+	if (total > j->segment_records * j->max_segments) {
+		struct dnet_time newest = j->horizon;
+		uint64_t last = j->first_seq;
+
+		/* Journal is still too large, forget about the oldest changes */
+		for (i = 0; i < kept; ++i) {
+			if (dnet_time_cmp(&selected[i]->timestamp, &newest) > 0)
+				newest = selected[i]->timestamp;
+			last = selected[i]->seq + 1;
+		}
+
+		list_del(&first->entry);
+		list_del(&second->entry);
+		j->segment_num -= 2;
+
+		dnet_journal_lose(n, j, last, &newest);
+
+		dnet_journal_segment_path(j, first->start, path, sizeof(path));
+		unlink(path);
+		unlink(tmp);
+		close(fd);
+
+		dnet_log(n, DNET_LOG_NOTICE, "journal: dropped %llu records, first seq: %llu\n",
+				(unsigned long long)num, (unsigned long long)j->first_seq);
+	} else {
+		dnet_journal_segment_path(j, first->start, path, sizeof(path));
+
+		err = rename(tmp, path);
+		if (err) {
+			err = -errno;
+			pthread_mutex_unlock(&j->lock);
+			goto err_out_close;
+		}
+
+		list_del(&second->entry);
+		j->segment_num--;
+
+		close(first->fd);
+		first->fd = fd;
+		first->num = kept;
+		memset(&first->newest, 0, sizeof(struct dnet_time));
+		for (i = 0; i < kept; ++i)
+			dnet_journal_segment_account(first, selected[i]);
+		first = NULL;
+
+		dnet_log(n, DNET_LOG_NOTICE, "journal: compacted %llu records into %llu\n",
+				(unsigned long long)num, (unsigned long long)kept);
+	}
+
+	dnet_journal_segment_path(j, second->start, path, sizeof(path));
+	unlink(path);
+
+	pthread_mutex_unlock(&j->lock);
+
+	if (first)
+		dnet_journal_segment_free(first);
+	dnet_journal_segment_free(second);
+
+	free(records);
+	munmap(maps[1].addr, maps[1].size);
+	munmap(maps[0].addr, maps[0].size);
+	return 0;
+
+err_out_close:
+	close(fd);
+	unlink(tmp);
+err_out_free:
+	free(records);
+err_out_unmap:
+	munmap(maps[1].addr, maps[1].size);
+	munmap(maps[0].addr, maps[0].size);
+err_out_exit:
+	dnet_log(n, DNET_LOG_ERROR, "journal: compaction failed: %s [%d]\n", strerror(-err), err);
+	return err;
+}
+
+static void *dnet_journal_compact_process(void *priv)
+{
+	struct dnet_node *n = priv;
+	struct dnet_journal *j = n->journal;
+	struct timespec ts;
+	struct timeval tv;
+	int err = 0;
+
+	dnet_set_name("journal");
+
+	pthread_mutex_lock(&j->lock);
+	while (!j->need_exit) {
+		if (j->segment_num <= j->max_segments || err) {
+			/* Failed compaction is retried a bit later */
+			gettimeofday(&tv, NULL);
+			ts.tv_sec = tv.tv_sec + 10;
+			ts.tv_nsec = tv.tv_usec * 1000;
+
+			pthread_cond_timedwait(&j->wait, &j->lock, &ts);
+			err = 0;
+			continue;
+		}
+
+		pthread_mutex_unlock(&j->lock);
+		err = dnet_journal_compact(n, j);
+		pthread_mutex_lock(&j->lock);
+	}
+	pthread_mutex_unlock(&j->lock);
+
+	return NULL;
+}
+
+int dnet_journal_init(struct dnet_node *n, struct dnet_config *cfg)
+{
+	struct dnet_journal *j;
+	int err;
+
+	if (!cfg->journal_segment_records)
+		return 0;
+
+	if (!cfg->history_env[0]) {
+		dnet_log(n, DNET_LOG_ERROR, "journal: history directory is not set\n");
+		err = -EINVAL;
+		goto err_out_exit;
+	}
+
+	j = malloc(sizeof(struct dnet_journal));
+	if (!j) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	memset(j, 0, sizeof(struct dnet_journal));
+	INIT_LIST_HEAD(&j->segments);
+
+	j->segment_records = cfg->journal_segment_records;
+	j->max_segments = cfg->journal_segments;
+	if (j->max_segments < 2)
+		j->max_segments = DNET_JOURNAL_DEFAULT_SEGMENTS;
+
+	snprintf(j->path, sizeof(j->path), "%s/journal", cfg->history_env);
+
+	err = mkdir(j->path, 0755);
+	if (err && errno != EEXIST) {
+		err = -errno;
+		dnet_log(n, DNET_LOG_ERROR, "journal: %s: failed to create directory: %s [%d]\n",
+				j->path, strerror(-err), err);
+		goto err_out_free;
+	}
+
+	err = pthread_mutex_init(&j->lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_free;
+	}
+
+	err = pthread_cond_init(&j->wait, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_lock_destroy;
+	}
+
+	err = dnet_journal_load(n, j);
+	if (err)
+		goto err_out_segments_free;
+
+	n->journal = j;
+
+	err = pthread_create(&j->compact_tid, NULL, dnet_journal_compact_process, n);
+	if (err) {
+		err = -err;
+		n->journal = NULL;
+		goto err_out_segments_free;
+	}
+
+	dnet_log(n, DNET_LOG_INFO, "journal: %s: segments: %d, seq: %llu, first seq: %llu, horizon: %llu.%09llu\n",
+			j->path, j->segment_num, (unsigned long long)j->seq, (unsigned long long)j->first_seq,
+			(unsigned long long)j->horizon.tsec, (unsigned long long)j->horizon.tnsec);
+	return 0;
+
+err_out_segments_free:
+	while (!list_empty(&j->segments)) {
+		struct dnet_journal_segment *s = list_first_entry(&j->segments, struct dnet_journal_segment, entry);
+
+		list_del(&s->entry);
+		dnet_journal_segment_free(s);
+	}
+	pthread_cond_destroy(&j->wait);
+err_out_lock_destroy:
+	pthread_mutex_destroy(&j->lock);
+err_out_free:
+	free(j);
+err_out_exit:
+	dnet_log(n, DNET_LOG_ERROR, "journal: initialization failed: %s [%d]\n", strerror(-err), err);
+	return err;
+}
+
+void dnet_journal_cleanup(struct dnet_node *n)
+{
+	struct dnet_journal *j = n->journal;
+
+	if (!j)
+		return;
+
+	pthread_mutex_lock(&j->lock);
+	j->need_exit = 1;
+	pthread_cond_signal(&j->wait);
+	pthread_mutex_unlock(&j->lock);
+
+	pthread_join(j->compact_tid, NULL);
+
+	while (!list_empty(&j->segments)) {
+		struct dnet_journal_segment *s = list_first_entry(&j->segments, struct dnet_journal_segment, entry);
+
+		list_del(&s->entry);
+		dnet_journal_segment_free(s);
+	}
+
+	pthread_cond_destroy(&j->wait);
+	pthread_mutex_destroy(&j->lock);
+	free(j);
+
+	n->journal = NULL;
+}
+
+void dnet_journal_append(struct dnet_node *n, struct dnet_cmd *cmd, struct dnet_io_attr *io)
+{
+	struct dnet_journal *j = n->journal;
+	struct dnet_journal_segment *s;
+	struct dnet_journal_record r;
+	struct timeval tv;
+	ssize_t err;
+
+	if (!j)
+		return;
+
+	memset(&r, 0, sizeof(struct dnet_journal_record));
+	memcpy(r.key.id, cmd->id.id, DNET_ID_SIZE);
+	r.cmd = cmd->cmd;
+
+	if (io) {
+		r.timestamp = io->timestamp;
+		r.size = io->size;
+	}
+
+	/* Backend stamps records with current time if client has not provided one */
+	if (!r.timestamp.tsec && !r.timestamp.tnsec) {
+		gettimeofday(&tv, NULL);
+		r.timestamp.tsec = tv.tv_sec;
+		r.timestamp.tnsec = tv.tv_usec * 1000;
+	}
+
+	pthread_mutex_lock(&j->lock);
+
+	s = list_entry(j->segments.prev, struct dnet_journal_segment, entry);
+	r.seq = j->seq++;
+
+	err = pwrite(s->fd, &r, sizeof(struct dnet_journal_record),
+			sizeof(struct dnet_journal_header) + s->num * sizeof(struct dnet_journal_record));
+	if (err != sizeof(struct dnet_journal_record)) {
+		err = err < 0 ? -errno : -EIO;
+		dnet_log(n, DNET_LOG_ERROR, "%s: journal: failed to append record: %s [%zd]\n",
+				dnet_dump_id(&cmd->id), strerror(-err), err);
+
+		/* Nobody should rely on journal for this change */
+		gettimeofday(&tv, NULL);
+		if (tv.tv_sec > (long)r.timestamp.tsec) {
+			r.timestamp.tsec = tv.tv_sec;
+			r.timestamp.tnsec = tv.tv_usec * 1000;
+		}
+		dnet_journal_lose(n, j, j->seq, &r.timestamp);
+		goto err_out_unlock;
+	}
+
+	dnet_journal_segment_account(s, &r);
+
+	if (++s->num >= j->segment_records) {
+		s = dnet_journal_segment_create(n, j, j->seq);
+		if (s) {
+			list_add_tail(&s->entry, &j->segments);
+			if (++j->segment_num > j->max_segments)
+				pthread_cond_signal(&j->wait);
+		}
+	}
+
+err_out_unlock:
+	pthread_mutex_unlock(&j->lock);
+}
+
+static struct dnet_journal_record *dnet_journal_search(struct dnet_journal_map *m, uint64_t seq)
+{
+	uint64_t low = 0, high = m->num;
+
+	while (low < high) {
+		uint64_t mid = low + (high - low) / 2;
+
+		if (m->records[mid].seq < seq)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return &m->records[low];
+}
+
+int dnet_journal_iterate(struct dnet_node *n, uint64_t seq, struct dnet_time *since,
+		int (* callback)(void *priv, struct dnet_journal_record *r), void *priv)
+{
+	struct dnet_journal *j = n->journal;
+	struct dnet_journal_segment *s;
+	struct dnet_journal_map *maps;
+	struct dnet_journal_record *r, *end;
+	int i, num = 0, err = 0;
+
+	if (!j)
+		return -ENOTSUP;
+
+	pthread_mutex_lock(&j->lock);
+
+	/* Lost records are not newer than horizon, so time alone tells whether journal covers the changes */
+	if (since && seq < j->first_seq && dnet_time_cmp(since, &j->horizon) > 0)
+		seq = j->first_seq;
+
+	if (seq < j->first_seq || (since && dnet_time_cmp(since, &j->horizon) <= 0)) {
+		dnet_log(n, DNET_LOG_NOTICE, "journal: changes since seq: %llu are not known, first seq: %llu, "
+				"horizon: %llu.%09llu\n",
+				(unsigned long long)seq, (unsigned long long)j->first_seq,
+				(unsigned long long)j->horizon.tsec, (unsigned long long)j->horizon.tnsec);
+		pthread_mutex_unlock(&j->lock);
+		return -ERANGE;
+	}
+
+	maps = malloc(j->segment_num * sizeof(struct dnet_journal_map));
+	if (!maps) {
+		pthread_mutex_unlock(&j->lock);
+		return -ENOMEM;
+	}
+
+	/* Records appended after this point are not iterated */
+	list_for_each_entry(s, &j->segments, entry) {
+		if (!s->num)
+			continue;
+
+		/* There is nothing to send from segment which has only older changes */
+		if (since && dnet_time_cmp(&s->newest, since) < 0)
+			continue;
+
+		err = dnet_journal_map(s->fd, s->num, &maps[num]);
+		if (err)
+			break;
+
+		if (maps[num].records[s->num - 1].seq < seq) {
+			munmap(maps[num].addr, maps[num].size);
+			continue;
+		}
+
+		++num;
+	}
+
+	pthread_mutex_unlock(&j->lock);
+
+	for (i = 0; i < num && !err; ++i) {
+		end = maps[i].records + maps[i].num;
+
+		for (r = dnet_journal_search(&maps[i], seq); r < end; ++r) {
+			err = callback(priv, r);
+			if (err)
+				break;
+		}
+	}
+
+	for (i = 0; i < num; ++i)
+		munmap(maps[i].addr, maps[i].size);
+	free(maps);
+
+	return err;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2008+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DNET_LATENCY_H
+#define __DNET_LATENCY_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Log-linear (HDR-like) latency buckets shared by server monitor and client states.
+ *
+ * Latencies below 2^DNET_LATENCY_SUB_BITS usecs have their own buckets, every
+ * next power of two is split into 2^DNET_LATENCY_SUB_BITS equal buckets, so
+ * upper bound of the bucket is less than 1/2^DNET_LATENCY_SUB_BITS above any
+ * latency it contains. Latencies of 2^DNET_LATENCY_MAX_BITS usecs (about 19 hours)
+ * and longer go into the last bucket.
+ *
+ * Counters of equal buckets may be simply added, so histograms recorded
+ * by different threads are merged by summing them.
+ */
+#define DNET_LATENCY_SUB_BITS		3
+#define DNET_LATENCY_SUB_BUCKETS	(1 << DNET_LATENCY_SUB_BITS)
+#define DNET_LATENCY_MAX_BITS		36
+#define DNET_LATENCY_BUCKETS		((DNET_LATENCY_MAX_BITS - DNET_LATENCY_SUB_BITS + 1) * DNET_LATENCY_SUB_BUCKETS)
+
+static inline int dnet_latency_bucket(uint64_t usecs)
+{
+	int bits;
+
+	if (usecs < DNET_LATENCY_SUB_BUCKETS)
+		return usecs;
+
+	bits = 63 - __builtin_clzll(usecs);
+	if (bits >= DNET_LATENCY_MAX_BITS)
+		return DNET_LATENCY_BUCKETS - 1;
+
+	return (bits - DNET_LATENCY_SUB_BITS + 1) * DNET_LATENCY_SUB_BUCKETS +
+		(usecs >> (bits - DNET_LATENCY_SUB_BITS)) - DNET_LATENCY_SUB_BUCKETS;
+}
+
+/*
+ * Upper bound of the bucket, so that estimate is never lower than real latency
+ */
+static inline uint64_t dnet_latency_bucket_max(int bucket)
+{
+	int bits;
+	uint64_t sub;
+
+	if (bucket < DNET_LATENCY_SUB_BUCKETS)
+		return bucket;
+
+	bits = bucket / DNET_LATENCY_SUB_BUCKETS + DNET_LATENCY_SUB_BITS - 1;
+	sub = DNET_LATENCY_SUB_BUCKETS + bucket % DNET_LATENCY_SUB_BUCKETS;
+
+	return ((sub + 1) << (bits - DNET_LATENCY_SUB_BITS)) - 1;
+}
+
+/*
+ * Returns latency which is not exceeded by @permille of @total latencies counted in @counts,
+ * for example 999 gives p99.9. Returns 0 if there are no latencies.
+ */
+static inline uint64_t dnet_latency_percentile(const uint64_t *counts, uint64_t total, int permille)
+{
+	uint64_t count = 0;
+	int i;
+
+	if (!total)
+		return 0;
+
+	for (i = 0; i < DNET_LATENCY_BUCKETS - 1; ++i) {
+		count += counts[i];
+		if (count * 1000 >= total * permille)
+			break;
+	}
+
+	return dnet_latency_bucket_max(i);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DNET_LATENCY_H */
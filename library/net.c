@@ -321,6 +321,18 @@ static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig
 		r->fsize = orig->fsize;
 	}
 
+	dnet_io_req_queue_nocopy(st, r);
+
+err_out_exit:
+	return err;
+}
+
+/*
+ * Queues request without copying it: @r must be allocated by malloc() together
+ * with header and data it points to, it will be freed by dnet_io_req_free() when sent.
+ */
+int dnet_io_req_queue_nocopy(struct dnet_net_state *st, struct dnet_io_req *r)
+{
 	pthread_mutex_lock(&st->send_lock);
 	list_add_tail(&r->req_entry, &st->send_list);
 
@@ -328,8 +340,7 @@ static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig
 		dnet_schedule_send(st);
 	pthread_mutex_unlock(&st->send_lock);
 
-err_out_exit:
-	return err;
+	return 0;
 }
 
 void dnet_io_req_free(struct dnet_io_req *r)
@@ -531,6 +542,73 @@ err_out_put:
 	return err;
 }
 
+/*
+ * Sends transactions which go to the same state by single io request:
+ * their headers are packed into one buffer, which is queued once and
+ * written by one pass of the network thread. Transactions must be created
+ * with the whole request copied after them. Transaction which can not be
+ * inserted is destroyed, others are still sent.
+ */
+int dnet_trans_send_batch(struct dnet_net_state *st, struct dnet_trans **trans, int num)
+{
+	struct dnet_io_req *r;
+	uint64_t hsize = 0;
+	void *buf;
+	int i, failed = 0, err = 0;
+
+	for (i = 0; i < num; ++i)
+		hsize += sizeof(struct dnet_cmd) + trans[i]->cmd.size;
+
+	r = malloc(sizeof(struct dnet_io_req) + hsize);
+	if (!r) {
+		err = -ENOMEM;
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: not enough memory for batch of %d requests: %s %d\n",
+				dnet_state_dump_addr(st), num, strerror(-err), err);
+		for (i = 0; i < num; ++i)
+			dnet_trans_put(trans[i]);
+		goto err_out_exit;
+	}
+	memset(r, 0, sizeof(struct dnet_io_req));
+	r->fd = -1;
+	r->header = buf = r + 1;
+
+	pthread_mutex_lock(&st->trans_lock);
+	for (i = 0; i < num; ++i) {
+		struct dnet_trans *t = trans[i];
+		size_t size = sizeof(struct dnet_cmd) + t->cmd.size;
+
+		if (dnet_trans_insert_nolock(&st->trans_root, t)) {
+			trans[failed++] = t;
+			continue;
+		}
+
+		dnet_trans_timestamp(st, t);
+		memcpy(buf + r->hsize, t + 1, size);
+		r->hsize += size;
+	}
+	pthread_mutex_unlock(&st->trans_lock);
+
+	/* Failed ones are moved to the head of the array, their completions are called without locks */
+	for (i = 0; i < failed; ++i)
+		dnet_trans_put(trans[i]);
+
+	if (failed) {
+		err = -EEXIST;
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to insert %d/%d batched transactions\n",
+				dnet_state_dump_addr(st), failed, num);
+	}
+
+	if (!r->hsize) {
+		free(r);
+		goto err_out_exit;
+	}
+
+	dnet_io_req_queue_nocopy(st, r);
+
+err_out_exit:
+	return err;
+}
+
 int dnet_recv(struct dnet_net_state *st, void *data, unsigned int size)
 {
 	int err;
@@ -692,6 +770,8 @@ int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r)
 
 	if (cmd->trans & DNET_TRANS_REPLY) {
 		uint64_t tid = cmd->trans & ~DNET_TRANS_REPLY;
+		/* Completion may adopt and free reply buffer, see dnet_reply_adopt() */
+		struct dnet_cmd reply = *cmd;
 
 		pthread_mutex_lock(&st->trans_lock);
 		t = dnet_trans_search(&st->trans_root, tid);
@@ -740,8 +820,8 @@ int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r)
 		}
 
 		dnet_trans_put(t);
-		if (!(cmd->flags & DNET_FLAGS_MORE)) {
-			memcpy(&t->cmd, cmd, sizeof(struct dnet_cmd));
+		if (!(reply.flags & DNET_FLAGS_MORE)) {
+			memcpy(&t->cmd, &reply, sizeof(struct dnet_cmd));
 			dnet_trans_put(t);
 		} else {
 			/*
@@ -984,11 +1064,11 @@ int dnet_state_micro_init(struct dnet_net_state *st,
 	st->process = process;
 
 	st->la = 1;
-	st->weight = DNET_STATE_MAX_WEIGHT / 2;
-	st->median_read_time = 1000; /* useconds for start */
+	st->latency_ewma = DNET_STATE_DEFAULT_LATENCY;
 
 	INIT_LIST_HEAD(&st->state_entry);
 	INIT_LIST_HEAD(&st->storage_state_entry);
+	INIT_LIST_HEAD(&st->addr_entry);
 
 	st->trans_root = RB_ROOT;
 	INIT_LIST_HEAD(&st->trans_list);
@@ -1220,6 +1300,26 @@ void dnet_state_destroy(struct dnet_net_state *st)
  * This is usefull to avoid memory bloat (and hence OOM) when data gets queued
  * into send queue faster than it could be send over wire.
  */
+static void dnet_send_threshold_wait(struct dnet_net_state *st)
+{
+	/* Request was queued, so we should increase queue size */
+	if (atomic_inc(&st->send_queue_size) > DNET_SEND_WATERMARK_HIGH) {
+		/* If high watermark is reached we should sleep */
+		dnet_log(st->n, DNET_LOG_DEBUG,
+				"State high_watermark reached: %s: %d, sleeping\n",
+				dnet_server_convert_dnet_addr(&st->addr),
+				atomic_read(&st->send_queue_size));
+
+		pthread_mutex_lock(&st->send_lock);
+		pthread_cond_wait(&st->send_wait, &st->send_lock);
+		pthread_mutex_unlock(&st->send_lock);
+
+		dnet_log(st->n, DNET_LOG_DEBUG, "State woken up: %s: %d",
+				dnet_server_convert_dnet_addr(&st->addr),
+				atomic_read(&st->send_queue_size));
+	}
+}
+
 int dnet_send_reply_threshold(void *state, struct dnet_cmd *cmd,
 		void *odata, unsigned int size, int more)
 {
@@ -1232,22 +1332,27 @@ int dnet_send_reply_threshold(void *state, struct dnet_cmd *cmd,
 	/* Send reply */
 	err = dnet_send_reply(state, cmd, odata, size, more);
 	if (err == 0)
-		/* If send succeeded then we should increase queue size */
-		if (atomic_inc(&st->send_queue_size) > DNET_SEND_WATERMARK_HIGH) {
-			/* If high watermark is reached we should sleep */
-			dnet_log(st->n, DNET_LOG_DEBUG,
-					"State high_watermark reached: %s: %d, sleeping\n",
-					dnet_server_convert_dnet_addr(&st->addr),
-					atomic_read(&st->send_queue_size));
-
-			pthread_mutex_lock(&st->send_lock);
-			pthread_cond_wait(&st->send_wait, &st->send_lock);
-			pthread_mutex_unlock(&st->send_lock);
-
-			dnet_log(st->n, DNET_LOG_DEBUG, "State woken up: %s: %d",
-					dnet_server_convert_dnet_addr(&st->addr),
-					atomic_read(&st->send_queue_size));
-		}
+		dnet_send_threshold_wait(st);
+
+	return err;
+}
+
+/*
+ * The same as above, but queues already formatted request without copying it,
+ * see dnet_io_req_queue_nocopy(). Request is freed if it can not be sent.
+ */
+int dnet_io_req_queue_threshold(struct dnet_net_state *st, struct dnet_io_req *r)
+{
+	int err;
+
+	if (st == st->n->st) {
+		dnet_io_req_free(r);
+		return 0;
+	}
+
+	err = dnet_io_req_queue_nocopy(st, r);
+	if (err == 0)
+		dnet_send_threshold_wait(st);
 
 	return err;
 }
@@ -23,12 +23,75 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <signal.h>
 
 #include "elliptics.h"
 #include "elliptics/interface.h"
 #include "monitor/monitor.h"
 
+#define DNET_ADDR_HASH_MIN_SIZE		1024
+
+static unsigned int dnet_addr_hash(struct dnet_addr *addr)
+{
+	unsigned int h = 2166136261U;
+	int i;
+
+	h = (h ^ addr->family) * 16777619U;
+	for (i = 0; i < addr->addr_len; ++i)
+		h = (h ^ addr->addr[i]) * 16777619U;
+
+	return h;
+}
+
+/*
+ * Allocates address hash of @size buckets and moves there all states from the current one.
+ * Must be called with state_lock held (or before node is used).
+ */
+static int dnet_addr_hash_init(struct dnet_node *n, unsigned int size)
+{
+	struct list_head *hash;
+	struct dnet_net_state *st, *tmp;
+	unsigned int i;
+
+	hash = malloc(size * sizeof(struct list_head));
+	if (!hash)
+		return -ENOMEM;
+
+	for (i = 0; i < size; ++i)
+		INIT_LIST_HEAD(&hash[i]);
+
+	for (i = 0; i < n->addr_hash_size; ++i) {
+		list_for_each_entry_safe(st, tmp, &n->addr_hash[i], addr_entry)
+			list_move_tail(&st->addr_entry, &hash[dnet_addr_hash(&st->addr) & (size - 1)]);
+	}
+
+	free(n->addr_hash);
+	n->addr_hash = hash;
+	n->addr_hash_size = size;
+
+	return 0;
+}
+
+static void dnet_addr_hash_add(struct dnet_node *n, struct dnet_net_state *st)
+{
+	/* Hash stays correct if it can not grow, chains just get longer */
+	if (n->addr_hash_num >= n->addr_hash_size * 2)
+		dnet_addr_hash_init(n, n->addr_hash_size * 2);
+
+	list_add_tail(&st->addr_entry, &n->addr_hash[dnet_addr_hash(&st->addr) & (n->addr_hash_size - 1)]);
+	n->addr_hash_num++;
+}
+
+static void dnet_addr_hash_remove(struct dnet_node *n, struct dnet_net_state *st)
+{
+	if (list_empty(&st->addr_entry))
+		return;
+
+	list_del_init(&st->addr_entry);
+	n->addr_hash_num--;
+}
+
 static struct dnet_node *dnet_node_alloc(struct dnet_config *cfg)
 {
 	struct dnet_node *n;
@@ -101,10 +164,18 @@ static struct dnet_node *dnet_node_alloc(struct dnet_config *cfg)
 
 	INIT_LIST_HEAD(&n->check_entry);
 
+	err = dnet_addr_hash_init(n, DNET_ADDR_HASH_MIN_SIZE);
+	if (err) {
+		dnet_log(n, DNET_LOG_ERROR, "Failed to allocate address hash.\n");
+		goto err_out_destroy_attr;
+	}
+
 	memcpy(n->cookie, cfg->cookie, DNET_AUTH_COOKIE_SIZE);
 
 	return n;
 
+err_out_destroy_attr:
+	pthread_attr_destroy(&n->attr);
 err_out_destroy_reconnect_lock:
 	pthread_mutex_destroy(&n->reconnect_lock);
 err_out_destroy_counter:
@@ -166,6 +237,275 @@ static struct dnet_group *dnet_group_search(struct dnet_node *n, unsigned int gr
 	return found;
 }
 
+static inline uint64_t dnet_route_prefix(const unsigned char *id)
+{
+	uint64_t prefix = 0;
+	int i;
+
+	for (i = 0; i < 8; ++i)
+		prefix = (prefix << 8) | id[i];
+
+	return prefix;
+}
+
+/*
+ * Readers increment counter of the current epoch before loading route table pointer
+ * and decrement it when they do not need the table anymore.
+ */
+static inline int dnet_route_read_lock(struct dnet_node *n)
+{
+	int epoch = *(volatile int *)&n->route_epoch & 1;
+
+	__sync_fetch_and_add(&n->route_readers[epoch].count, 1);
+	return epoch;
+}
+
+static inline void dnet_route_read_unlock(struct dnet_node *n, int epoch)
+{
+	__sync_fetch_and_sub(&n->route_readers[epoch].count, 1);
+}
+
+static void dnet_route_wait_readers(struct dnet_node *n, int epoch)
+{
+	while (__sync_fetch_and_add(&n->route_readers[epoch].count, 0))
+		sched_yield();
+}
+
+/*
+ * Waits until nobody can use route table which was replaced before this call.
+ * Reader could have read epoch before the previous flip and incremented its counter
+ * after the previous writer had checked it, so both epochs have to be drained.
+ * Must be called with state_lock held.
+ */
+static void dnet_route_synchronize(struct dnet_node *n)
+{
+	int epoch = n->route_epoch & 1;
+
+	dnet_route_wait_readers(n, epoch ^ 1);
+
+	__sync_synchronize();
+	n->route_epoch = epoch ^ 1;
+	__sync_synchronize();
+
+	dnet_route_wait_readers(n, epoch);
+}
+
+static struct dnet_route_group *dnet_route_group_create(struct dnet_group *g)
+{
+	struct dnet_route_group *rg;
+	int i;
+
+	rg = malloc(sizeof(struct dnet_route_group) + g->id_num *
+			(sizeof(uint64_t) + sizeof(struct dnet_net_state *) + sizeof(struct dnet_raw_id)));
+	if (!rg)
+		return NULL;
+
+	rg->group_id = g->group_id;
+	rg->id_num = g->id_num;
+	rg->prefixes = (uint64_t *)(rg + 1);
+	rg->states = (struct dnet_net_state **)(rg->prefixes + g->id_num);
+	rg->ids = (struct dnet_raw_id *)(rg->states + g->id_num);
+
+	for (i = 0; i < g->id_num; ++i) {
+		rg->prefixes[i] = dnet_route_prefix(g->ids[i].raw.id);
+		rg->states[i] = g->ids[i].idc->st;
+		rg->ids[i] = g->ids[i].raw;
+	}
+
+	return rg;
+}
+
+static struct dnet_route_table *dnet_route_table_alloc(int group_num)
+{
+	struct dnet_route_table *t;
+
+	t = malloc(sizeof(struct dnet_route_table) + group_num *
+			(sizeof(struct dnet_route_group *) + sizeof(unsigned int)));
+	if (!t)
+		return NULL;
+
+	t->group_num = 0;
+	t->groups = (struct dnet_route_group **)(t + 1);
+	t->group_ids = (unsigned int *)(t->groups + group_num);
+
+	return t;
+}
+
+static void dnet_route_table_free(struct dnet_route_table *t, int free_groups)
+{
+	int i;
+
+	if (!t)
+		return;
+
+	if (free_groups) {
+		for (i = 0; i < t->group_num; ++i)
+			free(t->groups[i]);
+	}
+
+	free(t);
+}
+
+static void dnet_route_table_add(struct dnet_route_table *t, struct dnet_route_group *rg)
+{
+	t->groups[t->group_num] = rg;
+	t->group_ids[t->group_num] = rg->group_id;
+	t->group_num++;
+}
+
+/*
+ * Builds route table from scratch, used when there is no published table.
+ * Must be called with state_lock held.
+ */
+static struct dnet_route_table *dnet_route_table_build(struct dnet_node *n)
+{
+	struct dnet_route_table *t;
+	struct dnet_route_group *rg;
+	struct dnet_group *g;
+	int group_num = 0, i, j;
+
+	list_for_each_entry(g, &n->group_list, group_entry)
+		group_num++;
+
+	t = dnet_route_table_alloc(group_num);
+	if (!t)
+		return NULL;
+
+	list_for_each_entry(g, &n->group_list, group_entry) {
+		if (!g->id_num)
+			continue;
+
+		rg = dnet_route_group_create(g);
+		if (!rg) {
+			dnet_route_table_free(t, 1);
+			return NULL;
+		}
+
+		/* Insertion sort by group id, there are not many groups */
+		for (i = t->group_num; i > 0 && t->group_ids[i - 1] > rg->group_id; --i);
+		for (j = t->group_num; j > i; --j) {
+			t->groups[j] = t->groups[j - 1];
+			t->group_ids[j] = t->group_ids[j - 1];
+		}
+		t->groups[i] = rg;
+		t->group_ids[i] = rg->group_id;
+		t->group_num++;
+	}
+
+	return t;
+}
+
+/*
+ * Publishes new route table where group @g is rebuilt from its current ids,
+ * tables of other groups are shared with the previous route table.
+ * Must be called with state_lock held after every change of group ids.
+ */
+void dnet_route_table_update(struct dnet_node *n, struct dnet_group *g)
+{
+	struct dnet_route_table *old = n->route_table, *t;
+	struct dnet_route_group *rg = NULL, *replaced = NULL;
+	int i;
+
+	if (!old) {
+		t = dnet_route_table_build(n);
+		if (!t)
+			goto err_out_exit;
+	} else {
+		if (g->id_num) {
+			rg = dnet_route_group_create(g);
+			if (!rg)
+				goto err_out_drop;
+		}
+
+		t = dnet_route_table_alloc(old->group_num + 1);
+		if (!t) {
+			free(rg);
+			goto err_out_drop;
+		}
+
+		for (i = 0; i < old->group_num; ++i) {
+			if (rg && old->group_ids[i] > g->group_id) {
+				dnet_route_table_add(t, rg);
+				rg = NULL;
+			}
+
+			if (old->group_ids[i] == g->group_id) {
+				replaced = old->groups[i];
+				continue;
+			}
+
+			dnet_route_table_add(t, old->groups[i]);
+		}
+
+		if (rg)
+			dnet_route_table_add(t, rg);
+	}
+
+	__sync_synchronize();
+	n->route_table = t;
+
+	dnet_route_synchronize(n);
+
+	dnet_route_table_free(old, 0);
+	free(replaced);
+	return;
+
+err_out_drop:
+	/*
+	 * Stale table must not be used, readers fall back to locked search
+	 * and the next update rebuilds the whole table
+	 */
+	n->route_table = NULL;
+	dnet_route_synchronize(n);
+	dnet_route_table_free(old, 1);
+err_out_exit:
+	dnet_log(n, DNET_LOG_ERROR, "Failed to update route table of group %d, using locked route search\n",
+			g->group_id);
+}
+
+void dnet_route_table_destroy(struct dnet_node *n)
+{
+	dnet_route_table_free(n->route_table, 1);
+	n->route_table = NULL;
+}
+
+/*
+ * Returns state responsible for @id without grabbing reference or NULL if there is no such group
+ */
+static struct dnet_net_state *dnet_route_table_search(struct dnet_route_table *t, struct dnet_id *id)
+{
+	struct dnet_route_group *rg;
+	uint64_t prefix;
+	int low, high, mid;
+
+	for (low = 0, high = t->group_num; low < high; ) {
+		mid = low + (high - low) / 2;
+		if (t->group_ids[mid] < id->group_id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low == t->group_num || t->group_ids[low] != id->group_id)
+		return NULL;
+
+	rg = t->groups[low];
+	prefix = dnet_route_prefix(id->id);
+
+	/* Number of ids which are not greater than @id, full ids are compared only for equal prefixes */
+	for (low = 0, high = rg->id_num; low < high; ) {
+		mid = low + (high - low) / 2;
+		if (rg->prefixes[mid] < prefix ||
+				(rg->prefixes[mid] == prefix && dnet_id_cmp_str(rg->ids[mid].id, id->id) <= 0))
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	/* Keys less than the first id belong to the last one */
+	return rg->states[low ? low - 1 : rg->id_num - 1];
+}
+
 static int dnet_idc_compare(const void *k1, const void *k2)
 {
 	const struct dnet_state_id *id1 = k1;
@@ -189,6 +529,8 @@ static void dnet_idc_remove_ids(struct dnet_net_state *st, struct dnet_group *g)
 
 	qsort(g->ids,  g->id_num, sizeof(struct dnet_state_id), dnet_idc_compare);
 	st->idc = NULL;
+
+	dnet_route_table_update(st->n, g);
 }
 
 int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id *ids, int id_num)
@@ -228,6 +570,7 @@ int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id
 	g->ids = realloc(g->ids, (g->id_num + id_num) * sizeof(struct dnet_state_id));
 	if (!g->ids) {
 		g->id_num = 0;
+		dnet_route_table_update(n, g);
 		goto err_out_unlock_put;
 	}
 
@@ -246,6 +589,7 @@ int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id
 
 	g->id_num += num;
 	qsort(g->ids, g->id_num, sizeof(struct dnet_state_id), dnet_idc_compare);
+	dnet_route_table_update(n, g);
 
 	list_add_tail(&st->state_entry, &g->state_list);
 	list_add_tail(&st->storage_state_entry, &n->storage_state_list);
@@ -268,6 +612,8 @@ int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id
 	if (err)
 		goto err_out_remove_nolock;
 
+	dnet_addr_hash_add(n, st);
+
 	pthread_mutex_unlock(&n->state_lock);
 
 	gettimeofday(&end, NULL);
@@ -321,12 +667,134 @@ void dnet_idc_destroy_nolock(struct dnet_net_state *st)
 	if (!idc)
 		return;
 
+	dnet_addr_hash_remove(st->n, st);
+
 	g = idc->group;
 	dnet_idc_remove_ids(st, g);
 	dnet_group_put(g);
 	free(idc);
 }
 
+/*
+ * Checks whether @ids (without duplicates) would change routes of the state which owns @idc
+ */
+static int dnet_idc_changed(struct dnet_group *g, struct dnet_idc *idc, struct dnet_state_id *ids, int id_num)
+{
+	struct dnet_state_id *sid;
+	int i, owned = 0, found = 0;
+
+	for (i = 0; i < g->id_num; ++i)
+		owned += (g->ids[i].idc == idc);
+
+	for (i = 0; i < id_num; ++i) {
+		sid = bsearch(&ids[i], g->ids, g->id_num, sizeof(struct dnet_state_id), dnet_idc_compare);
+		if (!sid)
+			return 1;
+
+		/* ids owned by other states are skipped on insertion anyway */
+		found += (sid->idc == idc);
+	}
+
+	return found != owned;
+}
+
+/*
+ * Applies new route ids of already connected state without reconnecting it.
+ * Only the state's group is touched and only if ids have really changed.
+ * Returns 0 if ids have been updated, -EEXIST if they are the same.
+ */
+int dnet_idc_update(struct dnet_net_state *st, int group_id, struct dnet_raw_id *ids, int id_num)
+{
+	struct dnet_node *n = st->n;
+	struct dnet_idc *idc, *old;
+	struct dnet_state_id *g_ids;
+	struct dnet_group *g;
+	int err, i, num, pos;
+
+	if (!id_num)
+		return -EINVAL;
+
+	idc = malloc(sizeof(struct dnet_idc) + sizeof(struct dnet_state_id) * id_num);
+	if (!idc) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	memset(idc, 0, sizeof(struct dnet_idc));
+
+	for (i = 0; i < id_num; ++i)
+		idc->ids[i].raw = ids[i];
+
+	qsort(idc->ids, id_num, sizeof(struct dnet_state_id), dnet_idc_compare);
+	for (i = 1, num = 1; i < id_num; ++i) {
+		if (dnet_id_cmp_str(idc->ids[i].raw.id, idc->ids[num - 1].raw.id))
+			idc->ids[num++] = idc->ids[i];
+	}
+	id_num = num;
+
+	for (i = 0; i < id_num; ++i)
+		idc->ids[i].idc = idc;
+
+	pthread_mutex_lock(&n->state_lock);
+
+	old = st->idc;
+	if (!old || old->group->group_id != (unsigned int)group_id) {
+		err = -EINVAL;
+		goto err_out_unlock;
+	}
+
+	g = old->group;
+
+	if (!dnet_idc_changed(g, old, idc->ids, id_num)) {
+		err = -EEXIST;
+		goto err_out_unlock;
+	}
+
+	g_ids = realloc(g->ids, (g->id_num + id_num) * sizeof(struct dnet_state_id));
+	if (!g_ids) {
+		err = -ENOMEM;
+		goto err_out_unlock;
+	}
+	g->ids = g_ids;
+
+	for (i = 0, pos = 0; i < g->id_num; ++i) {
+		if (g->ids[i].idc != old)
+			g->ids[pos++] = g->ids[i];
+	}
+	g->id_num = pos;
+
+	num = 0;
+	for (i = 0; i < id_num; ++i) {
+		if (!bsearch(&idc->ids[i], g->ids, g->id_num, sizeof(struct dnet_state_id), dnet_idc_compare))
+			g->ids[g->id_num + num++] = idc->ids[i];
+	}
+
+	g->id_num += num;
+	qsort(g->ids, g->id_num, sizeof(struct dnet_state_id), dnet_idc_compare);
+
+	/* Group reference is inherited from the old idc */
+	idc->id_num = id_num;
+	idc->st = st;
+	idc->group = g;
+	st->idc = idc;
+
+	dnet_route_table_update(n, g);
+
+	pthread_mutex_unlock(&n->state_lock);
+
+	dnet_log(n, DNET_LOG_NOTICE, "%s: updated route ids: group: %d, ids: %d -> %d, added to group: %d\n",
+			dnet_state_dump_addr(st), group_id, old->id_num, id_num, num);
+
+	free(old);
+	return 0;
+
+err_out_unlock:
+	pthread_mutex_unlock(&n->state_lock);
+	free(idc);
+err_out_exit:
+	return err;
+}
+
 static int __dnet_idc_search(struct dnet_group *g, struct dnet_id *id)
 {
 	int low, high, i, cmp;
@@ -422,18 +890,13 @@ static struct dnet_net_state *__dnet_state_search(struct dnet_node *n, struct dn
 struct dnet_net_state *dnet_state_search_by_addr(struct dnet_node *n, struct dnet_addr *addr)
 {
 	struct dnet_net_state *st, *found = NULL;
-	struct dnet_group *g;
+	struct list_head *head;
 
 	pthread_mutex_lock(&n->state_lock);
-	list_for_each_entry(g, &n->group_list, group_entry) {
-		list_for_each_entry(st, &g->state_list, state_entry) {
-			if (dnet_addr_equal(&st->addr, addr)) {
-				found = st;
-				break;
-			}
-		}
-		if (found) {
-			dnet_state_get(found);
+	head = &n->addr_hash[dnet_addr_hash(addr) & (n->addr_hash_size - 1)];
+	list_for_each_entry(st, head, addr_entry) {
+		if (dnet_addr_equal(&st->addr, addr)) {
+			found = dnet_state_get(st);
 			break;
 		}
 	}
@@ -446,6 +909,14 @@ struct dnet_net_state *dnet_state_search_nolock(struct dnet_node *n, struct dnet
 {
 	struct dnet_net_state *found;
 
+	/* Route table is updated under state_lock too, so it can not go away here */
+	if (n->route_table) {
+		found = dnet_route_table_search(n->route_table, id);
+		if (found)
+			dnet_state_get(found);
+		return found;
+	}
+
 	found = __dnet_state_search(n, id);
 	if (!found) {
 		struct dnet_group *g;
@@ -464,17 +935,30 @@ err_out_exit:
 
 struct dnet_net_state *dnet_state_get_first(struct dnet_node *n, struct dnet_id *id)
 {
-	struct dnet_net_state *found;
+	struct dnet_route_table *t;
+	struct dnet_net_state *found = NULL;
+	int epoch;
+
+	epoch = dnet_route_read_lock(n);
+	t = *(struct dnet_route_table * volatile *)&n->route_table;
+	if (t) {
+		found = dnet_route_table_search(t, id);
+		if (found)
+			dnet_state_get(found);
+	}
+	dnet_route_read_unlock(n, epoch);
+
+	if (!t) {
+		pthread_mutex_lock(&n->state_lock);
+		found = dnet_state_search_nolock(n, id);
+		pthread_mutex_unlock(&n->state_lock);
+	}
 
-	pthread_mutex_lock(&n->state_lock);
-	found = dnet_state_search_nolock(n, id);
 	if (found == n->st) {
 		dnet_state_put(found);
 		found = NULL;
 	}
 
-	pthread_mutex_unlock(&n->state_lock);
-
 	return found;
 }
 void dnet_state_put(struct dnet_net_state *st)
@@ -674,6 +1158,8 @@ void dnet_node_cleanup_common_resources(struct dnet_node *n)
 
 	pthread_attr_destroy(&n->attr);
 
+	dnet_route_table_destroy(n);
+	free(n->addr_hash);
 	pthread_mutex_destroy(&n->state_lock);
 	dnet_crypto_cleanup(n);
 
@@ -37,24 +37,79 @@
 
 #include "reverbrain_react.h"
 
-struct dnet_notify_entry
+/*
+ * Every bucket keeps a list of subscribed keys, every key keeps an array of
+ * its subscribers. Writes only check whether the key is subscribed and queue
+ * the event, notifications are sent by the notify thread, which packs all
+ * notifications destined to the same client into one send request.
+ */
+struct dnet_notify_subscriber
 {
-	struct list_head		notify_entry;
 	struct dnet_cmd			cmd;
 	struct dnet_net_state		*state;
 };
 
+struct dnet_notify_key
+{
+	struct list_head		key_entry;
+	struct dnet_id			id;
+	struct dnet_notify_subscriber	*subscribers;
+	int				num, size;
+};
+
+struct dnet_notify_event
+{
+	struct list_head		event_entry;
+	struct dnet_id			id;
+	struct dnet_io_notification	notif;
+};
+
+struct dnet_notify_batch
+{
+	struct list_head		batch_entry;
+	struct dnet_net_state		*state;
+	struct dnet_io_req		*r;
+	uint64_t			size;
+};
+
+/* Events are dropped if notify thread can not keep up with writes */
+#define DNET_NOTIFY_QUEUE_MAX		65536
+
 static unsigned int dnet_notify_hash(struct dnet_id *id, unsigned int hash_size)
 {
-	unsigned int hash = 0xbb40e64d; /* 3.141592653 */
-	unsigned int i;
-	unsigned int *int_id = (unsigned int *)id->id;
+	uint64_t hash;
+
+	/* Ids are hashes themselves, mix the first 8 bytes and the group */
+	memcpy(&hash, id->id, sizeof(hash));
+	hash ^= id->group_id;
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
 
-	for (i=0; i<DNET_ID_SIZE / 4; ++i)
-		hash ^= int_id[i];
+	return hash % hash_size;
+}
+
+static struct dnet_notify_key *dnet_notify_key_search(struct dnet_notify_bucket *b, struct dnet_id *id)
+{
+	struct dnet_notify_key *k;
+
+	list_for_each_entry(k, &b->key_list, key_entry) {
+		if (!dnet_id_cmp(id, &k->id))
+			return k;
+	}
 
-	hash %= hash_size;
-	return hash;
+	return NULL;
+}
+
+static void dnet_notify_key_destroy(struct dnet_notify_key *k)
+{
+	int i;
+
+	for (i = 0; i < k->num; ++i)
+		dnet_state_put(k->subscribers[i].state);
+
+	free(k->subscribers);
+	free(k);
 }
 
 int dnet_update_notify(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
@@ -64,33 +119,187 @@ int dnet_update_notify(struct dnet_net_state *st, struct dnet_cmd *cmd, void *da
 	struct dnet_node *n = st->n;
 	unsigned int hash = dnet_notify_hash(&cmd->id, n->notify_hash_size);
 	struct dnet_notify_bucket *b = &n->notify_hash[hash];
-	struct dnet_notify_entry *nt;
+	struct dnet_notify_queue *q = &n->notify_queue;
 	struct dnet_io_attr *io = data;
-	struct dnet_io_notification notif;
-
-	memcpy(&notif.io, io, sizeof(struct dnet_io_attr));
-	dnet_convert_io_attr(&notif.io);
+	struct dnet_notify_event *e;
+	int subscribed, err = 0;
 
 	pthread_rwlock_rdlock(&b->notify_lock);
-	list_for_each_entry(nt, &b->notify_list, notify_entry) {
-		if (dnet_id_cmp(&cmd->id, &nt->cmd.id))
-			continue;
+	subscribed = dnet_notify_key_search(b, &cmd->id) != NULL;
+	pthread_rwlock_unlock(&b->notify_lock);
 
-		memcpy(&notif.addr, &st->addr, sizeof(struct dnet_addr));
+	if (!subscribed)
+		goto err_out_exit;
 
-		dnet_log(n, DNET_LOG_NOTICE, "%s: sending notification.\n", dnet_dump_id(&cmd->id));
-		dnet_send_reply(nt->state, &nt->cmd, &notif, sizeof(struct dnet_io_notification), 1);
+	e = malloc(sizeof(struct dnet_notify_event));
+	if (!e) {
+		err = -ENOMEM;
+		goto err_out_exit;
 	}
-	pthread_rwlock_unlock(&b->notify_lock);
 
+	e->id = cmd->id;
+	memcpy(&e->notif.addr, &st->addr, sizeof(struct dnet_addr));
+	memcpy(&e->notif.io, io, sizeof(struct dnet_io_attr));
+	dnet_convert_io_attr(&e->notif.io);
+
+	pthread_mutex_lock(&q->lock);
+	if (q->num >= DNET_NOTIFY_QUEUE_MAX) {
+		pthread_mutex_unlock(&q->lock);
+
+		dnet_log(n, DNET_LOG_ERROR, "%s: notification queue is full, dropping notification.\n",
+				dnet_dump_id(&cmd->id));
+		free(e);
+		err = -EAGAIN;
+		goto err_out_exit;
+	}
+
+	list_add_tail(&e->event_entry, &q->events);
+	if (q->num++ == 0)
+		pthread_cond_signal(&q->wait);
+	pthread_mutex_unlock(&q->lock);
+
+err_out_exit:
 	stop_action(ACTION_DNET_UPDATE_NOTIFY);
+	return err;
+}
+
+static struct dnet_notify_batch *dnet_notify_batch_get(struct list_head *batches, struct dnet_net_state *st)
+{
+	struct dnet_notify_batch *batch;
+
+	list_for_each_entry(batch, batches, batch_entry) {
+		if (batch->state == st)
+			return batch;
+	}
+
+	batch = malloc(sizeof(struct dnet_notify_batch));
+	if (!batch)
+		return NULL;
+
+	memset(batch, 0, sizeof(struct dnet_notify_batch));
+	batch->state = dnet_state_get(st);
+	list_add_tail(&batch->batch_entry, batches);
+
+	return batch;
+}
+
+/*
+ * Appends reply with notification to the batch of subscriber's client,
+ * it is formatted the same way as dnet_send_reply() does with @more set
+ */
+static int dnet_notify_batch_add(struct list_head *batches, struct dnet_notify_subscriber *s,
+		struct dnet_io_notification *notif)
+{
+	const uint64_t frame = sizeof(struct dnet_cmd) + sizeof(struct dnet_io_notification);
+	struct dnet_notify_batch *batch;
+	struct dnet_cmd *c;
+
+	batch = dnet_notify_batch_get(batches, s->state);
+	if (!batch)
+		return -ENOMEM;
+
+	if (!batch->r || batch->r->hsize + frame > batch->size) {
+		uint64_t size = batch->size ? batch->size * 2 : frame * 8;
+		struct dnet_io_req *r;
+
+		r = realloc(batch->r, sizeof(struct dnet_io_req) + size);
+		if (!r)
+			return -ENOMEM;
+
+		if (!batch->r)
+			memset(r, 0, sizeof(struct dnet_io_req));
+
+		batch->r = r;
+		batch->size = size;
+	}
+
+	c = (void *)(batch->r + 1) + batch->r->hsize;
+
+	*c = s->cmd;
+	c->flags |= DNET_FLAGS_MORE;
+	c->size = sizeof(struct dnet_io_notification);
+	c->trans |= DNET_TRANS_REPLY;
+	memcpy(c + 1, notif, sizeof(struct dnet_io_notification));
+
+	dnet_convert_cmd(c);
+
+	batch->r->hsize += frame;
 	return 0;
 }
 
-static void dnet_notify_entry_destroy(struct dnet_notify_entry *e)
+static void dnet_notify_deliver(struct dnet_node *n, struct list_head *events)
+{
+	struct dnet_notify_event *e, *tmp;
+	struct dnet_notify_batch *batch, *btmp;
+	struct dnet_notify_bucket *b;
+	struct dnet_notify_key *k;
+	LIST_HEAD(batches);
+	int i, err;
+
+	list_for_each_entry_safe(e, tmp, events, event_entry) {
+		b = &n->notify_hash[dnet_notify_hash(&e->id, n->notify_hash_size)];
+
+		pthread_rwlock_rdlock(&b->notify_lock);
+		k = dnet_notify_key_search(b, &e->id);
+		for (i = 0; k && i < k->num; ++i) {
+			if (k->subscribers[i].state == n->st)
+				continue;
+
+			err = dnet_notify_batch_add(&batches, &k->subscribers[i], &e->notif);
+			if (err)
+				dnet_log(n, DNET_LOG_ERROR, "%s: failed to queue notification: %d.\n",
+						dnet_dump_id(&e->id), err);
+		}
+		pthread_rwlock_unlock(&b->notify_lock);
+
+		list_del(&e->event_entry);
+		free(e);
+	}
+
+	list_for_each_entry_safe(batch, btmp, &batches, batch_entry) {
+		if (batch->r) {
+			batch->r->header = batch->r + 1;
+			batch->r->fd = -1;
+
+			dnet_log(n, DNET_LOG_NOTICE, "%s: sending notifications, size: %llu.\n",
+					dnet_state_dump_addr(batch->state),
+					(unsigned long long)batch->r->hsize);
+
+			dnet_io_req_queue_nocopy(batch->state, batch->r);
+		}
+
+		list_del(&batch->batch_entry);
+		dnet_state_put(batch->state);
+		free(batch);
+	}
+}
+
+static void *dnet_notify_process(void *data)
 {
-	dnet_state_put(e->state);
-	free(e);
+	struct dnet_node *n = data;
+	struct dnet_notify_queue *q = &n->notify_queue;
+	LIST_HEAD(events);
+
+	dnet_set_name("dnet_notify");
+
+	pthread_mutex_lock(&q->lock);
+	while (!q->need_exit) {
+		if (list_empty(&q->events)) {
+			pthread_cond_wait(&q->wait, &q->lock);
+			continue;
+		}
+
+		list_splice_init(&q->events, &events);
+		q->num = 0;
+		pthread_mutex_unlock(&q->lock);
+
+		dnet_notify_deliver(n, &events);
+
+		pthread_mutex_lock(&q->lock);
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return NULL;
 }
 
 int dnet_notify_add(struct dnet_net_state *st, struct dnet_cmd *cmd)
@@ -98,56 +307,94 @@ int dnet_notify_add(struct dnet_net_state *st, struct dnet_cmd *cmd)
 	start_action(ACTION_DNET_NOTIFY_ADD);
 
 	struct dnet_node *n = st->n;
-	struct dnet_notify_entry *e;
+	struct dnet_notify_key *k;
+	struct dnet_notify_subscriber *s;
 	unsigned int hash = dnet_notify_hash(&cmd->id, n->notify_hash_size);
 	struct dnet_notify_bucket *b = &n->notify_hash[hash];
+	int err = 0;
 
-	e = malloc(sizeof(struct dnet_notify_entry));
-	if (!e)
-		return -ENOMEM;
+	pthread_rwlock_wrlock(&b->notify_lock);
+	k = dnet_notify_key_search(b, &cmd->id);
+	if (!k) {
+		k = malloc(sizeof(struct dnet_notify_key));
+		if (!k) {
+			err = -ENOMEM;
+			goto err_out_unlock;
+		}
 
-	e->state = dnet_state_get(st);
-	memcpy(&e->cmd, cmd, sizeof(struct dnet_cmd));
+		memset(k, 0, sizeof(struct dnet_notify_key));
+		k->id = cmd->id;
+		list_add_tail(&k->key_entry, &b->key_list);
+	}
 
-	pthread_rwlock_wrlock(&b->notify_lock);
-	list_add_tail(&e->notify_entry, &b->notify_list);
+	if (k->num == k->size) {
+		int size = k->size ? k->size * 2 : 4;
+
+		s = realloc(k->subscribers, size * sizeof(struct dnet_notify_subscriber));
+		if (!s) {
+			err = -ENOMEM;
+			if (!k->num) {
+				list_del(&k->key_entry);
+				dnet_notify_key_destroy(k);
+			}
+			goto err_out_unlock;
+		}
+
+		k->subscribers = s;
+		k->size = size;
+	}
+
+	s = &k->subscribers[k->num++];
+	s->state = dnet_state_get(st);
+	memcpy(&s->cmd, cmd, sizeof(struct dnet_cmd));
+
+err_out_unlock:
 	pthread_rwlock_unlock(&b->notify_lock);
 
-	dnet_log(n, DNET_LOG_INFO, "%s: added notification, hash: 0x%x.\n", dnet_dump_id(&cmd->id), hash);
+	if (!err)
+		dnet_log(n, DNET_LOG_INFO, "%s: added notification, hash: 0x%x.\n", dnet_dump_id(&cmd->id), hash);
 
 	stop_action(ACTION_DNET_NOTIFY_ADD);
-	return 0;
+	return err;
 }
 
 int dnet_notify_remove(struct dnet_net_state *st, struct dnet_cmd *cmd)
 {
 	struct dnet_node *n = st->n;
-	struct dnet_notify_entry *e, *tmp;
+	struct dnet_notify_key *k;
+	struct dnet_notify_subscriber s;
 	unsigned int hash = dnet_notify_hash(&cmd->id, n->notify_hash_size);
 	struct dnet_notify_bucket *b = &n->notify_hash[hash];
-	int err = -ENXIO;
+	int err;
 
 	pthread_rwlock_wrlock(&b->notify_lock);
-	list_for_each_entry_safe(e, tmp, &b->notify_list, notify_entry) {
-		if (dnet_id_cmp(&e->cmd.id, &cmd->id))
-			continue;
+	k = dnet_notify_key_search(b, &cmd->id);
+	if (!k) {
+		pthread_rwlock_unlock(&b->notify_lock);
+		return -ENXIO;
+	}
 
-		e->cmd.flags = 0;
-		err = dnet_send_reply(e->state, &e->cmd, NULL, 0, 0);
+	s = k->subscribers[0];
+	memmove(k->subscribers, k->subscribers + 1, --k->num * sizeof(struct dnet_notify_subscriber));
 
-		list_del(&e->notify_entry);
-		dnet_notify_entry_destroy(e);
-		
-		dnet_log(n, DNET_LOG_INFO, "%s: removed notification.\n", dnet_dump_id(&cmd->id));
-		break;
+	if (!k->num) {
+		list_del(&k->key_entry);
+		dnet_notify_key_destroy(k);
 	}
 	pthread_rwlock_unlock(&b->notify_lock);
 
+	s.cmd.flags = 0;
+	err = dnet_send_reply(s.state, &s.cmd, NULL, 0, 0);
+	dnet_state_put(s.state);
+
+	dnet_log(n, DNET_LOG_INFO, "%s: removed notification.\n", dnet_dump_id(&cmd->id));
+
 	return err;
 }
 
 int dnet_notify_init(struct dnet_node *n)
 {
+	struct dnet_notify_queue *q = &n->notify_queue;
 	unsigned int i;
 	struct dnet_notify_bucket *b;
 	int err;
@@ -163,7 +410,7 @@ int dnet_notify_init(struct dnet_node *n)
 	for (i=0; i<n->notify_hash_size; ++i) {
 		b = &n->notify_hash[i];
 
-		INIT_LIST_HEAD(&b->notify_list);
+		INIT_LIST_HEAD(&b->key_list);
 		err = pthread_rwlock_init(&b->notify_lock, NULL);
 		if (err) {
 			err = -err;
@@ -172,11 +419,37 @@ int dnet_notify_init(struct dnet_node *n)
 		}
 	}
 
+	memset(q, 0, sizeof(struct dnet_notify_queue));
+	INIT_LIST_HEAD(&q->events);
+
+	err = pthread_mutex_init(&q->lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_free;
+	}
+
+	err = pthread_cond_init(&q->wait, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_lock_destroy;
+	}
+
+	err = pthread_create(&q->tid, NULL, dnet_notify_process, n);
+	if (err) {
+		err = -err;
+		dnet_log(n, DNET_LOG_ERROR, "Failed to start notify thread: %d\n", err);
+		goto err_out_cond_destroy;
+	}
+
 	dnet_log(n, DNET_LOG_INFO, "Successfully initialized notify hash table (%u entries).\n",
 			n->notify_hash_size);
 
 	return 0;
 
+err_out_cond_destroy:
+	pthread_cond_destroy(&q->wait);
+err_out_lock_destroy:
+	pthread_mutex_destroy(&q->lock);
 err_out_free:
 	n->notify_hash_size = i;
 	for (i=0; i<n->notify_hash_size; ++i) {
@@ -184,28 +457,50 @@ err_out_free:
 		pthread_rwlock_destroy(&b->notify_lock);
 	}
 	free(n->notify_hash);
+	n->notify_hash = NULL;
 err_out_exit:
 	return err;
 }
 
 void dnet_notify_exit(struct dnet_node *n)
 {
+	struct dnet_notify_queue *q = &n->notify_queue;
 	unsigned int i;
 	struct dnet_notify_bucket *b;
-	struct dnet_notify_entry *e, *tmp;
+	struct dnet_notify_key *k, *tmp;
+	struct dnet_notify_event *e, *etmp;
+
+	if (!n->notify_hash)
+		return;
+
+	pthread_mutex_lock(&q->lock);
+	q->need_exit = 1;
+	pthread_cond_signal(&q->wait);
+	pthread_mutex_unlock(&q->lock);
+
+	pthread_join(q->tid, NULL);
+
+	list_for_each_entry_safe(e, etmp, &q->events, event_entry) {
+		list_del(&e->event_entry);
+		free(e);
+	}
+
+	pthread_cond_destroy(&q->wait);
+	pthread_mutex_destroy(&q->lock);
 
 	for (i=0; i<n->notify_hash_size; ++i) {
 		b = &n->notify_hash[i];
 
 		pthread_rwlock_wrlock(&b->notify_lock);
-		list_for_each_entry_safe(e, tmp, &b->notify_list, notify_entry) {
-			list_del(&e->notify_entry);
+		list_for_each_entry_safe(k, tmp, &b->key_list, key_entry) {
+			list_del(&k->key_entry);
 
-			dnet_notify_entry_destroy(e);
+			dnet_notify_key_destroy(k);
 		}
 		pthread_rwlock_unlock(&b->notify_lock);
 
 		pthread_rwlock_destroy(&b->notify_lock);
 	}
 	free(n->notify_hash);
+	n->notify_hash = NULL;
 }
@@ -36,6 +36,9 @@ static char *dnet_work_io_mode_string[] = {
 
 __thread uint32_t trace_id = 0;
 
+/* Received request being processed by this IO thread, NULL if its buffer was adopted */
+static __thread struct dnet_io_req *dnet_recv_req;
+
 static char *dnet_work_io_mode_str(int mode)
 {
 	if (mode < 0 || mode >= (int)ARRAY_SIZE(dnet_work_io_mode_string))
@@ -298,19 +301,23 @@ again:
 				!!(c->trans & DNET_TRANS_REPLY),
 				(unsigned long long)c->size, (unsigned long long)c->flags, c->status);
 
-		r = malloc(c->size + sizeof(struct dnet_cmd) + sizeof(struct dnet_io_req));
+		/*
+		 * Room for dnet_addr is left before command, so client
+		 * can adopt reply buffer as is, see dnet_reply_adopt()
+		 */
+		r = malloc(sizeof(struct dnet_io_req) + sizeof(struct dnet_addr) + sizeof(struct dnet_cmd) + c->size);
 		if (!r) {
 			err = -ENOMEM;
 			goto out;
 		}
 		memset(r, 0, sizeof(struct dnet_io_req));
 
-		r->header = r + 1;
+		r->header = (void *)(r + 1) + sizeof(struct dnet_addr);
 		r->hsize = sizeof(struct dnet_cmd);
 		memcpy(r->header, &st->rcv_cmd, sizeof(struct dnet_cmd));
 
 		st->rcv_data = r;
-		st->rcv_offset = sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd);
+		st->rcv_offset = sizeof(struct dnet_io_req) + sizeof(struct dnet_addr) + sizeof(struct dnet_cmd);
 		st->rcv_end = st->rcv_offset + c->size;
 		st->rcv_flags &= ~DNET_IO_CMD;
 
@@ -861,16 +868,30 @@ static void *dnet_io_process(void *data_)
 		dnet_log(n, DNET_LOG_DEBUG, "%s: %s: got IO event: %p: hsize: %zu, dsize: %zu, mode: %s\n",
 			dnet_state_dump_addr(st), dnet_dump_id(r->header), r, r->hsize, r->dsize, dnet_work_io_mode_str(pool->mode));
 
+		dnet_recv_req = r;
 		err = dnet_process_recv(st, r);
 		trace_id = 0;
 
-		dnet_io_req_free(r);
+		if (dnet_recv_req)
+			dnet_io_req_free(r);
+		dnet_recv_req = NULL;
 		dnet_state_put(st);
 	}
 
 	return NULL;
 }
 
+void *dnet_reply_adopt(struct dnet_cmd *cmd)
+{
+	struct dnet_io_req *r = dnet_recv_req;
+
+	if (!r || r->header != cmd || !(cmd->trans & DNET_TRANS_REPLY))
+		return NULL;
+
+	dnet_recv_req = NULL;
+	return r;
+}
+
 int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 {
 	int err, i;
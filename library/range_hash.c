@@ -0,0 +1,376 @@
+/*
+ * Copyright 2008+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Range hashes: per-cell number of keys and sum of (key, timestamp) hashes.
+ *
+ * Recovery compares them between replicas and iterates only those parts
+ * of the key space which differ. Backend does not tell us old timestamp
+ * of the overwritten or removed key, so instead of updating sums in place
+ * every modification marks its cell dirty and dirty cells are recalculated
+ * by single backend iteration on the next request. Iteration is limited
+ * to keys of dirty cells: backend skips other records by key without
+ * reading their data or metadata.
+ */
+
+#include <sys/time.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elliptics.h"
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+struct dnet_range_hash_private {
+	struct dnet_range_hash_cell	*cells;
+	unsigned char			*pending;
+};
+
+static inline uint32_t dnet_range_hash_prefix(const unsigned char *id, uint32_t depth)
+{
+	return ((id[0] << 8) | id[1]) >> (DNET_RANGE_HASH_DEPTH_MAX - depth);
+}
+
+/*
+ * FNV-1a over key and timestamp with final avalanche,
+ * otherwise sums of hashes of similar keys would collide too easily.
+ */
+static uint64_t dnet_range_hash_key(const struct dnet_raw_id *key, const struct dnet_time *ts)
+{
+	const uint64_t prime = 0x100000001b3ULL;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int i;
+
+	for (i = 0; i < DNET_ID_SIZE; ++i) {
+		h ^= key->id[i];
+		h *= prime;
+	}
+
+	h ^= ts->tsec;
+	h *= prime;
+	h ^= ts->tnsec;
+	h *= prime;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+int dnet_range_hash_init(struct dnet_node *n)
+{
+	struct dnet_range_hash_cache *cache;
+	int err;
+
+	cache = malloc(sizeof(struct dnet_range_hash_cache));
+	if (!cache) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	err = pthread_mutex_init(&cache->lock, NULL);
+	if (err) {
+		err = -err;
+		dnet_log(n, DNET_LOG_ERROR, "Could not create range hash lock: %s [%d]\n", strerror(-err), err);
+		goto err_out_free;
+	}
+
+	/* Nothing is known about backend content yet, the first request will calculate everything */
+	memset(cache->cells, 0, sizeof(cache->cells));
+	memset(cache->dirty, 1, sizeof(cache->dirty));
+
+	n->range_hash = cache;
+	return 0;
+
+err_out_free:
+	free(cache);
+err_out_exit:
+	return err;
+}
+
+void dnet_range_hash_cleanup(struct dnet_node *n)
+{
+	if (n->range_hash) {
+		pthread_mutex_destroy(&n->range_hash->lock);
+		free(n->range_hash);
+		n->range_hash = NULL;
+	}
+}
+
+void dnet_range_hash_invalidate(struct dnet_node *n, const struct dnet_id *id)
+{
+	if (n->range_hash)
+		n->range_hash->dirty[dnet_range_hash_prefix(id->id, DNET_RANGE_HASH_DEPTH_MAX)] = 1;
+}
+
+void dnet_range_hash_invalidate_all(struct dnet_node *n)
+{
+	if (n->range_hash)
+		memset(n->range_hash->dirty, 1, sizeof(n->range_hash->dirty));
+}
+
+static int dnet_range_hash_filter(void *priv, struct dnet_raw_id *key)
+{
+	struct dnet_range_hash_private *p = priv;
+
+	return p->pending[dnet_range_hash_prefix(key->id, DNET_RANGE_HASH_DEPTH_MAX)];
+}
+
+/*
+ * Backend may call it from several threads at once
+ */
+static int dnet_range_hash_callback(void *priv, struct dnet_raw_id *key,
+		void *data __unused, uint64_t dsize __unused, struct dnet_ext_list *elist)
+{
+	struct dnet_range_hash_private *p = priv;
+	uint32_t cell = dnet_range_hash_prefix(key->id, DNET_RANGE_HASH_DEPTH_MAX);
+
+	if (!p->pending[cell])
+		return 0;
+
+	__sync_fetch_and_add(&p->cells[cell].count, 1);
+	__sync_fetch_and_add(&p->cells[cell].hash, dnet_range_hash_key(key, &elist->timestamp));
+	return 0;
+}
+
+/*
+ * Recalculates dirty cells. Must be called with cache lock held.
+ */
+static int dnet_range_hash_update(struct dnet_node *n)
+{
+	struct dnet_range_hash_cache *cache = n->range_hash;
+	struct dnet_range_hash_private p;
+	struct dnet_iterator_ctl ictl = {
+		.iterate_private = n->cb->command_private,
+		.callback = dnet_range_hash_callback,
+		.callback_private = &p,
+		.key_filter = dnet_range_hash_filter,
+	};
+	struct timeval start, end;
+	long diff;
+	int i, num = 0, err;
+
+	p.pending = malloc(DNET_RANGE_HASH_CELLS);
+	if (!p.pending) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	/*
+	 * Dirty flags are cleared before iteration, so modification
+	 * which happens while backend is being iterated marks its cell
+	 * dirty again and it will be recalculated next time.
+	 */
+	for (i = 0; i < DNET_RANGE_HASH_CELLS; ++i) {
+		p.pending[i] = cache->dirty[i];
+		if (p.pending[i]) {
+			cache->dirty[i] = 0;
+			++num;
+		}
+	}
+	__sync_synchronize();
+
+	if (!num) {
+		err = 0;
+		goto err_out_free_pending;
+	}
+
+	p.cells = calloc(DNET_RANGE_HASH_CELLS, sizeof(struct dnet_range_hash_cell));
+	if (!p.cells) {
+		err = -ENOMEM;
+		goto err_out_restore;
+	}
+
+	gettimeofday(&start, NULL);
+
+	err = n->cb->iterator(&ictl);
+	if (err)
+		goto err_out_free_cells;
+
+	for (i = 0; i < DNET_RANGE_HASH_CELLS; ++i) {
+		if (p.pending[i])
+			cache->cells[i] = p.cells[i];
+	}
+
+	gettimeofday(&end, NULL);
+	diff = (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
+
+	dnet_log(n, DNET_LOG_INFO, "range-hash: recalculated %d/%d cells, time: %ld usecs\n",
+			num, DNET_RANGE_HASH_CELLS, diff);
+
+	free(p.cells);
+	free(p.pending);
+	return 0;
+
+err_out_free_cells:
+	free(p.cells);
+err_out_restore:
+	for (i = 0; i < DNET_RANGE_HASH_CELLS; ++i) {
+		if (p.pending[i])
+			cache->dirty[i] = 1;
+	}
+err_out_free_pending:
+	free(p.pending);
+err_out_exit:
+	if (err)
+		dnet_log(n, DNET_LOG_ERROR, "range-hash: failed to recalculate %d cells: %d\n", num, err);
+	return err;
+}
+
+/*
+ * Converts [key_begin, key_end) range into inclusive range of cells at given depth.
+ * Returns 0 if range is empty.
+ */
+static int dnet_range_hash_cells(struct dnet_iterator_range *r, uint32_t depth, uint32_t *first, uint32_t *last)
+{
+	uint32_t shift = DNET_RANGE_HASH_DEPTH_MAX - depth;
+	const unsigned char *end = r->key_end.id;
+	int i, tail_zero;
+
+	if (dnet_id_cmp_str(r->key_begin.id, end) >= 0)
+		return 0;
+
+	*first = dnet_range_hash_prefix(r->key_begin.id, depth);
+	*last = dnet_range_hash_prefix(end, depth);
+
+	/* End key is not included, if it starts new cell, the previous one is the last */
+	tail_zero = (((end[0] << 8) | end[1]) & ((1 << shift) - 1)) == 0;
+	for (i = 2; tail_zero && i < DNET_ID_SIZE; ++i)
+		tail_zero = end[i] == 0;
+
+	if (tail_zero)
+		*last -= 1;
+
+	return 1;
+}
+
+int dnet_cmd_range_hash(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_node *n = st->n;
+	struct dnet_range_hash_cache *cache = n->range_hash;
+	struct dnet_range_hash_request *req = data;
+	struct dnet_iterator_range *ranges = (struct dnet_iterator_range *)(req + 1);
+	struct dnet_range_hash *reply;
+	unsigned char *selected;
+	uint32_t i, j, first, last, cell_num, shift, num = 0;
+	int err;
+
+	if (!cache || !n->cb->iterator) {
+		err = -ENOTSUP;
+		goto err_out_exit;
+	}
+
+	if (cmd->size < sizeof(struct dnet_range_hash_request)) {
+		err = -EINVAL;
+		goto err_out_exit;
+	}
+
+	dnet_convert_range_hash_request(req);
+
+	if (req->depth > DNET_RANGE_HASH_DEPTH_MAX ||
+			cmd->size != sizeof(struct dnet_range_hash_request) +
+				(uint64_t)req->range_num * sizeof(struct dnet_iterator_range)) {
+		dnet_log(n, DNET_LOG_ERROR, "%s: range-hash: invalid request: depth: %u, ranges: %u, size: %llu\n",
+				dnet_dump_id(&cmd->id), req->depth, req->range_num, (unsigned long long)cmd->size);
+		err = -EINVAL;
+		goto err_out_exit;
+	}
+
+	cell_num = 1 << req->depth;
+	shift = DNET_RANGE_HASH_DEPTH_MAX - req->depth;
+
+	selected = calloc(cell_num, 1);
+	if (!selected) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	/* No ranges means the whole key space */
+	if (!req->range_num)
+		memset(selected, 1, cell_num);
+
+	for (i = 0; i < req->range_num; ++i) {
+		if (!dnet_range_hash_cells(&ranges[i], req->depth, &first, &last))
+			continue;
+
+		memset(selected + first, 1, last - first + 1);
+	}
+
+	for (i = 0; i < cell_num; ++i)
+		num += selected[i];
+
+	if (!num) {
+		err = 0;
+		goto err_out_free_selected;
+	}
+
+	reply = calloc(num, sizeof(struct dnet_range_hash));
+	if (!reply) {
+		err = -ENOMEM;
+		goto err_out_free_selected;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+
+	err = dnet_range_hash_update(n);
+	if (err) {
+		pthread_mutex_unlock(&cache->lock);
+		goto err_out_free_reply;
+	}
+
+	for (i = 0, j = 0; i < cell_num; ++i) {
+		struct dnet_range_hash *h;
+		uint32_t cell;
+
+		if (!selected[i])
+			continue;
+
+		h = &reply[j++];
+		h->prefix = i;
+		h->depth = req->depth;
+
+		for (cell = i << shift; cell < (i + 1) << shift; ++cell) {
+			h->count += cache->cells[cell].count;
+			h->hash += cache->cells[cell].hash;
+		}
+
+		dnet_convert_range_hash(h);
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+
+	dnet_log(n, DNET_LOG_NOTICE, "%s: range-hash: depth: %u, ranges: %u, cells: %u\n",
+			dnet_dump_id(&cmd->id), req->depth, req->range_num, num);
+
+	err = dnet_send_reply(st, cmd, reply, num * sizeof(struct dnet_range_hash), 0);
+
+err_out_free_reply:
+	free(reply);
+err_out_free_selected:
+	free(selected);
+err_out_exit:
+	return err;
+}
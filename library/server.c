@@ -270,14 +270,14 @@ struct dnet_node *dnet_server_node_create(struct dnet_config_data *cfg_data)
 	if (!n->notify_hash_size) {
 		n->notify_hash_size = DNET_DEFAULT_NOTIFY_HASH_SIZE;
 
-		err = dnet_notify_init(n);
-		if (err)
-			goto err_out_node_destroy;
-
 		dnet_log(n, DNET_LOG_NOTICE, "No notify hash size provided, using default %d.\n",
 				n->notify_hash_size);
 	}
 
+	err = dnet_notify_init(n);
+	if (err)
+		goto err_out_node_destroy;
+
 	err = dnet_backend_stat_provider_init(n);
 	if (err)
 		goto err_out_notify_exit;
@@ -298,9 +298,21 @@ struct dnet_node *dnet_server_node_create(struct dnet_config_data *cfg_data)
 		if (err)
 			goto err_out_addr_cleanup;
 
+		err = dnet_range_hash_init(n);
+		if (err)
+			goto err_out_locks_destroy;
+
+		err = dnet_journal_init(n, cfg);
+		if (err)
+			goto err_out_range_hash_cleanup;
+
+		err = dnet_io_sched_init(n, cfg);
+		if (err)
+			goto err_out_journal_cleanup;
+
 		ids = dnet_ids_init(n, cfg->history_env, &id_num, cfg->storage_free, cfg_data->cfg_addrs, cfg_data->cfg_remotes);
 		if (!ids)
-			goto err_out_locks_destroy;
+			goto err_out_io_sched_cleanup;
 
 		memset(&la, 0, sizeof(struct dnet_addr));
 		la.addr_len = sizeof(la.addr);
@@ -343,6 +355,12 @@ err_out_state_destroy:
 	dnet_state_put(n->st);
 err_out_ids_cleanup:
 	free(ids);
+err_out_io_sched_cleanup:
+	dnet_io_sched_cleanup(n);
+err_out_journal_cleanup:
+	dnet_journal_cleanup(n);
+err_out_range_hash_cleanup:
+	dnet_range_hash_cleanup(n);
 err_out_locks_destroy:
 	dnet_locks_destroy(n);
 err_out_addr_cleanup:
@@ -369,7 +387,11 @@ void dnet_server_node_destroy(struct dnet_node *n)
 	 * backend must be destroyed the last.
 	 *
 	 * After all of them finish destroying the node, all it's counters and so on.
+	 *
+	 * Deferred background work replies to states and writes into backend,
+	 * so scheduler is stopped before any of them is destroyed.
 	 */
+	dnet_io_sched_stop(n);
 	dnet_node_cleanup_common_resources(n);
 
 	dnet_srw_cleanup(n);
@@ -382,6 +404,9 @@ void dnet_server_node_destroy(struct dnet_node *n)
 		n->cb->backend_cleanup(n->cb->command_private);
 
 	dnet_counter_destroy(n);
+	dnet_io_sched_cleanup(n);
+	dnet_journal_cleanup(n);
+	dnet_range_hash_cleanup(n);
 	dnet_locks_destroy(n);
 	dnet_local_addr_cleanup(n);
 	dnet_notify_exit(n);
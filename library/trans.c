@@ -87,6 +87,9 @@ int dnet_trans_insert_nolock(struct rb_root *root, struct dnet_trans *a)
 
 	rb_link_node(&a->trans_entry, parent, n);
 	rb_insert_color(&a->trans_entry, root);
+
+	/* Every transaction tree belongs to some state */
+	container_of(root, struct dnet_net_state, trans_root)->inflight++;
 	return 0;
 }
 
@@ -102,9 +105,88 @@ void dnet_trans_remove_nolock(struct rb_root *root, struct dnet_trans *t)
 	if (t) {
 		rb_erase(&t->trans_entry, root);
 		t->trans_entry.rb_parent_color = 0;
+
+		container_of(root, struct dnet_net_state, trans_root)->inflight--;
 	}
 }
 
+long dnet_state_penalty(struct dnet_net_state *st, time_t now)
+{
+	long periods;
+
+	if (!st->penalty || now < st->penalty_time)
+		return st->penalty;
+
+	periods = (now - st->penalty_time) / DNET_STATE_PENALTY_HALF_LIFE;
+	if (periods >= (long)sizeof(long) * 8)
+		return 0;
+
+	return st->penalty >> periods;
+}
+
+/*
+ * Expected time to get reply from the state: latency estimate plus timeout penalty
+ * multiplied by number of requests which are already waiting. Lower is better.
+ */
+uint64_t dnet_state_score(struct dnet_net_state *st, time_t now)
+{
+	int inflight = st->inflight;
+
+	if (inflight < 0)
+		inflight = 0;
+
+	return (uint64_t)(st->latency_ewma + dnet_state_penalty(st, now)) * (inflight + 1);
+}
+
+long dnet_state_latency(struct dnet_node *n, struct dnet_id *id)
+{
+	struct dnet_net_state *st;
+	long latency;
+
+	st = dnet_state_get_first(n, id);
+	if (!st)
+		return -ENXIO;
+
+	latency = st->latency_ewma + dnet_state_penalty(st, time(NULL));
+	dnet_state_put(st);
+
+	return latency;
+}
+
+long dnet_state_latency_percentile(struct dnet_node *n, struct dnet_id *id, int permille)
+{
+	struct dnet_net_state *st;
+	uint64_t counts[DNET_LATENCY_BUCKETS];
+	uint64_t total = 0;
+	int i;
+
+	st = dnet_state_get_first(n, id);
+	if (!st)
+		return -ENXIO;
+
+	for (i = 0; i < DNET_LATENCY_BUCKETS; ++i) {
+		counts[i] = st->latency_hist[i];
+		total += counts[i];
+	}
+	dnet_state_put(st);
+
+	if (!total)
+		return -ENOENT;
+
+	return dnet_latency_percentile(counts, total, permille);
+}
+
+/*
+ * Timed out state gets penalty of the whole timeout on top of what is left from the previous ones
+ */
+static void dnet_state_penalize(struct dnet_net_state *st)
+{
+	time_t now = time(NULL);
+
+	st->penalty = dnet_state_penalty(st, now) + st->n->wait_ts.tv_sec * 1000000 + st->n->wait_ts.tv_nsec / 1000;
+	st->penalty_time = now;
+}
+
 void dnet_trans_remove(struct dnet_trans *t)
 {
 	struct dnet_net_state *st = t->st;
@@ -169,14 +251,13 @@ void dnet_trans_destroy(struct dnet_trans *t)
 	if (st && (t->cmd.status == 0) &&
 			((t->command == DNET_CMD_READ) || (t->command == DNET_CMD_LOOKUP))) {
 
-		if (diff < st->median_read_time && st->weight < DNET_STATE_MAX_WEIGHT)
-			st->weight *= 1.1;
-		else if (diff > st->median_read_time && st->weight > 1)
-			st->weight *= 0.8;
-
-		st->median_read_time = (st->median_read_time + diff) / 2;
+		/* The same smoothing as TCP uses for RTT */
+		st->latency_ewma += (diff - st->latency_ewma) / 8;
 	}
 
+	if (st && (t->cmd.status == 0) && t->command != 0)
+		__sync_fetch_and_add(&st->latency_hist[dnet_latency_bucket(diff > 0 ? diff : 0)], 1);
+
 	if (st && st->n && t->command != 0) {
 		char str[64];
 		char io_buf[128] = "";
@@ -184,8 +265,8 @@ void dnet_trans_destroy(struct dnet_trans *t)
 
 		if (t->cmd.status != -ETIMEDOUT) {
 			if (st->stall) {
-				dnet_log(st->n, DNET_LOG_INFO, "%s: reseting state stall counter: weight: %f\n",
-						dnet_state_dump_addr(st), st->weight);
+				dnet_log(st->n, DNET_LOG_INFO, "%s: reseting state stall counter: penalty: %ld\n",
+						dnet_state_dump_addr(st), st->penalty);
 			}
 
 			st->stall = 0;
@@ -215,13 +296,13 @@ void dnet_trans_destroy(struct dnet_trans *t)
 		}
 
 		dnet_log(st->n, DNET_LOG_INFO, "%s: destruction %s trans: %llu, reply: %d, st: %s, stall: %d, "
-				"weight: %f, mrt: %ld, time: %ld, started: %s.%06lu, cached status: %d%s",
+				"latency: %ld, inflight: %d, time: %ld, started: %s.%06lu, cached status: %d%s",
 			dnet_dump_id(&t->cmd.id),
 			dnet_cmd_string(t->command),
 			(unsigned long long)(t->trans & ~DNET_TRANS_REPLY),
 			!!(t->trans & ~DNET_TRANS_REPLY),
 			dnet_state_dump_addr(t->st), t->st->stall,
-			st->weight, st->median_read_time, diff,
+			st->latency_ewma, st->inflight, diff,
 			str, t->start.tv_usec,
 			t->cmd.status, io_buf);
 	}
@@ -279,11 +360,11 @@ int dnet_trans_alloc_send_state(struct dnet_session *s, struct dnet_net_state *s
 	req.header = cmd;
 	req.hsize = sizeof(struct dnet_cmd) + ctl->size;
 
-	dnet_log(n, DNET_LOG_INFO, "%s: alloc/send %s trans: %llu -> %s %f.\n",
+	dnet_log(n, DNET_LOG_INFO, "%s: alloc/send %s trans: %llu -> %s, latency: %ld.\n",
 			dnet_dump_id(&cmd->id),
 			dnet_cmd_string(ctl->cmd),
 			(unsigned long long)t->trans,
-			dnet_server_convert_dnet_addr(&t->st->addr), t->st->weight);
+			dnet_server_convert_dnet_addr(&t->st->addr), t->st->latency_ewma);
 
 	err = dnet_trans_send(t, &req);
 	if (err)
@@ -385,11 +466,10 @@ static void dnet_trans_check_stall(struct dnet_net_state *st, struct list_head *
 	if (trans_timeout) {
 		st->stall++;
 
-		if (st->weight >= 2)
-			st->weight /= 10;
+		dnet_state_penalize(st);
 
-		dnet_log(st->n, DNET_LOG_ERROR, "%s: TIMEOUT: transactions: %d, stall counter: %d/%u, weight: %f\n",
-				dnet_state_dump_addr(st), trans_timeout, st->stall, DNET_DEFAULT_STALL_TRANSACTIONS, st->weight);
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: TIMEOUT: transactions: %d, stall counter: %d/%u, penalty: %ld\n",
+				dnet_state_dump_addr(st), trans_timeout, st->stall, DNET_DEFAULT_STALL_TRANSACTIONS, st->penalty);
 
 		if (st->stall >= st->n->stall_count)
 			dnet_state_reset_nolock_noclean(st, -ETIMEDOUT, head);
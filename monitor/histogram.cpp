@@ -22,6 +22,8 @@
 #include <sys/time.h>
 #include <algorithm>
 
+#include "../library/latency.h"
+
 namespace ioremap { namespace monitor {
 
 bool cmp(const std::pair<uint64_t, std::string> &lh,
@@ -50,11 +52,18 @@ histogram::histogram(const std::vector<std::pair<uint64_t, std::string>> &xs,
 }
 
 void histogram::update(uint64_t x, uint64_t y) {
+	add(get_indx(x, y), 1);
+}
+
+void histogram::add(size_t indx, uint64_t count) {
 	validate_snapshots();
 
-	auto indx = get_indx(x, y);
-	m_snapshots.rbegin()->counters[indx] += 1;
-	m_last_data.counters[indx] += 1;
+	m_snapshots.rbegin()->counters[indx] += count;
+	m_last_data.counters[indx] += count;
+}
+
+size_t histogram::size() const {
+	return m_last_data.counters.size();
 }
 
 struct lower_cmp {
@@ -64,7 +73,7 @@ struct lower_cmp {
 	}
 };
 
-size_t histogram::get_indx(uint64_t x, uint64_t y) {
+size_t histogram::get_indx(uint64_t x, uint64_t y) const {
 	auto indx_x = std::lower_bound(m_xs.begin(), m_xs.end(), x, lower_cmp());
 	auto indx_y = std::lower_bound(m_ys.begin(), m_ys.end(), y, lower_cmp());
 
@@ -149,6 +158,54 @@ void histogram::validate_snapshots() {
 	}
 }
 
+latency_histogram::latency_histogram(time_t window_size, size_t windows_count)
+: m_window_size(window_size)
+, m_windows(windows_count) {
+}
+
+void latency_histogram::add(int bucket, uint64_t count, time_t now) {
+	const time_t epoch = now / m_window_size;
+	window &w = m_windows[epoch % m_windows.size()];
+
+	if (w.counts.empty())
+		w.counts.resize(DNET_LATENCY_BUCKETS);
+
+	if (w.epoch != epoch) {
+		w.epoch = epoch;
+		w.total = 0;
+		w.counts.assign(DNET_LATENCY_BUCKETS, 0);
+	}
+
+	w.counts[bucket] += count;
+	w.total += count;
+}
+
+rapidjson::Value& latency_histogram::report(rapidjson::Value &stat_value,
+                                            rapidjson::Document::AllocatorType &allocator,
+                                            time_t now) {
+	const time_t epoch = now / m_window_size;
+	std::vector<uint64_t> counts(DNET_LATENCY_BUCKETS, 0);
+	uint64_t total = 0;
+
+	for (auto it = m_windows.begin(), end = m_windows.end(); it != end; ++it) {
+		if (!it->total || it->epoch > epoch || epoch - it->epoch >= (time_t)m_windows.size())
+			continue;
+
+		for (size_t i = 0; i < counts.size(); ++i)
+			counts[i] += it->counts[i];
+		total += it->total;
+	}
+
+	stat_value.AddMember("count", total, allocator)
+	          .AddMember("p50", dnet_latency_percentile(counts.data(), total, 500), allocator)
+	          .AddMember("p90", dnet_latency_percentile(counts.data(), total, 900), allocator)
+	          .AddMember("p99", dnet_latency_percentile(counts.data(), total, 990), allocator)
+	          .AddMember("p999", dnet_latency_percentile(counts.data(), total, 999), allocator)
+	          .AddMember("window", uint64_t(m_window_size * m_windows.size()), allocator);
+
+	return stat_value;
+}
+
 std::vector<std::pair<uint64_t, std::string>> default_xs() {
 	static std::vector<std::pair<uint64_t, std::string>> ret =
 	{ std::make_pair<uint64_t, std::string>(500, "<500 usecs"),
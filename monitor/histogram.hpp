@@ -20,6 +20,7 @@
 #ifndef __DNET_MONITOR_HISTOGRAM_HPP
 #define __DNET_MONITOR_HISTOGRAM_HPP
 
+#include <ctime>
 #include <vector>
 #include <list>
 #include <string>
@@ -52,6 +53,28 @@ public:
 	 */
 	void update(uint64_t x, uint64_t y);
 
+	/*!
+	 * \internal
+	 *
+	 * Increases by \a count cell counter located at index \a indx
+	 * which is computed by get_indx()
+	 */
+	void add(size_t indx, uint64_t count);
+
+	/*!
+	 * \internal
+	 *
+	 * Computes and returns index of counters from \a x, \a y
+	 */
+	size_t get_indx(uint64_t x, uint64_t y) const;
+
+	/*!
+	 * \internal
+	 *
+	 * Returns number of cells in the histogram
+	 */
+	size_t size() const;
+
 	/*!
 	 * \internal
 	 *
@@ -94,13 +117,6 @@ private:
 	                             rapidjson::Document::AllocatorType &allocator,
 	                             histogram::data &data);
 
-	/*!
-	 * \internal
-	 *
-	 * Computes and returns index of counters from \a x, \a y
-	 */
-	size_t get_indx(uint64_t x, uint64_t y);
-
 	/*!
 	 * \internal
 	 *
@@ -147,6 +163,67 @@ private:
 	size_t											m_history_depth;
 };
 
+/*!
+ * \internal
+ *
+ * Log-linear latency histogram with buckets described in library/latency.h.
+ * Latencies are counted in \a windows_count windows of \a window_size seconds,
+ * the oldest window is reused when time goes on, so percentiles are computed
+ * over the last windows_count * window_size seconds.
+ */
+class latency_histogram {
+public:
+	/*!
+	 * \internal
+	 *
+	 * Constructor: windows are allocated by the first added latency
+	 */
+	latency_histogram(time_t window_size = 10, size_t windows_count = 6);
+
+	/*!
+	 * \internal
+	 *
+	 * Adds \a count latencies of \a bucket happened at \a now
+	 */
+	void add(int bucket, uint64_t count, time_t now);
+
+	/*!
+	 * \internal
+	 *
+	 * Fills and returns \a stat_value by number of latencies and their
+	 * p50, p90, p99 and p99.9 over the window ending at \a now
+	 * \a allocator - document allocator that is required by rapidjson
+	 */
+	rapidjson::Value& report(rapidjson::Value &stat_value,
+	                         rapidjson::Document::AllocatorType &allocator,
+	                         time_t now);
+
+private:
+	/*!
+	 * \internal
+	 *
+	 * Latencies counted during one window
+	 */
+	struct window {
+		time_t			epoch;
+		uint64_t		total;
+		std::vector<uint64_t>	counts;
+	};
+
+	/*!
+	 * \internal
+	 *
+	 * Duration of one window in seconds
+	 */
+	time_t				m_window_size;
+	/*!
+	 * \internal
+	 *
+	 * Ring of windows indexed by epoch (time divided by window size)
+	 */
+	std::vector<window>		m_windows;
+};
+
 /*!
  * \internal
  *
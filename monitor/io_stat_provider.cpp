@@ -32,26 +32,63 @@ void dump_list_stats(rapidjson::Value &stat, list_stat &list_stats, rapidjson::D
 	    .AddMember("volume", list_stats.volume, allocator);
 }
 
+static void dump_state_stats(rapidjson::Value &stat, struct dnet_net_state *st, time_t now, rapidjson::Document::AllocatorType &allocator) {
+	rapidjson::Value state_value(rapidjson::kObjectType);
+	state_value.AddMember("send_queue_size", atomic_read(&st->send_queue_size), allocator)
+	           .AddMember("la", st->la, allocator)
+	           .AddMember("free", (uint64_t)st->free, allocator)
+	           .AddMember("latency_ewma", (int64_t)st->latency_ewma, allocator)
+	           .AddMember("inflight", st->inflight, allocator)
+	           .AddMember("penalty", (int64_t)dnet_state_penalty(st, now), allocator)
+	           .AddMember("score", dnet_state_score(st, now), allocator)
+	           .AddMember("stall", st->stall, allocator)
+	           .AddMember("join_state", st->__join_state, allocator);
+
+	rapidjson::Value addr(dnet_server_convert_dnet_addr(&st->addr), allocator);
+	stat.AddMember(addr, state_value, allocator);
+}
+
+/*
+ * Client states are listed in empty_state_list, states of remote storage nodes are in storage_state_list.
+ * Client states are usually linked into storage_state_list too, they are not dumped twice.
+ */
 void dump_states_stats(rapidjson::Value &stat, struct dnet_node *n, rapidjson::Document::AllocatorType &allocator) {
 	struct dnet_net_state *st;
+	time_t now = time(NULL);
 
 	pthread_mutex_lock(&n->state_lock);
+	list_for_each_entry(st, &n->storage_state_list, storage_state_entry) {
+		dump_state_stats(stat, st, now, allocator);
+	}
+
 	list_for_each_entry(st, &n->empty_state_list, state_entry) {
-		rapidjson::Value state_value(rapidjson::kObjectType);
-		state_value.AddMember("send_queue_size", atomic_read(&st->send_queue_size), allocator)
-		           .AddMember("la", st->la, allocator)
-		           .AddMember("free", (uint64_t)st->free, allocator)
-		           .AddMember("weight", st->weight, allocator)
-		           .AddMember("median_read_time", st->median_read_time, allocator)
-		           .AddMember("stall", st->stall, allocator)
-		           .AddMember("join_state", st->__join_state, allocator);
-
-		rapidjson::Value addr(dnet_server_convert_dnet_addr(&st->addr), allocator);
-		stat.AddMember(addr, state_value, allocator);
+		if (list_empty(&st->storage_state_entry))
+			dump_state_stats(stat, st, now, allocator);
 	}
 	pthread_mutex_unlock(&n->state_lock);
 }
 
+void dump_io_sched_stats(rapidjson::Value &stat, struct dnet_node *n, rapidjson::Document::AllocatorType &allocator) {
+	static const char *class_names[__DNET_IO_CLASS_MAX] = {
+		"foreground", "iterator", "defrag", "sync", "recovery"
+	};
+	struct dnet_io_sched_ctl ctl;
+
+	dnet_io_sched_stat(n, &ctl);
+
+	stat.AddMember("latency_target", ctl.latency_target, allocator)
+	    .AddMember("latency_p99", ctl.latency_p99, allocator);
+
+	for (int i = 0; i < __DNET_IO_CLASS_MAX; ++i) {
+		rapidjson::Value class_value(rapidjson::kObjectType);
+		class_value.AddMember("rate", ctl.rate[i], allocator)
+		           .AddMember("current_rate", ctl.current_rate[i], allocator)
+		           .AddMember("bytes", ctl.bytes[i], allocator)
+		           .AddMember("wait_time", ctl.wait_time[i], allocator);
+		stat.AddMember(class_names[i], class_value, allocator);
+	}
+}
+
 std::string io_stat_provider::json() const {
 	rapidjson::Document doc;
 	doc.SetObject();
@@ -75,6 +112,10 @@ std::string io_stat_provider::json() const {
 
 	doc.AddMember("blocked", m_node->io->blocked == 1, allocator);
 
+	rapidjson::Value io_sched_stat(rapidjson::kObjectType);
+	dump_io_sched_stats(io_sched_stat, m_node, allocator);
+	doc.AddMember("io_sched", io_sched_stat, allocator);
+
 	rapidjson::StringBuffer buffer;
 	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
 	doc.Accept(writer);
@@ -25,15 +25,149 @@
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
 
+#include "../library/latency.h"
+
 namespace ioremap { namespace monitor {
 
+/*
+ * Number of histograms kept by shard: 4 for every command with histograms
+ */
+#define DNET_MONITOR_SHARD_HISTOGRAMS	16
+
+static inline void counter_add(uint_fast64_t &counter, uint_fast64_t value) {
+	__sync_fetch_and_add(&counter, value);
+}
+
+static inline uint_fast64_t counter_get(const uint_fast64_t &counter) {
+	return *static_cast<const volatile uint_fast64_t *>(&counter);
+}
+
+statistics_shard::statistics_shard(size_t histograms_size)
+: histograms(DNET_MONITOR_SHARD_HISTOGRAMS * histograms_size, 0)
+, history(2 * (DNET_MONITOR_HISTORY_SIZE / DNET_MONITOR_STAT_SHARDS), 0)
+, history_pos(0) {
+	memset(cmd_stats.c_array(), 0, sizeof(command_counters) * cmd_stats.size());
+
+	for (int i = 0; i < __DNET_CMD_MAX; ++i)
+		latencies[i] = NULL;
+}
+
+statistics_shard::~statistics_shard() {
+	for (int i = 0; i < __DNET_CMD_MAX; ++i)
+		delete [] latencies[i].load();
+}
+
 statistics::statistics(monitor& mon)
 : m_monitor(mon)
 , m_read_histograms(default_xs(), default_ys())
 , m_write_histograms(default_xs(), default_ys())
 , m_indx_update_histograms(default_xs(), default_ys())
-, m_indx_internal_histograms(default_xs(), default_ys()) {
-	memset(m_cmd_stats.c_array(), 0, sizeof(command_counters) * m_cmd_stats.size());
+, m_indx_internal_histograms(default_xs(), default_ys())
+, m_latencies(2 * __DNET_CMD_MAX)
+, m_need_exit(false) {
+	for (int i = 0; i < DNET_MONITOR_STAT_SHARDS; ++i)
+		m_shards[i].reset(new statistics_shard(m_read_histograms.cache.size()));
+
+	m_flush_thread = std::thread(std::bind(&statistics::flush_loop, this));
+}
+
+statistics_shard &statistics::get_shard() {
+	static std::atomic<int> next_shard(0);
+	static __thread int shard = -1;
+
+	if (shard < 0)
+		shard = next_shard++ % DNET_MONITOR_STAT_SHARDS;
+
+	return *m_shards[shard];
+}
+
+command_histograms *statistics::get_histograms(int cmd, size_t &indx) {
+	switch (cmd) {
+		case DNET_CMD_READ:
+			indx = 0;
+			return &m_read_histograms;
+		case DNET_CMD_WRITE:
+			indx = 4;
+			return &m_write_histograms;
+		case DNET_CMD_INDEXES_UPDATE:
+			indx = 8;
+			return &m_indx_update_histograms;
+		case DNET_CMD_INDEXES_INTERNAL:
+			indx = 12;
+			return &m_indx_internal_histograms;
+		default:
+			return NULL;
+	}
+}
+
+statistics::~statistics() {
+	{
+		std::unique_lock<std::mutex> guard(m_histograms_mutex);
+		m_need_exit = true;
+	}
+
+	m_flush_wait.notify_one();
+	m_flush_thread.join();
+}
+
+void statistics::flush_latencies(statistics_shard &shard) {
+	const time_t now = time(NULL);
+
+	for (int cmd = 0; cmd < __DNET_CMD_MAX; ++cmd) {
+		uint64_t *latencies = shard.latencies[cmd];
+		if (!latencies)
+			continue;
+
+		for (int i = 0; i < 2 * DNET_LATENCY_BUCKETS; ++i) {
+			if (!counter_get(latencies[i]))
+				continue;
+
+			m_latencies[2 * cmd + i / DNET_LATENCY_BUCKETS].add(i % DNET_LATENCY_BUCKETS,
+					__sync_lock_test_and_set(&latencies[i], 0), now);
+		}
+	}
+}
+
+void statistics::flush_histograms(statistics_shard &shard) {
+	static const int cmds[] = { DNET_CMD_READ, DNET_CMD_WRITE, DNET_CMD_INDEXES_UPDATE, DNET_CMD_INDEXES_INTERNAL };
+	const size_t size = m_read_histograms.cache.size();
+
+	for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); ++i) {
+		size_t indx;
+		command_histograms *hist = get_histograms(cmds[i], indx);
+		histogram *kinds[] = { &hist->cache, &hist->cache_internal, &hist->disk, &hist->disk_internal };
+
+		for (size_t k = 0; k < 4; ++k) {
+			uint_fast64_t *cells = &shard.histograms[(indx + k) * size];
+
+			for (size_t c = 0; c < size; ++c) {
+				if (!counter_get(cells[c]))
+					continue;
+
+				kinds[k]->add(c, __sync_lock_test_and_set(&cells[c], 0));
+			}
+		}
+	}
+}
+
+/*
+ * Histograms keep per-second snapshots and latencies are counted in windows,
+ * both are stamped by flush time, so all shards are flushed once a second,
+ * even shards whose threads are idle, otherwise their cells and latencies would
+ * be added to the snapshot or window which is current when the thread is woken up
+ * by the next command
+ */
+void statistics::flush_loop() {
+	std::unique_lock<std::mutex> guard(m_histograms_mutex);
+
+	while (!m_need_exit) {
+		m_flush_wait.wait_for(guard, std::chrono::seconds(1));
+
+		for (int s = 0; s < DNET_MONITOR_STAT_SHARDS; ++s) {
+			flush_histograms(*m_shards[s]);
+			flush_latencies(*m_shards[s]);
+		}
+	}
 }
 
 void statistics::command_counter(int cmd, const int trans, const int err, const int cache,
@@ -41,79 +175,81 @@ void statistics::command_counter(int cmd, const int trans, const int err, const
 	if (cmd >= __DNET_CMD_MAX || cmd <= 0)
 		cmd = DNET_CMD_UNKNOWN;
 
-	std::unique_lock<std::mutex> guard(m_cmd_info_mutex);
+	statistics_shard &shard = get_shard();
+	command_counters &counters = shard.cmd_stats[cmd];
+
 	if (cache) {
 		if (trans) {
 			if (!err)
-				m_cmd_stats[cmd].cache_successes++;
+				counter_add(counters.cache_successes, 1);
 			else
-				m_cmd_stats[cmd].cache_failures++;
-			m_cmd_stats[cmd].cache_size += size;
-			m_cmd_stats[cmd].cache_time += time;
+				counter_add(counters.cache_failures, 1);
+			counter_add(counters.cache_size, size);
+			counter_add(counters.cache_time, time);
 		} else {
 			if (!err)
-				m_cmd_stats[cmd].cache_internal_successes++;
+				counter_add(counters.cache_internal_successes, 1);
 			else
-				m_cmd_stats[cmd].cache_internal_failures++;
-			m_cmd_stats[cmd].cache_internal_size += size;
-			m_cmd_stats[cmd].cache_internal_time += time;
+				counter_add(counters.cache_internal_failures, 1);
+			counter_add(counters.cache_internal_size, size);
+			counter_add(counters.cache_internal_time, time);
 		}
 	} else {
 		if (trans) {
 			if (!err)
-				m_cmd_stats[cmd].disk_successes++;
+				counter_add(counters.disk_successes, 1);
 			else
-				m_cmd_stats[cmd].disk_failures++;
-			m_cmd_stats[cmd].disk_size += size;
-			m_cmd_stats[cmd].disk_time += time;
+				counter_add(counters.disk_failures, 1);
+			counter_add(counters.disk_size, size);
+			counter_add(counters.disk_time, time);
 		} else {
 			if (!err)
-				m_cmd_stats[cmd].disk_internal_successes++;
+				counter_add(counters.disk_internal_successes, 1);
 			else
-				m_cmd_stats[cmd].disk_internal_failures++;
-			m_cmd_stats[cmd].disk_internal_size += size;
-			m_cmd_stats[cmd].disk_internal_time += time;
+				counter_add(counters.disk_internal_failures, 1);
+			counter_add(counters.disk_internal_size, size);
+			counter_add(counters.disk_internal_time, time);
 		}
 	}
 
-	m_cmd_info_current.emplace_back(command_stat_info{cmd, size, time, trans == 0, cache != 0});
+	/*
+	 * History entry words are stored separately, so report may see them
+	 * from different commands when the ring wraps, which is fine for history
+	 */
+	const size_t history_size = shard.history.size() / 2;
+	const size_t pos = __sync_fetch_and_add(&shard.history_pos, 1) % history_size;
+	const uint_fast64_t info = (uint_fast64_t(size) << 32) | (cmd << 2) | ((trans == 0) << 1) | (cache != 0);
 
-	if (m_cmd_info_current.size() >= 50000) {
-		std::unique_lock<std::mutex> swap_guard(m_cmd_info_previous_mutex);
-		m_cmd_info_current.swap(m_cmd_info_previous);
-	}
+	*static_cast<volatile uint_fast64_t *>(&shard.history[2 * pos]) = info;
+	*static_cast<volatile uint_fast64_t *>(&shard.history[2 * pos + 1]) = time;
 
-	std::unique_lock<std::mutex> hist_guard(m_histograms_mutex);
-	command_histograms *hist = NULL;
+	if (trans) {
+		uint64_t *latencies = shard.latencies[cmd];
 
-	switch (cmd) {
-		case DNET_CMD_READ:
-			hist = &m_read_histograms;
-			break;
-		case DNET_CMD_WRITE:
-			hist = &m_write_histograms;
-			break;
-		case DNET_CMD_INDEXES_UPDATE:
-			hist = &m_indx_update_histograms;
-			break;
-		case DNET_CMD_INDEXES_INTERNAL:
-			hist = &m_indx_internal_histograms;
-			break;
-		default:
-			return;
-	}
+		if (!latencies) {
+			uint64_t *allocated = new uint64_t[2 * DNET_LATENCY_BUCKETS]();
 
-	if (cache) {
-		if (trans)
-			hist->cache.update(time, size);
-		else
-			hist->cache_internal.update(time, size);
-	} else {
-		if (trans)
-			hist->disk.update(time, size);
-		else
-			hist->disk_internal.update(time, size);
+			if (shard.latencies[cmd].compare_exchange_strong(latencies, allocated))
+				latencies = allocated;
+			else
+				delete [] allocated;
+		}
+
+		counter_add(latencies[(cache ? 0 : DNET_LATENCY_BUCKETS) + dnet_latency_bucket(time)], 1);
 	}
+
+	size_t indx;
+	command_histograms *hist = get_histograms(cmd, indx);
+	if (!hist)
+		return;
+
+	if (cache)
+		indx += trans ? 0 : 1;
+	else
+		indx += trans ? 2 : 3;
+
+	counter_add(shard.histograms[indx * hist->cache.size() + hist->cache.get_indx(time, size)], 1);
+
 }
 
 void statistics::add_provider(stat_provider *stat, const std::string &name) {
@@ -173,9 +309,33 @@ std::string statistics::report(int category) {
 }
 
 rapidjson::Value& statistics::commands_report(rapidjson::Value &stat_value, rapidjson::Document::AllocatorType &allocator) {
-	std::unique_lock<std::mutex> guard(m_cmd_info_mutex);
+	const size_t words = sizeof(command_counters) / sizeof(uint_fast64_t);
+	const time_t now = time(NULL);
+
+	std::unique_lock<std::mutex> guard(m_histograms_mutex);
+
+	for (int s = 0; s < DNET_MONITOR_STAT_SHARDS; ++s)
+		flush_latencies(*m_shards[s]);
+
 	for (int i = 1; i < __DNET_CMD_MAX; ++i) {
-		auto &cmd_stat = m_cmd_stats[i];
+		command_counters cmd_stat;
+		uint_fast64_t *sum = reinterpret_cast<uint_fast64_t *>(&cmd_stat);
+
+		memset(&cmd_stat, 0, sizeof(command_counters));
+		for (int s = 0; s < DNET_MONITOR_STAT_SHARDS; ++s) {
+			const uint_fast64_t *counters = reinterpret_cast<const uint_fast64_t *>(&m_shards[s]->cmd_stats[i]);
+
+			for (size_t w = 0; w < words; ++w)
+				sum[w] += counter_get(counters[w]);
+		}
+
+		rapidjson::Value cache_latency(rapidjson::kObjectType);
+		rapidjson::Value disk_latency(rapidjson::kObjectType);
+		rapidjson::Value latency(rapidjson::kObjectType);
+
+		latency.AddMember("cache", m_latencies[2 * i].report(cache_latency, allocator, now), allocator)
+		       .AddMember("disk", m_latencies[2 * i + 1].report(disk_latency, allocator, now), allocator);
+
 		stat_value.AddMember(dnet_cmd_string(i),
 		                     rapidjson::Value(rapidjson::kObjectType)
 		                     .AddMember("cache",
@@ -221,6 +381,9 @@ rapidjson::Value& statistics::commands_report(rapidjson::Value &stat_value, rapi
 		                                allocator)
 		                     .AddMember("disk_internal_time",
 		                                cmd_stat.disk_internal_time,
+		                                allocator)
+		                     .AddMember("latency",
+		                                latency,
 		                                allocator),
 		                     allocator);
 	}
@@ -242,22 +405,24 @@ inline rapidjson::Value& history_print(rapidjson::Value &stat_value,
 }
 
 rapidjson::Value& statistics::history_report(rapidjson::Value &stat_value, rapidjson::Document::AllocatorType &allocator) {
-	if (m_cmd_info_previous.empty() && m_cmd_info_current.empty())
-		return stat_value;
+	for (int s = 0; s < DNET_MONITOR_STAT_SHARDS; ++s) {
+		const statistics_shard &shard = *m_shards[s];
+		const uint_fast64_t history_size = shard.history.size() / 2;
+		const uint_fast64_t pos = counter_get(shard.history_pos);
+		const uint_fast64_t begin = pos > history_size ? pos - history_size : 0;
+
+		for (uint_fast64_t i = begin; i < pos; ++i) {
+			const uint_fast64_t info = counter_get(shard.history[2 * (i % history_size)]);
+			command_stat_info cmd_info;
+
+			cmd_info.cmd = (info & 0xffffffff) >> 2;
+			cmd_info.size = info >> 32;
+			cmd_info.time = counter_get(shard.history[2 * (i % history_size) + 1]);
+			cmd_info.internal = info & 2;
+			cmd_info.cache = info & 1;
 
-	{
-		std::unique_lock<std::mutex> guard(m_cmd_info_previous_mutex);
-		const auto begin = m_cmd_info_previous.begin(), end = m_cmd_info_previous.end();
-		for (auto it = begin; it != end; ++it) {
 			rapidjson::Value cmd_value(rapidjson::kObjectType);
-			stat_value.PushBack(history_print(cmd_value, allocator, *it), allocator);
-		}
-	} {
-		std::unique_lock<std::mutex> guard(m_cmd_info_mutex);
-		const auto begin = m_cmd_info_current.begin(), end = m_cmd_info_current.end();
-		for (auto it = begin; it != end; ++it) {
-			rapidjson::Value cmd_value(rapidjson::kObjectType);
-			stat_value.PushBack(history_print(cmd_value, allocator, *it), allocator);
+			stat_value.PushBack(history_print(cmd_value, allocator, cmd_info), allocator);
 		}
 	}
 
@@ -291,6 +456,9 @@ inline rapidjson::Value& command_histograms_print(rapidjson::Value &stat_value,
 rapidjson::Value& statistics::histogram_report(rapidjson::Value &stat_value, rapidjson::Document::AllocatorType &allocator) {
 	std::unique_lock<std::mutex> guard(m_histograms_mutex);
 
+	for (int s = 0; s < DNET_MONITOR_STAT_SHARDS; ++s)
+		flush_histograms(*m_shards[s]);
+
 	rapidjson::Value read_stat(rapidjson::kObjectType);
 	rapidjson::Value write_stat(rapidjson::kObjectType);
 	rapidjson::Value indx_update(rapidjson::kObjectType);
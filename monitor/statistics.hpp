@@ -25,9 +25,13 @@
 #else
 #  include <atomic>
 #endif
+#include <condition_variable>
+#include <ctime>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <thread>
+#include <vector>
 
 #include <boost/array.hpp>
 
@@ -319,6 +323,71 @@ struct command_histograms {
 	histogram	disk_internal;
 };
 
+/*!
+ * \internal
+ *
+ * Number of shards of commands statistics, every thread updates only one of them
+ */
+#define DNET_MONITOR_STAT_SHARDS	32
+
+/*!
+ * \internal
+ *
+ * Number of commands history entries kept by all shards
+ */
+#define DNET_MONITOR_HISTORY_SIZE	100000
+
+/*!
+ * \internal
+ *
+ * Part of commands statistics updated by threads bound to the shard.
+ * Counters are updated by atomic instructions without locks and are merged
+ * by report. Every shard is allocated separately, so threads bound
+ * to different shards do not share cache lines.
+ */
+struct statistics_shard {
+	statistics_shard(size_t histograms_size);
+	~statistics_shard();
+
+	/*!
+	 * \internal
+	 *
+	 * Commands statistics
+	 */
+	boost::array<command_counters, __DNET_CMD_MAX>	cmd_stats;
+
+	/*!
+	 * \internal
+	 *
+	 * Histograms cells not yet added to statistics histograms,
+	 * they are flushed once a second by statistics flush thread
+	 */
+	std::vector<uint_fast64_t>	histograms;
+
+	/*!
+	 * \internal
+	 *
+	 * Ring of commands history, every entry is packed into two words:
+	 * size, command and flags in the first one and time in the second one
+	 */
+	std::vector<uint_fast64_t>	history;
+	/*!
+	 * \internal
+	 *
+	 * Number of commands put into the history ring
+	 */
+	uint_fast64_t			history_pos;
+
+	/*!
+	 * \internal
+	 *
+	 * Latency buckets of commands not yet added to statistics latency histograms:
+	 * cache ones followed by disk ones, allocated by the first command,
+	 * they are flushed once a second by statistics flush thread
+	 */
+	std::atomic<uint64_t *>		latencies[__DNET_CMD_MAX];
+};
+
 /*!
  * \internal
  *
@@ -336,6 +405,13 @@ public:
 	 */
 	statistics(monitor& mon);
 
+	/*!
+	 * \internal
+	 *
+	 * Destructor: stops flush thread
+	 */
+	~statistics();
+
 	/*!
 	 * \internal
 	 *
@@ -370,56 +446,73 @@ private:
 	/*!
 	 * \internal
 	 *
-	 * Fills \a a stat_value by commands statistics and returns it
-	 * \a allocator - document allocator that is required by rapidjson
+	 * Returns shard of the current thread
 	 */
-	rapidjson::Value& commands_report(rapidjson::Value &stat_value,
-	                                  rapidjson::Document::AllocatorType &allocator);
+	statistics_shard &get_shard();
+
 	/*!
 	 * \internal
 	 *
-	 * Fills \a stat_value by commands hisotry statistics and returns it
-	 * \a allocator - document allocator that is required by rapidjson
+	 * Returns histograms of \a cmd or NULL if it has no histograms,
+	 * \a indx is set to the number of its first histogram in shard's buffer
 	 */
-	rapidjson::Value& history_report(rapidjson::Value &stat_value,
-	                                 rapidjson::Document::AllocatorType &allocator);
+	command_histograms *get_histograms(int cmd, size_t &indx);
 
 	/*!
 	 * \internal
 	 *
-	 * Fills \a stat_value by commands histograms statistics and returns it
-	 * \a allocator - document allocator that is required by rapidjson
+	 * Adds histograms cells of \a shard to the histograms,
+	 * must be called with \a m_histograms_mutex held
 	 */
-	rapidjson::Value& histogram_report(rapidjson::Value &stat_value,
-	                                   rapidjson::Document::AllocatorType &allocator);
+	void flush_histograms(statistics_shard &shard);
 
 	/*!
 	 * \internal
 	 *
-	 * Lock for controlling access to commands statistics
+	 * Adds latencies of \a shard to the latency histograms,
+	 * must be called with \a m_histograms_mutex held
 	 */
-	mutable std::mutex				m_cmd_info_mutex;
+	void flush_latencies(statistics_shard &shard);
+
 	/*!
 	 * \internal
 	 *
-	 * Commands statistics
+	 * Flushes histograms cells and latencies of all shards once a second
+	 */
+	void flush_loop();
+
+	/*!
+	 * \internal
+	 *
+	 * Fills \a a stat_value by commands statistics and returns it
+	 * \a allocator - document allocator that is required by rapidjson
+	 */
+	rapidjson::Value& commands_report(rapidjson::Value &stat_value,
+	                                  rapidjson::Document::AllocatorType &allocator);
+	/*!
+	 * \internal
+	 *
+	 * Fills \a stat_value by commands hisotry statistics and returns it
+	 * \a allocator - document allocator that is required by rapidjson
 	 */
-	boost::array<command_counters, __DNET_CMD_MAX> m_cmd_stats;
+	rapidjson::Value& history_report(rapidjson::Value &stat_value,
+	                                 rapidjson::Document::AllocatorType &allocator);
 
 	/*!
 	 * \internal
 	 *
-	 * Commands history statistics which is filling now and will be swapped
-	 * with \a m_cmd_info_previous and wil be emptied
+	 * Fills \a stat_value by commands histograms statistics and returns it
+	 * \a allocator - document allocator that is required by rapidjson
 	 */
-	std::vector<command_stat_info>	m_cmd_info_current;
+	rapidjson::Value& histogram_report(rapidjson::Value &stat_value,
+	                                   rapidjson::Document::AllocatorType &allocator);
+
 	/*!
 	 * \internal
 	 *
-	 * Lock for controlling access to \a m_cmd_info_previous
+	 * Shards of commands statistics, history and histograms
 	 */
-	mutable std::mutex				m_cmd_info_previous_mutex;
-	std::vector<command_stat_info>	m_cmd_info_previous;
+	std::unique_ptr<statistics_shard>	m_shards[DNET_MONITOR_STAT_SHARDS];
 
 	/*!
 	 * \internal
@@ -431,7 +524,8 @@ private:
 	/*!
 	 * \internal
 	 *
-	 * Lock for controlling access to histograms
+	 * Lock for controlling access to histograms and latency histograms,
+	 * it is never taken by commands
 	 */
 	mutable std::mutex				m_histograms_mutex;
 	/*!
@@ -459,6 +553,24 @@ private:
 	 */
 	command_histograms				m_indx_internal_histograms;
 
+	/*!
+	 * \internal
+	 *
+	 * Latency histograms of commands sent by clients:
+	 * two for every command, executed in cache and on disk
+	 */
+	std::vector<latency_histogram>	m_latencies;
+
+	/*!
+	 * \internal
+	 *
+	 * Thread which flushes shards, it waits on \a m_flush_wait
+	 * with \a m_histograms_mutex and exits when \a m_need_exit is set
+	 */
+	std::thread						m_flush_thread;
+	std::condition_variable			m_flush_wait;
+	bool							m_need_exit;
+
 	/*!
 	 * \internal
 	 *
@@ -211,10 +211,48 @@ class Iterator(object):
     Wrapper on top of elliptics new iterator and it's result container
     """
 
+    # How many times interrupted iteration is resumed from the last received checkpoint
+    RESUME_ATTEMPTS = 3
+
     def __init__(self, node, group):
         self.session = elliptics.Session(node)
         self.session.groups = [group]
 
+    def _iterate(self, eid, ranges, itype, flags, timestamp_range):
+        """
+        Yields iterated records. If iteration is interrupted it is resumed
+        from position of the last received record, so some records may be yielded twice.
+        """
+        position = None
+        attempt = 0
+        while True:
+            if position is None:
+                records = self.session.start_iterator(eid, ranges, itype, flags,
+                                                      timestamp_range[0], timestamp_range[1])
+            else:
+                records = self.session.resume_iterator(eid, ranges, itype, flags,
+                                                       timestamp_range[0], timestamp_range[1],
+                                                       elliptics.IteratorFilter(), position)
+            try:
+                for record in records:
+                    if record.status != 0:
+                        raise RuntimeError("Iteration status check failed: {0}".format(record.status))
+                    position = record.response.position
+                    yield record
+                break
+            except Exception as e:
+                attempt += 1
+                if attempt > self.RESUME_ATTEMPTS:
+                    raise
+                if position is None:
+                    self.log.warning("Iteration failed: {0}, restarting".format(e))
+                else:
+                    self.log.warning("Iteration interrupted: {0}, resuming from position: {1}:{2}"
+                                     .format(e, position.blob, position.offset))
+
+        elapsed_time = records.elapsed_time()
+        self.log.debug("Time spended for iterator: {0}/{1}".format(elapsed_time.tsec, elapsed_time.tnsec))
+
     def start(self,
               eid=IdRange.ID_MIN,
               itype=elliptics.iterator_types.network,
@@ -224,7 +262,8 @@ class Iterator(object):
               tmp_dir='/var/tmp',
               address=None,
               leave_file=False,
-              batch_size=1024
+              batch_size=1024,
+              journal=False
               ):
         assert itype == elliptics.iterator_types.network, "Only network iterator is supported for now"
         assert flags & elliptics.iterator_flags.data == 0, "Only metadata iterator is supported for now"
@@ -238,20 +277,26 @@ class Iterator(object):
                                                   )
 
             ranges = [IdRange.elliptics_range(start, stop) for start, stop in key_ranges]
-            records = self.session.start_iterator(eid, ranges, itype, flags, timestamp_range[0], timestamp_range[1])
+            if journal:
+                # Journal contains only changes made since timestamp_range[0],
+                # removals are skipped since recovery does not propagate them
+                records = self.session.start_journal_iterator(eid, ranges, flags, 0,
+                                                              timestamp_range[0], timestamp_range[1])
+            else:
+                records = self._iterate(eid, ranges, itype, flags, timestamp_range)
             last = 0
 
-            for num, record in enumerate(records):
+            for record in records:
                 # TODO: Here we can add throttling
                 if record.status != 0:
                     raise RuntimeError("Iteration status check failed: {0}".format(record.status))
+                if journal and record.response.removed:
+                    continue
                 result.append(record)
-                last = num + 1
+                last += 1
                 if last % batch_size == 0:
                     yield batch_size
 
-            elapsed_time = records.elapsed_time()
-            self.log.debug("Time spended for iterator: {0}/{1}".format(elapsed_time.tsec, elapsed_time.tnsec))
             yield last % batch_size
             yield result
         except Exception as e:
@@ -259,14 +304,16 @@ class Iterator(object):
             yield None
 
     @classmethod
-    def iterate_with_stats(cls, node, eid, timestamp_range, key_ranges, tmp_dir, address, batch_size, stats, counters, leave_file=False):
+    def iterate_with_stats(cls, node, eid, timestamp_range, key_ranges, tmp_dir, address, batch_size, stats, counters,
+                           leave_file=False, journal=False):
         result = cls(node, address.group_id).start(eid=eid,
                                                    timestamp_range=timestamp_range,
                                                    key_ranges=key_ranges,
                                                    tmp_dir=tmp_dir,
                                                    address=address,
                                                    batch_size=batch_size,
-                                                   leave_file=leave_file
+                                                   leave_file=leave_file,
+                                                   journal=journal
                                                    )
         result_len = 0
         for it in result:
@@ -0,0 +1,127 @@
+# =============================================================================
+# 2013+ Copyright (c) Kirill Smorodinnikov <shaitkir@gmail.com>
+# All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+# =============================================================================
+
+"""
+Range hashes routines
+
+Node splits key space into cells by the first `depth` bits of the key and
+returns number of keys and hash of keys with their timestamps for every cell.
+Cells with equal hashes on different nodes contain the same keys,
+so only ranges covered by the differing cells should be iterated.
+"""
+
+import logging
+
+from .range import IdRange
+
+import sys
+sys.path.insert(0, "bindings/python/") # XXX
+import elliptics
+
+log = logging.getLogger(__name__)
+
+# Depths used for descending: coarse cells are compared first,
+# only differing ones are requested with the finer depth
+DEPTHS = (8, 16)
+DEPTH_MAX = 16
+
+
+def cell_range(prefix, depth):
+    """
+    Returns IdRange covering all keys which first @depth bits are @prefix
+    """
+    start = prefix << (DEPTH_MAX - depth)
+    stop = start + (1 << (DEPTH_MAX - depth))
+
+    start_id = elliptics.Id([start >> 8, start & 255] + [0] * 62, 0)
+    if stop > (1 << DEPTH_MAX) - 1:
+        stop_id = IdRange.ID_MAX
+    else:
+        stop_id = elliptics.Id([stop >> 8, stop & 255] + [0] * 62, 0)
+    return IdRange(start_id, stop_id)
+
+
+def merge_ranges(ranges):
+    """
+    Sorts list of IdRange and merges overlapping and adjacent ones
+    """
+    result = []
+    for r in sorted(ranges, key=lambda r: r.start):
+        if result and result[-1].stop >= r.start:
+            result[-1] = IdRange(result[-1].start, max(result[-1].stop, r.stop))
+        else:
+            result.append(r)
+    return result
+
+
+def cells_ranges(prefixes, depth):
+    """
+    Converts list of cell prefixes into list of IdRange
+    """
+    return merge_ranges(cell_range(prefix, depth) for prefix in prefixes)
+
+
+def intersect(ranges, other):
+    """
+    Returns intersection of two lists of IdRange
+    """
+    result = []
+    for a in ranges:
+        for b in other:
+            start = max(a.start, b.start)
+            stop = min(a.stop, b.stop)
+            if start < stop:
+                result.append(IdRange(start, stop))
+    return result
+
+
+def range_hash(session, eid, ranges, depth):
+    """
+    Requests cells hashes for @ranges from the node responsible for @eid.
+    Returns dict prefix -> (count, hash)
+    """
+    eranges = [IdRange.elliptics_range(start, stop) for start, stop in ranges]
+    return dict((prefix, (count, hash_))
+                for prefix, count, hash_ in session.range_hash(eid, eranges, depth))
+
+
+def diverged_cells(local, remote, local_eid, remote_eid, ranges):
+    """
+    Descends through DEPTHS comparing cells of @local and @remote sessions.
+    Returns list of IdRange (intersected with @ranges) where nodes differ.
+    """
+    for depth in DEPTHS:
+        local_hashes = range_hash(local, local_eid, ranges, depth)
+        remote_hashes = range_hash(remote, remote_eid, ranges, depth)
+
+        prefixes = [prefix for prefix, value in remote_hashes.iteritems()
+                    if value[0] and local_hashes.get(prefix) != value]
+
+        log.debug("Depth: {0}: cells: {1}, diverged: {2}"
+                  .format(depth, len(remote_hashes), len(prefixes)))
+
+        ranges = intersect(ranges, cells_ranges(prefixes, depth))
+        if not ranges:
+            break
+    return ranges
+
+
+def non_empty_cells(session, eid, ranges):
+    """
+    Returns list of IdRange (intersected with @ranges) which contain keys on the node
+    """
+    hashes = range_hash(session, eid, ranges, DEPTH_MAX)
+    prefixes = [prefix for prefix, value in hashes.iteritems() if value[0]]
+    return intersect(ranges, cells_ranges(prefixes, DEPTH_MAX))
@@ -18,14 +18,16 @@
 Data Center recovery type - recovers keys at the expense of keys from other group.
 
  * Find ranges that host is responsible for now.
- * Start metadata-only iterator for the found ranges on local and remote hosts (from non-local groups).
+ * Compare range hashes of local and remote hosts (from non-local groups) and keep only ranges where they differ.
+ * Start metadata-only iterator for the remaining ranges on local and remote hosts.
  * Sort iterators' outputs.
  * Computes diff between local and remote iterator.
- * Recover keys provided by diff using bulk APIs.
+ * Recover keys provided by diff: remote node copies them to the local group itself.
 """
 
 import sys
 import os
+import errno
 import logging
 
 from itertools import groupby
@@ -33,6 +35,7 @@ from multiprocessing import Pool
 
 from ..iterator import Iterator, IteratorResult
 from ..etime import Time
+from ..range_hash import diverged_cells, intersect, merge_ranges
 from ..utils.misc import elliptics_create_node, elliptics_create_session, worker_init, mk_container_name
 
 # XXX: change me before BETA
@@ -42,9 +45,10 @@ import elliptics
 log = logging.getLogger(__name__)
 
 
-def run_iterator(ctx, address, eid, ranges, stats):
+def run_iterator(ctx, address, eid, ranges, stats, journal=False):
     """
-    Runs iterator for all ranges on node specified by address
+    Runs iterator for all ranges on node specified by address.
+    If @journal is set only changes made since ctx.timestamp are taken from the node's change journal.
     """
     node = elliptics_create_node(address=address, elog=ctx.elog, wait_timeout=ctx.wait_timeout)
 
@@ -61,18 +65,22 @@ def run_iterator(ctx, address, eid, ranges, stats):
                                                          batch_size=ctx.batch_size,
                                                          stats=stats,
                                                          counters=['iterated_keys'],
-                                                         leave_file=True
+                                                         leave_file=True,
+                                                         journal=journal
                                                          )
 
         if result is None:
             raise RuntimeError("Iterator result is None")
         log.debug("Iterator {0} obtained: {1} record(s)".format(result.address, result_len))
-        stats.counter('iterations', 1)
+        stats.counter('journal' if journal else 'iterations', 1)
         return result
 
     except Exception as e:
-        log.error("Iteration failed for: {0}: {1}".format(address, repr(e)))
-        stats.counter('iterations', -1)
+        if journal:
+            log.info("Journal iteration failed for: {0}: {1}".format(address, repr(e)))
+        else:
+            log.error("Iteration failed for: {0}: {1}".format(address, repr(e)))
+        stats.counter('journal' if journal else 'iterations', -1)
         return None
 
 
@@ -181,6 +189,48 @@ def recover((address, )):
 
 
 def recover_keys(ctx, address, group_id, keys, local_session, remote_session, stats):
+    """
+    Asks remote node to copy keys to the local group directly.
+    Falls back to bulk read and write through this process if remote node can't do it.
+    """
+    keys_len = len(keys)
+
+    log.debug("Copying {0} keys from {1} to group {2}".format(keys_len, address, ctx.group_id))
+
+    try:
+        statuses = remote_session.copy(keys[0], keys, [ctx.group_id],
+                                       elliptics.copy_flags.newer)
+    except Exception as e:
+        log.warning("Server-side copy failed: {0} keys: {1}, falling back to bulk read"
+                    .format(keys_len, e))
+        return recover_keys_bulk(ctx, address, group_id, keys, local_session, remote_session, stats)
+
+    successes, successes_size, skipped, failed = (0, 0, 0, 0)
+    for eid, group, status, size in statuses:
+        if status == 0:
+            successes += 1
+            successes_size += size
+        elif status in (-errno.EALREADY, -errno.ENOENT):
+            # Local record is the same or newer or remote one has gone
+            skipped += 1
+        else:
+            log.error("Copy of {0} to group {1} failed: {2}".format(eid, group, status))
+            failed += 1
+
+    log.debug("Recovered batch: {0}/{1} of size: {2}, skipped: {3}"
+              .format(successes + failed, keys_len, successes_size, skipped))
+
+    stats.counter('read_keys', successes)
+    stats.counter('read_keys', -failed)
+    stats.counter('skipped_keys', skipped)
+    stats.counter('recovered_keys', successes)
+    stats.counter('recovered_keys', -failed)
+    stats.counter('recovered_bytes', successes_size)
+
+    return failed == 0
+
+
+def recover_keys_bulk(ctx, address, group_id, keys, local_session, remote_session, stats):
     """
     Bulk recovery of keys.
     """
@@ -258,14 +308,31 @@ def iterate_node(address_ranges):
     stats = ctx.monitor.stats[stats_name]
     stats.timer('process', 'started')
 
-    log.info("Running iterator")
-    stats.timer('process', 'iterate')
-    result = run_iterator(ctx=ctx,
-                          address=address_ranges.address,
-                          eid=address_ranges.eid,
-                          ranges=address_ranges.id_ranges,
-                          stats=stats
-                          )
+    result = None
+    journal = use_journal(ctx) and address_ranges.address != ctx.address
+    if journal:
+        log.info("Running journal iterator")
+        stats.timer('process', 'journal')
+        result = run_iterator(ctx=ctx,
+                              address=address_ranges.address,
+                              eid=address_ranges.eid,
+                              ranges=address_ranges.id_ranges,
+                              stats=stats,
+                              journal=True
+                              )
+        # Journal does not cover ctx.timestamp or is disabled on the node
+        if result is None:
+            journal = False
+
+    if result is None:
+        log.info("Running iterator")
+        stats.timer('process', 'iterate')
+        result = run_iterator(ctx=ctx,
+                              address=address_ranges.address,
+                              eid=address_ranges.eid,
+                              ranges=address_ranges.id_ranges,
+                              stats=stats
+                              )
     if result is None or len(result) == 0:
         log.warning("Iterator result is empty, skipping")
         stats.timer('process', 'finished')
@@ -285,7 +352,54 @@ def iterate_node(address_ranges):
         return None
 
     stats.timer('process', 'finished')
-    return (sorted_result.address, sorted_result.filename)
+    return (sorted_result.address, sorted_result.filename, journal)
+
+
+def use_journal(ctx):
+    """
+    Journal keeps only recent changes, so it is worth trying only when
+    recovery is limited by timestamp, e.g. after short outage
+    """
+    return ctx.timestamp.to_etime().tsec != 0
+
+
+def narrow_ranges(local_ranges, remote_ranges):
+    """
+    Compares range hashes of local and every remote node and leaves only ranges where they differ.
+    Falls back to the full ranges of the remote node if its hashes can't be obtained.
+    """
+    ctx = g_ctx
+    stats = ctx.monitor.stats['range_hash']
+    stats.timer('process', 'started')
+
+    local_node = elliptics_create_node(address=ctx.address, elog=ctx.elog, wait_timeout=ctx.wait_timeout)
+    local_session = elliptics_create_session(node=local_node, group=ctx.address.group_id)
+
+    local_result, remote_result = [], []
+    for remote in remote_ranges:
+        try:
+            remote_node = elliptics_create_node(address=remote.address, elog=ctx.elog, wait_timeout=ctx.wait_timeout)
+            remote_session = elliptics_create_session(node=remote_node, group=remote.address.group_id)
+            id_ranges = diverged_cells(local=local_session,
+                                       remote=remote_session,
+                                       local_eid=local_ranges.eid,
+                                       remote_eid=remote.eid,
+                                       ranges=remote.id_ranges)
+            stats.counter('range_hash', 1)
+        except Exception as e:
+            log.error("Range hash failed for: {0}: {1}, iterating full ranges".format(remote.address, repr(e)))
+            stats.counter('range_hash', -1)
+            id_ranges = remote.id_ranges
+
+        log.info("Node {0}: {1} diverged range(s)".format(remote.address, len(id_ranges)))
+        if not id_ranges:
+            continue
+
+        remote_result.append(remote._replace(id_ranges=id_ranges))
+        local_result.extend(intersect(local_ranges.id_ranges, id_ranges))
+
+    stats.timer('process', 'finished')
+    return local_ranges._replace(id_ranges=merge_ranges(local_result)), remote_result
 
 
 def process_diff((local, remote)):
@@ -295,7 +409,7 @@ def process_diff((local, remote)):
         return None
 
     ctx = g_ctx
-    remote_address, remote_filename = remote
+    remote_address, remote_filename, remote_journal = remote
 
     stats_name = 'diff_remote_{0}'.format(remote_address)
     stats = ctx.monitor.stats[stats_name]
@@ -304,9 +418,15 @@ def process_diff((local, remote)):
     if local is None:
         log.info("Local container is empty, recovering full range")
         stats.timer('process', 'finished')
-        return remote
+        return (remote_address, remote_filename)
 
-    local_address, local_filename = local
+    if remote_journal:
+        # Journal contains only changes, copy with newer flag skips keys which are up to date locally
+        log.info("Remote result is taken from journal, skipping diff")
+        stats.timer('process', 'finished')
+        return (remote_address, remote_filename)
+
+    local_address, local_filename, _ = local
 
     log.debug("Loading local result")
     local_result = None
@@ -358,23 +478,43 @@ def main(ctx):
 
     log.debug("Processing nodes: {0}".format([str(r.address) for r in all_ranges]))
 
-    processes = min(g_ctx.nprocess, len(all_ranges))
+    local_ranges = next((r for r in all_ranges if r.address == g_ctx.address), None)
+    assert local_ranges, 'Local ranges is absent in route table'
+    remote_ranges = [range for range in all_ranges
+                     if range.address != g_ctx.address and
+                        range.address.group_id in g_ctx.groups]
+
+    log.warning("Comparing range hashes")
+    g_ctx.monitor.stats.timer('main', 'range_hash')
+    local_ranges, remote_ranges = narrow_ranges(local_ranges, remote_ranges)
+    if not remote_ranges:
+        log.warning("Local node has up-to-date data")
+        g_ctx.monitor.stats.timer('main', 'finished')
+        return result
+    g_ctx.monitor.stats.timer('main', 'iterate')
+
+    processes = min(g_ctx.nprocess, len(remote_ranges) + 1)
     log.info("Creating pool of processes: {0}".format(processes))
     pool = Pool(processes=processes, initializer=worker_init)
 
-    local_ranges = next((r for r in all_ranges if r.address == g_ctx.address), None)
-    assert local_ranges, 'Local ranges is absent in route table'
-    ctx.monitor.stats.counter('iterations', len(all_ranges))
+    ctx.monitor.stats.counter('iterations', len(remote_ranges) + 1)
 
-    local_iter_result = pool.apply_async(iterate_node, (local_ranges, ))
-    remote_ranges = (range for range in all_ranges
-                     if range.address != g_ctx.address and
-                        range.address.group_id in g_ctx.groups)
+    # If all remote nodes answer from their journals, local iteration is not needed at all
+    journal = use_journal(g_ctx)
+    local_iter_result = None
+    if not journal:
+        local_iter_result = pool.apply_async(iterate_node, (local_ranges, ))
     iter_result = pool.imap_unordered(iterate_node, remote_ranges)
 
     try:
         timeout = 2147483647
-        local_it_result = local_iter_result.get(timeout)
+        if journal:
+            iter_result = list(iter_result)
+            if any(r and not r[2] for r in iter_result):
+                local_iter_result = pool.apply_async(iterate_node, (local_ranges, ))
+        local_it_result = None
+        if local_iter_result:
+            local_it_result = local_iter_result.get(timeout)
         diff_async_results = pool.imap_unordered(process_diff, ((local_it_result, result) for result in iter_result if result))
 
     except KeyboardInterrupt:
@@ -23,6 +23,8 @@ by placing them to the node where they belong.
  * If the key on the proper node is missed or older
  * then moved it form the node to ther proper node
  * If the key is valid then just remove it from the node.
+ * Keys are copied by the node itself in batches,
+ * only keys it failed to copy are read and written through recovery process.
 """
 
 import sys
@@ -36,6 +38,7 @@ from ..utils.misc import elliptics_create_node, worker_init
 from ..route import RouteList
 from ..iterator import Iterator
 from ..range import IdRange
+from ..range_hash import non_empty_cells
 
 import errno
 
@@ -424,6 +427,76 @@ def iterate_node(ctx, node, address, ranges, eid, stats):
         return None
 
 
+def copy_batch(ctx, address, group, node, responses, rs):
+    """
+    Asks the node to copy batch of keys to the proper nodes itself
+    and removes copied keys from it.
+    Returns list of responses which should be recovered through this process.
+    """
+    session = elliptics.Session(node)
+    session.set_direct_id(*address)
+    session.groups = [group]
+
+    try:
+        statuses = session.copy(responses[0].key, [r.key for r in responses], [group],
+                                elliptics.copy_flags.newer)
+    except Exception as e:
+        log.warning("Server-side copy failed for node: {0}: {1}, recovering keys one by one"
+                    .format(address, e))
+        return responses
+
+    if len(statuses) != len(responses):
+        log.warning("Server-side copy returned {0} statuses for {1} keys, recovering keys one by one"
+                    .format(len(statuses), len(responses)))
+        return responses
+
+    rest = []
+    removes = []
+    for response, (eid, _, status, size) in zip(responses, statuses):
+        if status == 0:
+            rs.read += 1
+            rs.read_bytes += size
+            rs.write += 1
+            rs.written_bytes += size
+            removes.append((response, size, False))
+        elif status == -errno.EALREADY:
+            log.debug("Key: {0} on the proper node is not older. Just removing it from node: {1}."
+                      .format(repr(response.key), address))
+            removes.append((response, response.size, True))
+        elif status in (-errno.ENOENT, -errno.ELOOP):
+            rs.skipped += 1
+        else:
+            log.debug("Server-side copy of key: {0} from node: {1} failed: {2}"
+                      .format(repr(response.key), address, status))
+            rest.append(response)
+
+    if ctx.safe:
+        return rest
+
+    results = [session.remove(response.key) for response, _, _ in removes]
+    for r, (response, size, just_remove) in zip(results, removes):
+        try:
+            r.wait()
+            removed = r.successful()
+        except Exception as e:
+            log.error("Key: {0} hasn't been removed from node: {1}: {2}"
+                      .format(repr(response.key), address, e))
+            removed = False
+
+        if just_remove and removed:
+            rs.remove_old += 1
+            rs.remove_old_bytes += size
+        elif just_remove:
+            rs.remove_old_failed += 1
+        elif removed:
+            rs.remove += 1
+            rs.removed_bytes += size
+        else:
+            rs.remove_failed += 1
+
+    return rest
+
+
 def recover(ctx, address, group, node, results, stats):
     if results is None or len(results) < 1:
         log.warning("Recover skipped iterator results are empty for node: {0}"
@@ -434,7 +507,11 @@ def recover(ctx, address, group, node, results, stats):
     for batch_id, batch in groupby(enumerate(results), key=lambda x: x[0] / ctx.batch_size):
         recovers = []
         rs = RecoverStat()
-        for _, response in batch:
+        batch = [response for _, response in batch]
+        # Node moves keys itself, only keys it failed to copy go through this process
+        if not ctx.dry_run:
+            batch = copy_batch(ctx, address, group, node, batch, rs)
+        for response in batch:
             rec = Recovery(ctx, response, address, group, node)
             rec.run()
             recovers.append(rec)
@@ -456,13 +533,29 @@ def process_node(address, group, ranges):
                                  elog=ctx.elog,
                                  wait_timeout=ctx.wait_timeout)
     s = elliptics.Session(node)
+    s.groups = [group]
+    eid = s.routes.get_address_eid(address)
+
+    # Foreign ranges are usually empty, so iterate only cells which have keys
+    stats.timer('process', 'range_hash')
+    try:
+        ranges = [tuple(r) for r in non_empty_cells(s, eid, [IdRange(r[0], r[1]) for r in ranges])]
+        stats.counter('range_hash', 1)
+    except Exception as e:
+        log.error("Range hash failed for: {0}: {1}, iterating full ranges".format(address, repr(e)))
+        stats.counter('range_hash', -1)
+
+    if not ranges:
+        log.info("Node {0} has no keys in foreign ranges, skipping".format(address))
+        stats.timer('process', 'finished')
+        return True
 
     stats.timer('process', 'iterate')
     results = iterate_node(ctx=ctx,
                            node=node,
                            address=address,
                            ranges=ranges,
-                           eid=s.routes.get_address_eid(address),
+                           eid=eid,
                            stats=stats)
     if results is None or len(results) == 0:
         log.warning('Iterator result is empty, skipping')
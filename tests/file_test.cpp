@@ -0,0 +1,165 @@
+/*
+ * 2008+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#include "test_base.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#define BOOST_TEST_NO_MAIN
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/program_options.hpp>
+
+using namespace ioremap::elliptics;
+using namespace boost::unit_test;
+
+namespace tests {
+
+static std::shared_ptr<nodes_data> global_data;
+
+static void configure_nodes(const std::vector<std::string> &remotes, const std::string &path)
+{
+#ifndef NO_SERVER
+	if (remotes.empty()) {
+		global_data = start_nodes(results_reporter::get_stream(), std::vector<server_config>({
+			server_config::default_file_value().apply_options(config_data()
+				("group", 1)
+			)
+		}), path);
+	} else
+#endif // NO_SERVER
+		global_data = start_nodes(results_reporter::get_stream(), remotes, path);
+}
+
+static void test_write_read(session &sess)
+{
+	const std::string key = "file-write-read-test";
+
+	ELLIPTICS_REQUIRE(write_result, sess.write_data(key, "55555", 0));
+	ELLIPTICS_REQUIRE(partial_write_result, sess.write_data(key, "43210", 1));
+
+	ELLIPTICS_REQUIRE(read_result, sess.read_data(key, 0, 0));
+	BOOST_REQUIRE_EQUAL(read_result.get_one().file().to_string(), "543210");
+
+	// Write at zero offset replaces whole file
+	ELLIPTICS_REQUIRE(overwrite_result, sess.write_data(key, "new", 0));
+	ELLIPTICS_REQUIRE(second_read_result, sess.read_data(key, 0, 0));
+	BOOST_REQUIRE_EQUAL(second_read_result.get_one().file().to_string(), "new");
+}
+
+/*
+ * Appends are sent without waiting for each other, so server handles them
+ * in several IO threads on the same cached descriptor. Every acknowledged
+ * part has to be present in the file exactly once.
+ */
+static void test_concurrent_append(session &sess, int count)
+{
+	const std::string key = "file-concurrent-append-test";
+	const size_t part_size = 16;
+
+	ELLIPTICS_REQUIRE(write_result, sess.write_data(key, "", 0));
+
+	session sa = sess.clone();
+	sa.set_ioflags(sa.get_ioflags() | DNET_IO_FLAGS_APPEND);
+
+	std::vector<std::string> parts;
+	std::vector<async_write_result> results;
+
+	for (int i = 0; i < count; ++i) {
+		std::ostringstream str;
+		str << "part_" << std::setw(part_size - 6) << std::setfill('0') << i << "|";
+		parts.push_back(str.str());
+
+		results.emplace_back(sa.write_data(key, parts.back(), 0));
+	}
+
+	for (auto it = results.begin(); it != results.end(); ++it) {
+		it->wait();
+		BOOST_REQUIRE_EQUAL(it->error().code(), 0);
+	}
+
+	ELLIPTICS_REQUIRE(read_result, sess.read_data(key, 0, 0));
+	const std::string data = read_result.get_one().file().to_string();
+	BOOST_REQUIRE_EQUAL(data.size(), count * part_size);
+
+	std::vector<std::string> read_parts;
+	for (size_t offset = 0; offset < data.size(); offset += part_size)
+		read_parts.push_back(data.substr(offset, part_size));
+
+	std::sort(parts.begin(), parts.end());
+	std::sort(read_parts.begin(), read_parts.end());
+	BOOST_REQUIRE(parts == read_parts);
+}
+
+bool register_tests(test_suite *suite, node n)
+{
+	ELLIPTICS_TEST_CASE(test_write_read, create_session(n, {1}, 0, 0));
+	ELLIPTICS_TEST_CASE(test_concurrent_append, create_session(n, {1}, 0, 0), 1000);
+
+	return true;
+}
+
+static void destroy_global_data()
+{
+	global_data.reset();
+}
+
+boost::unit_test::test_suite *register_tests(int argc, char *argv[])
+{
+	namespace bpo = boost::program_options;
+
+	bpo::variables_map vm;
+	bpo::options_description generic("Test options");
+
+	std::vector<std::string> remotes;
+	std::string path;
+
+	generic.add_options()
+		("help", "This help message")
+		("remote", bpo::value(&remotes), "Remote elliptics server address")
+		("path", bpo::value(&path), "Path where to store everything")
+		 ;
+
+	bpo::store(bpo::parse_command_line(argc, argv, generic), vm);
+	bpo::notify(vm);
+
+#ifndef NO_SERVER
+	if (vm.count("help")) {
+#else
+	if (vm.count("help") || remotes.empty()) {
+#endif
+		std::cerr << generic;
+		return NULL;
+	}
+
+	test_suite *suite = new test_suite("Local Test Suite");
+
+	configure_nodes(remotes, path);
+
+	register_tests(suite, *global_data->node);
+
+	return suite;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	srand(time(0));
+	atexit(tests::destroy_global_data);
+	return unit_test_main(tests::register_tests, argc, argv);
+}
@@ -0,0 +1,228 @@
+/*
+ * 2008+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#include "test_base.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+#define BOOST_TEST_NO_MAIN
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/program_options.hpp>
+
+using namespace ioremap::elliptics;
+using namespace boost::unit_test;
+
+namespace tests {
+
+static std::shared_ptr<nodes_data> global_data;
+
+static void configure_nodes(const std::vector<std::string> &remotes, const std::string &path)
+{
+#ifndef NO_SERVER
+	if (remotes.empty()) {
+		global_data = start_nodes(results_reporter::get_stream(), std::vector<server_config>({
+			server_config::default_ram_value().apply_options(config_data()
+				("group", 1)
+			)
+		}), path);
+	} else
+#endif // NO_SERVER
+		global_data = start_nodes(results_reporter::get_stream(), remotes, path);
+}
+
+static void test_write_read(session &sess)
+{
+	const std::string key = "ram-write-read-test";
+
+	ELLIPTICS_REQUIRE(write_result, sess.write_data(key, "55555", 0));
+	ELLIPTICS_REQUIRE(partial_write_result, sess.write_data(key, "43210", 1));
+
+	ELLIPTICS_REQUIRE(read_result, sess.read_data(key, 0, 0));
+	BOOST_REQUIRE_EQUAL(read_result.get_one().file().to_string(), "543210");
+
+	ELLIPTICS_REQUIRE(offset_read_result, sess.read_data(key, 2, 1));
+	BOOST_REQUIRE_EQUAL(offset_read_result.get_one().file().to_string(), "3");
+
+	// Write at zero offset replaces whole record
+	ELLIPTICS_REQUIRE(overwrite_result, sess.write_data(key, "new", 0));
+	ELLIPTICS_REQUIRE(second_read_result, sess.read_data(key, 0, 0));
+	BOOST_REQUIRE_EQUAL(second_read_result.get_one().file().to_string(), "new");
+
+	ELLIPTICS_REQUIRE_ERROR(big_offset_result, sess.read_data(key, 100, 0), -E2BIG);
+}
+
+static void test_append(session &sess)
+{
+	const std::string key = "ram-append-test";
+	std::string full;
+
+	session sa = sess.clone();
+	sa.set_ioflags(sa.get_ioflags() | DNET_IO_FLAGS_APPEND);
+
+	for (int i = 0; i < 100; ++i) {
+		std::ostringstream str;
+		str << "test_" << i << ", ";
+		full += str.str();
+
+		ELLIPTICS_REQUIRE(append_result, sa.write_data(key, str.str(), 0));
+	}
+
+	ELLIPTICS_REQUIRE(read_result, sess.read_data(key, 0, 0));
+	BOOST_REQUIRE_EQUAL(read_result.get_one().file().to_string(), full);
+}
+
+static void test_prepare_commit(session &sess)
+{
+	const std::string key = "ram-prepare-commit-test";
+	const std::string prepare_data = "prepare|", plain_data = "plain|", commit_data = "commit";
+
+	ELLIPTICS_REQUIRE(prepare_result, sess.write_prepare(key, prepare_data, 0, 1024));
+	ELLIPTICS_REQUIRE(plain_result, sess.write_plain(key, plain_data, prepare_data.size()));
+
+	const std::string written = prepare_data + plain_data + commit_data;
+	ELLIPTICS_REQUIRE(commit_result, sess.write_commit(key, commit_data,
+				prepare_data.size() + plain_data.size(), written.size()));
+
+	ELLIPTICS_REQUIRE(read_result, sess.read_data(key, 0, 0));
+	BOOST_REQUIRE_EQUAL(read_result.get_one().file().to_string(), written);
+}
+
+static void test_lookup_remove(session &sess)
+{
+	const std::string key = "ram-lookup-remove-test";
+	const std::string data = "lookup data";
+
+	ELLIPTICS_REQUIRE(write_result, sess.write_data(key, data, 0));
+
+	ELLIPTICS_REQUIRE(lookup_result, sess.lookup(key));
+	BOOST_REQUIRE_EQUAL(lookup_result.get_one().file_info()->size, data.size());
+
+	ELLIPTICS_REQUIRE(remove_result, sess.remove(key));
+	ELLIPTICS_REQUIRE_ERROR(read_result, sess.read_data(key, 0, 0), -ENOENT);
+	ELLIPTICS_REQUIRE_ERROR(second_lookup_result, sess.lookup(key), -ENOENT);
+}
+
+static void test_range(session &sess, int limit_start, int limit_num)
+{
+	const size_t item_count = 16;
+	const size_t number_index = 5;
+
+	struct dnet_id begin;
+	memset(&begin, 0x29, sizeof(begin));
+	begin.group_id = 0;
+	begin.id[number_index] = 0;
+
+	std::vector<std::string> data(item_count);
+
+	for (size_t i = 0; i < item_count; ++i) {
+		std::ostringstream out;
+		out << "ram_range_test_data_" << i;
+		data[i] = out.str();
+
+		dnet_id id = begin;
+		id.id[number_index] = i;
+		ELLIPTICS_REQUIRE(write_result, sess.write_data(id, data[i], 0));
+	}
+
+	struct dnet_io_attr io;
+	memset(&io, 0, sizeof(io));
+	memcpy(io.id, begin.id, sizeof(io.id));
+	memcpy(io.parent, begin.id, sizeof(io.id));
+	io.parent[number_index] = item_count;
+	io.start = limit_start;
+	io.num = limit_num;
+
+	ELLIPTICS_REQUIRE(read_result_async, sess.read_data_range(io, 1));
+	sync_read_result read_result = read_result_async.get();
+	BOOST_REQUIRE_EQUAL(read_result.size(), std::min(limit_num, int(item_count) - limit_start));
+
+	// Records are returned in key order, the same order they were written in
+	for (size_t i = 0; i < read_result.size(); ++i)
+		BOOST_REQUIRE_EQUAL(read_result[i].file().to_string(), data[limit_start + i]);
+
+	ELLIPTICS_REQUIRE(remove_result_async, sess.remove_data_range(io, 1));
+	sync_read_result remove_result = remove_result_async.get();
+
+	int removed = 0;
+	for (size_t i = 0; i < remove_result.size(); ++i)
+		removed += remove_result[i].io_attribute()->num;
+
+	BOOST_REQUIRE_EQUAL(removed, int(item_count));
+}
+
+bool register_tests(test_suite *suite, node n)
+{
+	ELLIPTICS_TEST_CASE(test_write_read, create_session(n, {1}, 0, 0));
+	ELLIPTICS_TEST_CASE(test_append, create_session(n, {1}, 0, 0));
+	ELLIPTICS_TEST_CASE(test_prepare_commit, create_session(n, {1}, 0, 0));
+	ELLIPTICS_TEST_CASE(test_lookup_remove, create_session(n, {1}, 0, 0));
+	ELLIPTICS_TEST_CASE(test_range, create_session(n, {1}, 0, 0), 0, 255);
+	ELLIPTICS_TEST_CASE(test_range, create_session(n, {1}, 0, 0), 3, 7);
+
+	return true;
+}
+
+static void destroy_global_data()
+{
+	global_data.reset();
+}
+
+boost::unit_test::test_suite *register_tests(int argc, char *argv[])
+{
+	namespace bpo = boost::program_options;
+
+	bpo::variables_map vm;
+	bpo::options_description generic("Test options");
+
+	std::vector<std::string> remotes;
+	std::string path;
+
+	generic.add_options()
+		("help", "This help message")
+		("remote", bpo::value(&remotes), "Remote elliptics server address")
+		("path", bpo::value(&path), "Path where to store everything")
+		 ;
+
+	bpo::store(bpo::parse_command_line(argc, argv, generic), vm);
+	bpo::notify(vm);
+
+#ifndef NO_SERVER
+	if (vm.count("help")) {
+#else
+	if (vm.count("help") || remotes.empty()) {
+#endif
+		std::cerr << generic;
+		return NULL;
+	}
+
+	test_suite *suite = new test_suite("Local Test Suite");
+
+	configure_nodes(remotes, path);
+
+	register_tests(suite, *global_data->node);
+
+	return suite;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	srand(time(0));
+	atexit(tests::destroy_global_data);
+	return unit_test_main(tests::register_tests, argc, argv);
+}
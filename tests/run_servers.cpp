@@ -77,6 +77,7 @@ static void setup_signals()
  * \code{.json}
  * {
  * 	"srw": true,
+ * 	"backend": "blob",
  * 	"path": "/tmp/elliptics-test",
  * 	"servers": [
  * 		{
@@ -89,6 +90,7 @@ static void setup_signals()
  *
  * Possible options are:
  * \li If \c srw is set to true elliptics will be started with Cocaine runtime.
+ * \li \c backend is either \c blob (default) or \c ram, in-memory backend starts much faster.
  * \li All logs and blobs' data is written to \c path.
  * \li \c server is a list of key-value maps of servers configurations. Each entry \
  *	 contains options which must overwrite default values in configuration file.
@@ -112,6 +114,24 @@ static int run_servers(const rapidjson::Value &doc)
 	}
 #endif
 
+	bool ram = false;
+
+	if (doc.HasMember("backend")) {
+		const rapidjson::Value &backend = doc["backend"];
+		if (!backend.IsString()) {
+			std::cerr << "Field \"backend\" must be string" << std::endl;
+			return 1;
+		}
+
+		const std::string type(backend.GetString(), backend.GetStringLength());
+		if (type == "ram") {
+			ram = true;
+		} else if (type != "blob") {
+			std::cerr << "Field \"backend\" must be either \"blob\" or \"ram\"" << std::endl;
+			return 1;
+		}
+	}
+
 	if (!doc.HasMember("servers")) {
 		std::cerr << "Field \"servers\" is missed" << std::endl;
 		return 1;
@@ -136,7 +156,11 @@ static int run_servers(const rapidjson::Value &doc)
 	}
 
 	std::vector<tests::server_config> configs;
-	configs.resize(servers.Size(), srw ? tests::server_config::default_srw_value() : tests::server_config::default_value());
+	tests::server_config default_config = srw ? tests::server_config::default_srw_value() : tests::server_config::default_value();
+	if (ram)
+		default_config.backends = tests::server_config::default_ram_value().backends;
+
+	configs.resize(servers.Size(), default_config);
 
 	std::set<int> unique_groups;
 
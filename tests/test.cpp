@@ -16,12 +16,17 @@
 
 #include "test_base.hpp"
 #include <algorithm>
+#include <limits>
 
 #define BOOST_TEST_NO_MAIN
 #include <boost/test/included/unit_test.hpp>
 
 #include <boost/program_options.hpp>
 
+#ifndef NO_SERVER
+#include "library/elliptics.h"
+#endif
+
 using namespace ioremap::elliptics;
 using namespace boost::unit_test;
 
@@ -36,6 +41,8 @@ static void configure_nodes(const std::vector<std::string> &remotes, const std::
 		global_data = start_nodes(results_reporter::get_stream(), std::vector<server_config>({
 			server_config::default_value().apply_options(config_data()
 				("group", 1)
+				("journal_segment_records", 64)
+				("journal_segments", 2)
 			),
 
 			server_config::default_value().apply_options(config_data()
@@ -879,6 +886,387 @@ static void test_read_latest_non_existing(session &sess, const std::string &id)
 	ELLIPTICS_REQUIRE_ERROR(read_data, sess.read_latest(id, 0, 0), -ENOENT);
 }
 
+/*
+ * Zero-length object written after non-empty one in the other group is the latest one
+ */
+static void test_read_latest_empty(session &sess, const std::string &id)
+{
+	session first_sess = sess.clone();
+	first_sess.set_groups(std::vector<int>(1, 1));
+
+	session second_sess = sess.clone();
+	second_sess.set_groups(std::vector<int>(1, 2));
+
+	dnet_time ts;
+	dnet_current_time(&ts);
+
+	first_sess.set_timestamp(&ts);
+	ELLIPTICS_REQUIRE(first_write_result, first_sess.write_data(id, "stale data", 0));
+
+	ts.tsec++;
+	second_sess.set_timestamp(&ts);
+	ELLIPTICS_REQUIRE(second_write_result, second_sess.write_data(id, "", 0));
+
+	ELLIPTICS_REQUIRE(read_result, sess.read_latest(id, 0, 0, 1024));
+
+	sync_read_result entries = read_result.get();
+	BOOST_REQUIRE_EQUAL(entries.size(), 1);
+	BOOST_REQUIRE_EQUAL(entries[0].command()->id.group_id, 2);
+	BOOST_REQUIRE_EQUAL(entries[0].file().size(), 0);
+}
+
+/*
+ * The latest object does not fit into size limit: received prefix is joined with the rest
+ */
+static void test_read_latest_large(session &sess, const std::string &id)
+{
+	session first_sess = sess.clone();
+	first_sess.set_groups(std::vector<int>(1, 1));
+
+	session second_sess = sess.clone();
+	second_sess.set_groups(std::vector<int>(1, 2));
+
+	std::string data;
+	for (int i = 0; i < 16; ++i)
+		data += "latest-" + boost::lexical_cast<std::string>(i) + "|";
+
+	dnet_time ts;
+	dnet_current_time(&ts);
+
+	first_sess.set_timestamp(&ts);
+	ELLIPTICS_REQUIRE(first_write_result, first_sess.write_data(id, "stale data", 0));
+
+	ts.tsec++;
+	second_sess.set_timestamp(&ts);
+	ELLIPTICS_REQUIRE(second_write_result, second_sess.write_data(id, data, 0));
+
+	ELLIPTICS_REQUIRE(read_result, sess.read_latest(id, 0, 0, 16));
+
+	sync_read_result entries = read_result.get();
+	BOOST_REQUIRE_EQUAL(entries.size(), 1);
+	BOOST_REQUIRE_EQUAL(entries[0].command()->id.group_id, 2);
+	BOOST_REQUIRE_EQUAL(entries[0].io_attribute()->size, data.size());
+	BOOST_REQUIRE_EQUAL(entries[0].file().to_string(), data);
+
+	ELLIPTICS_REQUIRE(range_result, sess.read_latest(id, 4, 40, 16));
+
+	entries = range_result.get();
+	BOOST_REQUIRE_EQUAL(entries.size(), 1);
+	BOOST_REQUIRE_EQUAL(entries[0].file().to_string(), data.substr(4, 40));
+}
+
+static void test_read_cache(session &sess, const std::string &id)
+{
+	const std::string first_data = "read-cache-first";
+	const std::string second_data = "read-cache-second";
+	const long lifetime = 500;
+
+	node n = sess.get_node();
+	n.set_read_cache(1024 * 1024, lifetime);
+
+	session cached_sess = sess.clone();
+	cached_sess.set_cached_reads(true);
+
+	ELLIPTICS_REQUIRE(first_write_result, sess.write_data(id, first_data, 0));
+
+	read_cache_stats start = n.get_read_cache_stats();
+
+	// The first read misses and populates the cache, the second one is served from it
+	ELLIPTICS_COMPARE_REQUIRE(miss_read_result, cached_sess.read_data(id, 0, 0), first_data);
+	ELLIPTICS_COMPARE_REQUIRE(hit_read_result, cached_sess.read_data(id, 0, 0), first_data);
+
+	read_cache_stats cached = n.get_read_cache_stats();
+	BOOST_REQUIRE_EQUAL(cached.misses - start.misses, 1);
+	BOOST_REQUIRE_EQUAL(cached.hits - start.hits, 1);
+	BOOST_REQUIRE_EQUAL(cached.entries, 1);
+
+	// Write through the same node drops the key, so the next read sees new data
+	ELLIPTICS_REQUIRE(second_write_result, sess.write_data(id, second_data, 0));
+
+	read_cache_stats written = n.get_read_cache_stats();
+	BOOST_REQUIRE_EQUAL(written.entries, 0);
+
+	ELLIPTICS_COMPARE_REQUIRE(written_read_result, cached_sess.read_data(id, 0, 0), second_data);
+
+	read_cache_stats reread = n.get_read_cache_stats();
+	BOOST_REQUIRE_EQUAL(reread.misses - written.misses, 1);
+	BOOST_REQUIRE_EQUAL(reread.entries, 1);
+
+	// Expired entry is not served
+	usleep((lifetime + 100) * 1000);
+
+	ELLIPTICS_COMPARE_REQUIRE(expired_read_result, cached_sess.read_data(id, 0, 0), second_data);
+
+	read_cache_stats expired = n.get_read_cache_stats();
+	BOOST_REQUIRE_EQUAL(expired.misses - reread.misses, 1);
+	BOOST_REQUIRE_EQUAL(expired.hits, reread.hits);
+
+	// Removed key is not served from the cache either
+	ELLIPTICS_REQUIRE(remove_result, sess.remove(id));
+	ELLIPTICS_REQUIRE_ERROR(removed_read_result, cached_sess.read_data(id, 0, 0), -ENOENT);
+
+	n.set_read_cache(0, 0);
+}
+
+/*
+ * Returns changes of @ids tailed from the change journal of the group 1 node
+ * since @seq, or since @since if it is not NULL
+ */
+static std::vector<dnet_iterator_response> journal_changes(session &sess, const std::vector<key> &ids,
+		uint64_t seq, const dnet_time *since)
+{
+	dnet_time time_begin, time_end;
+
+	memset(&time_begin, 0, sizeof(time_begin));
+	if (since)
+		time_begin = *since;
+
+	time_end.tsec = std::numeric_limits<int64_t>::max();
+	time_end.tnsec = 0;
+
+	ELLIPTICS_REQUIRE(tail_result, sess.start_journal_iterator(ids.front(), std::vector<dnet_iterator_range>(),
+			since ? DNET_IFLAGS_TS_RANGE : 0, seq, time_begin, time_end));
+
+	std::vector<dnet_iterator_response> changes;
+	sync_iterator_result entries = tail_result.get();
+
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		dnet_iterator_response *reply = it->reply();
+
+		for (auto jt = ids.begin(); jt != ids.end(); ++jt) {
+			if (!memcmp(reply->key.id, jt->raw_id().id, DNET_ID_SIZE)) {
+				changes.push_back(*reply);
+				break;
+			}
+		}
+	}
+
+	return changes;
+}
+
+static void test_journal(session &sess, const std::string &prefix)
+{
+	std::vector<key> ids;
+
+	for (int i = 0; i < 4; ++i) {
+		key id(prefix + boost::lexical_cast<std::string>(i));
+		id.transform(sess);
+		ids.push_back(id);
+	}
+
+	dnet_time start;
+	dnet_current_time(&start);
+
+	// Appended changes are tailed in the order they were made
+	for (auto it = ids.begin(); it != ids.end(); ++it) {
+		ELLIPTICS_REQUIRE(write_result, sess.write_data(*it, "journal-data", 0));
+	}
+	ELLIPTICS_REQUIRE(remove_result, sess.remove(ids.front()));
+
+	std::vector<dnet_iterator_response> changes = journal_changes(sess, ids, 0, &start);
+	BOOST_REQUIRE_EQUAL(changes.size(), ids.size() + 1);
+
+	for (size_t i = 0; i < ids.size(); ++i) {
+		BOOST_REQUIRE_EQUAL(changes[i].cmd, DNET_CMD_WRITE);
+		BOOST_REQUIRE(!memcmp(changes[i].key.id, ids[i].raw_id().id, DNET_ID_SIZE));
+		if (i)
+			BOOST_REQUIRE(changes[i].journal_seq > changes[i - 1].journal_seq);
+	}
+	BOOST_REQUIRE_EQUAL(changes.back().cmd, DNET_CMD_DEL);
+	BOOST_REQUIRE(!memcmp(changes.back().key.id, ids.front().raw_id().id, DNET_ID_SIZE));
+
+	// Tail from sequence number skips earlier changes
+	const uint64_t seq = changes[2].journal_seq;
+	std::vector<dnet_iterator_response> tail = journal_changes(sess, ids, seq, NULL);
+	BOOST_REQUIRE_EQUAL(tail.size(), changes.size() - 2);
+	BOOST_REQUIRE_EQUAL(tail.front().journal_seq, seq);
+
+	// Journal of the group 1 node holds 64 * 2 records, older ones are compacted away
+	for (int i = 0; i < 64 * 2 * 2; ++i) {
+		ELLIPTICS_REQUIRE(overflow_result, sess.write_data(prefix + "overflow-" + boost::lexical_cast<std::string>(i),
+				"journal-data", 0));
+	}
+
+	// Compaction runs in background, changes below its horizon are not known anymore
+	int err = 0;
+	for (int i = 0; i < 100; ++i) {
+		auto lost_result = sess.start_journal_iterator(ids.front(), std::vector<dnet_iterator_range>(),
+				0, changes.front().journal_seq);
+		lost_result.wait();
+
+		err = lost_result.error().code();
+		if (err == -ERANGE)
+			break;
+
+		usleep(100 * 1000);
+	}
+	BOOST_REQUIRE_EQUAL(err, -ERANGE);
+
+	ELLIPTICS_REQUIRE_ERROR(lost_time_result, sess.start_journal_iterator(ids.front(), std::vector<dnet_iterator_range>(),
+			DNET_IFLAGS_TS_RANGE, 0, start, dnet_time()), -ERANGE);
+
+	// Changes made after horizon are still tailed by time
+	dnet_time late;
+	dnet_current_time(&late);
+
+	ELLIPTICS_REQUIRE(late_write_result, sess.write_data(ids[1], "journal-data-late", 0));
+
+	std::vector<dnet_iterator_response> late_changes = journal_changes(sess, ids, 0, &late);
+	BOOST_REQUIRE_EQUAL(late_changes.size(), 1);
+	BOOST_REQUIRE_EQUAL(late_changes.front().cmd, DNET_CMD_WRITE);
+	BOOST_REQUIRE(!memcmp(late_changes.front().key.id, ids[1].raw_id().id, DNET_ID_SIZE));
+}
+
+#ifndef NO_SERVER
+/*
+ * Read from group 1 is stalled by holding lock of the key on its server node,
+ * so hedged read sent to group 2 after the delay has to win
+ */
+static void test_hedged_read(session &sess, const std::string &id)
+{
+	const std::string data = "hedged-read-data";
+
+	// Lock can be held only when servers run in this process
+	if (global_data->nodes.empty())
+		return;
+
+	ELLIPTICS_REQUIRE(write_result, sess.write_data(id, data, 0));
+
+	node n = sess.get_node();
+	n.set_hedge_budget(100);
+
+	session hedged_sess = sess.clone();
+	hedged_sess.set_hedge_delay(10 * 1000);
+
+	key kid(id);
+	kid.transform(sess);
+
+	dnet_id lock_id = kid.id();
+	lock_id.group_id = 1;
+
+	dnet_node *first = global_data->nodes[0].get_native();
+	dnet_oplock(first, &lock_id);
+
+	async_read_result hedged_result = hedged_sess.read_data(kid, std::vector<int>({1, 2}), 0, 0);
+	hedged_result.wait();
+
+	dnet_opunlock(first, &lock_id);
+	n.set_hedge_budget(10);
+
+	ELLIPTICS_REQUIRE(read_result, std::move(hedged_result));
+
+	sync_read_result entries = read_result.get();
+	BOOST_REQUIRE_EQUAL(entries.size(), 1);
+	BOOST_REQUIRE_EQUAL(entries[0].command()->id.group_id, 2);
+	BOOST_REQUIRE_EQUAL(entries[0].file().to_string(), data);
+}
+#endif // NO_SERVER
+
+static void test_batch(session &sess, const std::string &prefix)
+{
+	const std::vector<int> groups = sess.get_groups();
+	std::map<std::string, size_t> indexes;
+	std::vector<std::string> data;
+	std::vector<key> ids;
+
+	for (size_t i = 0; i < 4; ++i) {
+		key id(prefix + boost::lexical_cast<std::string>(i));
+		id.transform(sess);
+
+		indexes[std::string(reinterpret_cast<const char *>(id.raw_id().id), DNET_ID_SIZE)] = i;
+		data.push_back("batch-data-" + boost::lexical_cast<std::string>(i));
+		ids.push_back(id);
+	}
+
+	key missing(prefix + "missing");
+	missing.transform(sess);
+
+	// Returns index of the key reply @cmd belongs to or ids.size() if it is not one of them
+	auto key_index = [&indexes, &ids] (const dnet_cmd *cmd) -> size_t {
+		auto it = indexes.find(std::string(reinterpret_cast<const char *>(cmd->id.id), DNET_ID_SIZE));
+		return it == indexes.end() ? ids.size() : it->second;
+	};
+
+	// Write request is sent to every group of the session
+	session_batch write_batch = sess.batch();
+	for (size_t i = 0; i < ids.size(); ++i)
+		write_batch.write_data(ids[i], data_pointer::copy(data[i]), 0);
+	BOOST_REQUIRE_EQUAL(write_batch.size(), ids.size() * groups.size());
+
+	ELLIPTICS_REQUIRE(write_result, write_batch.execute());
+	BOOST_REQUIRE_EQUAL(write_batch.size(), 0);
+
+	std::map<std::pair<size_t, int>, int> written;
+	sync_generic_result write_entries = write_result.get();
+	for (auto it = write_entries.begin(); it != write_entries.end(); ++it) {
+		dnet_cmd *cmd = it->command();
+		if (it->status() != 0 || it->data().empty())
+			continue;
+
+		BOOST_REQUIRE_EQUAL(cmd->cmd, DNET_CMD_WRITE);
+		written[std::make_pair(key_index(cmd), int(cmd->id.group_id))]++;
+	}
+
+	for (size_t i = 0; i < ids.size(); ++i) {
+		for (auto it = groups.begin(); it != groups.end(); ++it) {
+			BOOST_REQUIRE_EQUAL(written[std::make_pair(i, *it)], 1);
+
+			session group_sess = sess.clone();
+			group_sess.set_groups(std::vector<int>(1, *it));
+			ELLIPTICS_COMPARE_REQUIRE(read_result, group_sess.read_data(ids[i], 0, 0), data[i]);
+		}
+	}
+
+	// Every read and lookup gets its own reply, failed one does not affect others
+	session_batch read_batch = sess.batch();
+	for (size_t i = 0; i < ids.size(); ++i) {
+		read_batch.read_data(ids[i], 0, 0);
+		read_batch.lookup(ids[i]);
+	}
+	read_batch.read_data(missing, 0, 0);
+
+	auto read_result = read_batch.execute();
+	read_result.wait();
+
+	std::vector<int> reads(ids.size()), lookups(ids.size());
+	int missing_status = 0;
+
+	sync_generic_result read_entries = read_result.get();
+	for (auto it = read_entries.begin(); it != read_entries.end(); ++it) {
+		dnet_cmd *cmd = it->command();
+		size_t index = key_index(cmd);
+
+		if (index == ids.size()) {
+			BOOST_REQUIRE(!memcmp(cmd->id.id, missing.raw_id().id, DNET_ID_SIZE));
+			if (it->status())
+				missing_status = it->status();
+			continue;
+		}
+
+		BOOST_REQUIRE_EQUAL(it->status(), 0);
+		if (it->data().empty())
+			continue;
+
+		if (cmd->cmd == DNET_CMD_READ) {
+			const read_result_entry &entry = static_cast<const read_result_entry &>(*it);
+			BOOST_REQUIRE_EQUAL(entry.file().to_string(), data[index]);
+			reads[index]++;
+		} else {
+			BOOST_REQUIRE_EQUAL(cmd->cmd, DNET_CMD_LOOKUP);
+
+			const lookup_result_entry &entry = static_cast<const lookup_result_entry &>(*it);
+			BOOST_REQUIRE_EQUAL(entry.file_info()->size, data[index].size());
+			lookups[index]++;
+		}
+	}
+
+	for (size_t i = 0; i < ids.size(); ++i) {
+		BOOST_REQUIRE_EQUAL(reads[i], 1);
+		BOOST_REQUIRE_EQUAL(lookups[i], 1);
+	}
+	BOOST_REQUIRE_EQUAL(missing_status, -ENOENT);
+}
+
 bool register_tests(test_suite *suite, node n)
 {
 	ELLIPTICS_TEST_CASE(test_cache_write, create_session(n, { 1, 2 }, 0, DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY), 1000);
@@ -920,6 +1308,14 @@ bool register_tests(test_suite *suite, node n)
 	ELLIPTICS_TEST_CASE(test_prepare_latest, create_session(n, {1, 2}, 0, 0), "prepare-latest-key");
 	ELLIPTICS_TEST_CASE(test_partial_lookup, create_session(n, {1, 2}, 0, 0), "partial-lookup-key");
 	ELLIPTICS_TEST_CASE(test_read_latest_non_existing, create_session(n, {1, 2}, 0, 0), "read-latest-non-existing");
+	ELLIPTICS_TEST_CASE(test_read_latest_empty, create_session(n, {1, 2}, 0, 0), "read-latest-empty");
+	ELLIPTICS_TEST_CASE(test_read_latest_large, create_session(n, {1, 2}, 0, 0), "read-latest-large");
+	ELLIPTICS_TEST_CASE(test_read_cache, create_session(n, {1, 2}, 0, 0), "read-cache-key");
+	ELLIPTICS_TEST_CASE(test_journal, create_session(n, {1}, 0, 0), "journal-key-");
+	ELLIPTICS_TEST_CASE(test_batch, create_session(n, {1, 2}, 0, 0), "batch-key-");
+#ifndef NO_SERVER
+	ELLIPTICS_TEST_CASE(test_hedged_read, create_session(n, {1, 2}, 0, 0), "hedged-read-key");
+#endif
 
 	return true;
 }
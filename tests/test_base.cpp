@@ -174,6 +174,29 @@ server_config server_config::default_value()
 	return data;
 }
 
+server_config server_config::default_ram_value()
+{
+	server_config config = default_value();
+	config.backends[0] = config_data();
+	config.backends[0]
+			("type", "ram")
+			("memory_limit", "256M");
+	return config;
+}
+
+server_config server_config::default_file_value()
+{
+	server_config config = default_value();
+	config.backends[0] = config_data();
+	config.backends[0]
+			("type", "filesystem")
+			("sync", 5)
+			("directory_bit_number", 8)
+			("blob_size", "10M")
+			("records_in_blob", 10000000);
+	return config;
+}
+
 server_config server_config::default_srw_value()
 {
 	server_config config = default_value();
@@ -521,10 +544,11 @@ nodes_data::ptr start_nodes(std::ostream &debug_stream, const std::vector<server
 				("monitor_port", boost::lexical_cast<int>(monitor_ports[i]))
 				;
 
-		config.backends[0]
-				("history", server_path + "/history")
-				("data", server_path + "/blob/data")
-				;
+		config.backends[0]("history", server_path + "/history");
+		if (config.backends[0].string_value("type") == "blob")
+			config.backends[0]("data", server_path + "/blob/data");
+		else if (config.backends[0].string_value("type") == "filesystem")
+			config.backends[0]("root", server_path + "/blob");
 
 		config.write(server_path + "/ioserv.conf");
 
@@ -106,6 +106,8 @@ class server_config
 public:
 	static server_config default_srw_value();
 	static server_config default_value();
+	static server_config default_ram_value();
+	static server_config default_file_value();
 
 	void write(const std::string &path);
 	server_config &apply_options(const config_data &data);